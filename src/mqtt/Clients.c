@@ -25,6 +25,9 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#include "Heap.h"
 
 
 /**
@@ -53,3 +56,76 @@ int clientSocketCompare(void* a, void* b)
 	/*printf("comparing %d with %d\n", (char*)a, (char*)b); */
 	return client->net.socket == *(int*)b;
 }
+
+
+/**
+ * Record the client's current socket in the socket index, growing the index if needed
+ * @param cs the client states structure holding the index
+ * @param client the client whose net.socket has just been set
+ * @return 0 on success, -1 if the index could not be extended
+ */
+int Clients_addSocket(ClientStates* cs, Clients* client)
+{
+	int socket = client->net.socket;
+
+	if (socket <= 0)
+		return -1;
+	if (socket >= cs->nsockets)
+	{
+		int newsize = (cs->nsockets == 0) ? 64 : cs->nsockets;
+		Clients** newsockets = NULL;
+
+		while (newsize <= socket)
+			newsize *= 2;
+		if (cs->sockets == NULL)
+			newsockets = malloc(newsize * sizeof(Clients*));
+		else
+			newsockets = realloc(cs->sockets, newsize * sizeof(Clients*));
+		if (newsockets == NULL)
+			return -1;
+		memset(&newsockets[cs->nsockets], '\0', (newsize - cs->nsockets) * sizeof(Clients*));
+		cs->sockets = newsockets;
+		cs->nsockets = newsize;
+	}
+	cs->sockets[socket] = client;
+	return 0;
+}
+
+
+/**
+ * Clear a socket's entry in the socket index, before the socket is closed
+ * @param cs the client states structure holding the index
+ * @param socket the socket being closed
+ */
+void Clients_removeSocket(ClientStates* cs, int socket)
+{
+	if (socket > 0 && socket < cs->nsockets)
+		cs->sockets[socket] = NULL;
+}
+
+
+/**
+ * Find the client which owns a socket, in constant time
+ * @param cs the client states structure holding the index
+ * @param socket the socket to look up
+ * @return the client, or NULL if no client is using the socket
+ */
+Clients* Clients_findSocket(ClientStates* cs, int socket)
+{
+	if (socket <= 0 || socket >= cs->nsockets)
+		return NULL;
+	return cs->sockets[socket];
+}
+
+
+/**
+ * Free the socket index
+ * @param cs the client states structure holding the index
+ */
+void Clients_terminate(ClientStates* cs)
+{
+	if (cs->sockets)
+		free(cs->sockets);
+	cs->sockets = NULL;
+	cs->nsockets = 0;
+}
@@ -29,6 +29,7 @@
 #include "MQTTClient.h"
 #include "LinkedList.h"
 #include "MQTTClientPersistence.h"
+#include "Timer.h"
 /*BE
 include "LinkedList"
 BE*/
@@ -52,6 +53,7 @@ typedef struct
 	char* payload;
 	int payloadlen;
 	int refcount;
+	int shared;		/**< payload is a reference counted buffer, released rather than freed */
 } Publications;
 
 /*BE
@@ -85,9 +87,12 @@ typedef struct
 	int retain;
 	int msgid;
 	Publications *publish;
-	time_t lastTouch;		/**> used for retry and expiry */
+	mstime_type lastTouch;	/**> used for retry and expiry */
 	char nextMessageType;	/**> PUBREC, PUBREL, PUBCOMP */
 	int len;				/**> length of the whole structure+data */
+	Timer retry_timer;		/**> armed while waiting for an acknowledgement */
+	int retries;			/**> times resent since the last acknowledgement, so only round trips of packets sent once are measured */
+	ustime_type created;	/**> when the message was first sent, for the latency to its completion */
 } Messages;
 
 
@@ -146,15 +151,84 @@ defList(CLIENTS)
 
 BE*/
 
+/**
+ * Size of the arena each connection decodes its incoming packets into
+ */
+#define PACKET_ARENA_SIZE 512
+
+/**
+ * Bump allocator for the packets read from one connection.  Packets are handled and freed one
+ * at a time, so the arena is almost always empty again before the next packet is read.
+ */
+typedef struct
+{
+	double block[PACKET_ARENA_SIZE / sizeof(double)];	/**< storage, aligned for any packet structure */
+	size_t used;	/**< bytes handed out since the arena was last empty */
+	int live;		/**< packets allocated from the arena and not yet freed */
+} PacketArena;
+
+/**
+ * Number of 32-bit words in a bitmap of all the message ids, 0 to 65535
+ */
+#define MSGID_BITMAP_WORDS (65536 / 32)
+
+/**
+ * Hash table of the elements of a message list by message id, so that an acknowledgement finds
+ * its message without walking the list.  Open addressing with linear probing; the number of
+ * slots is a power of 2 kept at least twice the number of messages.
+ */
+typedef struct
+{
+	ListElement** slots;	/**< element for each slot, NULL when empty */
+	int size;	/**< number of slots, 0 until the first message is indexed */
+	int count;	/**< number of messages indexed */
+} MessageIndex;
+
+/**
+ * Adaptive flow control of the messages in flight, as TCP does for segments: the round trip
+ * time from PUBLISH or PUBREL to its acknowledgement is measured to set the retry timeout, and
+ * the window of messages in flight grows while they are acknowledged and halves when one has
+ * to be retried.
+ */
+typedef struct
+{
+	int window;			/**< messages allowed in flight, from 1 up to maxInflightMessages */
+	int ssthresh;		/**< the window grows by one per acknowledgement below this, by one per window above it */
+	int acked;			/**< acknowledgements towards the next increase of the window above ssthresh */
+	int srtt;			/**< smoothed round trip time, in eighths of a millisecond */
+	int rttvar;			/**< round trip time variation, in quarters of a millisecond */
+	int rto;			/**< retry timeout in milliseconds */
+	int samples;		/**< round trip times measured since connecting */
+	mstime_type recovery;	/**< when the window was last reduced, so it is reduced once for the messages in flight then */
+} FlowControl;
+
+/**
+ * Update a statistics counter.  Counters are only updated with the client mutex held, but are
+ * read by MQTTClient_getStats() without it, so the update is a relaxed atomic one wherever that
+ * needs no lock; elsewhere a reader may see a torn value.
+ */
+#if defined(__GNUC__) && defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define Clients_addStat(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define Clients_setStat(counter, v) __atomic_store_n(&(counter), (v), __ATOMIC_RELAXED)
+#define Clients_getStat(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#else
+#define Clients_addStat(counter, n) ((counter) += (n))
+#define Clients_setStat(counter, v) ((counter) = (v))
+#define Clients_getStat(counter) (counter)
+#endif
+
 typedef struct
 {
 	int socket;
-	time_t lastSent;
-	time_t lastReceived;
+	mstime_type lastSent;
+	mstime_type lastReceived;
+	unsigned long long bytesSent;		/**< counted as each packet is written, for MQTTClient_getStats() */
+	unsigned long long bytesReceived;	/**< counted as each packet is read */
 #if defined(OPENSSL)
 	SSL* ssl;
 	SSL_CTX* ctx;
 #endif
+	PacketArena arena;	/**< storage for the packets read from the socket */
 } networkHandles;
 
 /**
@@ -175,15 +249,28 @@ typedef struct
 	int keepAliveInterval;
 	int retryInterval;
 	int maxInflightMessages;
+	FlowControl flow;				/**< the window and retry timeout adapted to the link */
+	MQTTClient_stats stats;			/**< counters and latencies; the gauges and byte counts are filled in by MQTTClient_getStats() */
+	ustime_type connectSent;		/**< when CONNECT was sent, for the latency to CONNACK */
+	ustime_type pingSent;			/**< when PINGREQ was sent, for the latency to PINGRESP */
 	willMessages* will;
 	List* inboundMsgs;
 	List* outboundMsgs;				/**< in flight */
+	unsigned int outboundIds[MSGID_BITMAP_WORDS];	/**< bit set for the id of each message in outboundMsgs */
+	unsigned int outboundFull[MSGID_BITMAP_WORDS / 32];	/**< bit set for each word of outboundIds with all bits set */
+	MessageIndex inboundIndex;	/**< the elements of inboundMsgs by message id */
+	MessageIndex outboundIndex;	/**< the elements of outboundMsgs by message id */
 	List* messageQueue;
 	unsigned int qentry_seqno;
+	int qentry_pending;				/**< entries at the end of messageQueue not yet persisted */
+	unsigned int qentry_delivered;	/**< sequence number of the last persisted entry delivered */
+	unsigned int qentry_marked;		/**< qentry_delivered as last persisted */
 	void* phandle;  /* the persistence handle */
 	MQTTClient_persistence* persistence; /* a persistence implementation */
 	void* context; /* calling context - used when calling disconnect_internal */
 	int MQTTVersion;
+	Timer keepalive_timer;	/**< armed while connected with a keepalive interval */
+	MQTTClient_socketOptions* sockopts;	/**< TCP tuning for the connection, NULL for the defaults */
 #if defined(OPENSSL)
 	MQTTClient_SSLOptions *sslopts;
 	SSL_SESSION* session;    /***< SSL session pointer for fast handhake */
@@ -200,6 +287,13 @@ typedef struct
 {
 	const char* version;
 	List* clients;
+	Clients** sockets;	/**< clients indexed by socket descriptor, so packet handling doesn't search the client list */
+	int nsockets;		/**< number of entries allocated in sockets */
 } ClientStates;
 
+int Clients_addSocket(ClientStates* cs, Clients* client);
+void Clients_removeSocket(ClientStates* cs, int socket);
+Clients* Clients_findSocket(ClientStates* cs, int socket);
+void Clients_terminate(ClientStates* cs);
+
 #endif
@@ -0,0 +1,307 @@
+/**
+ * @file
+ * \brief Fast compression of message payloads
+ *
+ * The output is an LZ4 block: each sequence is a token holding the lengths of its literals and
+ * match in 4 bits each, extended by bytes of 255 when 15 is not enough, then the literals, then
+ * the offset of the match as 2 bytes little-endian.  The last sequence has literals only.  As in
+ * LZ4 the last 5 bytes are always literals and no match starts in the last 12, so the output can
+ * be expanded by any LZ4 block decoder which is given the same dictionary.
+ *
+ * The positions of a dictionary are numbered before those of the payload, so that one table of
+ * positions covers both; a match found in the dictionary ends where the dictionary does.
+ */
+
+#include <string.h>
+
+#include "Compress.h"
+#include "StackTrace.h"
+
+#include "Heap.h"
+
+#define COMPRESS_MIN_MATCH 4
+#define COMPRESS_LAST_LITERALS 5
+#define COMPRESS_MF_LIMIT 12
+#define COMPRESS_MAX_OFFSET 65535
+
+
+static unsigned int Compress_read32(const unsigned char* p)
+{
+	unsigned int v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+static unsigned int Compress_hash(const unsigned char* p)
+{
+	return (Compress_read32(p) * 2654435761U) >> (32 - COMPRESS_HASH_BITS);
+}
+
+
+/**
+ * Create a dictionary for compressing and expanding payloads
+ * @param data the typical content, of which the last 64KB are used
+ * @param len the length of data
+ * @return the dictionary, or NULL if there was no memory
+ */
+Compress_dictionary* Compress_createDictionary(const char* data, int len)
+{
+	Compress_dictionary* dict = NULL;
+	int i;
+
+	FUNC_ENTRY;
+	if (len > COMPRESS_MAX_DICTIONARY)
+	{
+		data += len - COMPRESS_MAX_DICTIONARY;
+		len = COMPRESS_MAX_DICTIONARY;
+	}
+	if ((dict = malloc(sizeof(Compress_dictionary))) == NULL)
+		goto exit;
+	if ((dict->data = malloc(len + 1)) == NULL)
+	{
+		free(dict);
+		dict = NULL;
+		goto exit;
+	}
+	memcpy(dict->data, data, len);
+	dict->len = len;
+	memset(dict->table, '\0', sizeof(dict->table));
+	for (i = 0; i + COMPRESS_MIN_MATCH <= len; ++i)
+		dict->table[Compress_hash((unsigned char*)&dict->data[i])] = i + 1;
+exit:
+	FUNC_EXIT;
+	return dict;
+}
+
+
+/**
+ * Free a dictionary created with Compress_createDictionary()
+ * @param dict the dictionary, which may be NULL
+ */
+void Compress_freeDictionary(Compress_dictionary* dict)
+{
+	if (dict)
+	{
+		free(dict->data);
+		free(dict);
+	}
+}
+
+
+/**
+ * The largest size a payload can have after compression
+ * @param len the length of the payload
+ * @return the size of destination buffer which is always large enough
+ */
+int Compress_bound(int len)
+{
+	return len + len / 255 + 16;
+}
+
+
+static unsigned char* Compress_putLength(unsigned char* op, int len)
+{
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+
+/**
+ * Write one sequence to the output
+ * @param op the output pointer, advanced past the sequence
+ * @param oend the end of the output buffer
+ * @param literals the literals of the sequence
+ * @param litlen the number of literals
+ * @param offset how far back the match starts
+ * @param matchlen the length of the match, 0 for the last sequence
+ * @return 1 if the sequence was written, 0 if there was not enough room
+ */
+static int Compress_sequence(unsigned char** op, unsigned char* oend, const unsigned char* literals, int litlen,
+		int offset, int matchlen)
+{
+	unsigned char* p = *op;
+	int room = 1 + litlen + (litlen >= 15 ? (litlen - 15) / 255 + 1 : 0);
+
+	if (matchlen)
+		room += 2 + (matchlen - COMPRESS_MIN_MATCH >= 15 ? (matchlen - COMPRESS_MIN_MATCH - 15) / 255 + 1 : 0);
+	if (room > oend - p)
+		return 0;
+	*p = (unsigned char)(((litlen < 15) ? litlen : 15) << 4);
+	if (matchlen)
+		*p |= (matchlen - COMPRESS_MIN_MATCH < 15) ? matchlen - COMPRESS_MIN_MATCH : 15;
+	++p;
+	if (litlen >= 15)
+		p = Compress_putLength(p, litlen);
+	memcpy(p, literals, litlen);
+	p += litlen;
+	if (matchlen)
+	{
+		*p++ = (unsigned char)(offset & 0xFF);
+		*p++ = (unsigned char)(offset >> 8);
+		if (matchlen - COMPRESS_MIN_MATCH >= 15)
+			p = Compress_putLength(p, matchlen - COMPRESS_MIN_MATCH);
+	}
+	*op = p;
+	return 1;
+}
+
+
+/**
+ * Compress a payload
+ * @param source the payload
+ * @param srclen the length of the payload
+ * @param dest the buffer for the compressed data
+ * @param dstlen the size of dest.  Compression stops when the output would not fit, so this
+ * can be less than the payload length to find out whether compression pays off at all.
+ * @param dict the dictionary, or NULL
+ * @return the length of the compressed data, or 0 if it did not fit in dstlen
+ */
+int Compress_block(const char* source, int srclen, char* dest, int dstlen, Compress_dictionary* dict)
+{
+	const unsigned char* src = (const unsigned char*)source;
+	unsigned char* op = (unsigned char*)dest;
+	unsigned char* oend = op + dstlen;
+	int table[COMPRESS_HASH_SIZE];
+	int dictlen = (dict) ? dict->len : 0;
+	int ip = 0, anchor = 0;
+	int limit = srclen - COMPRESS_MF_LIMIT;
+	int matchlimit = srclen - COMPRESS_LAST_LITERALS;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (dict)
+		memcpy(table, dict->table, sizeof(table));
+	else
+		memset(table, '\0', sizeof(table));
+	while (ip < limit)
+	{
+		unsigned int h = Compress_hash(src + ip);
+		int candidate = table[h] - 1;
+		const unsigned char* match;
+		int avail, len;
+
+		table[h] = dictlen + ip + 1;
+		if (candidate >= 0 && dictlen + ip - candidate <= COMPRESS_MAX_OFFSET)
+		{
+			if (candidate >= dictlen)
+			{
+				match = src + (candidate - dictlen);
+				avail = matchlimit - ip;
+			}
+			else
+			{
+				match = (unsigned char*)dict->data + candidate;
+				avail = dictlen - candidate;
+				if (avail > matchlimit - ip)
+					avail = matchlimit - ip;
+			}
+			if (avail >= COMPRESS_MIN_MATCH && Compress_read32(match) == Compress_read32(src + ip))
+			{
+				len = COMPRESS_MIN_MATCH;
+				while (len < avail && match[len] == src[ip + len])
+					++len;
+				if (Compress_sequence(&op, oend, src + anchor, ip - anchor, dictlen + ip - candidate, len) == 0)
+					goto exit;
+				ip += len;
+				anchor = ip;
+				continue;
+			}
+		}
+		/* step further the longer nothing has matched, so incompressible data is passed over quickly */
+		ip += 1 + ((ip - anchor) >> 6);
+	}
+	if (Compress_sequence(&op, oend, src + anchor, srclen - anchor, 0, 0) == 0)
+		goto exit;
+	rc = (int)(op - (unsigned char*)dest);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static int Compress_getLength(const unsigned char** ip, const unsigned char* iend, size_t* len)
+{
+	unsigned char c;
+
+	do
+	{
+		if (*ip >= iend)
+			return -1;
+		c = *(*ip)++;
+		*len += c;
+	} while (c == 255);
+	return 0;
+}
+
+
+/**
+ * Expand a compressed payload
+ * @param source the compressed data
+ * @param srclen the length of the compressed data
+ * @param dest the buffer for the payload
+ * @param dstlen the size of dest
+ * @param dict the dictionary the payload was compressed with, or NULL
+ * @return the length of the payload, or -1 if the data is not valid or does not fit
+ */
+int Compress_expand(const char* source, int srclen, char* dest, int dstlen, Compress_dictionary* dict)
+{
+	const unsigned char* ip = (const unsigned char*)source;
+	const unsigned char* iend = ip + srclen;
+	unsigned char* op = (unsigned char*)dest;
+	unsigned char* oend = op + dstlen;
+	int rc = -1;
+
+	FUNC_ENTRY;
+	while (ip < iend)
+	{
+		int token = *ip++;
+		size_t litlen = token >> 4;
+		size_t matchlen = token & 15;
+		size_t offset;
+		const unsigned char* from;
+
+		if (litlen == 15 && Compress_getLength(&ip, iend, &litlen) != 0)
+			goto exit;
+		if (litlen > (size_t)(iend - ip) || litlen > (size_t)(oend - op))
+			goto exit;
+		memcpy(op, ip, litlen);
+		ip += litlen;
+		op += litlen;
+		if (ip == iend)
+			break;	/* the last sequence */
+
+		if (iend - ip < 2)
+			goto exit;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (matchlen == 15 && Compress_getLength(&ip, iend, &matchlen) != 0)
+			goto exit;
+		matchlen += COMPRESS_MIN_MATCH;
+		if (offset == 0 || matchlen > (size_t)(oend - op))
+			goto exit;
+		if (offset > (size_t)(op - (unsigned char*)dest))
+		{	/* the match starts in the dictionary, and may continue at the start of the payload */
+			size_t before = offset - (op - (unsigned char*)dest);
+			size_t count = (matchlen < before) ? matchlen : before;
+
+			if (dict == NULL || before > (size_t)dict->len)
+				goto exit;
+			memcpy(op, dict->data + dict->len - before, count);
+			op += count;
+			matchlen -= count;
+			from = (unsigned char*)dest;
+		}
+		else
+			from = op - offset;
+		while (matchlen--)
+			*op++ = *from++;	/* byte by byte, as the match may overlap what it writes */
+	}
+	rc = (int)(op - (unsigned char*)dest);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file
+ * \brief Fast compression of message payloads
+ *
+ * A compressor producing the LZ4 block format: sequences of literals and back references
+ * of at least 4 bytes within the previous 64KB, found with a single hash probe per position.
+ * Short repetitive payloads such as JSON telemetry compress better with a dictionary of
+ * typical content, which both sides must share; back references can then reach into it.
+ */
+
+#if !defined(COMPRESS_H)
+#define COMPRESS_H
+
+/**
+ * number of bits in the hash of 4 bytes, so the size of the table of positions
+ */
+#define COMPRESS_HASH_BITS 12
+#define COMPRESS_HASH_SIZE (1 << COMPRESS_HASH_BITS)
+
+/**
+ * the longest dictionary used, as back references are at most this far
+ */
+#define COMPRESS_MAX_DICTIONARY 65535
+
+/**
+ * the most a block can expand by: each byte of a length adds at most 255 bytes
+ */
+#define COMPRESS_MAX_RATIO 255
+
+/**
+ * A dictionary, with its positions already hashed so that they need not be for every payload
+ */
+typedef struct
+{
+	char* data;
+	int len;
+	int table[COMPRESS_HASH_SIZE];	/**< last position + 1 of each hash in the data, 0 for none */
+} Compress_dictionary;
+
+Compress_dictionary* Compress_createDictionary(const char* data, int len);
+void Compress_freeDictionary(Compress_dictionary* dict);
+
+int Compress_bound(int len);
+int Compress_block(const char* src, int srclen, char* dst, int dstlen, Compress_dictionary* dict);
+int Compress_expand(const char* src, int srclen, char* dst, int dstlen, Compress_dictionary* dict);
+
+#endif
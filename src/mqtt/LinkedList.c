@@ -189,6 +189,47 @@ ListElement* ListFindItem(List* aList, void* content, int(*callback)(void*, void
 }
 
 
+/**
+ * Unlinks and frees an element of a list, keeping the current pointer valid
+ * @param aList the list the element is in
+ * @param element the element to remove
+ * @param freeContent boolean value to indicate whether the content is to be freed
+ */
+static void ListUnlinkElement(List* aList, ListElement* element, int freeContent)
+{
+	ListElement* saved = aList->current;
+
+	if (element->prev == NULL)
+		/* so this is the first element, and we have to update the "first" pointer */
+		aList->first = element->next;
+	else
+		element->prev->next = element->next;
+
+	if (element->next == NULL)
+		aList->last = element->prev;
+	else
+		element->next->prev = element->prev;
+
+	if (freeContent)
+		free(element->content);
+	aList->current = (saved == element) ? element->next : saved;
+	free(element);
+	--(aList->count);
+}
+
+
+/**
+ * Removes and frees an element of a list, and its content, when the element is already known
+ * so that no search is needed
+ * @param aList the list the element is in
+ * @param element the element to remove
+ */
+void ListRemoveElement(List* aList, ListElement* element)
+{
+	ListUnlinkElement(aList, element, 1);
+}
+
+
 /**
  * Removes and optionally frees an element in a list by comparing the content.
  * A callback function is used to define the method of comparison for each element.
@@ -200,35 +241,14 @@ ListElement* ListFindItem(List* aList, void* content, int(*callback)(void*, void
  */
 int ListUnlink(List* aList, void* content, int(*callback)(void*, void*), int freeContent)	//-ƳһԪزͷſռ
 {
-	ListElement* next = NULL;
 	ListElement* saved = aList->current;
-	int saveddeleted = 0;
+	ListElement* found = NULL;
 
-	if (!ListFindItem(aList, content, callback))
+	if ((found = ListFindItem(aList, content, callback)) == NULL)
 		return 0; /* false, did not remove item */
 
-	if (aList->current->prev == NULL)
-		/* so this is the first element, and we have to update the "first" pointer */
-		aList->first = aList->current->next;
-	else
-		aList->current->prev->next = aList->current->next;
-
-	if (aList->current->next == NULL)
-		aList->last = aList->current->prev;
-	else
-		aList->current->next->prev = aList->current->prev;
-
-	next = aList->current->next;
-	if (freeContent)
-		free(aList->current->content);
-	if (saved == aList->current)
-		saveddeleted = 1;
-	free(aList->current);
-	if (saveddeleted)
-		aList->current = next;
-	else
-		aList->current = saved;
-	--(aList->count);
+	aList->current = saved;
+	ListUnlinkElement(aList, found, freeContent);
 	return 1; /* successfully removed item */
 }
 
@@ -79,6 +79,7 @@ void ListInsert(List* aList, void* content, int size, ListElement* index);
 
 int ListRemove(List* aList, void* content);
 int ListRemoveItem(List* aList, void* content, int(*callback)(void*, void*));
+void ListRemoveElement(List* aList, ListElement* element);
 void* ListDetachHead(List* aList);
 int ListRemoveHead(List* aList);
 void* ListPopTail(List* aList);
@@ -0,0 +1,858 @@
+/**
+ * @file
+ * \brief Micro-benchmarks for the packet, publish, compression, message id and persistence paths
+ *
+ * Built and run by "make bench".  Each benchmark is run with increasing iteration counts until
+ * one run takes the target time, and the result of that run is written to stdout as one JSON
+ * object per line: the time and number of allocations per operation, and operations per second.
+ * Allocations are counted by wrapping the allocation functions at link time, so they include
+ * those made through the heap tracking functions, but not the blocks those functions use for
+ * their own bookkeeping.
+ *
+ * The packet benchmarks read from and write to a unix socket pair, one end of which is owned by
+ * the socket module, so that they go through the same buffering as a connection to a broker.
+ * The round trip benchmark publishes to a stand-in broker on a local TCP port, which answers
+ * each QoS 1 PUBLISH with a PUBACK.  The persistence and spool benchmarks store their files
+ * beneath the working directory, and remove them when they finish.
+ *
+ * Usage: mqtt_bench [-t milliseconds] [name prefix]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "MQTTClient.h"
+#include "MQTTPacket.h"
+#include "MQTTProtocolClient.h"
+#include "Socket.h"
+#include "Thread.h"
+#include "LinkedList.h"
+#include "utf-8.h"
+#include "Compress.h"
+#include "MQTTPersistence.h"
+#include "MQTTPersistenceLog.h"
+#include "MQTTPersistenceMmap.h"
+#include "MQTTSpool.h"
+
+#define BENCH_BATCH 64				/* packets written to the socket at a time */
+#define BENCH_MAX_INFLIGHT 1000
+
+static __thread int counting = 0;	/* allocations are counted while the timer runs */
+static __thread int in_heap = 0;	/* inside the heap tracking functions */
+static __thread long allocs = 0;
+
+static long long started = 0;		/* start of the current timed section, in ns */
+static long long elapsed = 0;		/* timed so far in the run */
+
+static int sock = -1;				/* end of the socket pair owned by the socket module */
+static int peer = -1;				/* the other end */
+
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* p, size_t size);
+void* __real_mymalloc(char* file, int line, size_t size);
+void* __real_myrealloc(char* file, int line, void* p, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+	if (counting && !in_heap)
+		++allocs;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+	if (counting && !in_heap)
+		++allocs;
+	return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* p, size_t size)
+{
+	if (counting && !in_heap)
+		++allocs;
+	return __real_realloc(p, size);
+}
+
+void* __wrap_mymalloc(char* file, int line, size_t size)
+{
+	void* p;
+
+	if (counting && !in_heap)
+		++allocs;
+	++in_heap;
+	p = __real_mymalloc(file, line, size);
+	--in_heap;
+	return p;
+}
+
+void* __wrap_myrealloc(char* file, int line, void* p, size_t size)
+{
+	if (counting && !in_heap)
+		++allocs;
+	++in_heap;
+	p = __real_myrealloc(file, line, p, size);
+	--in_heap;
+	return p;
+}
+
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ * Stop the timer, for work in a benchmark which is not to be measured
+ */
+static void bench_pause(void)
+{
+	elapsed += now_ns() - started;
+	counting = 0;
+}
+
+
+/**
+ * Restart the timer after bench_pause()
+ */
+static void bench_resume(void)
+{
+	counting = 1;
+	started = now_ns();
+}
+
+
+/**
+ * Run a benchmark until one run takes at least the target time, and print the result
+ * @param name the name of the benchmark
+ * @param fn the benchmark, which performs the operation the number of times given
+ * @param filter run only the benchmarks whose names start with this, or NULL
+ * @param target the target time in ns
+ */
+static void bench_run(const char* name, void (*fn)(long), const char* filter, long long target)
+{
+	long iterations = 1;
+
+	if (filter && strncmp(name, filter, strlen(filter)) != 0)
+		return;
+	for (;;)
+	{
+		long next;
+
+		allocs = 0;
+		elapsed = 0;
+		bench_resume();
+		(*fn)(iterations);
+		bench_pause();
+		if (elapsed >= target || iterations >= 1000000000L)
+			break;
+		/* aim 20% past the target, growing at most 100 times per run */
+		next = (elapsed > 0) ? (long)((double)iterations * target * 1.2 / elapsed) : iterations * 100;
+		if (next > iterations * 100)
+			next = iterations * 100;
+		iterations = (next > iterations) ? next : iterations + 1;
+	}
+	printf("{\"benchmark\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f,\"ops_per_s\":%.0f,\"allocs_per_op\":%.3f}\n",
+		name, iterations, (double)elapsed / iterations, iterations * 1e9 / elapsed, (double)allocs / iterations);
+	fflush(stdout);
+}
+
+
+/**
+ * Write data to the peer, and wait until the socket module sees it on the other end
+ */
+static void bench_feed(char* data, int len)
+{
+	struct timeval tv;
+
+	if (write(peer, data, len) != len)
+	{
+		perror("write");
+		exit(1);
+	}
+	do
+	{
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+	} while (Socket_getReadySocket(0, &tv) != sock);
+}
+
+
+/**
+ * Read whatever has been written to the peer, completing any outstanding sends first
+ */
+static void bench_drain(void)
+{
+	struct timeval tv = {0, 0};
+	char buf[4096];
+
+	Socket_getReadySocket(0, &tv);
+	while (recv(peer, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		;
+}
+
+
+static int lengths[] = {0, 100, 127, 128, 1000, 16383, 16384, 2097152};
+#define LENGTHS (sizeof(lengths) / sizeof(lengths[0]))
+static volatile int result;
+
+static void bench_encode(long n)
+{
+	char buf[4];
+	long i;
+
+	for (i = 0; i < n; ++i)
+		result = MQTTPacket_encode(buf, lengths[i % LENGTHS]);
+}
+
+
+static void bench_decode(long n)
+{
+	static networkHandles net;
+	char stream[BENCH_BATCH * 4];
+	int ends[BENCH_BATCH];	/* where each encoded length ends in the stream */
+	int len = 0, i, value;
+	long done = 0;
+
+	bench_pause();
+	for (i = 0; i < BENCH_BATCH; ++i)
+		ends[i] = len += MQTTPacket_encode(&stream[len], lengths[i % LENGTHS]);
+	net.socket = sock;
+	bench_resume();
+	while (done < n)
+	{
+		int count = (n - done < BENCH_BATCH) ? (int)(n - done) : BENCH_BATCH;
+
+		bench_pause();
+		bench_feed(stream, ends[count - 1]);
+		bench_resume();
+		for (i = 0; i < count; ++i)
+			MQTTPacket_decode(&net, &value);
+		done += count;
+	}
+}
+
+
+/**
+ * Append a packet to a buffer
+ */
+static int bench_packet(char* buf, int type, int qos, int msgid, const char* topic, int payloadlen)
+{
+	int len = 0, rem;
+	int topiclen = topic ? (int)strlen(topic) : 0;
+
+	rem = (topic ? 2 + topiclen : 0) + ((type == PUBACK || qos > 0) ? 2 : 0) + payloadlen;
+	buf[len++] = (char)((type << 4) | (qos << 1));
+	len += MQTTPacket_encode(&buf[len], rem);
+	if (topic)
+	{
+		buf[len++] = (char)(topiclen >> 8);
+		buf[len++] = (char)topiclen;
+		memcpy(&buf[len], topic, topiclen);
+		len += topiclen;
+	}
+	if (type == PUBACK || qos > 0)
+	{
+		buf[len++] = (char)(msgid >> 8);
+		buf[len++] = (char)msgid;
+	}
+	memset(&buf[len], 'x', payloadlen);
+	return len + payloadlen;
+}
+
+
+static void bench_factory(long n)
+{
+	static networkHandles net;
+	char stream[BENCH_BATCH * 64];
+	int ends[BENCH_BATCH];	/* where each packet ends in the stream */
+	int len = 0, i, error;
+	long done = 0;
+
+	bench_pause();
+	for (i = 0; i < BENCH_BATCH; ++i)
+	{
+		if (i % 3 == 0)
+			len += bench_packet(&stream[len], PUBLISH, 0, 0, "sensors/uart/0/temperature", 16);
+		else if (i % 3 == 1)
+			len += bench_packet(&stream[len], PUBLISH, 1, i, "sensors/uart/0/humidity", 24);
+		else
+			len += bench_packet(&stream[len], PUBACK, 0, i, NULL, 0);
+		ends[i] = len;
+	}
+	memset(&net, '\0', sizeof(net));
+	net.socket = sock;
+	bench_resume();
+	while (done < n)
+	{
+		int count = (n - done < BENCH_BATCH) ? (int)(n - done) : BENCH_BATCH;
+
+		bench_pause();
+		bench_feed(stream, ends[count - 1]);
+		bench_resume();
+		for (i = 0; i < count; ++i)
+		{
+			MQTTPacket* pack = MQTTPacket_Factory(&net, &error);
+
+			if (pack == NULL)
+			{
+				fprintf(stderr, "factory failed with %d\n", error);
+				exit(1);
+			}
+			MQTTPacket_free_packet(pack);
+		}
+		done += count;
+	}
+}
+
+
+static void bench_send(long n, PreparedTopic* prepared)
+{
+	static networkHandles net;
+	char payload[32];
+	Publish pub;
+	long i;
+
+	memset(&net, '\0', sizeof(net));
+	net.socket = sock;
+	memset(&pub, '\0', sizeof(pub));
+	memset(payload, 'x', sizeof(payload));
+	pub.topic = "sensors/uart/0/temperature";
+	pub.topiclen = (int)strlen(pub.topic);
+	pub.payload = payload;
+	pub.payloadlen = sizeof(payload);
+	pub.prepared = prepared;
+	for (i = 0; i < n; ++i)
+	{
+		/* QoS 0, as sending QoS 1 or 2 would persist the message for a client owning the socket.
+		 * A send left incomplete is finished by the socket module when the peer is drained. */
+		if (MQTTPacket_send_publish(&pub, 0, 0, 0, &net, "bench") == SOCKET_ERROR)
+		{
+			fprintf(stderr, "send_publish failed\n");
+			exit(1);
+		}
+		if (i % BENCH_BATCH == BENCH_BATCH - 1)
+		{
+			bench_pause();
+			bench_drain();
+			bench_resume();
+		}
+	}
+	bench_pause();
+	bench_drain();
+	bench_resume();
+}
+
+
+static void bench_send_publish(long n)
+{
+	bench_send(n, NULL);
+}
+
+
+static void bench_send_prepared(long n)
+{
+	PreparedTopic* prepared;
+
+	bench_pause();
+	prepared = MQTTPacket_prepareTopic("sensors/uart/0/temperature");
+	bench_resume();
+	bench_send(n, prepared);
+	bench_pause();
+	MQTTClient_freeTopic((MQTTClient_topic*)&prepared);
+	bench_resume();
+}
+
+
+/**
+ * Store a publication for retries and remove it again, as for each QoS 1 message
+ */
+static void bench_store(long n, int shared)
+{
+	char* payload;
+	Publish pub;
+	long i;
+	int len;
+
+	bench_pause();
+	payload = MQTTProtocol_allocPayload(1024);
+	memset(payload, 'x', 1024);
+	memset(&pub, '\0', sizeof(pub));
+	pub.topic = "sensors/uart/0/temperature";
+	pub.topiclen = (int)strlen(pub.topic);
+	pub.payload = payload;
+	pub.payloadlen = 1024;
+	pub.shared = shared;
+	bench_resume();
+	for (i = 0; i < n; ++i)
+		MQTTProtocol_removePublication(MQTTProtocol_storePublication(&pub, &len));
+	bench_pause();
+	MQTTProtocol_releasePayload(payload);
+	bench_resume();
+}
+
+
+static void bench_store_copy(long n)
+{
+	bench_store(n, 0);
+}
+
+
+static void bench_store_shared(long n)
+{
+	bench_store(n, 1);
+}
+
+
+static void bench_utf8_ascii(long n)
+{
+	long i;
+
+	for (i = 0; i < n; ++i)
+		result = UTF8_validateString("sensors/uart/0/temperature");
+}
+
+
+static void bench_utf8_multibyte(long n)
+{
+	long i;
+
+	for (i = 0; i < n; ++i)
+		result = UTF8_validateString("capteurs/\xc3\xa9tage/\xe4\xbc\xa0\xe6\x84\x9f\xe5\x99\xa8/\xf0\x9f\x8c\xa1");
+}
+
+
+static char json[] = "{\"dev\":\"uart1\",\"temperature\":21.5,\"humidity\":44,\"status\":\"ok\",\"seq\":1234}";
+static char compressed[256];
+static int compressedlen;
+
+static void bench_compress(long n)
+{
+	long i;
+
+	for (i = 0; i < n; ++i)
+		result = Compress_block(json, sizeof(json) - 1, compressed, sizeof(compressed), NULL);
+}
+
+
+static void bench_expand(long n)
+{
+	char buf[sizeof(json)];
+	long i;
+
+	bench_pause();
+	compressedlen = Compress_block(json, sizeof(json) - 1, compressed, sizeof(compressed), NULL);
+	bench_resume();
+	for (i = 0; i < n; ++i)
+		result = Compress_expand(compressed, compressedlen, buf, sizeof(buf), NULL);
+}
+
+
+static Clients msgid_client;
+static Messages inflight[BENCH_MAX_INFLIGHT];
+
+/**
+ * Put messages with ids 1 to count in flight for the message id benchmarks
+ */
+static void bench_inflight(int count)
+{
+	int i;
+
+	if (msgid_client.outboundMsgs)
+		ListFreeNoContent(msgid_client.outboundMsgs);
+	MQTTProtocol_emptyIndex(&msgid_client.outboundIndex);
+	memset(&msgid_client, '\0', sizeof(msgid_client));
+	msgid_client.outboundMsgs = ListInitialize();
+	for (i = 0; i < count; ++i)
+	{
+		inflight[i].msgid = i + 1;
+		ListAppend(msgid_client.outboundMsgs, &inflight[i], sizeof(Messages));
+		MQTTProtocol_indexMessage(&msgid_client.outboundIndex, msgid_client.outboundMsgs->last);
+		MQTTProtocol_useMsgId(&msgid_client, i + 1);
+	}
+}
+
+
+static void bench_msgid(long n)
+{
+	long i;
+
+	for (i = 0; i < n; ++i)
+	{
+		msgid_client.msgID = 0;	/* so the search starts at the lowest id in flight */
+		result = MQTTProtocol_assignMsgId(&msgid_client);
+	}
+}
+
+
+static void bench_findmsg(long n)
+{
+	int count = msgid_client.outboundMsgs->count;
+	long i;
+
+	for (i = 0; i < n; ++i)	/* the id of each acknowledgement in turn, as they would arrive */
+		result = (MQTTProtocol_findMessage(&msgid_client.outboundIndex, (int)(i % count) + 1) != NULL);
+}
+
+
+static MQTTClient_histogram histogram;
+
+static void bench_latency(long n)
+{
+	ustime_type start = Timer_nowMicros();
+	long i;
+
+	for (i = 0; i < n; ++i)	/* as each acknowledgement is handled */
+		MQTTProtocol_recordLatency(&histogram, start);
+}
+
+
+static MQTTClient client = NULL;
+
+static void bench_stats(long n)
+{
+	static MQTTClient_stats stats;
+	long i;
+
+	for (i = 0; i < n; ++i)
+		result = MQTTClient_getStats(client, &stats);
+}
+
+
+static Clients persistence_client;
+
+/**
+ * Persist a QoS 1 message and remove it again, as when it is sent and then acknowledged
+ */
+static void bench_persist(long n)
+{
+	char header[] = {0x32, 0x7f, 0x00, 0x1a};
+	char payload[100];
+	char* buffers[2] = {header, payload};
+	int buflens[2] = {sizeof(header), sizeof(payload)};
+	char key[PERSISTENCE_MAX_KEY_LENGTH + 1];
+	MQTTClient_persistence* per = persistence_client.persistence;
+	long i;
+
+	memset(payload, 'x', sizeof(payload));
+	for (i = 0; i < n; ++i)
+	{
+		sprintf(key, "%s%d", PERSISTENCE_PUBLISH_SENT, (int)(i % MAX_MSG_ID) + 1);
+		result = per->pput(persistence_client.phandle, key, 2, buffers, buflens);
+		per->premove(persistence_client.phandle, key);
+	}
+}
+
+
+/**
+ * Persist QoS 1 messages with ten in flight, removing each when the tenth after it has been
+ * persisted, and running any timers the persistence has armed, as when publishing steadily
+ */
+static void bench_persist_window(long n)
+{
+	char header[] = {0x32, 0x7f, 0x00, 0x1a};
+	char payload[100];
+	char* buffers[2] = {header, payload};
+	int buflens[2] = {sizeof(header), sizeof(payload)};
+	char key[PERSISTENCE_MAX_KEY_LENGTH + 1];
+	MQTTClient_persistence* per = persistence_client.persistence;
+	long i;
+
+	memset(payload, 'x', sizeof(payload));
+	for (i = 0; i < n + 10; ++i)
+	{
+		if (i < n)
+		{
+			sprintf(key, "%s%d", PERSISTENCE_PUBLISH_SENT, (int)(i % MAX_MSG_ID) + 1);
+			result = per->pput(persistence_client.phandle, key, 2, buffers, buflens);
+		}
+		if (i >= 10)
+		{
+			sprintf(key, "%s%d", PERSISTENCE_PUBLISH_SENT, (int)((i - 10) % MAX_MSG_ID) + 1);
+			per->premove(persistence_client.phandle, key);
+		}
+		Timer_expire(Timer_now());
+	}
+}
+
+
+static Spool* spool;
+
+/**
+ * Spool a message and take it again, as when publishing while disconnected and then draining
+ */
+static void bench_spool(long n)
+{
+	char payload[100];
+	char* topic;
+	char* taken;
+	int payloadlen, qos, retained;
+	long i;
+
+	memset(payload, 'x', sizeof(payload));
+	for (i = 0; i < n; ++i)
+	{
+		MQTTSpool_append(spool, "uart/1/data", payload, sizeof(payload), 1, 0);
+		if ((result = MQTTSpool_take(spool, &topic, &taken, &payloadlen, &qos, &retained)) == 0)
+			MQTTClient_free(topic);
+	}
+}
+
+
+/**
+ * Run a persistence benchmark on a persistence implementation, in the working directory
+ */
+static void bench_persistence(const char* name, void (*fn)(long), int type, void* context, const char* filter,
+		long long target)
+{
+	MQTTClient_persistence* per = NULL;
+
+	if (MQTTPersistence_create(&per, type, context) != 0 ||
+			per->popen(&persistence_client.phandle, "bench", "tcp://127.0.0.1:1883", per->context) != 0)
+	{
+		fprintf(stderr, "%s: the persistence could not be opened\n", name);
+		return;
+	}
+	persistence_client.persistence = per;
+	bench_run(name, fn, filter, target);
+	MQTTPersistence_close(&persistence_client);
+}
+
+static void bench_roundtrip(long n)
+{
+	char payload[32];
+	long i;
+
+	memset(payload, 'x', sizeof(payload));
+	for (i = 0; i < n; ++i)
+	{
+		MQTTClient_deliveryToken token;
+
+		if (MQTTClient_publish(client, "sensors/uart/0/temperature", sizeof(payload), payload, 1, 0, &token) != MQTTCLIENT_SUCCESS
+			|| MQTTClient_waitForCompletion(client, token, 1000L) != MQTTCLIENT_SUCCESS)
+		{
+			fprintf(stderr, "round trip failed\n");
+			exit(1);
+		}
+	}
+}
+
+
+static int bench_read(int fd, char* buf, int len)
+{
+	int got = 0;
+
+	while (got < len)
+	{
+		int rc = recv(fd, &buf[got], len - got, 0);
+
+		if (rc <= 0)
+			return -1;
+		got += rc;
+	}
+	return 0;
+}
+
+
+/**
+ * The stand-in broker: accepts one connection, and acknowledges CONNECT, QoS 1 PUBLISH
+ * and PINGREQ packets until the connection is closed
+ */
+static thread_return_type bench_broker(void* arg)
+{
+	int listener = *(int*)arg;
+	int fd = accept(listener, NULL, NULL);
+	static char buf[65536];
+
+	while (fd >= 0)
+	{
+		unsigned char header;
+		int rem = 0, multiplier = 1;
+		char c;
+
+		if (bench_read(fd, (char*)&header, 1) != 0)
+			break;
+		do
+		{
+			if (bench_read(fd, &c, 1) != 0)
+				goto exit;
+			rem += (c & 127) * multiplier;
+			multiplier *= 128;
+		} while (c & 128);
+		if (rem > (int)sizeof(buf) || bench_read(fd, buf, rem) != 0)
+			break;
+		if ((header >> 4) == CONNECT)
+		{
+			char connack[] = {CONNACK << 4, 2, 0, 0};
+
+			send(fd, connack, sizeof(connack), 0);
+		}
+		else if ((header >> 4) == PUBLISH && ((header >> 1) & 3) == 1)
+		{
+			int topiclen = ((unsigned char)buf[0] << 8) + (unsigned char)buf[1];
+			char puback[] = {PUBACK << 4, 2, buf[2 + topiclen], buf[3 + topiclen]};
+
+			send(fd, puback, sizeof(puback), 0);
+		}
+		else if ((header >> 4) == PINGREQ)
+		{
+			char pingresp[] = {PINGRESP << 4, 0};
+
+			send(fd, pingresp, sizeof(pingresp), 0);
+		}
+		else if ((header >> 4) == DISCONNECT)
+			break;
+	}
+exit:
+	if (fd >= 0)
+		close(fd);
+	close(listener);
+	return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+	static int listener;
+	struct sockaddr_in addr;
+	struct sockaddr_un uaddr;
+	socklen_t addrlen = sizeof(addr);
+	MQTTClient_connectOptions opts = MQTTClient_connectOptions_initializer;
+	const char* filter = NULL;
+	long long target = 500000000LL;
+	char uri[64];
+	int ulistener, rc, i;
+	static const int counts[] = {0, 10, 100, 1000};
+	MQTTClient_logPersistenceOptions log_sync = MQTTClient_logPersistenceOptions_initializer;
+	MQTTClient_defaultPersistenceOptions default_async = MQTTClient_defaultPersistenceOptions_initializer;
+	MQTTClient_defaultPersistenceOptions default_interval = MQTTClient_defaultPersistenceOptions_initializer;
+	MQTTClient_defaultPersistenceOptions default_strict = MQTTClient_defaultPersistenceOptions_initializer;
+	MQTTClient_spoolOptions spool_options = MQTTClient_spoolOptions_initializer;
+	MQTTClient_stats spool_stats;
+
+	log_sync.sync = 1;
+	default_interval.durability = MQTTCLIENT_PERSISTENCE_INTERVAL;
+	default_strict.durability = MQTTCLIENT_PERSISTENCE_STRICT;
+	spool_options.directory = "bench_spool";
+	memset(&spool_stats, '\0', sizeof(spool_stats));
+	for (i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			target = atoll(argv[++i]) * 1000000LL;
+		else
+			filter = argv[i];
+	}
+
+	/* the stand-in broker */
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, '\0', sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0
+		|| getsockname(listener, (struct sockaddr*)&addr, &addrlen) != 0)
+	{
+		perror("broker");
+		return 1;
+	}
+	Thread_start(bench_broker, &listener);
+
+	/* creating the client initializes the library */
+	snprintf(uri, sizeof(uri), "tcp://127.0.0.1:%d", ntohs(addr.sin_port));
+	if ((rc = MQTTClient_create(&client, uri, "bench", MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS)
+	{
+		fprintf(stderr, "MQTTClient_create failed with %d\n", rc);
+		return 1;
+	}
+
+	/* the socket pair for the packet benchmarks */
+	memset(&uaddr, '\0', sizeof(uaddr));
+	uaddr.sun_family = AF_UNIX;
+	snprintf(uaddr.sun_path, sizeof(uaddr.sun_path), "/tmp/mqtt_bench.%d", (int)getpid());
+	unlink(uaddr.sun_path);
+	ulistener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (bind(ulistener, (struct sockaddr*)&uaddr, sizeof(uaddr)) != 0 || listen(ulistener, 1) != 0
+		|| Socket_newUnix(uaddr.sun_path, &sock) != 0 || (peer = accept(ulistener, NULL, NULL)) < 0)
+	{
+		perror("socket pair");
+		return 1;
+	}
+	close(ulistener);
+	unlink(uaddr.sun_path);
+
+	bench_run("MQTTPacket_encode", bench_encode, filter, target);
+	bench_run("MQTTPacket_decode", bench_decode, filter, target);
+	bench_run("MQTTPacket_Factory", bench_factory, filter, target);
+	bench_run("MQTTPacket_send_publish/qos0", bench_send_publish, filter, target);
+	bench_run("MQTTPacket_send_publish/prepared", bench_send_prepared, filter, target);
+	bench_run("MQTTProtocol_storePublication/copy", bench_store_copy, filter, target);
+	bench_run("MQTTProtocol_storePublication/shared", bench_store_shared, filter, target);
+	bench_run("UTF8_validateString/ascii", bench_utf8_ascii, filter, target);
+	bench_run("UTF8_validateString/multibyte", bench_utf8_multibyte, filter, target);
+	bench_run("Compress_block/json", bench_compress, filter, target);
+	bench_run("Compress_expand/json", bench_expand, filter, target);
+	for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); ++i)
+	{
+		char name[64];
+
+		snprintf(name, sizeof(name), "MQTTProtocol_assignMsgId/inflight=%d", counts[i]);
+		bench_inflight(counts[i]);
+		bench_run(name, bench_msgid, filter, target);
+		if (counts[i] > 0)
+		{
+			snprintf(name, sizeof(name), "MQTTProtocol_findMessage/inflight=%d", counts[i]);
+			bench_run(name, bench_findmsg, filter, target);
+		}
+	}
+	ListFreeNoContent(msgid_client.outboundMsgs);
+	MQTTProtocol_emptyIndex(&msgid_client.outboundIndex);
+	bench_run("MQTTProtocol_recordLatency", bench_latency, filter, target);
+	bench_run("MQTTClient_getStats", bench_stats, filter, target);
+	bench_persistence("Persistence_put+remove/default", bench_persist, MQTTCLIENT_PERSISTENCE_DEFAULT, NULL, filter, target);
+	bench_persistence("Persistence_put+remove/log", bench_persist, MQTTCLIENT_PERSISTENCE_LOG, NULL, filter, target);
+	bench_persistence("Persistence_put+remove/log+sync", bench_persist, MQTTCLIENT_PERSISTENCE_LOG, &log_sync, filter, target);
+	bench_persistence("Persistence_put+remove/mmap", bench_persist, MQTTCLIENT_PERSISTENCE_MMAP, NULL, filter, target);
+	bench_persistence("Persistence_window/default", bench_persist_window, MQTTCLIENT_PERSISTENCE_DEFAULT, NULL, filter, target);
+	bench_persistence("Persistence_window/default+async", bench_persist_window, MQTTCLIENT_PERSISTENCE_DURABLE, &default_async,
+		filter, target);
+	bench_persistence("Persistence_window/default+interval", bench_persist_window, MQTTCLIENT_PERSISTENCE_DURABLE,
+		&default_interval, filter, target);
+	bench_persistence("Persistence_window/default+strict", bench_persist_window, MQTTCLIENT_PERSISTENCE_DURABLE,
+		&default_strict, filter, target);
+	bench_persistence("Persistence_window/log+sync", bench_persist_window, MQTTCLIENT_PERSISTENCE_LOG, &log_sync, filter, target);
+	if ((spool = MQTTSpool_open(&spool_options, &spool_stats)) != NULL)
+	{
+		bench_run("MQTTSpool_append+take", bench_spool, filter, target);
+		MQTTSpool_close(spool);
+		rmdir(spool_options.directory);
+	}
+	Socket_close(sock);
+	close(peer);
+
+	if (filter == NULL || strncmp("roundtrip", filter, strlen(filter)) == 0)
+	{
+		opts.keepAliveInterval = 60;
+		opts.cleansession = 1;
+		if ((rc = MQTTClient_connect(client, &opts)) != MQTTCLIENT_SUCCESS)
+		{
+			fprintf(stderr, "MQTTClient_connect failed with %d\n", rc);
+			return 1;
+		}
+		bench_run("roundtrip/qos1", bench_roundtrip, filter, target);
+		MQTTClient_disconnect(client, 1000);
+	}
+	MQTTClient_destroy(&client);
+	return 0;
+}
@@ -43,6 +43,7 @@
 #include "MQTTClient.h"
 #if !defined(NO_PERSISTENCE)
 #include "MQTTPersistence.h"
+#include "MQTTSpool.h"
 #endif
 
 #include "utf-8.h"
@@ -59,6 +60,11 @@
 
 #define URI_TCP "tcp://"
 
+/**
+ * Bytes which may be queued for writing on a client's socket before a publish has to wait
+ */
+#define PENDING_WRITE_LIMIT 65536
+
 #define BUILD_TIMESTAMP "##MQTTCLIENT_BUILD_TAG##"
 #define CLIENT_VERSION  "##MQTTCLIENT_VERSION_TAG##"
 
@@ -68,7 +74,9 @@ char* client_version_eye = "MQTTClientV3_Version " CLIENT_VERSION;
 static ClientStates ClientState =
 {
 	CLIENT_VERSION, /* version */
-	NULL /* client list */
+	NULL, /* client list */
+	NULL, /* socket index */
+	0 /* socket index size */
 };
 
 /* ʹstaticClientStateӿͻ״̬Clients͵m->c */
@@ -133,7 +141,14 @@ void MQTTClient_init()	//-
 static volatile int initialized = 0;
 /* ͻʵר */
 static List* handles = NULL;
-static time_t last;
+/* clients which have refused a non-blocking publish and are owed a writable callback */
+static List* writable_waiters = NULL;
+/* clients with a spool, whose messages are sent as the connection allows */
+static List* spoolers = NULL;
+#if !defined(NO_PERSISTENCE)
+/* set when a message queue may have entries or deliveries not yet persisted */
+static int queues_unpersisted = 0;
+#endif
 /* ͻɨб־ */
 static int running = 0;
 static int tostop = 0;
@@ -146,13 +161,16 @@ void MQTTClient_stop();
 int MQTTClient_disconnect_internal(MQTTClient handle, int timeout);
 int MQTTClient_disconnect1(MQTTClient handle, int timeout, int internal, int stop);
 void MQTTClient_writeComplete(int socket);
+void MQTTProtocol_checkPendingWrites(void);
+static void MQTTClient_yieldOnce(void);
 
 typedef struct
 {
 	MQTTClient_message* msg;
 	char* topicName;
 	int topicLen;
-	unsigned int seqno; /* only used on restore */
+	unsigned int seqno;
+	unsigned int batch; /* sequence number of the first entry of its batch, 0 until persisted */
 } qEntry;
 
 
@@ -175,6 +193,14 @@ typedef struct
 	sem_type unsuback_sem;
 	MQTTPacket* pack;
 
+	int nonblocking;		/**< publish returns MQTTCLIENT_WOULDBLOCK rather than waiting */
+	int wouldblock;			/**< a publish was refused, so the writable callback is owed */
+	MQTTClient_writable* wr;
+	void* wr_context;
+
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+	Spool* spool;			/**< messages published while they could not be sent, or NULL */
+#endif
 } MQTTClients;
 
 void MQTTClient_sleep(long milliseconds)
@@ -272,6 +298,8 @@ int MQTTClient_create(MQTTClient* handle, const char* serverURI, const char* cli
 		Socket_outInitialize();	//-һϵеĳʼ,ص㻹Ǵ洢ռ
 		Socket_setWriteCompleteCallback(MQTTClient_writeComplete);	//-Իصֵ,˳
 		handles = ListInitialize();
+		writable_waiters = ListInitialize();
+		spoolers = ListInitialize();
 #if defined(OPENSSL)
 		SSLSocket_initialize();
 #endif
@@ -330,8 +358,13 @@ void MQTTClient_terminate(void)	//-
 	if (initialized)
 	{
 		ListFree(bstate->clients);
+		Clients_terminate(bstate);
 		ListFree(handles);
 		handles = NULL;
+		ListFreeNoContent(writable_waiters);
+		writable_waiters = NULL;
+		ListFreeNoContent(spoolers);
+		spoolers = NULL;
 		Socket_outTerminate();
 #if defined(OPENSSL)
 		SSLSocket_terminate();
@@ -357,8 +390,7 @@ void MQTTClient_emptyMessageQueue(Clients* client)	//-
 		{
 			qEntry* qe = (qEntry*)(current->content);
 			free(qe->topicName);
-			free(qe->msg->payload);
-			free(qe->msg);
+			MQTTClient_freeMessage(&qe->msg);
 		}
 		ListEmpty(client->messageQueue);
 	}
@@ -376,11 +408,20 @@ void MQTTClient_destroy(MQTTClient* handle)	//-
 	if (m == NULL)
 		goto exit;
 
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+	if (m->spool)
+	{
+		MQTTSpool_close(m->spool);
+		ListDetach(spoolers, m);
+	}
+#endif
 	if (m->c)
 	{
 		int saved_socket = m->c->net.socket;
 		char* saved_clientid = MQTTStrdup(m->c->clientID);
 #if !defined(NO_PERSISTENCE)
+		if (m->c->persistence)
+			MQTTPersistence_persistQueue(m->c);
 		MQTTPersistence_close(m->c);
 #endif
 		MQTTClient_emptyMessageQueue(m->c);
@@ -397,6 +438,8 @@ void MQTTClient_destroy(MQTTClient* handle)	//-
 	Thread_destroy_sem(m->connack_sem);
 	Thread_destroy_sem(m->suback_sem);
 	Thread_destroy_sem(m->unsuback_sem);
+	if (m->wouldblock)
+		ListDetach(writable_waiters, m);
 	if (!ListRemove(handles, m))
 		Log(LOG_ERROR, -1, "free error");
 	*handle = NULL;
@@ -412,7 +455,8 @@ exit:
 void MQTTClient_freeMessage(MQTTClient_message** message)	//-ͷϢ
 {
 	FUNC_ENTRY;
-	free((*message)->payload);
+	if ((*message)->payload != (void*)(*message + 1))	/* unless stored along with the message */
+		free((*message)->payload);
 	free(*message);
 	*message = NULL;
 	FUNC_EXIT;
@@ -439,7 +483,13 @@ int MQTTClient_deliverMessage(int rc, MQTTClients* m, char** topicName, int* top
 		rc = MQTTCLIENT_TOPICNAME_TRUNCATED;	//-һִ,ֲ
 #if !defined(NO_PERSISTENCE)
 	if (m->c->persistence)
-		MQTTPersistence_unpersistQueueEntry(m->c, (MQTTPersistence_qEntry*)qe);
+	{
+		ListElement* next = m->c->messageQueue->first->next;
+
+		MQTTPersistence_unpersistQueueEntry(m->c, (MQTTPersistence_qEntry*)qe,
+			(next) ? (MQTTPersistence_qEntry*)(next->content) : NULL);
+		queues_unpersisted = 1;
+	}
 #endif
 	ListRemove(m->c->messageQueue, m->c->messageQueue->first->content);	//-˵ϢѾһ־,ȥ
 	FUNC_EXIT_RC(rc);
@@ -448,15 +498,15 @@ int MQTTClient_deliverMessage(int rc, MQTTClients* m, char** topicName, int* top
 
 
 /**
- * List callback function for comparing clients by socket
- * @param a first integer value
- * @param b second integer value
- * @return boolean indicating whether a and b are equal
+ * Find the API client structure using a socket, via the socket index
+ * @param sock the socket
+ * @return the client, or NULL if no client is using the socket
  */
-int clientSockCompare(void* a, void* b)	//?ȽϻصǷͬ
+static MQTTClients* MQTTClient_findSocket(int sock)
 {
-	MQTTClients* m = (MQTTClients*)a;
-	return m->c->net.socket == *(int*)b;
+	Clients* client = Clients_findSocket(bstate, sock);
+
+	return (client == NULL) ? NULL : (MQTTClients*)(client->context);
 }
 
 
@@ -501,13 +551,7 @@ thread_return_type WINAPI MQTTClient_run(void* n)	//-*ʹ
 
 		/* ѰҽӵĿͻ */
 		/* find client corresponding to socket */
-		if (ListFindItem(handles, &sock, clientSockCompare) == NULL)	//-Ѱҿͻ˶Ӧ׽
-		{
-			/* assert: should not happen */
-			continue;
-		}
-		m = (MQTTClient)(handles->current->content);
-		if (m == NULL)
+		if ((m = MQTTClient_findSocket(sock)) == NULL)	//-Ѱҿͻ˶Ӧ׽
 		{
 			/* assert: should not happen */
 			continue;
@@ -554,7 +598,19 @@ thread_return_type WINAPI MQTTClient_run(void* n)	//-*ʹ
 				 * so we must be careful how we use it.
 				 */
 				if (rc)
+				{
+#if !defined(NO_PERSISTENCE)
+					if (m->c->persistence)
+					{
+						ListElement* next = m->c->messageQueue->first->next;
+
+						MQTTPersistence_unpersistQueueEntry(m->c, (MQTTPersistence_qEntry*)qe,
+							(next) ? (MQTTPersistence_qEntry*)(next->content) : NULL);
+						queues_unpersisted = 1;
+					}
+#endif
 					ListRemove(m->c->messageQueue, qe);
+				}
 				else
 					Log(TRACE_MIN, -1, "False returned from messageArrived for client %s, message remains on queue",
 						m->c->clientID);
@@ -682,6 +738,73 @@ int MQTTClient_setCallbacks(MQTTClient handle, void* context, MQTTClient_connect
 }
 
 
+int MQTTClient_setNonBlockingPublish(MQTTClient handle, int nonblocking, void* context, MQTTClient_writable* wr)
+{
+	int rc = MQTTCLIENT_SUCCESS;
+	MQTTClients* m = handle;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(mqttclient_mutex);
+
+	if (m == NULL)
+		rc = MQTTCLIENT_FAILURE;
+	else
+	{
+		m->nonblocking = nonblocking;
+		m->wr_context = context;
+		m->wr = wr;
+	}
+
+	Thread_unlock_mutex(mqttclient_mutex);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTClient_setSpool(MQTTClient handle, MQTTClient_spoolOptions* options)
+{
+	int rc = MQTTCLIENT_SUCCESS;
+	MQTTClients* m = handle;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(mqttclient_mutex);
+
+	if (m == NULL || m->c == NULL)
+	{
+		rc = MQTTCLIENT_FAILURE;
+		goto exit;
+	}
+	if (options && (strncmp(options->struct_id, "MQSF", 4) != 0 || options->struct_version != 0))
+	{
+		rc = MQTTCLIENT_BAD_STRUCTURE;
+		goto exit;
+	}
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+	if (m->spool)
+	{
+		MQTTSpool_close(m->spool);
+		m->spool = NULL;
+		ListDetach(spoolers, m);
+	}
+	if (options)
+	{
+		if ((m->spool = MQTTSpool_open(options, &m->c->stats)) == NULL)
+			rc = MQTTCLIENT_FAILURE;
+		else
+			ListAppend(spoolers, m, sizeof(MQTTClients));
+	}
+#else
+	if (options)
+		rc = MQTTCLIENT_FAILURE;
+#endif
+
+exit:
+	Thread_unlock_mutex(mqttclient_mutex);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
 void MQTTClient_closeSession(Clients* client)	//-رջỰ
 {
 	FUNC_ENTRY;
@@ -692,11 +815,13 @@ void MQTTClient_closeSession(Clients* client)	//-
 		if (client->connected)
 			MQTTPacket_send_disconnect(&client->net, client->clientID);	//-һͻ˻ܽ׽,ͷ
 		Thread_lock_mutex(socket_mutex);
+		Clients_removeSocket(bstate, client->net.socket);
 #if defined(OPENSSL)
 		SSLSocket_close(&client->net);
 #endif
 		Socket_close(client->net.socket);
 		Thread_unlock_mutex(socket_mutex);
+		MQTTProtocol_checkPendingWrites();	/* release the publications held for its queued writes */
 		client->net.socket = 0;
 #if defined(OPENSSL)
 		client->net.ssl = NULL;
@@ -704,6 +829,7 @@ void MQTTClient_closeSession(Clients* client)	//-
 	}
 	client->connected = 0;
 	client->connect_state = 0;
+	Timer_cancel(&client->keepalive_timer);
 
 	if (client->cleansession)	//-ͻʱʹclean session־ôͻ֮ǰάϢᱻ
 		MQTTClient_cleanSession(client);
@@ -721,7 +847,12 @@ int MQTTClient_cleanSession(Clients* client)	//-
 #endif
 	MQTTProtocol_emptyMessageList(client->inboundMsgs);
 	MQTTProtocol_emptyMessageList(client->outboundMsgs);
+	MQTTProtocol_emptyIndex(&client->inboundIndex);
+	MQTTProtocol_emptyIndex(&client->outboundIndex);
+	MQTTProtocol_releaseMsgIds(client);
 	MQTTClient_emptyMessageQueue(client);
+	client->qentry_pending = 0;
+	client->qentry_delivered = client->qentry_marked = 0;
 	client->msgID = 0;
 	FUNC_EXIT_RC(rc);
 	return rc;
@@ -735,24 +866,29 @@ void Protocol_processPublication(Publish* publish, Clients* client)	//-
 
 	FUNC_ENTRY;
 	qe = malloc(sizeof(qEntry));
-	mm = malloc(sizeof(MQTTClient_message));
-
-	qe->msg = mm;
-
-	qe->topicName = publish->topic;
 	qe->topicLen = publish->topiclen;
-	publish->topic = NULL;
+	qe->seqno = qe->batch = 0;
 
-	/* If the message is QoS 2, then we have already stored the incoming payload
-	 * in an allocated buffer, so we don't need to copy again.
+	/* If the message is QoS 2, then we have already stored the incoming topic and payload
+	 * in allocated buffers, so we don't need to copy again.  Otherwise the packet is about to
+	 * be freed, so the topic is copied and the payload is stored after the message structure.
 	 */
 	if (publish->header.bits.qos == 2)
+	{
+		qe->topicName = publish->topic;
+		mm = malloc(sizeof(MQTTClient_message));
 		mm->payload = publish->payload;
+	}
 	else
 	{
-		mm->payload = malloc(publish->payloadlen);
+		qe->topicName = malloc(publish->topiclen + 1);
+		memcpy(qe->topicName, publish->topic, publish->topiclen + 1);
+		mm = malloc(sizeof(MQTTClient_message) + publish->payloadlen);
+		mm->payload = mm + 1;
 		memcpy(mm->payload, publish->payload, publish->payloadlen);
 	}
+	publish->topic = NULL;
+	qe->msg = mm;
 
 	mm->payloadlen = publish->payloadlen;
 	mm->qos = publish->header.bits.qos;
@@ -766,7 +902,10 @@ void Protocol_processPublication(Publish* publish, Clients* client)	//-
 	ListAppend(client->messageQueue, qe, sizeof(qe) + sizeof(mm) + mm->payloadlen + strlen(qe->topicName)+1);	//-յϢ洢ڿٵ¿ռ,Ȼͨṹ
 #if !defined(NO_PERSISTENCE)
 	if (client->persistence)
-		MQTTPersistence_persistQueueEntry(client, (MQTTPersistence_qEntry*)qe);	//-ѽյϢ洢־ļ
+	{	/* persisted with the others received before the socket has no more data waiting */
+		++client->qentry_pending;
+		queues_unpersisted = 1;
+	}
 #endif
 	FUNC_EXIT;
 }
@@ -901,11 +1040,14 @@ int MQTTClient_connectURIVersion(MQTTClient handle, MQTTClient_connectOptions* o
 		{
 			Connack* connack = (Connack*)pack;
 			Log(TRACE_PROTOCOL, 1, NULL, m->c->net.socket, m->c->clientID, connack->rc);
+			MQTTProtocol_recordLatency(&m->c->stats.connectLatency, m->c->connectSent);
 			if ((rc = connack->rc) == MQTTCLIENT_SUCCESS)
-			{//-˵MQTTЭѾɹ
+			{
+				Clients_addStat(m->c->stats.connects, 1);//-˵MQTTЭѾɹ
 				m->c->connected = 1;	//-MQTTɹĽ
 				m->c->good = 1;
 				m->c->connect_state = 0;	//?յӦ֮Ϊ0
+				MQTTProtocol_startKeepalive(m->c);
 				if (MQTTVersion == 4)
 					sessionPresent = connack->flags.bits.sessionPresent;
 
@@ -921,24 +1063,26 @@ int MQTTClient_connectURIVersion(MQTTClient handle, MQTTClient_connectOptions* o
 						Messages* m = (Messages*)(outcurrent->content);
 						m->lastTouch = 0;
 					}
-					MQTTProtocol_retry((time_t)0, 1, 1);
+					MQTTProtocol_retry(1);
 					if (m->c->connected != 1)	//-жMQTTǷ
 						rc = MQTTCLIENT_DISCONNECTED;
 				}
 			}
-			free(connack);
+			MQTTPacket_free_packet(pack);
 			m->pack = NULL;
 		}
 	}
 exit:
 	if (rc == MQTTCLIENT_SUCCESS)
 	{
-		if (options->struct_version == 4) /* means we have to fill out return values */
+		if (options->struct_version >= 4) /* means we have to fill out return values */
 		{//-һҪ,д			
 			options->returned.serverURI = serverURI;
 			options->returned.MQTTVersion = MQTTVersion;    
 			options->returned.sessionPresent = sessionPresent;
 		}
+		if (options->struct_version >= 5 && options->socketOptions)
+			Socket_getOptions(m->c->net.socket, options->socketOptions);
 	}
 	else
 	{
@@ -967,7 +1111,12 @@ int MQTTClient_connectURI(MQTTClient handle, MQTTClient_connectOptions* options,
 	//-ָһͻ˽иֵ,ԴݽĲͿͻ˰
 	m->c->keepAliveInterval = options->keepAliveInterval;	//-ѡдṹ,ʵһʽת,Ҳṩ˷ֲ
 	m->c->cleansession = options->cleansession;
-	m->c->maxInflightMessages = (options->reliable) ? 1 : 10;
+	if (options->reliable)
+		m->c->maxInflightMessages = 1;
+	else if (options->struct_version >= 6 && options->maxInflightMessages > 0)
+		m->c->maxInflightMessages = (options->maxInflightMessages < MAX_MSG_ID) ? options->maxInflightMessages : MAX_MSG_ID;
+	else
+		m->c->maxInflightMessages = 10;
 
 	if (m->c->will)
 	{//-տʼݵĻҪͷ
@@ -1021,9 +1170,21 @@ int MQTTClient_connectURI(MQTTClient handle, MQTTClient_connectOptions* options,
 	}
 #endif
 
+	if (m->c->sockopts)
+	{
+		free(m->c->sockopts);
+		m->c->sockopts = NULL;
+	}
+	if (options->struct_version >= 5 && options->socketOptions)
+	{
+		m->c->sockopts = malloc(sizeof(MQTTClient_socketOptions));
+		memcpy(m->c->sockopts, options->socketOptions, sizeof(MQTTClient_socketOptions));
+	}
+
 	m->c->username = options->username;	//-ѸɫĲ洢ͻϢ
 	m->c->password = options->password;
 	m->c->retryInterval = options->retryInterval;
+	MQTTProtocol_initFlow(m->c);
 
 	if (options->struct_version >= 3)
 		MQTTVersion = options->MQTTVersion;
@@ -1059,7 +1220,8 @@ int MQTTClient_connect(MQTTClient handle, MQTTClient_connectOptions* options)	//
 
 	if (strncmp(options->struct_id, "MQTC", 4) != 0 || 
 		(options->struct_version != 0 && options->struct_version != 1 && options->struct_version != 2
-			&& options->struct_version != 3 && options->struct_version != 4))
+			&& options->struct_version != 3 && options->struct_version != 4 && options->struct_version != 5
+			&& options->struct_version != 6))
 	{
 		rc = MQTTCLIENT_BAD_STRUCTURE;
 		goto exit;
@@ -1085,6 +1247,15 @@ int MQTTClient_connect(MQTTClient handle, MQTTClient_connectOptions* options)	//
 	}
 #endif
 
+	if (options->struct_version >= 5 && options->socketOptions) /* check validity of socket options structure */
+	{
+		if (strncmp(options->socketOptions->struct_id, "MQSO", 4) != 0 || options->socketOptions->struct_version != 0)
+		{
+			rc = MQTTCLIENT_BAD_STRUCTURE;
+			goto exit;
+		}
+	}
+
 	if ((options->username && !UTF8_validateString(options->username)) ||
 		(options->password && !UTF8_validateString(options->password)))
 	{
@@ -1158,7 +1329,7 @@ int MQTTClient_disconnect1(MQTTClient handle, int timeout, int internal, int sto
 			if (MQTTClient_elapsed(start) >= timeout)	//-һʱڱ֤ͳȥ
 				break;
 			Thread_unlock_mutex(mqttclient_mutex);
-			MQTTClient_yield();
+			MQTTClient_yieldOnce();
 			Thread_lock_mutex(mqttclient_mutex);
 		}
 	}
@@ -1176,6 +1347,8 @@ int MQTTClient_disconnect1(MQTTClient handle, int timeout, int internal, int sto
 exit:
 	if (stop)
 		MQTTClient_stop();
+	if (internal && was_connected)
+		Clients_addStat(m->c->stats.connectionsLost, 1);
 	if (internal && m->cl && was_connected)
 	{
 		Log(TRACE_MIN, -1, "Calling connectionLost for client %s", m->c->clientID);
@@ -1272,7 +1445,7 @@ int MQTTClient_subscribeMany(MQTTClient handle, int count, char* const* topic, i
 	ListFreeNoContent(topics);	//-Խʹ,ͷ
 	ListFreeNoContent(qoss);
 	//-治һͳȥ,ҲΨһĵط
-	if (rc == TCPSOCKET_COMPLETE)
+	if (rc == TCPSOCKET_COMPLETE || rc == TCPSOCKET_INTERRUPTED)	/* queued packets are written in turn */
 	{
 		MQTTPacket* pack = NULL;
 
@@ -1366,7 +1539,7 @@ int MQTTClient_unsubscribeMany(MQTTClient handle, int count, char* const* topic)
 	rc = MQTTProtocol_unsubscribe(m->c, topics, msgid);	//-ûʲôѵ,ʵЩظԵĶ,дĺõĻ,
 	ListFreeNoContent(topics);
 
-	if (rc == TCPSOCKET_COMPLETE)
+	if (rc == TCPSOCKET_COMPLETE || rc == TCPSOCKET_INTERRUPTED)
 	{
 		MQTTPacket* pack = NULL;
 
@@ -1406,9 +1579,152 @@ int MQTTClient_unsubscribe(MQTTClient handle, const char* topic)	//-
 	return rc;
 }
 
-//-,ĴѾܶУ
-int MQTTClient_publish(MQTTClient handle, const char* topicName, int payloadlen, void* payload,
-							 int qos, int retained, MQTTClient_deliveryToken* deliveryToken)
+
+/**
+ * Whether a publish would have to wait, either for space in the in-flight window or
+ * for the packets queued for writing on the socket to drain below PENDING_WRITE_LIMIT
+ * @param m the client
+ * @return boolean
+ */
+static int MQTTClient_publishWouldBlock(MQTTClients* m)
+{
+	return m->c->outboundMsgs->count >= m->c->flow.window ||
+		SocketBuffer_pendingBytes(m->c->net.socket) >= PENDING_WRITE_LIMIT;
+}
+
+
+#if !defined(NO_PERSISTENCE)
+/**
+ * Persist the entries queued for delivery to each client as one batch once the socket has no
+ * more received data waiting to be handled, or the batch is full, along with the position of
+ * the last entry delivered.  Called with the client mutex held.
+ */
+static void MQTTClient_persistQueues(void)
+{
+	ListElement* current = NULL;
+	int unpersisted = 0;
+
+	FUNC_ENTRY;
+	while (ListNextElement(handles, &current))
+	{
+		Clients* c = ((MQTTClients*)(current->content))->c;
+
+		if (c == NULL || c->persistence == NULL ||
+				(c->qentry_pending == 0 && c->qentry_marked == c->qentry_delivered))
+			continue;
+		if (c->qentry_pending > 0 && c->qentry_pending < PERSISTENCE_QUEUE_BATCH &&
+				c->net.socket > 0 && SocketBuffer_readAheadLength(c->net.socket) > 0)
+			unpersisted = 1;	/* more of this batch has been received */
+		else if (MQTTPersistence_persistQueue(c) != 0)
+			unpersisted = 1;	/* tried again by the next cycle */
+	}
+	queues_unpersisted = unpersisted;
+	FUNC_EXIT;
+}
+#endif
+
+
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+/**
+ * Send the spooled messages of each connected client, oldest first, for as long as the
+ * in-flight window and the socket's write queue allow.  Called with the client mutex held.
+ */
+static void MQTTClient_drainSpools(void)
+{
+	ListElement* current = NULL;
+
+	FUNC_ENTRY;
+	while (ListNextElement(spoolers, &current))
+	{
+		MQTTClients* m = (MQTTClients*)(current->content);
+
+		while (m->c->connected == 1 && m->c->connect_state == 0 && MQTTSpool_count(m->spool) > 0 &&
+				!MQTTClient_publishWouldBlock(m))
+		{
+			Publish p;
+			Messages* msg = NULL;
+			char* topic = NULL;
+			char* payload = NULL;
+			int payloadlen, qos, retained, rc, tracked;
+
+			if (MQTTSpool_take(m->spool, &topic, &payload, &payloadlen, &qos, &retained) != 0)
+				break;
+			memset(&p, '\0', sizeof(Publish));
+			if (qos > 0 && (p.msgId = MQTTProtocol_assignMsgId(m->c)) == 0)
+			{	/* cannot happen while there is room in the window */
+				free(topic);
+				break;
+			}
+			p.topic = topic;
+			p.payload = payload;
+			p.payloadlen = payloadlen;
+			tracked = (Heap_findItem(topic) != NULL);
+			rc = MQTTProtocol_startPublish(m->c, &p, qos, retained, &msg);
+			/* a stored publication takes over a topic in the heap, and frees it with the message */
+			if (!tracked || (qos == 0 && rc != TCPSOCKET_INTERRUPTED))
+				free(topic);
+			if (rc == SOCKET_ERROR || rc == MESSAGE_INDEX_FAILED)
+				break;	/* the cycle finds the socket closed; a message of QoS > 0 is already stored */
+			Clients_addStat(m->c->stats.published[qos], 1);
+		}
+	}
+	FUNC_EXIT;
+}
+#endif
+
+
+/**
+ * Call the writable callback of each client which refused a non-blocking publish and can
+ * now accept one, or has lost its connection so that a retry will report it.  The callback
+ * is called without the client mutex held, so it can publish.
+ */
+static void MQTTClient_notifyWritable(void)
+{
+	FUNC_ENTRY;
+	Thread_lock_mutex(mqttclient_mutex);
+	while (writable_waiters && writable_waiters->count > 0)
+	{
+		ListElement* current = NULL;
+		MQTTClients* m = NULL;
+
+		while (ListNextElement(writable_waiters, &current))
+		{
+			MQTTClients* b = (MQTTClients*)(current->content);
+
+			if (b->c->connected == 0 || !MQTTClient_publishWouldBlock(b))
+			{
+				m = b;
+				break;
+			}
+		}
+		if (m == NULL)
+			break;
+		ListDetach(writable_waiters, m);
+		m->wouldblock = 0;
+		if (m->wr)
+		{
+			MQTTClient_writable* wr = m->wr;
+			void* context = m->wr_context;
+
+			Log(TRACE_MIN, -1, "Calling writable for client %s", m->c->clientID);
+			Thread_unlock_mutex(mqttclient_mutex);
+			(*wr)(context);
+			Thread_lock_mutex(mqttclient_mutex);
+		}
+	}
+	Thread_unlock_mutex(mqttclient_mutex);
+	FUNC_EXIT;
+}
+
+/**
+ * Publish a message to a topic string, or to a prepared topic.  The other parameters are
+ * those of MQTTClient_publish().
+ * @param prepared the prepared topic, or NULL to publish to topicName
+ * @param shared boolean - whether the payload is a buffer from MQTTClient_allocBuffer(), whose
+ * reference passes to the library if the message is accepted
+ */
+static int MQTTClient_publishCommon(MQTTClient handle, const char* topicName, PreparedTopic* prepared, int payloadlen,
+							 void* payload, int qos, int retained, MQTTClient_deliveryToken* deliveryToken, int shared)
 {
 	int rc = MQTTCLIENT_SUCCESS;
 	MQTTClients* m = handle;
@@ -1422,24 +1738,56 @@ int MQTTClient_publish(MQTTClient handle, const char* topicName, int payloadlen,
 
 	if (m == NULL || m->c == NULL)
 		rc = MQTTCLIENT_FAILURE;
-	else if (m->c->connected == 0)	//-ݱʶλжǷԷ,Ҫȥ,Ҫû
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+	else if (m->c->connected == 0 && m->spool == NULL)	//-ݱʶλжǷԷ,Ҫȥ,Ҫû
+#else
+	else if (m->c->connected == 0)
+#endif
 		rc = MQTTCLIENT_DISCONNECTED;
-	else if (!UTF8_validateString(topicName))
+	else if (qos < 0 || qos > 2)
+		rc = MQTTCLIENT_BAD_QOS;
+	else if (prepared == NULL && !UTF8_validateString(topicName))
 		rc = MQTTCLIENT_BAD_UTF8_STRING;
 	if (rc != MQTTCLIENT_SUCCESS)
 		goto exit;
 
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+	/* Spool the message rather than wait, and behind any already spooled so that order is kept */
+	if (m->spool && (m->c->connected == 0 || MQTTSpool_count(m->spool) > 0 || MQTTClient_publishWouldBlock(m)))
+	{
+		if (MQTTSpool_append(m->spool, (prepared) ? prepared->topic : topicName, payload, payloadlen, qos, retained) != 0)
+			rc = MQTTCLIENT_FAILURE;
+		else
+		{
+			if (deliveryToken)
+				*deliveryToken = 0;
+			if (shared && payload)
+				MQTTProtocol_releasePayload(payload);
+		}
+		goto exit;
+	}
+#endif
+
 	/* If outbound queue is full, block until it is not */
-	while (m->c->outboundMsgs->count >= m->c->maxInflightMessages || 
-         Socket_noPendingWrites(m->c->net.socket) == 0) /* wait until the socket is free of large packets being written */
-	{//-˵Ҫ,ڲʺ
+	while (MQTTClient_publishWouldBlock(m)) /* wait until the socket's write queue has drained */
+	{
+		if (m->nonblocking)
+		{
+			if (m->wouldblock == 0)
+			{
+				m->wouldblock = 1;
+				ListAppend(writable_waiters, m, sizeof(MQTTClients));
+			}
+			rc = MQTTCLIENT_WOULDBLOCK;
+			goto exit;
+		}//-˵Ҫ,ڲʺ
 		if (blocked == 0)
 		{
 			blocked = 1;
 			Log(TRACE_MIN, -1, "Blocking publish on queue full for client %s", m->c->clientID);
 		}
 		Thread_unlock_mutex(mqttclient_mutex);
-		MQTTClient_yield();	//-ҪͣĴշ,һǵ̵߳,Զ
+		MQTTClient_yieldOnce();	//-ҪͣĴշ,һǵ̵߳,Զ
 		Thread_lock_mutex(mqttclient_mutex);
 		if (m->c->connected == 0)	//-û,ûбҪ
 		{
@@ -1459,22 +1807,32 @@ int MQTTClient_publish(MQTTClient handle, const char* topicName, int payloadlen,
 
 	p->payload = payload;
 	p->payloadlen = payloadlen;
-	p->topic = (char*)topicName;
+	p->topic = (prepared) ? prepared->topic : (char*)topicName;
 	p->msgId = msgid;
+	p->prepared = prepared;
+	p->shared = shared && payload != NULL;
 
 	rc = MQTTProtocol_startPublish(m->c, p, qos, retained, &msg);
+	if (rc == MESSAGE_INDEX_FAILED)
+	{
+		free(p);
+		rc = MQTTCLIENT_FAILURE;
+		goto exit;
+	}
 
-	/* If the packet was partially written to the socket, wait for it to complete.
+	/* If the packet was queued behind others or partially written to the socket, it is written
+	 * in turn by the cycle; only wait here while the queue is over its limit.
 	 * However, if the client is disconnected during this time and qos is not 0, still return success, as
 	 * the packet has already been written to persistence and assigned a message id so will
-	 * be sent when the client next connects.
+	 * be sent when the client next connects.  In non-blocking mode don't wait at all.
 	 */
 	if (rc == TCPSOCKET_INTERRUPTED)
 	{//-뷨ܼ,ûзͳȥѭ,ں,ٶ
-		while (m->c->connected == 1 && SocketBuffer_getWrite(m->c->net.socket))
+		while (m->nonblocking == 0 && m->c->connected == 1 &&
+				SocketBuffer_pendingBytes(m->c->net.socket) >= PENDING_WRITE_LIMIT)
 		{
 			Thread_unlock_mutex(mqttclient_mutex);
-			MQTTClient_yield();
+			MQTTClient_yieldOnce();
 			Thread_lock_mutex(mqttclient_mutex);
 		}
 		rc = (qos > 0 || m->c->connected == 1) ? MQTTCLIENT_SUCCESS : MQTTCLIENT_FAILURE;
@@ -1493,6 +1851,10 @@ int MQTTClient_publish(MQTTClient handle, const char* topicName, int payloadlen,
 		/* Return success for qos > 0 as the send will be retried automatically */
 		rc = (qos > 0) ? MQTTCLIENT_SUCCESS : MQTTCLIENT_FAILURE;
 	}
+	if (rc == MQTTCLIENT_SUCCESS)
+		Clients_addStat(m->c->stats.published[qos], 1);
+	if (shared && payload && rc == MQTTCLIENT_SUCCESS)
+		MQTTProtocol_releasePayload(payload);	/* the stored message holds its own reference, if it needs one */
 
 exit:
 	Thread_unlock_mutex(mqttclient_mutex);
@@ -1501,6 +1863,83 @@ exit:
 }
 
 
+//-,ĴѾܶУ
+int MQTTClient_publish(MQTTClient handle, const char* topicName, int payloadlen, void* payload,
+							 int qos, int retained, MQTTClient_deliveryToken* deliveryToken)
+{
+	return MQTTClient_publishCommon(handle, topicName, NULL, payloadlen, payload, qos, retained, deliveryToken, 0);
+}
+
+
+void* MQTTClient_allocBuffer(int len)
+{
+	return (len < 0) ? NULL : MQTTProtocol_allocPayload(len);
+}
+
+
+void MQTTClient_freeBuffer(void* buffer)
+{
+	if (buffer)
+		MQTTProtocol_releasePayload(buffer);
+}
+
+
+int MQTTClient_publishBuffer(MQTTClient handle, const char* topicName, int payloadlen, void* buffer,
+							 int qos, int retained, MQTTClient_deliveryToken* deliveryToken)
+{
+	return MQTTClient_publishCommon(handle, topicName, NULL, payloadlen, buffer, qos, retained, deliveryToken, 1);
+}
+
+
+int MQTTClient_prepareTopic(const char* topicName, MQTTClient_topic* topic)
+{
+	int rc = MQTTCLIENT_SUCCESS;
+
+	FUNC_ENTRY;
+	if (topicName == NULL || topic == NULL)
+		rc = MQTTCLIENT_NULL_PARAMETER;
+	else if (!UTF8_validateString(topicName))
+		rc = MQTTCLIENT_BAD_UTF8_STRING;
+	else if ((*topic = MQTTPacket_prepareTopic(topicName)) == NULL)
+		rc = MQTTCLIENT_FAILURE;
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTClient_publishTopic(MQTTClient handle, MQTTClient_topic topic, int payloadlen, void* payload,
+							 int qos, int retained, MQTTClient_deliveryToken* deliveryToken)
+{
+	if (topic == NULL)
+		return MQTTCLIENT_NULL_PARAMETER;
+	return MQTTClient_publishCommon(handle, NULL, (PreparedTopic*)topic, payloadlen, payload, qos, retained, deliveryToken, 0);
+}
+
+
+int MQTTClient_publishTopicBuffer(MQTTClient handle, MQTTClient_topic topic, int payloadlen, void* buffer,
+							 int qos, int retained, MQTTClient_deliveryToken* deliveryToken)
+{
+	if (topic == NULL)
+		return MQTTCLIENT_NULL_PARAMETER;
+	return MQTTClient_publishCommon(handle, NULL, (PreparedTopic*)topic, payloadlen, buffer, qos, retained, deliveryToken, 1);
+}
+
+
+void MQTTClient_freeTopic(MQTTClient_topic* topic)
+{
+	FUNC_ENTRY;
+	free(*topic);
+	*topic = NULL;
+	FUNC_EXIT;
+}
+
+
+const char* MQTTClient_topicName(MQTTClient_topic topic)
+{
+	return (topic) ? ((PreparedTopic*)topic)->topic : NULL;
+}
+
+
 //-Ϣ
 int MQTTClient_publishMessage(MQTTClient handle, const char* topicName, MQTTClient_message* message,
 															 MQTTClient_deliveryToken* deliveryToken)
@@ -1541,18 +1980,9 @@ Keep Alive timerΪ
 */
 void MQTTClient_retry(void)	//-ٴγ
 {
-	time_t now;
-
 	FUNC_ENTRY;
-	time(&(now));
-	if (difftime(now, last) > 5)	//-Сÿ5Sӽһж,˾Ҫһping֡
-	{
-		time(&(last));
-		MQTTProtocol_keepalive(now);	//-ԻԾж,ҪĻһPINGREQ
-		MQTTProtocol_retry(now, 1, 0);
-	}
-	else
-		MQTTProtocol_retry(now, 0, 0);
+	Timer_expire(Timer_now());	/* keepalive and message retries */
+	MQTTProtocol_retry(0);
 	FUNC_EXIT;
 }
 
@@ -1566,6 +1996,10 @@ MQTTPacket* MQTTClient_cycle(int* sock, unsigned long timeout, int* rc)	//-
 	MQTTPacket* pack = NULL;	//-ݽṹָMQTT֡ͷ
 
 	FUNC_ENTRY;
+	/* don't sleep past the next keepalive or retry time */
+	Thread_lock_mutex(mqttclient_mutex);
+	timeout = Timer_timeout((long)timeout);
+	Thread_unlock_mutex(mqttclient_mutex);
 	if (timeout > 0L)
 	{
 		tp.tv_sec = timeout / 1000;
@@ -1586,9 +2020,7 @@ MQTTPacket* MQTTClient_cycle(int* sock, unsigned long timeout, int* rc)	//-
 	Thread_lock_mutex(mqttclient_mutex);
 	if (*sock > 0)
 	{//-׽׼ö,ͽж
-		MQTTClients* m = NULL;
-		if (ListFindItem(handles, sock, clientSockCompare) != NULL)
-			m = (MQTTClient)(handles->current->content);
+		MQTTClients* m = MQTTClient_findSocket(*sock);
 		if (m != NULL)
 		{
 			if (m->c->connect_state == 1 || m->c->connect_state == 2)
@@ -1634,7 +2066,17 @@ MQTTPacket* MQTTClient_cycle(int* sock, unsigned long timeout, int* rc)	//-
 		}
 	}
 	MQTTClient_retry();
+#if !defined(NO_PERSISTENCE)
+	if (queues_unpersisted)
+		MQTTClient_persistQueues();
+#endif
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+	if (spoolers && spoolers->count > 0)
+		MQTTClient_drainSpools();
+#endif
 	Thread_unlock_mutex(mqttclient_mutex);
+	if (writable_waiters && writable_waiters->count > 0)
+		MQTTClient_notifyWritable();
 	FUNC_EXIT_RC(*rc);
 	return pack;
 }
@@ -1770,8 +2212,7 @@ int MQTTClient_receive(MQTTClient handle, char** topicName, int* topicLen, MQTTC
 		
 		if (rc == SOCKET_ERROR)
 		{
-			if (ListFindItem(handles, &sock, clientSockCompare) && 	/* find client corresponding to socket */
-			  (MQTTClient)(handles->current->content) == handle)
+			if (MQTTClient_findSocket(sock) == handle) 	/* find client corresponding to socket */
 				break; /* there was an error on the socket we are interested in */
 		}
 		elapsed = MQTTClient_elapsed(start);
@@ -1810,10 +2251,11 @@ void MQTTClient_yield(void)	//-
 	do
 	{
 		int sock = -1;
+		MQTTClients* m = NULL;
+
 		MQTTClient_cycle(&sock, (timeout > elapsed) ? timeout - elapsed : 0L, &rc);	//-ڴǱ֤ͨѶ,ûûͳȥ
-		if (rc == SOCKET_ERROR && ListFindItem(handles, &sock, clientSockCompare))
+		if (rc == SOCKET_ERROR && (m = MQTTClient_findSocket(sock)) != NULL)
 		{
-			MQTTClients* m = (MQTTClient)(handles->current->content);
 			if (m->c->connect_state != -2)
 				MQTTClient_disconnect_internal(m, 0);
 		}
@@ -1825,6 +2267,34 @@ exit:
 }
 
 
+/**
+ * Process one packet or timer, or wait for up to 100 milliseconds for one, for a caller which is
+ * waiting for an acknowledgement or for the socket to drain.  Unlike MQTTClient_yield() this
+ * returns as soon as something has happened, so the caller can look again straight away.
+ */
+static void MQTTClient_yieldOnce(void)
+{
+	int sock = -1;
+	int rc = 0;
+	MQTTClients* m = NULL;
+
+	FUNC_ENTRY;
+	if (running)
+	{	/* the background thread is processing packets */
+		MQTTClient_sleep(10L);
+		goto exit;
+	}
+	MQTTClient_cycle(&sock, 100L, &rc);
+	if (rc == SOCKET_ERROR && (m = MQTTClient_findSocket(sock)) != NULL)
+	{
+		if (m->c->connect_state != -2)
+			MQTTClient_disconnect_internal(m, 0);
+	}
+exit:
+	FUNC_EXIT;
+}
+
+
 int pubCompare(void* a, void* b)
 {
 	Messages* msg = (Messages*)a;
@@ -1854,7 +2324,7 @@ int MQTTClient_waitForCompletion(MQTTClient handle, MQTTClient_deliveryToken mdt
 		goto exit;
 	}
 
-	if (ListFindItem(m->c->outboundMsgs, &mdt, messageIDCompare) == NULL)	//-Ҫ,û˵ɹ
+	if (!MQTTProtocol_msgIdInUse(m->c, mdt))	//-Ҫ,û˵ɹ
 	{
 		rc = MQTTCLIENT_SUCCESS; /* well we couldn't find it */
 		goto exit;
@@ -1864,9 +2334,9 @@ int MQTTClient_waitForCompletion(MQTTClient handle, MQTTClient_deliveryToken mdt
 	while (elapsed < timeout)
 	{
 		Thread_unlock_mutex(mqttclient_mutex);
-		MQTTClient_yield();	//-ں,ѭȴֱ
+		MQTTClient_yieldOnce();	//-ں,ѭȴֱ
 		Thread_lock_mutex(mqttclient_mutex);
-		if (ListFindItem(m->c->outboundMsgs, &mdt, messageIDCompare) == NULL)
+		if (!MQTTProtocol_msgIdInUse(m->c, mdt))
 		{
 			rc = MQTTCLIENT_SUCCESS; /* well we couldn't find it */
 			goto exit;
@@ -1917,6 +2387,106 @@ exit:
 	return rc;
 }
 
+
+static void MQTTClient_copyHistogram(MQTTClient_histogram* to, MQTTClient_histogram* from)
+{
+	int i;
+
+	to->count = Clients_getStat(from->count);
+	to->sum = Clients_getStat(from->sum);
+	to->max = Clients_getStat(from->max);
+	for (i = 0; i < MQTTCLIENT_HISTOGRAM_BUCKETS; ++i)
+		to->buckets[i] = Clients_getStat(from->buckets[i]);
+}
+
+
+/*
+ * Counters are read without the client mutex, so that a monitoring thread never holds up the
+ * protocol flows; each one is read atomically, as it was updated.
+ */
+int MQTTClient_getStats(MQTTClient handle, MQTTClient_stats* stats)
+{
+	MQTTClients* m = handle;
+	MQTTClient_stats* from;
+	int rc = MQTTCLIENT_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (m == NULL || m->c == NULL || stats == NULL)
+	{
+		rc = MQTTCLIENT_FAILURE;
+		goto exit;
+	}
+	from = &m->c->stats;
+	for (i = 0; i < 3; ++i)
+	{
+		stats->published[i] = Clients_getStat(from->published[i]);
+		stats->received[i] = Clients_getStat(from->received[i]);
+	}
+	stats->acknowledged = Clients_getStat(from->acknowledged);
+	stats->retries = Clients_getStat(from->retries);
+	stats->duplicates = Clients_getStat(from->duplicates);
+	stats->bytesSent = Clients_getStat(m->c->net.bytesSent);
+	stats->bytesReceived = Clients_getStat(m->c->net.bytesReceived);
+	stats->connects = Clients_getStat(from->connects);
+	stats->connectionsLost = Clients_getStat(from->connectionsLost);
+	stats->restored = Clients_getStat(from->restored);
+	stats->restoreTime = Clients_getStat(from->restoreTime);
+	stats->spooled = Clients_getStat(from->spooled);
+	stats->spoolEvicted = Clients_getStat(from->spoolEvicted);
+	stats->spoolExpired = Clients_getStat(from->spoolExpired);
+	stats->spoolBytes = Clients_getStat(from->spoolBytes);
+
+	stats->inflightOut = Clients_getStat(m->c->outboundMsgs->count);
+	stats->inflightIn = Clients_getStat(m->c->inboundMsgs->count);
+	stats->queued = Clients_getStat(m->c->messageQueue->count);
+	stats->window = Clients_getStat(m->c->flow.window);
+	stats->srtt = Clients_getStat(m->c->flow.srtt) * 125;	/* from eighths of a millisecond */
+	stats->rto = Clients_getStat(m->c->flow.rto);
+
+	MQTTClient_copyHistogram(&stats->qos1Latency, &from->qos1Latency);
+	MQTTClient_copyHistogram(&stats->qos2Latency, &from->qos2Latency);
+	MQTTClient_copyHistogram(&stats->connectLatency, &from->connectLatency);
+	MQTTClient_copyHistogram(&stats->pingLatency, &from->pingLatency);
+	MQTTClient_copyHistogram(&stats->persistLatency, &from->persistLatency);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+unsigned long long MQTTClient_histogramPercentile(const MQTTClient_histogram* histogram, double percentile)
+{
+	unsigned long long total = 0, rank, count = 0;
+	unsigned long long rc = 0;
+	int i;
+
+	FUNC_ENTRY;
+	if (histogram == NULL)
+		goto exit;
+	for (i = 0; i < MQTTCLIENT_HISTOGRAM_BUCKETS; ++i)
+		total += histogram->buckets[i];
+	if (total == 0)
+		goto exit;
+	if (percentile < 0)
+		percentile = 0;
+	rank = (unsigned long long)(percentile / 100 * total + 0.5);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < MQTTCLIENT_HISTOGRAM_BUCKETS - 1; ++i)
+	{
+		if ((count += histogram->buckets[i]) >= rank)
+			break;
+	}
+	/* the highest latency the bucket holds, which the largest recorded may be below */
+	rc = MQTTProtocol_bucketLatency(i + 1) - 1;
+	if (i == MQTTCLIENT_HISTOGRAM_BUCKETS - 1 || rc > histogram->max)
+		rc = histogram->max;
+exit:
+	FUNC_EXIT;
+	return rc;
+}
+
 MQTTClient_nameValue* MQTTClient_getVersionInfo()	//-ð汾
 {
 	#define MAX_INFO_STRINGS 8
@@ -1983,7 +2553,7 @@ void MQTTProtocol_checkPendingWrites()	//-
 
 void MQTTClient_writeComplete(int socket)	//-ЭϢĴ洢Ҫһ׻				
 {
-	ListElement* found = NULL;
+	Clients* client = NULL;
 	
 	FUNC_ENTRY;
 	/* a partial write is now complete for a socket - this will be on a publish*/
@@ -1991,11 +2561,7 @@ void MQTTClient_writeComplete(int socket)	//-
 	MQTTProtocol_checkPendingWrites();
 	
 	/* find the client using this socket */
-	if ((found = ListFindItem(handles, &socket, clientSockCompare)) != NULL)
-	{
-		MQTTClients* m = (MQTTClients*)(found->content);
-		
-		time(&(m->c->net.lastSent));
-	}
+	if ((client = Clients_findSocket(bstate, socket)) != NULL)
+		client->net.lastSent = Timer_now();
 	FUNC_EXIT;
 }
@@ -163,6 +163,13 @@
  * Return code: A QoS value that falls outside of the acceptable range (0,1,2)
  */
 #define MQTTCLIENT_BAD_QOS -9
+/**
+ * Return code: The message could not be accepted without waiting, because the
+ * in-flight window is full or a previous packet is still being written.  Only
+ * returned once non-blocking publish has been enabled with
+ * MQTTClient_setNonBlockingPublish().
+ */
+#define MQTTCLIENT_WOULDBLOCK -10
 
 /**
  * Default MQTT version to connect with.  Use 3.1.1 then fall back to 3.1
@@ -199,6 +206,12 @@ typedef void* MQTTClient;
 typedef int MQTTClient_deliveryToken;
 typedef int MQTTClient_token;
 
+/**
+ * A handle representing a topic prepared for publishing, available following a
+ * successful call to MQTTClient_prepareTopic().  It can be used with any client.
+ */
+typedef void* MQTTClient_topic;
+
 /**
  * A structure representing the payload and attributes of an MQTT message. The
  * message topic is not part of this structure (see MQTTClient_publishMessage(),
@@ -330,6 +343,19 @@ typedef void MQTTClient_deliveryComplete(void* context, MQTTClient_deliveryToken
  */
 typedef void MQTTClient_connectionLost(void* context, char* cause);
 
+/**
+ * This is a callback function. It is registered with the client library by
+ * passing it as an argument to MQTTClient_setNonBlockingPublish(). It is called
+ * once after MQTTClient_publish() or MQTTClient_publishMessage() has returned
+ * ::MQTTCLIENT_WOULDBLOCK, as soon as a publish can be accepted again (or the
+ * connection has been lost, so that the next publish reports it). It is called
+ * from MQTTClient_yield(), MQTTClient_receive() or the background thread, with
+ * no library locks held, so it may publish.
+ * @param context A pointer to the <i>context</i> value originally passed to
+ * MQTTClient_setNonBlockingPublish().
+ */
+typedef void MQTTClient_writable(void* context);
+
 /**
  * This function sets the callback functions for a specific client.
  * If your client application doesn't use a particular callback, set the 
@@ -359,6 +385,89 @@ typedef void MQTTClient_connectionLost(void* context, char* cause);
  */
 DLLExport int MQTTClient_setCallbacks(MQTTClient handle, void* context, MQTTClient_connectionLost* cl,
 									MQTTClient_messageArrived* ma, MQTTClient_deliveryComplete* dc);
+
+/**
+ * This function switches a client between blocking and non-blocking publish.
+ * By default MQTTClient_publish() and MQTTClient_publishMessage() wait while
+ * the in-flight window is full or a large packet is still being written. In
+ * non-blocking mode they return ::MQTTCLIENT_WOULDBLOCK instead, and the
+ * MQTTClient_writable() callback is called when a publish can be retried, so
+ * that the application applies its own backpressure policy (queueing,
+ * coalescing or dropping messages).
+ * @param handle A valid client handle from a successful call to
+ * MQTTClient_create().
+ * @param nonblocking 1 to enable non-blocking publish, 0 to restore the
+ * default blocking behaviour.
+ * @param context A pointer to any application-specific context, passed to the
+ * writable callback.
+ * @param wr A pointer to an MQTTClient_writable() callback function. You can
+ * set this to NULL if the application polls instead.
+ * @return ::MQTTCLIENT_SUCCESS if the mode was set,
+ * ::MQTTCLIENT_FAILURE if an error occurred.
+ */
+DLLExport int MQTTClient_setNonBlockingPublish(MQTTClient handle, int nonblocking, void* context,
+									MQTTClient_writable* wr);
+
+/**
+ * This eviction value makes a full spool drop its oldest messages first.
+ */
+#define MQTTCLIENT_SPOOL_OLDEST 0
+/**
+ * This eviction value makes a full spool drop QoS 0 messages first, then QoS 1
+ * messages and then QoS 2 messages, the oldest first within each QoS.
+ */
+#define MQTTCLIENT_SPOOL_PRIORITY 1
+
+/**
+ * The options of the spool of a client, set with MQTTClient_setSpool().
+ * Messages are kept in a queue for each QoS of segment files, written one
+ * after another and deleted when all the messages in them have been sent or
+ * dropped, so that only the segments being written and read are open.
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQSF. */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0. */
+	int struct_version;
+	/** The directory of the segment files, which is created if needed.  It
+	  * must not be shared with another client. */
+	const char* directory;
+	/** The most bytes the segments may hold, or 0 for 16MB.  Messages are
+	  * dropped a segment at a time to make room for new ones. */
+	long maxBytes;
+	/** The longest time in seconds a message may wait in the spool before it
+	  * is dropped instead of sent, or 0 for no limit. */
+	int maxAge;
+	/** ::MQTTCLIENT_SPOOL_OLDEST or ::MQTTCLIENT_SPOOL_PRIORITY */
+	int eviction;
+	/** The size in bytes after which the next segment of a queue is started,
+	  * or 0 for 256KB. */
+	int segmentSize;
+} MQTTClient_spoolOptions;
+
+#define MQTTClient_spoolOptions_initializer { {'M', 'Q', 'S', 'F'}, 0, NULL, 0, 0, MQTTCLIENT_SPOOL_OLDEST, 0 }
+
+/**
+ * This function gives a client a spool on disk for the messages it cannot
+ * send yet.  While the client is disconnected, or the in-flight window is
+ * full, or messages are already waiting in the spool, MQTTClient_publish()
+ * and MQTTClient_publishMessage() append the message to the spool and return
+ * ::MQTTCLIENT_SUCCESS at once, with a delivery token of 0, instead of
+ * failing or waiting.  Once connected the client takes the messages from the
+ * spool in the order they were published, as fast as the in-flight window
+ * allows, from MQTTClient_yield(), MQTTClient_receive() or the background
+ * thread.  Messages spooled before the client was created are sent as well.
+ * Not available on Windows or without persistence.
+ * @param handle A valid client handle from a successful call to
+ * MQTTClient_create().
+ * @param options The options of the spool, or NULL to close the spool,
+ * leaving any messages in it for the next time it is opened.
+ * @return ::MQTTCLIENT_SUCCESS if the spool was opened or closed,
+ * ::MQTTCLIENT_BAD_STRUCTURE if the options are not valid, or
+ * ::MQTTCLIENT_FAILURE if the spool could not be opened.
+ */
+DLLExport int MQTTClient_setSpool(MQTTClient handle, MQTTClient_spoolOptions* options);
 		
 
 /**
@@ -374,7 +483,9 @@ DLLExport int MQTTClient_setCallbacks(MQTTClient handle, void* context, MQTTClie
  * For <i>host</i>, you can
  * specify either an IP address or a host name. For instance, to connect to
  * a server running on the local machines with the default MQTT port, specify
- * <i>tcp://localhost:1883</i>.
+ * <i>tcp://localhost:1883</i>. To connect to a server on the same machine through a
+ * Unix domain socket, specify <i>unix://</i> followed by the path name of the socket,
+ * for instance <i>unix:///var/run/mosquitto.sock</i>.
  * @param clientId The client identifier passed to the server when the
  * client connects to it. It is a null-terminated UTF-8 encoded string. 
  * ClientIDs must be no longer than 23 characters according to the MQTT 
@@ -395,6 +506,20 @@ DLLExport int MQTTClient_setCallbacks(MQTTClient handle, void* context, MQTTClie
  * implementation. Using this type of persistence gives control of the 
  * persistence mechanism to the application. The application has to implement
  * the MQTTClient_persistence interface.
+ * <br>
+ * ::MQTTCLIENT_PERSISTENCE_LOG: Use the log-structured file system-based
+ * persistence mechanism, which appends to a log instead of creating and
+ * deleting a file for each message, and can write several messages at once.
+ * Not available on Windows.
+ * <br>
+ * ::MQTTCLIENT_PERSISTENCE_MMAP: Use the memory-mapped persistence mechanism,
+ * which copies each in-flight message into a slot of one file mapped into
+ * memory.  Meant for a persistence directory on tmpfs or battery-backed RAM.
+ * Not available on Windows.
+ * <br>
+ * ::MQTTCLIENT_PERSISTENCE_DURABLE: Use the default persistence mechanism,
+ * syncing the files written for the messages as chosen.  Not available on
+ * Windows.
  * @param persistence_context If the application uses 
  * ::MQTTCLIENT_PERSISTENCE_NONE persistence, this argument is unused and should
  * be set to NULL. For ::MQTTCLIENT_PERSISTENCE_DEFAULT persistence, it
@@ -402,6 +527,12 @@ DLLExport int MQTTClient_setCallbacks(MQTTClient handle, void* context, MQTTClie
  * to NULL, the persistence directory used is the working directory).
  * Applications that use ::MQTTCLIENT_PERSISTENCE_USER persistence set this
  * argument to point to a valid MQTTClient_persistence structure.
+ * For ::MQTTCLIENT_PERSISTENCE_LOG persistence, it points to an
+ * MQTTClient_logPersistenceOptions structure, or is NULL for the defaults,
+ * and for ::MQTTCLIENT_PERSISTENCE_MMAP persistence to an
+ * MQTTClient_mmapPersistenceOptions structure, or is NULL for the defaults,
+ * and for ::MQTTCLIENT_PERSISTENCE_DURABLE persistence to an
+ * MQTTClient_defaultPersistenceOptions structure, or is NULL for the defaults.
  * @return ::MQTTCLIENT_SUCCESS if the client is successfully created, otherwise
  * an error code is returned.
  */
@@ -494,6 +625,68 @@ typedef struct
 
 #define MQTTClient_SSLOptions_initializer { {'M', 'Q', 'T', 'S'}, 0, NULL, NULL, NULL, NULL, NULL, 1 }
 
+/**
+ * MQTTClient_socketOptions tunes the TCP connection made to the server.  A value of 0 for any
+ * setting leaves the operating system default in place.  The values actually in effect once
+ * the connection has been made are written to the <i>returned</i> member when
+ * MQTTClient_connect() succeeds.  Options the platform does not support are ignored and
+ * returned as 0.
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQSO */
+	const char struct_id[4];
+	/** The version number of this structure.  Must be 0 */
+	int struct_version;
+	/**
+	 * Boolean: disable the Nagle algorithm (TCP_NODELAY), so that small packets such as
+	 * QoS 0 telemetry and acknowledgements are sent without waiting for earlier data to
+	 * be acknowledged.
+	 */
+	int tcpNoDelay;
+	/** The size in bytes of the socket send buffer (SO_SNDBUF). */
+	int sendBufferSize;
+	/** The size in bytes of the socket receive buffer (SO_RCVBUF). */
+	int receiveBufferSize;
+	/**
+	 * The time in milliseconds for which sent data may remain unacknowledged before the
+	 * connection is closed (TCP_USER_TIMEOUT), so that a dead link is detected in that time
+	 * rather than after the system's retransmission limit.
+	 */
+	int userTimeout;
+	/** Boolean: send TCP keepalive probes when the connection is idle (SO_KEEPALIVE). */
+	int keepAlive;
+	/** The idle time in seconds before the first keepalive probe is sent (TCP_KEEPIDLE). */
+	int keepAliveIdle;
+	/** The time in seconds between keepalive probes (TCP_KEEPINTVL). */
+	int keepAliveInterval;
+	/** The number of unanswered keepalive probes before the connection is closed (TCP_KEEPCNT). */
+	int keepAliveCount;
+	/**
+	 * The number of bytes of unsent data above which the socket is not reported as writable
+	 * (TCP_NOTSENT_LOWAT), so that less data waits in the socket behind a slow link.
+	 */
+	int notSentLowat;
+	/**
+	 * Returned from the connect: the values in effect on the connection, as reported by
+	 * the operating system.  Note that Linux reports buffer sizes doubled.
+	 */
+	struct
+	{
+		int tcpNoDelay;
+		int sendBufferSize;
+		int receiveBufferSize;
+		int userTimeout;
+		int keepAlive;
+		int keepAliveIdle;
+		int keepAliveInterval;
+		int keepAliveCount;
+		int notSentLowat;
+	} returned;
+} MQTTClient_socketOptions;
+
+#define MQTTClient_socketOptions_initializer { {'M', 'Q', 'S', 'O'}, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+
 /**
  * MQTTClient_connectOptions defines several settings that control the way the
  * client connects to an MQTT server. 
@@ -512,11 +705,13 @@ typedef struct
 {
 	/** The eyecatcher for this structure.  must be MQTC. */
 	const char struct_id[4];
-	/** The version number of this structure.  Must be 0, 1, 2, 3 or 4.  
+	/** The version number of this structure.  Must be 0, 1, 2, 3, 4 or 5.
 	 * 0 signifies no SSL options and no serverURIs
 	 * 1 signifies no serverURIs 
 	 * 2 signifies no MQTTVersion
 	 * 3 signifies no returned values
+	 * 4 signifies no socket options
+	 * 5 signifies no maxInflightMessages
 	 */
 	int struct_version;
 	/** The "keep alive" interval, measured in seconds, defines the maximum time
@@ -584,7 +779,9 @@ typedef struct
    */
 	int connectTimeout;
 	/**
-	 * The time interval in seconds
+	 * The longest time interval in seconds to wait for a message to be acknowledged
+	 * before sending it again, and the wait until a round trip time has been measured.
+	 * Values under 10 are taken as 10; 0 or less only resends messages on reconnect.
 	 */
 	int retryInterval;
 	/** 
@@ -602,7 +799,7 @@ typedef struct
    * <i>protocol</i> must be <i>tcp</i> or <i>ssl</i>. For <i>host</i>, you can 
    * specify either an IP address or a host name. For instance, to connect to
    * a server running on the local machines with the default MQTT port, specify
-   * <i>tcp://localhost:1883</i>.
+   * <i>tcp://localhost:1883</i>, or for a Unix domain socket <i>unix:///path</i>.
    * If this list is empty (the default), the server URI specified on MQTTClient_create()
    * is used.
    */    
@@ -623,9 +820,21 @@ typedef struct
 		int MQTTVersion;     /**< the MQTT version used to connect with */
 		int sessionPresent;  /**< if the MQTT version is 3.1.1, the value of sessionPresent returned in the connack */
 	} returned;
+	/**
+	 * An optional pointer to an MQTTClient_socketOptions structure, to tune the TCP
+	 * connection.  Set it to NULL to use the operating system defaults.
+	 */
+	MQTTClient_socketOptions* socketOptions;
+	/**
+	 * The most QoS 1 and 2 messages to have in flight at once, or 0 for the default of 10.
+	 * Ignored if #reliable is set.  The number actually allowed adapts to the link: it grows
+	 * while messages are acknowledged and halves when one has to be retried, and the time
+	 * waited before retrying follows the measured round trip time, up to #retryInterval.
+	 */
+	int maxInflightMessages;
 } MQTTClient_connectOptions;
 
-#define MQTTClient_connectOptions_initializer { {'M', 'Q', 'T', 'C'}, 4, 60, 1, 1, NULL, NULL, NULL, 30, 20, NULL, 0, NULL, 0}
+#define MQTTClient_connectOptions_initializer { {'M', 'Q', 'T', 'C'}, 6, 60, 1, 1, NULL, NULL, NULL, 30, 20, NULL, 0, NULL, 0, {NULL, 0, 0}, NULL, 0}
 
 /**
   * MQTTClient_libraryInfo is used to store details relating to the currently used
@@ -805,6 +1014,113 @@ DLLExport int MQTTClient_publish(MQTTClient handle, const char* topicName, int p
   */
 DLLExport int MQTTClient_publishMessage(MQTTClient handle, const char* topicName, MQTTClient_message* msg, MQTTClient_deliveryToken* dt);
 
+/**
+  * This function validates and encodes a topic once, for an application which
+  * publishes to the same topics repeatedly.  Publishing to the topic with
+  * MQTTClient_publishTopic() then skips the validation and encoding of the topic
+  * for each message.
+  * @param topicName The topic to prepare.
+  * @param topic A pointer to an ::MQTTClient_topic, which is set to the prepared
+  * topic when the function returns successfully.
+  * @return ::MQTTCLIENT_SUCCESS if the topic was prepared.
+  * ::MQTTCLIENT_BAD_UTF8_STRING is returned if the topic is not a valid UTF-8 string.
+  */
+DLLExport int MQTTClient_prepareTopic(const char* topicName, MQTTClient_topic* topic);
+
+/**
+  * This function attempts to publish a message to a topic prepared with
+  * MQTTClient_prepareTopic().  Otherwise it is the same as MQTTClient_publish().
+  * @param handle A valid client handle from a successful call to
+  * MQTTClient_create().
+  * @param topic The prepared topic to publish the message to.
+  * @param payloadlen The length of the payload in bytes.
+  * @param payload A pointer to the byte array payload of the message.
+  * @param qos The @ref qos of the message.
+  * @param retained The retained flag for the message.
+  * @param dt A pointer to an ::MQTTClient_deliveryToken. This is populated
+  * with a token representing the message when the function returns
+  * successfully. If your application does not use delivery tokens, set this
+  * argument to NULL.
+  * @return ::MQTTCLIENT_SUCCESS if the message is accepted for publication.
+  * An error code is returned if there was a problem accepting the message.
+  */
+DLLExport int MQTTClient_publishTopic(MQTTClient handle, MQTTClient_topic topic, int payloadlen, void* payload, int qos, int retained,
+																 MQTTClient_deliveryToken* dt);
+
+/**
+  * This function frees a topic prepared with MQTTClient_prepareTopic().  Messages
+  * already published to the topic are not affected.
+  * @param topic A pointer to the ::MQTTClient_topic to free, which is set to NULL.
+  */
+DLLExport void MQTTClient_freeTopic(MQTTClient_topic* topic);
+
+/**
+  * This function returns the name of a topic prepared with MQTTClient_prepareTopic().
+  * @param topic The prepared topic.
+  * @return The topic name, which is valid until the topic is freed.
+  */
+DLLExport const char* MQTTClient_topicName(MQTTClient_topic topic);
+
+/**
+  * This function allocates a buffer for a payload which is to be handed over to the
+  * library with MQTTClient_publishBuffer() or MQTTClient_publishTopicBuffer().  The
+  * library keeps a reference to the buffer for as long as it needs the payload, until
+  * the message is acknowledged, instead of copying it.  Reading data straight into
+  * the buffer means the payload is not copied at all on its way to the socket.
+  * @param len The size of the payload in bytes.
+  * @return A pointer to the buffer, or NULL if there was no memory.  The caller
+  * holds one reference to it.
+  */
+DLLExport void* MQTTClient_allocBuffer(int len);
+
+/**
+  * This function drops the caller's reference to a buffer allocated with
+  * MQTTClient_allocBuffer(), for a buffer which was not published.  The buffer is
+  * freed when the library no longer holds a reference to it either.
+  * @param buffer The buffer, which may be NULL.
+  */
+DLLExport void MQTTClient_freeBuffer(void* buffer);
+
+/**
+  * This function attempts to publish a message whose payload is a buffer allocated
+  * with MQTTClient_allocBuffer(), without copying the payload.  Otherwise it is the
+  * same as MQTTClient_publish().  If ::MQTTCLIENT_SUCCESS is returned the caller's
+  * reference to the buffer passes to the library, and the caller must not use the
+  * buffer again.  If an error is returned, including ::MQTTCLIENT_WOULDBLOCK, the
+  * caller still holds the buffer, and can publish it again or free it with
+  * MQTTClient_freeBuffer().
+  * @param handle A valid client handle from a successful call to
+  * MQTTClient_create().
+  * @param topicName The topic associated with this message.
+  * @param payloadlen The length of the payload in bytes.
+  * @param buffer The buffer holding the payload.
+  * @param qos The @ref qos of the message.
+  * @param retained The retained flag for the message.
+  * @param dt A pointer to an ::MQTTClient_deliveryToken, as for MQTTClient_publish().
+  * @return ::MQTTCLIENT_SUCCESS if the message is accepted for publication.
+  * An error code is returned if there was a problem accepting the message.
+  */
+DLLExport int MQTTClient_publishBuffer(MQTTClient handle, const char* topicName, int payloadlen, void* buffer, int qos, int retained,
+																 MQTTClient_deliveryToken* dt);
+
+/**
+  * This function attempts to publish a message whose payload is a buffer allocated
+  * with MQTTClient_allocBuffer() to a topic prepared with MQTTClient_prepareTopic().
+  * The buffer is handed over as by MQTTClient_publishBuffer().
+  * @param handle A valid client handle from a successful call to
+  * MQTTClient_create().
+  * @param topic The prepared topic to publish the message to.
+  * @param payloadlen The length of the payload in bytes.
+  * @param buffer The buffer holding the payload.
+  * @param qos The @ref qos of the message.
+  * @param retained The retained flag for the message.
+  * @param dt A pointer to an ::MQTTClient_deliveryToken, as for MQTTClient_publish().
+  * @return ::MQTTCLIENT_SUCCESS if the message is accepted for publication.
+  * An error code is returned if there was a problem accepting the message.
+  */
+DLLExport int MQTTClient_publishTopicBuffer(MQTTClient handle, MQTTClient_topic topic, int payloadlen, void* buffer, int qos, int retained,
+																 MQTTClient_deliveryToken* dt);
+
 
 /**
   * This function is called by the client application to synchronize execution
@@ -844,6 +1160,122 @@ DLLExport int MQTTClient_waitForCompletion(MQTTClient handle, MQTTClient_deliver
   */
 DLLExport int MQTTClient_getPendingDeliveryTokens(MQTTClient handle, MQTTClient_deliveryToken **tokens);
 
+/**
+  * Number of sub-buckets each power of 2 of a latency histogram is divided
+  * into, so a latency is known to within 1/8 of its value.
+  */
+#define MQTTCLIENT_HISTOGRAM_SUB_BUCKETS 8
+
+/**
+  * Number of buckets in a latency histogram, enough for latencies of up to
+  * 2^32 microseconds (71 minutes).  Longer ones are counted in the last bucket.
+  */
+#define MQTTCLIENT_HISTOGRAM_BUCKETS 240
+
+/**
+  * A histogram of latencies in microseconds.  Latencies below
+  * ::MQTTCLIENT_HISTOGRAM_SUB_BUCKETS have a bucket each; above that, the
+  * buckets of each power of 2 are ::MQTTCLIENT_HISTOGRAM_SUB_BUCKETS equal
+  * parts of it, as in an HDR histogram with 3 significant bits.  Use
+  * MQTTClient_histogramPercentile() to read it.
+  */
+typedef struct
+{
+	/** The number of latencies recorded */
+	unsigned long long count;
+	/** The sum of the latencies recorded, in microseconds */
+	unsigned long long sum;
+	/** The longest latency recorded, in microseconds */
+	unsigned long long max;
+	/** The number of latencies recorded in each bucket */
+	unsigned int buckets[MQTTCLIENT_HISTOGRAM_BUCKETS];
+} MQTTClient_histogram;
+
+/**
+  * Counters and latencies of the MQTT protocol flows of a client, returned by
+  * MQTTClient_getStats().  The counters accumulate from the creation of the
+  * client, across connections.
+  */
+typedef struct
+{
+	/** Messages accepted for publishing at each QoS */
+	unsigned long long published[3];
+	/** Messages received at each QoS, not counting duplicates of QoS 2 messages already received */
+	unsigned long long received[3];
+	/** QoS 1 and 2 messages published and acknowledged by PUBACK or PUBCOMP */
+	unsigned long long acknowledged;
+	/** PUBLISH and PUBREL packets resent because no acknowledgement came */
+	unsigned long long retries;
+	/** PUBLISH packets received with the duplicate flag set or for a QoS 2 message already received */
+	unsigned long long duplicates;
+	/** Bytes of MQTT packets sent */
+	unsigned long long bytesSent;
+	/** Bytes of MQTT packets received */
+	unsigned long long bytesReceived;
+	/** Successful connects; each after the first is a reconnect */
+	unsigned long long connects;
+	/** Connections lost, rather than closed by MQTTClient_disconnect() */
+	unsigned long long connectionsLost;
+	/** Messages and queued messages restored from persistence when the client was created */
+	unsigned long long restored;
+	/** The time taken to restore them, in microseconds */
+	unsigned long long restoreTime;
+	/** Messages appended to the spool */
+	unsigned long long spooled;
+	/** Spooled messages dropped to keep the spool within its size limit */
+	unsigned long long spoolEvicted;
+	/** Spooled messages dropped because they were older than its age limit */
+	unsigned long long spoolExpired;
+	/** Bytes in the segment files of the spool now */
+	unsigned long long spoolBytes;
+	/** Outbound QoS 1 and 2 messages in flight now */
+	int inflightOut;
+	/** Inbound QoS 2 messages waiting for PUBREL now */
+	int inflightIn;
+	/** Received messages not yet taken by MQTTClient_receive() or the message arrived callback */
+	int queued;
+	/** The number of messages allowed in flight now, adapted to the link */
+	int window;
+	/** The smoothed round trip time to an acknowledgement, in microseconds */
+	int srtt;
+	/** The current retry timeout, in milliseconds */
+	int rto;
+	/** Latencies from PUBLISH to PUBACK of QoS 1 messages, including any retries */
+	MQTTClient_histogram qos1Latency;
+	/** Latencies from PUBLISH to PUBCOMP of QoS 2 messages, including any retries */
+	MQTTClient_histogram qos2Latency;
+	/** Latencies from CONNECT to CONNACK */
+	MQTTClient_histogram connectLatency;
+	/** Latencies from PINGREQ to PINGRESP */
+	MQTTClient_histogram pingLatency;
+	/** Latencies of persisting PUBLISH and PUBREL packets before they are sent, or received
+	  * QoS 2 messages, including any sync the durability of the persistence asks for */
+	MQTTClient_histogram persistLatency;
+} MQTTClient_stats;
+
+/**
+  * This function takes a snapshot of the counters and latency histograms of a
+  * client.  It does not take the client lock, so it can be called as often as
+  * wanted from a monitoring thread without delaying the protocol flows; each
+  * value is read atomically, but values updated while the snapshot is taken
+  * may be from just before or just after the update.
+  * @param handle A valid client handle from a successful call to 
+  * MQTTClient_create(). 
+  * @param stats The structure to fill in.
+  * @return ::MQTTCLIENT_SUCCESS, or ::MQTTCLIENT_FAILURE if a parameter is NULL.
+  */
+DLLExport int MQTTClient_getStats(MQTTClient handle, MQTTClient_stats* stats);
+
+/**
+  * This function finds a percentile of the latencies in a histogram.
+  * @param histogram The histogram, from MQTTClient_getStats().
+  * @param percentile The percentile, from 0 to 100; 50 gives the median.
+  * @return The latency in microseconds which at least that percentage of the
+  * latencies recorded do not exceed, to within the width of a bucket, or 0 if
+  * none have been recorded.
+  */
+DLLExport unsigned long long MQTTClient_histogramPercentile(const MQTTClient_histogram* histogram, double percentile);
+
 /**
   * When implementing a single-threaded client, call this function periodically
   * to allow processing of message retries and to send MQTT keepalive pings.
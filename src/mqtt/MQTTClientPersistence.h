@@ -73,6 +73,28 @@
   * persistence mechanism (see MQTTClient_create()).
   */
 #define MQTTCLIENT_PERSISTENCE_USER 2
+/**
+  * This <i>persistence_type</i> value specifies the log-structured file
+  * system-based persistence mechanism (see MQTTClient_create()), which appends
+  * every put and remove to a log rather than writing a file for each message.
+  * Its context is an ::MQTTClient_logPersistenceOptions structure.
+  */
+#define MQTTCLIENT_PERSISTENCE_LOG 3
+/**
+  * This <i>persistence_type</i> value specifies the memory-mapped persistence
+  * mechanism (see MQTTClient_create()), which keeps in-flight messages in
+  * the slots of one file mapped into memory, for gateways whose persistence
+  * directory is on tmpfs or battery-backed RAM.  Its context is an
+  * ::MQTTClient_mmapPersistenceOptions structure.
+  */
+#define MQTTCLIENT_PERSISTENCE_MMAP 4
+/**
+  * This <i>persistence_type</i> value specifies the default file system-based
+  * persistence mechanism with a choice of how durable the files written for
+  * the messages are (see MQTTClient_create()).  Its context is an
+  * ::MQTTClient_defaultPersistenceOptions structure.
+  */
+#define MQTTCLIENT_PERSISTENCE_DURABLE 5
 
 /** 
   * Application-specific persistence functions must return this error code if 
@@ -80,6 +102,110 @@
   */
 #define MQTTCLIENT_PERSISTENCE_ERROR -2
 
+/**
+  * The options of the ::MQTTCLIENT_PERSISTENCE_LOG persistence mechanism,
+  * passed as the <i>persistence_context</i> of MQTTClient_create().  The log
+  * is written to a directory beneath the persistence directory, in segment
+  * files; a segment is deleted when nothing in it is needed any longer, and
+  * the data still needed is copied out of the oldest segment when most of the
+  * data in the log is no longer needed.
+  */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQLP. */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0. */
+	int struct_version;
+	/** The persistence directory, or NULL for the working directory. */
+	const char* directory;
+	/** The size in bytes after which the next segment of the log is started,
+	  * or 0 for 1MB. */
+	int segmentSize;
+	/** The longest time in milliseconds a put may wait to be written to the
+	  * log in one write with others.  The default of 0 writes each put before
+	  * the message is sent, in which case removes wait up to 100ms to be
+	  * written with a put. */
+	int commitInterval;
+	/** Boolean: fdatasync() the log after each write, so that what was
+	  * written survives a power cut. */
+	int sync;
+} MQTTClient_logPersistenceOptions;
+
+#define MQTTClient_logPersistenceOptions_initializer { {'M', 'Q', 'L', 'P'}, 0, NULL, 0, 0, 0 }
+
+/**
+  * The options of the ::MQTTCLIENT_PERSISTENCE_MMAP persistence mechanism,
+  * passed as the <i>persistence_context</i> of MQTTClient_create().  The file
+  * holds a slot for each message id of sent PUBLISH packets, sent PUBREL
+  * packets and received QoS 2 PUBLISH packets.  Messages which do not fit in
+  * a slot, and records other than these, are written to files as by the
+  * default persistence mechanism.  The sizes of an existing file are kept.
+  */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQMP. */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0. */
+	int struct_version;
+	/** The persistence directory, or NULL for the working directory. */
+	const char* directory;
+	/** The number of slots for each kind of record, or 0 for 64.  This should
+	  * be at least maxInflightMessages. */
+	int slots;
+	/** The largest packet in bytes a slot holds, or 0 for 1024. */
+	int slotSize;
+} MQTTClient_mmapPersistenceOptions;
+
+#define MQTTClient_mmapPersistenceOptions_initializer { {'M', 'Q', 'M', 'P'}, 0, NULL, 0, 0 }
+
+/**
+  * This durability value leaves persisted messages to be written out by the
+  * operating system, as the default persistence always has: fastest, but
+  * messages persisted shortly before a power cut may be lost.
+  */
+#define MQTTCLIENT_PERSISTENCE_ASYNC 0
+/**
+  * This durability value syncs persisted messages to the device in batches,
+  * after an interval or a number of messages, whichever comes first, so that
+  * at most that much may be lost in a power cut.
+  */
+#define MQTTCLIENT_PERSISTENCE_INTERVAL 1
+/**
+  * This durability value syncs each persisted message to the device before
+  * the packet it records is sent, so that no message acknowledged as
+  * persisted is lost in a power cut.
+  */
+#define MQTTCLIENT_PERSISTENCE_STRICT 2
+
+/**
+  * The options of the ::MQTTCLIENT_PERSISTENCE_DURABLE persistence mechanism,
+  * passed as the <i>persistence_context</i> of MQTTClient_create(), to choose
+  * how durable the files written for the messages are.  A remove is not synced on its own,
+  * as losing one only means a message is sent again; it is made durable by
+  * the next sync.  The ::MQTTCLIENT_PERSISTENCE_LOG persistence mechanism
+  * makes the same choice with its commitInterval and sync options.
+  */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQDP. */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0. */
+	int struct_version;
+	/** The persistence directory, or NULL for the working directory. */
+	const char* directory;
+	/** ::MQTTCLIENT_PERSISTENCE_ASYNC, ::MQTTCLIENT_PERSISTENCE_INTERVAL or
+	  * ::MQTTCLIENT_PERSISTENCE_STRICT. */
+	int durability;
+	/** For ::MQTTCLIENT_PERSISTENCE_INTERVAL, the longest time in milliseconds
+	  * a persisted message may wait to be synced, or 0 for 100ms. */
+	int syncInterval;
+	/** For ::MQTTCLIENT_PERSISTENCE_INTERVAL, the number of persisted messages
+	  * which are synced together without waiting for the interval, or 0 for 32. */
+	int syncRecords;
+} MQTTClient_defaultPersistenceOptions;
+
+#define MQTTClient_defaultPersistenceOptions_initializer { {'M', 'Q', 'D', 'P'}, 0, NULL, MQTTCLIENT_PERSISTENCE_ASYNC, 0, 0 }
+
 /**
   * @brief Initialize the persistent store.
   * 
@@ -103,6 +103,58 @@ pf new_packets[] =
 };
 
 
+/**
+ * Header in front of each decoded packet, recording where its storage came from
+ */
+typedef union
+{
+	PacketArena* arena;	/**< the arena holding the packet, or NULL if it was allocated from the heap */
+	double align;		/**< keeps the packet structure which follows aligned */
+} PacketStorage;
+
+
+/**
+ * Allocate the storage for a decoded packet, from the arena of its connection if there is room.
+ * Used by the functions in the new packets table.
+ * @param arena the arena of the connection the packet was read from, or NULL to use the heap
+ * @param size the size of the packet structure, including any data copied in after it
+ * @return pointer to the packet storage, or NULL if none could be allocated
+ */
+void* MQTTPacket_alloc(PacketArena* arena, size_t size)
+{
+	PacketStorage* storage = NULL;
+	size_t total = sizeof(PacketStorage) + size;
+
+	total = (total + sizeof(PacketStorage) - 1) / sizeof(PacketStorage) * sizeof(PacketStorage);
+	if (arena && arena->used + total <= sizeof(arena->block))
+	{
+		storage = (PacketStorage*)((char*)arena->block + arena->used);
+		arena->used += total;
+		++arena->live;
+		storage->arena = arena;
+	}
+	else if ((storage = malloc(total)) != NULL)
+		storage->arena = NULL;
+	return (storage == NULL) ? NULL : storage + 1;
+}
+
+
+/**
+ * Free the storage of a decoded packet.  The space in an arena is reclaimed all at once, when
+ * the last packet allocated from it is freed.
+ * @param pack pointer to the packet structure
+ */
+static void MQTTPacket_release(void* pack)
+{
+	PacketStorage* storage = (PacketStorage*)pack - 1;
+
+	if (storage->arena == NULL)
+		free(storage);
+	else if (--(storage->arena->live) == 0)
+		storage->arena->used = 0;
+}
+
+
 /**
  * Reads one MQTT packet from a socket.
  * @param socket a socket from which to read an MQTT packet
@@ -156,7 +208,7 @@ void* MQTTPacket_Factory(networkHandles* net, int* error)	//-
 			Log(TRACE_MIN, 2, NULL, ptype);
 		else
 		{
-			if ((pack = (*new_packets[ptype])(header.byte, data, remaining_length)) == NULL)
+			if ((pack = (*new_packets[ptype])(&net->arena, header.byte, data, remaining_length)) == NULL)
 				*error = BAD_MQTT_PACKET;
 #if !defined(NO_PERSISTENCE)
 			else if (header.bits.type == PUBLISH && header.bits.qos == 2)
@@ -174,7 +226,12 @@ void* MQTTPacket_Factory(networkHandles* net, int* error)	//-
 		}
 	}
 	if (pack)
-		time(&(net->lastReceived));
+	{
+		char lenbuf[4];
+
+		net->lastReceived = Timer_now();
+		Clients_addStat(net->bytesReceived, 1 + MQTTPacket_encode(lenbuf, remaining_length) + remaining_length);
+	}
 exit:
 	FUNC_EXIT_RC(*error);
 	return pack;
@@ -216,7 +273,9 @@ int MQTTPacket_send(networkHandles* net, Header header, char* buffer, size_t buf
 		rc = Socket_putdatas(net->socket, buf, buf0len, 1, &buffer, &buflen, &free);	//-ʵݷ
 		
 	if (rc == TCPSOCKET_COMPLETE)
-		time(&(net->lastSent));		//-¼һη͵ʱ
+		net->lastSent = Timer_now();		//-¼һη͵ʱ
+	if (rc != SOCKET_ERROR)
+		Clients_addStat(net->bytesSent, buf0len + buflen);
 	
 	if (rc != TCPSOCKET_INTERRUPTED)
 	  free(buf);	//-˿ռͿͷ
@@ -263,7 +322,9 @@ int MQTTPacket_sends(networkHandles* net, Header header, int count, char** buffe
 		rc = Socket_putdatas(net->socket, buf, buf0len, count, buffers, buflens, frees);
 		
 	if (rc == TCPSOCKET_COMPLETE)
-		time(&(net->lastSent));
+		net->lastSent = Timer_now();
+	if (rc != SOCKET_ERROR)
+		Clients_addStat(net->bytesSent, buf0len + total);
 	
 	if (rc != TCPSOCKET_INTERRUPTED)
 	  free(buf);
@@ -455,12 +516,13 @@ void writeUTF(char** pptr, const char* string)	//-
 
 /**
  * Function used in the new packets table to create packets which have only a header.
+ * @param arena not used, as the header is held statically
  * @param aHeader the MQTT header byte
  * @param data the rest of the packet
  * @param datalen the length of the rest of the packet
  * @return pointer to the packet structure
  */
-void* MQTTPacket_header_only(unsigned char aHeader, char* data, size_t datalen)	//-˺ʵһģ鹦
+void* MQTTPacket_header_only(PacketArena* arena, unsigned char aHeader, char* data, size_t datalen)	//-˺ʵһģ鹦
 {
 	static unsigned char header = 0;
 	header = aHeader;
@@ -489,32 +551,41 @@ int MQTTPacket_send_disconnect(networkHandles *net, const char* clientID)	//-
 
 
 /**
- * Function used in the new packets table to create publish packets.
+ * Function used in the new packets table to create publish packets.  The topic is copied in
+ * after the packet structure, while the payload is left where it is in the data read.
+ * @param arena the arena to allocate the packet from, or NULL to use the heap
  * @param aHeader the MQTT header byte
  * @param data the rest of the packet
  * @param datalen the length of the rest of the packet
  * @return pointer to the packet structure
  */
-void* MQTTPacket_publish(unsigned char aHeader, char* data, size_t datalen)	//-
+void* MQTTPacket_publish(PacketArena* arena, unsigned char aHeader, char* data, size_t datalen)	//-
 {
-	Publish* pack = malloc(sizeof(Publish));
+	Publish* pack = NULL;
 	char* curdata = data;
 	char* enddata = &data[datalen];
+	int topiclen;
 
 	FUNC_ENTRY;
-	pack->header.byte = aHeader;
-	if ((pack->topic = readUTFlen(&curdata, enddata, &pack->topiclen)) == NULL) /* Topic name on which to publish */
-	{
-		free(pack);
-		pack = NULL;
+	if (datalen < 2)
 		goto exit;
-	}
+	topiclen = readInt(&curdata); /* Topic name on which to publish */
+	if (&curdata[topiclen] > enddata || (pack = MQTTPacket_alloc(arena, sizeof(Publish) + topiclen + 1)) == NULL)
+		goto exit;
+	pack->header.byte = aHeader;
+	pack->topic = (char*)(pack + 1);
+	memcpy(pack->topic, curdata, topiclen);
+	pack->topic[topiclen] = '\0';
+	pack->topiclen = topiclen;
+	curdata += topiclen;
 	if (pack->header.bits.qos > 0)  /* Msgid only exists for QoS 1 or 2 */
 		pack->msgId = readInt(&curdata);
 	else
 		pack->msgId = 0;
 	pack->payload = curdata;
 	pack->payloadlen = datalen-(curdata-data);
+	pack->prepared = NULL;
+	pack->shared = 0;
 exit:
 	FUNC_EXIT;
 	return pack;
@@ -522,15 +593,13 @@ exit:
 
 
 /**
- * Free allocated storage for a publish packet.
+ * Free allocated storage for a publish packet.  The topic is part of the same storage.
  * @param pack pointer to the publish packet structure
  */
 void MQTTPacket_freePublish(Publish* pack)
 {
 	FUNC_ENTRY;
-	if (pack->topic != NULL)
-		free(pack->topic);
-	free(pack);
+	MQTTPacket_release(pack);
 	FUNC_EXIT;
 }
 
@@ -592,7 +661,7 @@ void MQTTPacket_freeSuback(Suback* pack)	//-
 	FUNC_ENTRY;
 	if (pack->qoss != NULL)
 		ListFree(pack->qoss);
-	free(pack);
+	MQTTPacket_release(pack);
 	FUNC_EXIT;
 }
 
@@ -657,24 +726,109 @@ int MQTTPacket_send_pubcomp(int msgid, networkHandles* net, const char* clientID
 
 /**
  * Function used in the new packets table to create acknowledgement packets.
+ * @param arena the arena to allocate the packet from, or NULL to use the heap
  * @param aHeader the MQTT header byte
  * @param data the rest of the packet
  * @param datalen the length of the rest of the packet
  * @return pointer to the packet structure
  */
-void* MQTTPacket_ack(unsigned char aHeader, char* data, size_t datalen)
+void* MQTTPacket_ack(PacketArena* arena, unsigned char aHeader, char* data, size_t datalen)
 {
-	Ack* pack = malloc(sizeof(Ack));
+	Ack* pack = MQTTPacket_alloc(arena, sizeof(Ack));
 	char* curdata = data;
 
 	FUNC_ENTRY;
-	pack->header.byte = aHeader;
-	pack->msgId = readInt(&curdata);
+	if (pack != NULL)
+	{
+		pack->header.byte = aHeader;
+		pack->msgId = readInt(&curdata);
+	}
 	FUNC_EXIT;
 	return pack;
 }
 
 
+/**
+ * Encode a topic for publishing to repeatedly, so that sending each PUBLISH only has to fill in
+ * the fixed header and msgid.  The topic must have been validated already.
+ * @param topicName the topic string
+ * @return the prepared topic, freed with free(), or NULL if the topic is too long
+ */
+PreparedTopic* MQTTPacket_prepareTopic(const char* topicName)
+{
+	PreparedTopic* prepared = NULL;
+	size_t len = strlen(topicName);
+	char* ptr;
+
+	FUNC_ENTRY;
+	if (len > 65535 || (prepared = malloc(sizeof(PreparedTopic) + len + 3)) == NULL)
+		goto exit;
+	ptr = prepared->encoded = (char*)(prepared + 1);
+	prepared->encodedlen = (int)len + 2;
+	writeUTF(&ptr, topicName);
+	*ptr = '\0';
+	prepared->topic = prepared->encoded + 2;
+exit:
+	FUNC_EXIT;
+	return prepared;
+}
+
+
+/**
+ * Send an MQTT PUBLISH packet to a prepared topic down a socket.  The fixed header, encoded
+ * topic and msgid are put together in one buffer, so the packet is written from two buffers.
+ * @param pack a structure from which to get some values to use, e.g prepared topic, payload
+ * @param dup boolean - whether to set the MQTT DUP flag
+ * @param qos the value to use for the MQTT QoS setting
+ * @param retained boolean - whether to set the MQTT retained flag
+ * @param net the network handle to send the data to
+ * @return the completion code (e.g. TCPSOCKET_COMPLETE)
+ */
+static int MQTTPacket_send_prepared(Publish* pack, int dup, int qos, int retained, networkHandles* net)
+{
+	Header header;
+	PreparedTopic* prepared = pack->prepared;
+	char *buf, *ptr;
+	size_t buflen, payloadlen = pack->payloadlen;
+	int rc, frees = 0;
+
+	FUNC_ENTRY;
+	header.byte = 0;
+	header.bits.type = PUBLISH;
+	header.bits.dup = dup;
+	header.bits.qos = qos;
+	header.bits.retain = retained;
+	ptr = buf = malloc(5 + prepared->encodedlen + 2);
+	writeChar(&ptr, header.byte);
+	ptr += MQTTPacket_encode(ptr, prepared->encodedlen + ((qos > 0) ? 2 : 0) + pack->payloadlen);
+	memcpy(ptr, prepared->encoded, prepared->encodedlen);
+	ptr += prepared->encodedlen;
+	if (qos > 0)
+		writeInt(&ptr, pack->msgId);
+	buflen = ptr - buf;
+#if !defined(NO_PERSISTENCE)
+	if (qos > 0)
+		rc = MQTTPersistence_put(net->socket, buf, buflen, 1, &pack->payload, &payloadlen, PUBLISH, pack->msgId, 0);
+#endif
+#if defined(OPENSSL)
+	if (net->ssl)
+		rc = SSLSocket_putdatas(net->ssl, net->socket, buf, buflen, 1, &pack->payload, &payloadlen, &frees);
+	else
+#endif
+		rc = Socket_putdatas(net->socket, buf, buflen, 1, &pack->payload, &payloadlen, &frees);
+
+	if (rc == TCPSOCKET_COMPLETE)
+		net->lastSent = Timer_now();
+	if (rc != SOCKET_ERROR)
+		Clients_addStat(net->bytesSent, buflen + payloadlen);
+
+	if (rc != TCPSOCKET_INTERRUPTED)
+		free(buf);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
 /**
  * Send an MQTT PUBLISH packet down a socket.
  * @param pack a structure from which to get some values to use, e.g topic, payload
@@ -692,6 +846,11 @@ int MQTTPacket_send_publish(Publish* pack, int dup, int qos, int retained, netwo
 	int rc = -1;
 
 	FUNC_ENTRY;
+	if (pack->prepared)
+	{
+		rc = MQTTPacket_send_prepared(pack, dup, qos, retained, net);
+		goto exit;
+	}
 	topiclen = malloc(2);
 
 	header.bits.type = PUBLISH;
@@ -725,6 +884,7 @@ int MQTTPacket_send_publish(Publish* pack, int dup, int qos, int retained, netwo
 	}
 	if (rc != TCPSOCKET_INTERRUPTED)
 		free(topiclen);
+exit:
 	if (qos == 0)
 		Log(LOG_PROTOCOL, 27, NULL, net->socket, clientID, retained, rc);
 	else
@@ -737,18 +897,20 @@ int MQTTPacket_send_publish(Publish* pack, int dup, int qos, int retained, netwo
 
 /**
  * Free allocated storage for a various packet tyoes
- * @param pack pointer to the suback packet structure
+ * @param pack pointer to the packet structure, as returned by one of the new packets functions
  */
 void MQTTPacket_free_packet(MQTTPacket* pack)	//-ͷ֡ʲô˼
 {
 	FUNC_ENTRY;
 	if (pack->header.bits.type == PUBLISH)
 		MQTTPacket_freePublish((Publish*)pack);
+	else if (pack->header.bits.type == SUBACK)
+		MQTTPacket_freeSuback((Suback*)pack);
 	/*else if (pack->header.type == SUBSCRIBE)
 		MQTTPacket_freeSubscribe((Subscribe*)pack, 1);
 	else if (pack->header.type == UNSUBSCRIBE)
 		MQTTPacket_freeUnsubscribe((Unsubscribe*)pack);*/
 	else
-		free(pack);
+		MQTTPacket_release(pack);
 	FUNC_EXIT;
 }
@@ -33,7 +33,7 @@ include "Clients"
 BE*/
 
 typedef unsigned int bool;
-typedef void* (*pf)(unsigned char, char*, size_t);
+typedef void* (*pf)(PacketArena*, unsigned char, char*, size_t);
 
 #define BAD_MQTT_PACKET -4
 
@@ -187,6 +187,18 @@ typedef struct
 } Unsubscribe;
 
 
+/**
+ * A topic whose part of a PUBLISH packet has been encoded in advance, for topics which are
+ * published to repeatedly.
+ */
+typedef struct
+{
+	char* topic;		/**< topic string, within encoded */
+	char* encoded;		/**< the topic with its length prefix, as it appears in the packet */
+	int encodedlen;		/**< length of encoded */
+} PreparedTopic;
+
+
 /**
  * Data for a publish packet.
  */
@@ -198,6 +210,8 @@ typedef struct
 	int msgId;		/**< MQTT message id */
 	char* payload;	/**< binary payload, length delimited */
 	int payloadlen;	/**< payload length */
+	PreparedTopic* prepared;	/**< the encoded topic, for outgoing publishes to a prepared topic, or NULL */
+	int shared;		/**< payload is a reference counted buffer, which is stored without copying */
 } Publish;	//-Ϊһķ֡
 
 
@@ -231,20 +245,22 @@ void* MQTTPacket_Factory(networkHandles* net, int* error);
 int MQTTPacket_send(networkHandles* net, Header header, char* buffer, size_t buflen, int free);
 int MQTTPacket_sends(networkHandles* net, Header header, int count, char** buffers, size_t* buflens, int* frees);
 
-void* MQTTPacket_header_only(unsigned char aHeader, char* data, size_t datalen);
+void* MQTTPacket_header_only(PacketArena* arena, unsigned char aHeader, char* data, size_t datalen);
 int MQTTPacket_send_disconnect(networkHandles* net, const char* clientID);
 
-void* MQTTPacket_publish(unsigned char aHeader, char* data, size_t datalen);
+void* MQTTPacket_publish(PacketArena* arena, unsigned char aHeader, char* data, size_t datalen);
 void MQTTPacket_freePublish(Publish* pack);
 int MQTTPacket_send_publish(Publish* pack, int dup, int qos, int retained, networkHandles* net, const char* clientID);
+PreparedTopic* MQTTPacket_prepareTopic(const char* topicName);
 int MQTTPacket_send_puback(int msgid, networkHandles* net, const char* clientID);
-void* MQTTPacket_ack(unsigned char aHeader, char* data, size_t datalen);
+void* MQTTPacket_ack(PacketArena* arena, unsigned char aHeader, char* data, size_t datalen);
 
 void MQTTPacket_freeSuback(Suback* pack);
 int MQTTPacket_send_pubrec(int msgid, networkHandles* net, const char* clientID);
 int MQTTPacket_send_pubrel(int msgid, int dup, networkHandles* net, const char* clientID);
 int MQTTPacket_send_pubcomp(int msgid, networkHandles* net, const char* clientID);
 
+void* MQTTPacket_alloc(PacketArena* arena, size_t size);
 void MQTTPacket_free_packet(MQTTPacket* pack);
 
 #if !defined(NO_BRIDGE)
@@ -131,6 +131,7 @@ int MQTTPacket_send_connect(Clients* client, int MQTTVersion)	//-
 	if (client->password)
 		writeUTF(&ptr, client->password);
 	//-дЭ,ӦÿԴMQTTЭıҵ
+	client->connectSent = Timer_nowMicros();
 	rc = MQTTPacket_send(&client->net, packet.header, buf, len, 1);
 	Log(LOG_PROTOCOL, 0, NULL, client->net.socket, client->clientID, client->cleansession, rc);
 exit:
@@ -143,20 +144,24 @@ exit:
 
 /**
  * Function used in the new packets table to create connack packets.
+ * @param arena the arena to allocate the packet from, or NULL to use the heap
  * @param aHeader the MQTT header byte
  * @param data the rest of the packet
  * @param datalen the length of the rest of the packet
  * @return pointer to the packet structure
  */
-void* MQTTPacket_connack(unsigned char aHeader, char* data, size_t datalen)	//-ȷ
+void* MQTTPacket_connack(PacketArena* arena, unsigned char aHeader, char* data, size_t datalen)	//-ȷ
 {//-ָ϶ǲҪͻ˷ͳȥ,˵Ϳͻʹõͬһ
-	Connack* pack = malloc(sizeof(Connack));
+	Connack* pack = MQTTPacket_alloc(arena, sizeof(Connack));
 	char* curdata = data;
 
 	FUNC_ENTRY;
-	pack->header.byte = aHeader;
-	pack->flags.all = readChar(&curdata);
-	pack->rc = readChar(&curdata);
+	if (pack != NULL)
+	{
+		pack->header.byte = aHeader;
+		pack->flags.all = readChar(&curdata);
+		pack->rc = readChar(&curdata);
+	}
 	FUNC_EXIT;
 	return pack;
 }
@@ -257,17 +262,20 @@ int MQTTPacket_send_subscribe(List* topics, List* qoss, int msgid, int dup, netw
 
 /**
  * Function used in the new packets table to create suback packets.
+ * @param arena the arena to allocate the packet from, or NULL to use the heap
  * @param aHeader the MQTT header byte
  * @param data the rest of the packet
  * @param datalen the length of the rest of the packet
  * @return pointer to the packet structure
  */
-void* MQTTPacket_suback(unsigned char aHeader, char* data, size_t datalen)	//-ȷ
+void* MQTTPacket_suback(PacketArena* arena, unsigned char aHeader, char* data, size_t datalen)	//-ȷ
 {//-пҲ˷ĳ,ֻ涼ǰտͻ˵,ǿͳһ
-	Suback* pack = malloc(sizeof(Suback));
+	Suback* pack = MQTTPacket_alloc(arena, sizeof(Suback));
 	char* curdata = data;
 
 	FUNC_ENTRY;
+	if (pack == NULL)
+		goto exit;
 	pack->header.byte = aHeader;
 	pack->msgId = readInt(&curdata);
 	pack->qoss = ListInitialize();	//-ΪӦһµ֡
@@ -278,6 +286,7 @@ void* MQTTPacket_suback(unsigned char aHeader, char* data, size_t datalen)	//-
 		*newint = (int)readChar(&curdata);	//?һֽʲô˼
 		ListAppend(pack->qoss, newint, sizeof(int));	//?һֽһֽʲô˼
 	}
+exit:
 	FUNC_EXIT;
 	return pack;
 }
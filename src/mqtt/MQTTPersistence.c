@@ -23,11 +23,15 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "MQTTPersistence.h"
 #include "MQTTPersistenceDefault.h"
 #include "MQTTProtocolClient.h"
+#include "MQTTPersistenceLog.h"
+#include "MQTTPersistenceMmap.h"
+#include "MQTTPersistenceSync.h"
 #include "Heap.h"
 
 
@@ -76,6 +80,77 @@ int MQTTPersistence_create(MQTTClient_persistence** persistence, int type, void*
 			else
 				rc = MQTTCLIENT_PERSISTENCE_ERROR;
 			break;
+#if !defined(WIN32) && !defined(WIN64)
+		case MQTTCLIENT_PERSISTENCE_LOG :
+			per = malloc(sizeof(MQTTClient_persistence));
+			if ( per != NULL && (per->context = MQTTPersistenceLog_copyOptions(pcontext)) != NULL )
+			{
+				per->popen        = MQTTPersistenceLog_open;
+				per->pclose       = MQTTPersistenceLog_close;
+				per->pput         = MQTTPersistenceLog_put;
+				per->pget         = MQTTPersistenceLog_get;
+				per->premove      = MQTTPersistenceLog_remove;
+				per->pkeys        = MQTTPersistenceLog_keys;
+				per->pclear       = MQTTPersistenceLog_clear;
+				per->pcontainskey = MQTTPersistenceLog_containskey;
+			}
+			else
+			{
+				if ( per != NULL )
+				{
+					free(per);
+					per = NULL;
+				}
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			}
+			break;
+		case MQTTCLIENT_PERSISTENCE_MMAP :
+			per = malloc(sizeof(MQTTClient_persistence));
+			if ( per != NULL && (per->context = MQTTPersistenceMmap_copyOptions(pcontext)) != NULL )
+			{
+				per->popen        = MQTTPersistenceMmap_open;
+				per->pclose       = MQTTPersistenceMmap_close;
+				per->pput         = MQTTPersistenceMmap_put;
+				per->pget         = MQTTPersistenceMmap_get;
+				per->premove      = MQTTPersistenceMmap_remove;
+				per->pkeys        = MQTTPersistenceMmap_keys;
+				per->pclear       = MQTTPersistenceMmap_clear;
+				per->pcontainskey = MQTTPersistenceMmap_containskey;
+			}
+			else
+			{
+				if ( per != NULL )
+				{
+					free(per);
+					per = NULL;
+				}
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			}
+			break;
+		case MQTTCLIENT_PERSISTENCE_DURABLE :
+			per = malloc(sizeof(MQTTClient_persistence));
+			if ( per != NULL && (per->context = MQTTPersistenceSync_copyOptions(pcontext)) != NULL )
+			{
+				per->popen        = MQTTPersistenceSync_open;
+				per->pclose       = MQTTPersistenceSync_close;
+				per->pput         = MQTTPersistenceSync_put;
+				per->pget         = MQTTPersistenceSync_get;
+				per->premove      = MQTTPersistenceSync_remove;
+				per->pkeys        = MQTTPersistenceSync_keys;
+				per->pclear       = MQTTPersistenceSync_clear;
+				per->pcontainskey = MQTTPersistenceSync_containskey;
+			}
+			else
+			{
+				if ( per != NULL )
+				{
+					free(per);
+					per = NULL;
+				}
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			}
+			break;
+#endif
 		case MQTTCLIENT_PERSISTENCE_USER :	//-ûָ˴洢ָ
 			per = (MQTTClient_persistence *)pcontext;
 			if ( per == NULL || (per != NULL && (per->context == NULL || per->pclear == NULL ||
@@ -136,6 +211,14 @@ int MQTTPersistence_close(Clients *c)	//-
 #if !defined(NO_PERSISTENCE)
 		if ( c->persistence->popen == pstopen )
 			free(c->persistence);
+#if !defined(WIN32) && !defined(WIN64)
+		else if ( c->persistence->popen == MQTTPersistenceLog_open || c->persistence->popen == MQTTPersistenceMmap_open ||
+				c->persistence->popen == MQTTPersistenceSync_open )
+		{
+			free(c->persistence->context);
+			free(c->persistence);
+		}
+#endif
 #endif
 		c->persistence = NULL;
 	}
@@ -162,6 +245,52 @@ int MQTTPersistence_clear(Clients *c)	//-
 }
 
 
+/**
+ * Orders persistence keys by their prefix, and then by the number after it rather than its
+ * digits, so that sorting the keys once puts each kind of record in message id or sequence
+ * number order
+ */
+static int MQTTPersistence_keyCompare(const void* a, const void* b)
+{
+	const char* ka = *(char* const*)a;
+	const char* kb = *(char* const*)b;
+	size_t la = strcspn(ka, "0123456789");
+	size_t lb = strcspn(kb, "0123456789");
+
+	if (la == lb && strncmp(ka, kb, la) == 0)
+	{
+		long na = atol(ka + la), nb = atol(kb + lb);
+
+		if (na != nb)
+			return (na < nb) ? -1 : 1;
+	}
+	return strcmp(ka, kb);
+}
+
+
+/**
+ * Whether a key is among keys sorted by MQTTPersistence_keyCompare(), without asking the
+ * persistence, which may mean a system call
+ */
+static int MQTTPersistence_findKey(char** keys, int nkeys, char* key)
+{
+	return bsearch(&key, keys, nkeys, sizeof(char*), MQTTPersistence_keyCompare) != NULL;
+}
+
+
+/**
+ * Count restored messages and the time taken to restore them in the statistics of the client
+ * @param c the client as ::Clients
+ * @param count the number of messages restored
+ * @param start when restoring started
+ */
+static void MQTTPersistence_restored(Clients* c, int count, ustime_type start)
+{
+	Clients_addStat(c->stats.restored, count);
+	Clients_addStat(c->stats.restoreTime, Timer_nowMicros() - start);
+}
+
+
 /**
  * Restores the persisted records to the outbound and inbound message queues of the
  * client.
@@ -177,10 +306,14 @@ int MQTTPersistence_restore(Clients *c)	//-
 	int i = 0;
 	int msgs_sent = 0;
 	int msgs_rcvd = 0;
+	ustime_type start = Timer_nowMicros();
 
 	FUNC_ENTRY;
 	if (c->persistence && (rc = c->persistence->pkeys(c->phandle, &msgkeys, &nkeys)) == 0)
 	{
+		/* sorted once, so that each message can be appended to its queue in message id order */
+		if (nkeys > 1)
+			qsort(msgkeys, nkeys, sizeof(char*), MQTTPersistence_keyCompare);
 		while (rc == 0 && i < nkeys)
 		{
 			if (strncmp(msgkeys[i], PERSISTENCE_COMMAND_KEY, strlen(PERSISTENCE_COMMAND_KEY)) == 0)
@@ -200,7 +333,6 @@ int MQTTPersistence_restore(Clients *c)	//-
 						msg->nextMessageType = PUBREL;
 						/* order does not matter for persisted received messages */
 						ListAppend(c->inboundMsgs, msg, msg->len);
-						publish->topic = NULL;
 						MQTTPacket_freePublish(publish);
 						msgs_rcvd++;
 					}
@@ -211,14 +343,13 @@ int MQTTPersistence_restore(Clients *c)	//-
 						char *key = malloc(MESSAGE_FILENAME_LENGTH + 1);
 						sprintf(key, "%s%d", PERSISTENCE_PUBREL, publish->msgId);
 						msg = MQTTProtocol_createMessage(publish, &msg, publish->header.bits.qos, publish->header.bits.retain);
-						if ( c->persistence->pcontainskey(c->phandle, key) == 0 )
+						if ( MQTTPersistence_findKey(msgkeys, nkeys, key) )
 							/* PUBLISH Qo2 and PUBREL sent */
 							msg->nextMessageType = PUBCOMP;
 						/* else: PUBLISH QoS1, or PUBLISH QoS2 and PUBREL not sent */
 						/* retry at the first opportunity */
 						msg->lastTouch = 0;
-						MQTTPersistence_insertInOrder(c->outboundMsgs, msg, msg->len);
-						publish->topic = NULL;
+						ListAppend(c->outboundMsgs, msg, msg->len);	/* the keys are in message id order */
 						MQTTPacket_freePublish(publish);
 						free(key);
 						msgs_sent++;
@@ -229,9 +360,9 @@ int MQTTPersistence_restore(Clients *c)	//-
 						Pubrel* pubrel = (Pubrel*)pack;
 						char *key = malloc(MESSAGE_FILENAME_LENGTH + 1);
 						sprintf(key, "%s%d", PERSISTENCE_PUBLISH_SENT, pubrel->msgId);
-						if ( c->persistence->pcontainskey(c->phandle, key) != 0 )
+						if ( !MQTTPersistence_findKey(msgkeys, nkeys, key) )
 							rc = c->persistence->premove(c->phandle, msgkeys[i]);
-						free(pubrel);
+						MQTTPacket_free_packet(pack);
 						free(key);
 					}
 				}
@@ -243,16 +374,18 @@ int MQTTPersistence_restore(Clients *c)	//-
 				free(buffer);
 				buffer = NULL;
 			}
-			if (msgkeys[i])
-				free(msgkeys[i]);
 			i++;
 		}
+		for (i = 0; i < nkeys; ++i)
+			free(msgkeys[i]);	/* only now, as they are searched until the end */
 		if (msgkeys)
 			free(msgkeys);
 	}
-	Log(TRACE_MINIMUM, -1, "%d sent messages and %d received messages restored for client %s\n", 
-		msgs_sent, msgs_rcvd, c->clientID);
 	MQTTPersistence_wrapMsgID(c);
+	MQTTProtocol_indexMessages(c);
+	MQTTPersistence_restored(c, msgs_sent + msgs_rcvd, start);
+	Log(TRACE_MINIMUM, -1, "%d sent messages and %d received messages restored for client %s in %llu us\n",
+		msgs_sent, msgs_rcvd, c->clientID, Timer_nowMicros() - start);
 
 	FUNC_EXIT_RC(rc);
 	return rc;
@@ -288,7 +421,7 @@ void* MQTTPersistence_restorePacket(char* buffer, size_t buflen)	//-
 	{
 		ptype = header.bits.type;
 		if (ptype >= CONNECT && ptype <= DISCONNECT && new_packets[ptype] != NULL)
-			pack = (*new_packets[ptype])(header.byte, ++buffer, remaining_length);
+			pack = (*new_packets[ptype])(NULL, header.byte, ++buffer, remaining_length);
 	}
 
 	FUNC_EXIT;
@@ -343,9 +476,10 @@ int MQTTPersistence_put(int socket, char* buf0, size_t buf0len, int count,
 	char** bufs = NULL;
 	char *key;
 	Clients* client = NULL;
+	ustime_type start;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &socket, clientSocketCompare)->content);	//-ѰһָĿͻ,ȻӼ¼
+	client = Clients_findSocket(bstate, socket);	//-ѰһָĿͻ,ȻӼ¼
 	if (client->persistence != NULL)
 	{
 		key = malloc(MESSAGE_FILENAME_LENGTH + 1);
@@ -371,7 +505,9 @@ int MQTTPersistence_put(int socket, char* buf0, size_t buf0len, int count,
 		if ( scr == 1 )  /* receiving PUBLISH QoS2 */
 			sprintf(key, "%s%d", PERSISTENCE_PUBLISH_RECEIVED, msgId);
 		//-Ϊڴ,νkeyҲһ־
+		start = Timer_nowMicros();
 		rc = client->persistence->pput(client->phandle, key, nbufs, bufs, lens);
+		MQTTProtocol_recordLatency(&client->stats.persistLatency, start);
 
 		free(key);	//-*̬ڴϵ,ϵͳĻر
 		free(lens);
@@ -465,79 +601,197 @@ void MQTTPersistence_wrapMsgID(Clients *client)	//-
 }
 
 
+/**
+ * Update a CRC-32 (as used by zlib and Ethernet) with more data, to check that records read back
+ * from a persistent store are whole
+ * @param crc the CRC of the data so far, 0 to start
+ * @param data the data
+ * @param len the length of the data
+ * @return the CRC including the data
+ */
+unsigned int MQTTPersistence_checksum(unsigned int crc, const char* data, size_t len)
+{
+	static unsigned int table[256];
+	static int initialized = 0;
+	const unsigned char* p = (const unsigned char*)data;
+
+	if (!initialized)
+	{
+		unsigned int i, j;
+
+		for (i = 0; i < 256; ++i)
+		{
+			unsigned int c = i;
+
+			for (j = 0; j < 8; ++j)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		initialized = 1;
+	}
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+
 #if !defined(NO_PERSISTENCE)
-int MQTTPersistence_unpersistQueueEntry(Clients* client, MQTTPersistence_qEntry* qe)	//-ӳ־öƳһ
+/**
+ * Note the delivery of an entry of the message queue.  Entries are delivered in the order they
+ * were queued, so only the sequence number of the last delivered is kept, to be persisted by
+ * MQTTPersistence_persistQueue(); the batch of the entry is removed once its last entry is delivered.
+ * @param client the client as ::Clients
+ * @param qe the entry delivered, at the front of the queue
+ * @param next the entry after it, or NULL
+ * @return 0 if successful
+ */
+int MQTTPersistence_unpersistQueueEntry(Clients* client, MQTTPersistence_qEntry* qe, MQTTPersistence_qEntry* next)	//-ӳ־öƳһ
 {
 	int rc = 0;
 	char key[PERSISTENCE_MAX_KEY_LENGTH + 1];
 	
 	FUNC_ENTRY;
-	sprintf(key, "%s%d", PERSISTENCE_QUEUE_KEY, qe->seqno);
-	if ((rc = client->persistence->premove(client->phandle, key)) != 0)
-		Log(LOG_ERROR, 0, "Error %d removing qEntry from persistence", rc);
+	if (qe->batch == 0)
+		--client->qentry_pending;	/* delivered before it was persisted */
+	else
+	{
+		client->qentry_delivered = qe->seqno;
+		if (next == NULL || next->batch != qe->batch)
+		{
+			sprintf(key, "%s%d", PERSISTENCE_QUEUE_KEY, qe->batch);
+			if ((rc = client->persistence->premove(client->phandle, key)) != 0)
+				Log(LOG_ERROR, 0, "Error %d removing qEntry batch from persistence", rc);
+		}
+	}
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
-int MQTTPersistence_persistQueueEntry(Clients* aclient, MQTTPersistence_qEntry* qe)	//-Ǻ,һ,ռ,ֻռ丳ĵĺ岻ͬ,ͨṹ嶨
+/**
+ * Persist the entries at the end of the message queue which are not yet persisted as one batch,
+ * under the sequence number of the first, and the sequence number of the last entry delivered
+ * if entries of its batch remain.  If they cannot be written, they are left pending, to be
+ * written by the next call.
+ * @param client the client as ::Clients
+ * @return 0 if successful
+ */
+int MQTTPersistence_persistQueue(Clients* client)	//-Ǻ,һ,ռ,ֻռ丳ĵĺ岻ͬ,ͨṹ嶨
 {
 	int rc = 0;
-	int nbufs = 8;
-	int bufindex = 0;
 	char key[PERSISTENCE_MAX_KEY_LENGTH + 1];
 	int* lens = NULL;
 	void** bufs = NULL;
+	ListElement* first;
+	ListElement* current;
+	unsigned int batch = client->qentry_seqno + 1;
+	int nbufs, bufindex = 0;
+	int i, erc;
 		
 	FUNC_ENTRY;
+	if (client->qentry_marked != client->qentry_delivered)
+	{
+		MQTTPersistence_qEntry* first = (client->messageQueue->first) ?
+				(MQTTPersistence_qEntry*)(client->messageQueue->first->content) : NULL;
+
+		if (first && first->batch != 0 && first->batch <= client->qentry_delivered)
+		{
+			char* mark = (char*)&client->qentry_delivered;
+			int marklen = sizeof(client->qentry_delivered);
+
+			strcpy(key, PERSISTENCE_QUEUE_MARK_KEY);
+			if ((rc = client->persistence->pput(client->phandle, key, 1, &mark, &marklen)) != 0)
+				Log(LOG_ERROR, 0, "Error persisting queue mark, rc %d", rc);
+		}
+		if (rc == 0)
+			client->qentry_marked = client->qentry_delivered;
+	}
+	if (client->qentry_pending == 0)
+		goto exit;
+
+	nbufs = client->qentry_pending * 8;
 	lens = (int*)malloc(nbufs * sizeof(int));
 	bufs = malloc(nbufs * sizeof(char *));
-						
-	bufs[bufindex] = &qe->msg->payloadlen;
-	lens[bufindex++] = sizeof(qe->msg->payloadlen);
+	if (lens == NULL || bufs == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	for (first = client->messageQueue->last, i = 1; i < client->qentry_pending; ++i)
+		first = first->prev;
+	sprintf(key, "%s%d", PERSISTENCE_QUEUE_KEY, batch);
+	for (current = first; current; current = current->next)
+	{
+		MQTTPersistence_qEntry* qe = (MQTTPersistence_qEntry*)(current->content);
+
+		bufs[bufindex] = &qe->msg->payloadlen;
+		lens[bufindex++] = sizeof(qe->msg->payloadlen);
 				
-	bufs[bufindex] = qe->msg->payload;
-	lens[bufindex++] = qe->msg->payloadlen;
+		bufs[bufindex] = qe->msg->payload;
+		lens[bufindex++] = qe->msg->payloadlen;
 		
-	bufs[bufindex] = &qe->msg->qos;
-	lens[bufindex++] = sizeof(qe->msg->qos);
+		bufs[bufindex] = &qe->msg->qos;
+		lens[bufindex++] = sizeof(qe->msg->qos);
 		
-	bufs[bufindex] = &qe->msg->retained;
-	lens[bufindex++] = sizeof(qe->msg->retained);
+		bufs[bufindex] = &qe->msg->retained;
+		lens[bufindex++] = sizeof(qe->msg->retained);
 		
-	bufs[bufindex] = &qe->msg->dup;
-	lens[bufindex++] = sizeof(qe->msg->dup);
+		bufs[bufindex] = &qe->msg->dup;
+		lens[bufindex++] = sizeof(qe->msg->dup);
 				
-	bufs[bufindex] = &qe->msg->msgid;
-	lens[bufindex++] = sizeof(qe->msg->msgid);
+		bufs[bufindex] = &qe->msg->msgid;
+		lens[bufindex++] = sizeof(qe->msg->msgid);
 						
-	bufs[bufindex] = qe->topicName;
-	lens[bufindex++] = strlen(qe->topicName) + 1;
+		bufs[bufindex] = qe->topicName;
+		lens[bufindex++] = strlen(qe->topicName) + 1;
 				
-	bufs[bufindex] = &qe->topicLen;
-	lens[bufindex++] = sizeof(qe->topicLen);			
-		
-	sprintf(key, "%s%d", PERSISTENCE_QUEUE_KEY, ++aclient->qentry_seqno);	
-	qe->seqno = aclient->qentry_seqno;
+		bufs[bufindex] = &qe->topicLen;
+		lens[bufindex++] = sizeof(qe->topicLen);
+	}
 
-	if ((rc = aclient->persistence->pput(aclient->phandle, key, nbufs, (char**)bufs, lens)) != 0)	//-־·д
-		Log(LOG_ERROR, 0, "Error persisting queue entry, rc %d", rc);
+	if ((erc = client->persistence->pput(client->phandle, key, nbufs, (char**)bufs, lens)) != 0)	//-־·д
+	{
+		Log(LOG_ERROR, 0, "Error persisting queue entries, rc %d", erc);
+		rc = erc;
+	}
+	else
+	{
+		for (current = first; current; current = current->next)
+		{
+			MQTTPersistence_qEntry* qe = (MQTTPersistence_qEntry*)(current->content);
 
+			qe->seqno = ++client->qentry_seqno;
+			qe->batch = batch;
+		}
+		client->qentry_pending = 0;
+	}
+
+exit:
 	free(lens);
 	free(bufs);
-
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 //-ָܻ֮ǰҪһռ׼ָ
-MQTTPersistence_qEntry* MQTTPersistence_restoreQueueEntry(char* buffer, size_t buflen)	//-ָ,ʹ˶еĸ,ʹ˼·ʲô
+/**
+ * Restore an entry of the message queue from the start of a batch of them
+ * @param buffer the persisted data
+ * @param buflen its length
+ * @param used set to the length of the entry
+ * @return the entry, or NULL if the data does not hold a whole one
+ */
+MQTTPersistence_qEntry* MQTTPersistence_restoreQueueEntry(char* buffer, size_t buflen, size_t* used)	//-ָ,ʹ˶еĸ,ʹ˼·ʲô
 {
 	MQTTPersistence_qEntry* qe = NULL;
 	char* ptr = buffer;
 	int data_size;
 	
 	FUNC_ENTRY;
+	if (buflen < 6 * sizeof(int) + 1 || *(int*)ptr < 0 || (size_t)*(int*)ptr > buflen - 6 * sizeof(int) - 1 ||
+			memchr(ptr + 5 * sizeof(int) + *(int*)ptr, '\0', buflen - 6 * sizeof(int) - *(int*)ptr) == NULL)
+		goto exit;
 	qe = malloc(sizeof(MQTTPersistence_qEntry));
 	memset(qe, '\0', sizeof(MQTTPersistence_qEntry));
 	
@@ -571,28 +825,14 @@ MQTTPersistence_qEntry* MQTTPersistence_restoreQueueEntry(char* buffer, size_t b
 	
 	qe->topicLen = *(int*)ptr;
 	ptr += sizeof(int);
+	*used = ptr - buffer;
 
+exit:
 	FUNC_EXIT;
 	return qe;
 }
 
 
-void MQTTPersistence_insertInSeqOrder(List* list, MQTTPersistence_qEntry* qEntry, size_t size)
-{
-	ListElement* index = NULL;
-	ListElement* current = NULL;
-
-	FUNC_ENTRY;
-	while (ListNextElement(list, &current) != NULL && index == NULL)
-	{
-		if (qEntry->seqno < ((MQTTPersistence_qEntry*)current->content)->seqno)
-			index = current;
-	}
-	ListInsert(list, qEntry, size, index);	//- 
-	FUNC_EXIT;
-}
-
-
 /**
  * Restores a queue of messages from persistence to memory
  * @param c the client as ::Clients - the client object to restore the messages to
@@ -605,10 +845,14 @@ int MQTTPersistence_restoreMessageQueue(Clients* c)	//-
 	int nkeys;
 	int i = 0;
 	int entries_restored = 0;
+	ustime_type start = Timer_nowMicros();
 
 	FUNC_ENTRY;
 	if (c->persistence && (rc = c->persistence->pkeys(c->phandle, &msgkeys, &nkeys)) == 0)
 	{
+		/* sorted once, so that each entry can be appended to the queue in sequence number order */
+		if (nkeys > 1)
+			qsort(msgkeys, nkeys, sizeof(char*), MQTTPersistence_keyCompare);
 		while (rc == 0 && i < nkeys)
 		{
 			char *buffer = NULL;
@@ -616,19 +860,46 @@ int MQTTPersistence_restoreMessageQueue(Clients* c)	//-
 					
 			if (strncmp(msgkeys[i], PERSISTENCE_QUEUE_KEY, strlen(PERSISTENCE_QUEUE_KEY)) != 0)
 				;
-			else if ((rc = c->persistence->pget(c->phandle, msgkeys[i], &buffer, &buflen)) == 0)
+			else if ((rc = c->persistence->pget(c->phandle, msgkeys[i], &buffer, &buflen)) != 0)
+				;
+			else if (strcmp(msgkeys[i], PERSISTENCE_QUEUE_MARK_KEY) == 0)
+			{	/* the first key, as it sorts before any batch */
+				if (buflen == sizeof(c->qentry_delivered))
+					c->qentry_delivered = c->qentry_marked = *(unsigned int*)buffer;
+				c->qentry_seqno = max(c->qentry_seqno, c->qentry_delivered);
+			}
+			else
 			{
-				MQTTPersistence_qEntry* qe = MQTTPersistence_restoreQueueEntry(buffer, buflen);
-				
-				if (qe)
-				{	
-					qe->seqno = atoi(msgkeys[i]+2);	//-(ʾ ascii to integer)ǰַתһ
-					MQTTPersistence_insertInSeqOrder(c->messageQueue, qe, sizeof(MQTTPersistence_qEntry));
-					free(buffer);
+				unsigned int batch = atoi(msgkeys[i] + strlen(PERSISTENCE_QUEUE_KEY));	//-(ʾ ascii to integer)ǰַתһ
+				unsigned int seqno = batch;
+				size_t offset = 0, used = 0;
+				int remaining = 0;
+				MQTTPersistence_qEntry* qe;
+
+				while (offset < (size_t)buflen &&
+						(qe = MQTTPersistence_restoreQueueEntry(buffer + offset, buflen - offset, &used)) != NULL)
+				{
+					offset += used;
+					qe->seqno = seqno++;
+					qe->batch = batch;
+					if (qe->seqno <= c->qentry_delivered)
+					{	/* delivered before the batch was removed */
+						free(qe->msg->payload);
+						free(qe->msg);
+						free(qe->topicName);
+						free(qe);
+						continue;
+					}
+					ListAppend(c->messageQueue, qe, sizeof(MQTTPersistence_qEntry));
 					c->qentry_seqno = max(c->qentry_seqno, qe->seqno);
 					entries_restored++;
+					remaining++;
 				}
+				if (remaining == 0)
+					c->persistence->premove(c->phandle, msgkeys[i]);
 			}
+			if (buffer)
+				free(buffer);
 			if (msgkeys[i])
 				free(msgkeys[i]);
 			i++;
@@ -636,7 +907,9 @@ int MQTTPersistence_restoreMessageQueue(Clients* c)	//-
 		if (msgkeys != NULL)
 			free(msgkeys);
 	}
-	Log(TRACE_MINIMUM, -1, "%d queued messages restored for client %s", entries_restored, c->clientID);
+	MQTTPersistence_restored(c, entries_restored, start);
+	Log(TRACE_MINIMUM, -1, "%d queued messages restored for client %s in %llu us", entries_restored, c->clientID,
+		Timer_nowMicros() - start);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -32,6 +32,11 @@
 #define PERSISTENCE_COMMAND_KEY "c-"
 /** Stem of the key for an async client message queue */
 #define PERSISTENCE_QUEUE_KEY "q-"
+/** Key of the sequence number of the last entry delivered from the message queue, for a batch
+ * of which some entries remain */
+#define PERSISTENCE_QUEUE_MARK_KEY "q-0"
+/** Most message queue entries persisted as one batch */
+#define PERSISTENCE_QUEUE_BATCH 64
 #define PERSISTENCE_MAX_KEY_LENGTH 8
 
 int MQTTPersistence_create(MQTTClient_persistence** per, int type, void* pcontext);
@@ -45,6 +50,7 @@ int MQTTPersistence_put(int socket, char* buf0, size_t buf0len, int count,
 								 char** buffers, size_t* buflens, int htype, int msgId, int scr);
 int MQTTPersistence_remove(Clients* c, char* type, int qos, int msgId);
 void MQTTPersistence_wrapMsgID(Clients *c);
+unsigned int MQTTPersistence_checksum(unsigned int crc, const char* data, size_t len);
 
 typedef struct
 {
@@ -63,11 +69,12 @@ typedef struct
 	MQTTPersistence_message* msg;
 	char* topicName;
 	int topicLen;
-	unsigned int seqno; /* only used on restore */
+	unsigned int seqno;
+	unsigned int batch; /* sequence number of the first entry of its batch, 0 until persisted */
 } MQTTPersistence_qEntry;
 
-int MQTTPersistence_unpersistQueueEntry(Clients* client, MQTTPersistence_qEntry* qe);
-int MQTTPersistence_persistQueueEntry(Clients* aclient, MQTTPersistence_qEntry* qe);
+int MQTTPersistence_unpersistQueueEntry(Clients* client, MQTTPersistence_qEntry* qe, MQTTPersistence_qEntry* next);
+int MQTTPersistence_persistQueue(Clients* client);
 int MQTTPersistence_restoreMessageQueue(Clients* c);
 #ifdef __cplusplus
      }
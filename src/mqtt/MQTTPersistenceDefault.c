@@ -72,11 +72,17 @@ int pstopen(void **handle, const char* clientID, const char* serverURI, void* co
 	char *perserverURI = NULL, *ptraux;
 
 	FUNC_ENTRY;
-	/* Note that serverURI=address:port, but ":" not allowed in Windows directories */
+	/* Note that serverURI=address:port, but ":" not allowed in Windows directories.  A
+	 * unix:///path URI holds directory separators too, which are replaced as well */
 	perserverURI = malloc(strlen(serverURI) + 1);
 	strcpy(perserverURI, serverURI);	//-ѴsrcַʼҺ'\0'ַƵdestʼĵַռ
-	ptraux = strstr(perserverURI, ":");	//-жַstr2Ƿstr1Ӵǣústr2str1״γֵĵַ򣬷NULL
-	*ptraux = '-' ;	//-ԭ:
+	if ((ptraux = strstr(perserverURI, ":")) != NULL)	//-жַstr2Ƿstr1Ӵǣústr2str1״γֵĵַ򣬷NULL
+		*ptraux = '-' ;	//-ԭ:
+	for (ptraux = perserverURI; *ptraux; ++ptraux)
+	{
+		if (*ptraux == '/' || *ptraux == '\\')
+			*ptraux = '-';
+	}
 
 	/* consider '/'  +  '-'  +  '\0' */
 	clientDir = malloc(strlen(dataDir) + strlen(clientID) + strlen(perserverURI) + 3);
@@ -641,62 +647,64 @@ int keysUnix(char *dirname, char ***keys, int *nkeys)	//-
 	int rc = 0;
 	char **fkeys = NULL;
 	int nfkeys = 0;
+	int size = 0;
 	char *ptraux;
-	int i;
 	DIR *dp;
 	struct dirent *dir_entry;
 	struct stat stat_info;
 
 	FUNC_ENTRY;
-	/* get number of keys */
-	if((dp = opendir(dirname)) != NULL)	//-һĿ¼ʧܵʱ򷵻һյָ롣
+	/* one pass over the directory, growing the array of keys as it goes */
+	if((dp = opendir(dirname)) == NULL)
 	{
-		while((dir_entry = readdir(dp)) != NULL)	//-ȡĿ¼,ͶȡĿ¼µж
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	while((dir_entry = readdir(dp)) != NULL && rc == 0)
+	{
+		int regular;
+
+#if defined(_DIRENT_HAVE_D_TYPE)
+		if (dir_entry->d_type != DT_UNKNOWN)
+			regular = (dir_entry->d_type == DT_REG);	/* no lstat needed */
+		else
+#endif
 		{
 			char* temp = malloc(strlen(dirname)+strlen(dir_entry->d_name)+2);
 
-			sprintf(temp, "%s/%s", dirname, dir_entry->d_name);	//-¼Ŀ¼е,γlsЧ
-			if (lstat(temp, &stat_info) == 0 && S_ISREG(stat_info.st_mode))	//-lstatһļʡ˼ǻȡһЩļصϢS_ISREGǷһļ
-				nfkeys++;	//-Ѱҵļͼ1
+			sprintf(temp, "%s/%s", dirname, dir_entry->d_name);
+			regular = (lstat(temp, &stat_info) == 0 && S_ISREG(stat_info.st_mode));
 			free(temp);
 		}
-		closedir(dp);
-	} else
-	{
-		rc = MQTTCLIENT_PERSISTENCE_ERROR;	//-·ʶ˽гʧʲô˼
-		goto exit;
-	}
-
-	if (nfkeys != 0)
-	{
-		fkeys = (char **)malloc(nfkeys * sizeof(char *));
-
-		/* copy the keys */
-		if((dp = opendir(dirname)) != NULL)
+		if (!regular)
+			continue;
+		if (nfkeys == size)
 		{
-			i = 0;
-			while((dir_entry = readdir(dp)) != NULL)
+			char **newkeys;
+
+			size = (size) ? size * 2 : 16;
+			newkeys = (fkeys) ? realloc(fkeys, size * sizeof(char *)) : malloc(size * sizeof(char *));
+			if (newkeys == NULL)
 			{
-				char* temp = malloc(strlen(dirname)+strlen(dir_entry->d_name)+2);
-	
-				sprintf(temp, "%s/%s", dirname, dir_entry->d_name);
-				if (lstat(temp, &stat_info) == 0 && S_ISREG(stat_info.st_mode))
-				{//-ǳļĻ
-					fkeys[i] = malloc(strlen(dir_entry->d_name) + 1);
-					strcpy(fkeys[i], dir_entry->d_name);
-					ptraux = strstr(fkeys[i], MESSAGE_FILENAME_EXTENSION);	//-չ
-					if ( ptraux != NULL )
-						*ptraux = '\0' ;
-					i++;
-				}
-				free(temp);
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+				break;
 			}
-			closedir(dp);
-		} else
-		{
-			rc = MQTTCLIENT_PERSISTENCE_ERROR;
-			goto exit;
+			fkeys = newkeys;
 		}
+		fkeys[nfkeys] = malloc(strlen(dir_entry->d_name) + 1);
+		strcpy(fkeys[nfkeys], dir_entry->d_name);
+		ptraux = strstr(fkeys[nfkeys], MESSAGE_FILENAME_EXTENSION);
+		if ( ptraux != NULL )
+			*ptraux = '\0' ;
+		nfkeys++;
+	}
+	closedir(dp);
+	if (rc != 0)
+	{
+		while (nfkeys > 0)
+			free(fkeys[--nfkeys]);
+		free(fkeys);
+		goto exit;
 	}
 
 	*nkeys = nfkeys;
@@ -0,0 +1,978 @@
+/**
+ * @file
+ * \brief A log-structured file system based persistence implementation.
+ *
+ * Each put and remove is appended as a record to a log, in the directory #LOG_DIRECTORY
+ * beneath the one the default persistence would use for the client.  Records are collected
+ * in a buffer and written together with one write and, if wanted, one fdatasync(): a put is
+ * written at once unless a commit interval is set, and a remove waits to be written with
+ * the next put, since a remove lost in a crash only means a message is sent again.
+ *
+ * The log is split into segment files of about the configured size.  The segments are only
+ * ever deleted oldest first, so that a remove is never lost while the put it cancels is still
+ * in the log: the oldest segment is deleted once none of its records are live, and when less
+ * than half of the data in the segments before the last is live, the live records of the
+ * oldest are copied to the end of the log so that it can be.
+ *
+ * Each record is a header of a CRC-32 of the rest of the record, the length of the key
+ * (2 bytes), the type of record, a reserved byte and the length of the data (4 bytes), all
+ * little-endian, followed by the key and the data.  When the store is opened the segments
+ * are read in order to index the live records by key, and a record torn by a crash at the
+ * end of the last segment is cut off.
+ */
+
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "MQTTPersistenceLog.h"
+#include "MQTTPersistenceDefault.h"
+#include "MQTTPersistence.h"
+#include "Log.h"
+#include "Timer.h"
+#include "Tree.h"
+#include "StackTrace.h"
+
+#include "Heap.h"
+
+#define LOG_HEADER_SIZE 12
+
+enum LogRecordTypes { LOG_PUT = 1, LOG_REMOVE };
+
+/**
+ * One segment file of the log
+ */
+typedef struct
+{
+	unsigned int id;	/**< number of the segment, which is its file name */
+	long size;			/**< bytes written to the segment */
+	long live;			/**< bytes of the records in it which are still live */
+} LogSegment;
+
+/**
+ * Where the data of a live key is in the log
+ */
+typedef struct
+{
+	char* key;
+	unsigned int segment;	/**< id of the segment holding the record */
+	long offset;			/**< position of the data in the segment */
+	int len;				/**< length of the data */
+} LogEntry;
+
+/**
+ * The handle of an open log
+ */
+typedef struct
+{
+	char* clientDir;		/**< the directory for the client, from pstopen() */
+	char* dir;				/**< the directory of the segments */
+	int segmentSize;
+	int commitInterval;
+	int sync;
+	int fd;					/**< the last segment, open for appending */
+	LogSegment* segments;	/**< oldest first */
+	int nsegments;
+	int maxsegments;
+	Tree* index;			/**< the LogEntry of each live key */
+	char* pending;			/**< records not yet written to the last segment */
+	int pendinglen;
+	int pendingsize;
+	int cleaning;			/**< set while segments are being deleted, so that commits made for that don't */
+	Timer commit_timer;		/**< armed while there are pending records */
+} LogStore;
+
+
+static int MQTTPersistenceLog_commit(LogStore* s);
+
+
+/**
+ * Copy the options of a log, for the context of the persistence structure
+ * @param options the options, or NULL for the defaults
+ * @return the copy, which is freed with free(), or NULL if the options are not valid
+ */
+MQTTClient_logPersistenceOptions* MQTTPersistenceLog_copyOptions(MQTTClient_logPersistenceOptions* options)
+{
+	MQTTClient_logPersistenceOptions defaults = MQTTClient_logPersistenceOptions_initializer;
+	MQTTClient_logPersistenceOptions* copy = NULL;
+	const char* dir;
+
+	FUNC_ENTRY;
+	if (options == NULL)
+		options = &defaults;
+	else if (strncmp(options->struct_id, "MQLP", 4) != 0 || options->struct_version != 0)
+		goto exit;
+	dir = (options->directory) ? options->directory : ".";	/* working directory */
+	if ((copy = malloc(sizeof(MQTTClient_logPersistenceOptions) + strlen(dir) + 1)) == NULL)
+		goto exit;
+	*copy = *options;
+	copy->directory = strcpy((char*)(copy + 1), dir);
+exit:
+	FUNC_EXIT;
+	return copy;
+}
+
+
+static void MQTTPersistenceLog_write16(char* p, unsigned int v)
+{
+	p[0] = (char)(v & 0xFF);
+	p[1] = (char)((v >> 8) & 0xFF);
+}
+
+
+static void MQTTPersistenceLog_write32(char* p, unsigned int v)
+{
+	MQTTPersistenceLog_write16(p, v & 0xFFFF);
+	MQTTPersistenceLog_write16(p + 2, v >> 16);
+}
+
+
+static unsigned int MQTTPersistenceLog_read16(const char* p)
+{
+	return (unsigned char)p[0] | ((unsigned char)p[1] << 8);
+}
+
+
+static unsigned int MQTTPersistenceLog_read32(const char* p)
+{
+	return MQTTPersistenceLog_read16(p) | (MQTTPersistenceLog_read16(p + 2) << 16);
+}
+
+
+static int MQTTPersistenceLog_compare(void* a, void* b, int content)
+{
+	return strcmp(((LogEntry*)a)->key, (content) ? ((LogEntry*)b)->key : (char*)b);
+}
+
+
+/**
+ * The file name of a segment
+ * @param s the log
+ * @param id the number of the segment
+ * @return the path, to be freed by the caller
+ */
+static char* MQTTPersistenceLog_segmentName(LogStore* s, unsigned int id)
+{
+	char* name = malloc(strlen(s->dir) + 1 + 8 + strlen(LOG_SEGMENT_EXTENSION) + 1);
+
+	if (name)
+		sprintf(name, "%s/%08x%s", s->dir, id, LOG_SEGMENT_EXTENSION);
+	return name;
+}
+
+
+/**
+ * Find a segment by its number
+ * @param s the log
+ * @param id the number of the segment
+ * @return the segment, or NULL if it is not in the log
+ */
+static LogSegment* MQTTPersistenceLog_findSegment(LogStore* s, unsigned int id)
+{
+	int lo = 0, hi = s->nsegments - 1;
+
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+
+		if (s->segments[mid].id == id)
+			return &s->segments[mid];
+		if (s->segments[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+
+static int MQTTPersistenceLog_recordSize(LogEntry* e)
+{
+	return LOG_HEADER_SIZE + (int)strlen(e->key) + e->len;
+}
+
+
+/**
+ * Add a segment to the end of the array of segments
+ * @param s the log
+ * @param id the number of the segment
+ * @return the segment, or NULL if there was no memory
+ */
+static LogSegment* MQTTPersistenceLog_addSegment(LogStore* s, unsigned int id)
+{
+	LogSegment* seg;
+
+	if (s->nsegments == s->maxsegments)
+	{
+		int newmax = (s->maxsegments) ? s->maxsegments * 2 : 8;
+		LogSegment* newsegments = (s->segments) ? realloc(s->segments, newmax * sizeof(LogSegment)) :
+				malloc(newmax * sizeof(LogSegment));
+
+		if (newsegments == NULL)
+			return NULL;
+		s->segments = newsegments;
+		s->maxsegments = newmax;
+	}
+	seg = &s->segments[s->nsegments++];
+	seg->id = id;
+	seg->size = seg->live = 0;
+	return seg;
+}
+
+
+/**
+ * Start a new segment at the end of the log, to which records are then written
+ * @param s the log
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise
+ */
+static int MQTTPersistenceLog_startSegment(LogStore* s)
+{
+	unsigned int id = (s->nsegments) ? s->segments[s->nsegments - 1].id + 1 : 1;
+	char* name = MQTTPersistenceLog_segmentName(s, id);
+	int fd, rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (name == NULL)
+		goto exit;
+	if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR)) < 0)
+		goto exit;
+	if (MQTTPersistenceLog_addSegment(s, id) == NULL)
+	{
+		close(fd);
+		unlink(name);
+		goto exit;
+	}
+	if (s->sync)
+	{	/* so that the new file is found after a power cut */
+		int dirfd = open(s->dir, O_RDONLY);
+
+		if (dirfd >= 0)
+		{
+			fsync(dirfd);
+			close(dirfd);
+		}
+	}
+	if (s->fd >= 0)
+		close(s->fd);
+	s->fd = fd;
+	rc = 0;
+exit:
+	free(name);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Append a record to the pending records
+ * @param s the log
+ * @param type LOG_PUT or LOG_REMOVE
+ * @param key the key
+ * @param bufcount the number of buffers of data
+ * @param buffers the buffers
+ * @param buflens the lengths of the buffers
+ * @return the offset at which the data will be in the last segment, or -1 if there was no memory
+ */
+static long MQTTPersistenceLog_append(LogStore* s, int type, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	int keylen = (int)strlen(key);
+	int len = 0, size, i;
+	char* p;
+	char* data;
+	long offset;
+
+	for (i = 0; i < bufcount; ++i)
+		len += buflens[i];
+	size = LOG_HEADER_SIZE + keylen + len;
+	if (s->pendinglen + size > s->pendingsize)
+	{
+		int newsize = (s->pendingsize) ? s->pendingsize : 4096;
+		char* newpending;
+
+		while (newsize < s->pendinglen + size)
+			newsize *= 2;
+		newpending = (s->pending) ? realloc(s->pending, newsize) : malloc(newsize);
+		if (newpending == NULL)
+			return -1;
+		s->pending = newpending;
+		s->pendingsize = newsize;
+	}
+	p = s->pending + s->pendinglen;
+	MQTTPersistenceLog_write16(p + 4, keylen);
+	p[6] = (char)type;
+	p[7] = 0;
+	MQTTPersistenceLog_write32(p + 8, len);
+	memcpy(p + LOG_HEADER_SIZE, key, keylen);
+	data = p + LOG_HEADER_SIZE + keylen;
+	for (i = 0; i < bufcount; ++i)
+	{
+		memcpy(data, buffers[i], buflens[i]);
+		data += buflens[i];
+	}
+	MQTTPersistenceLog_write32(p, MQTTPersistence_checksum(0, p + 4, size - 4));
+	offset = s->segments[s->nsegments - 1].size + s->pendinglen + LOG_HEADER_SIZE + keylen;
+	s->pendinglen += size;
+	return offset;
+}
+
+
+/**
+ * Note that the record of an entry is no longer live
+ * @param s the log
+ * @param e the entry
+ */
+static void MQTTPersistenceLog_unlive(LogStore* s, LogEntry* e)
+{
+	LogSegment* seg = MQTTPersistenceLog_findSegment(s, e->segment);
+
+	if (seg)
+		seg->live -= MQTTPersistenceLog_recordSize(e);
+}
+
+
+/**
+ * Record where the data of a key is
+ * @param s the log
+ * @param key the key
+ * @param segment the segment holding the record
+ * @param offset the position of the data in the segment
+ * @param len the length of the data
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR if there was no memory
+ */
+static int MQTTPersistenceLog_index(LogStore* s, char* key, LogSegment* segment, long offset, int len)
+{
+	Node* node = TreeFind(s->index, key);
+	LogEntry* e;
+
+	if (node)
+	{
+		e = (LogEntry*)(node->content);
+		MQTTPersistenceLog_unlive(s, e);
+	}
+	else
+	{
+		if ((e = malloc(sizeof(LogEntry))) == NULL)
+			return MQTTCLIENT_PERSISTENCE_ERROR;
+		if ((e->key = malloc(strlen(key) + 1)) == NULL)
+		{
+			free(e);
+			return MQTTCLIENT_PERSISTENCE_ERROR;
+		}
+		strcpy(e->key, key);
+		TreeAdd(s->index, e, sizeof(LogEntry));
+	}
+	e->segment = segment->id;
+	e->offset = offset;
+	e->len = len;
+	segment->live += MQTTPersistenceLog_recordSize(e);
+	return 0;
+}
+
+
+/**
+ * Remove a key from the index
+ * @param s the log
+ * @param node the node of the key in the index
+ */
+static void MQTTPersistenceLog_unindex(LogStore* s, Node* node)
+{
+	LogEntry* e = (LogEntry*)(node->content);
+
+	MQTTPersistenceLog_unlive(s, e);
+	TreeRemoveNodeIndex(s->index, node, 0);
+	free(e->key);
+	free(e);
+}
+
+
+static void MQTTPersistenceLog_commitExpired(Timer* timer, void* context)
+{
+	MQTTPersistenceLog_commit((LogStore*)context);
+}
+
+
+/**
+ * Make sure the pending records are written within a time
+ * @param s the log
+ * @param ms the most milliseconds the records may wait
+ */
+static void MQTTPersistenceLog_commitWithin(LogStore* s, long ms)
+{
+	if (!Timer_isArmed(&s->commit_timer) || s->commit_timer.expires > Timer_now() + ms)
+		Timer_arm(&s->commit_timer, ms, MQTTPersistenceLog_commitExpired, s);
+}
+
+
+/**
+ * Read the data of a live record from its segment
+ * @param s the log
+ * @param fd the segment, open for reading
+ * @param e the entry of the record
+ * @return the data, to be freed by the caller, or NULL if it could not be read
+ */
+static char* MQTTPersistenceLog_read(LogStore* s, int fd, LogEntry* e)
+{
+	char* data = malloc(e->len + 1);	/* not malloc(0) */
+
+	if (data && pread(fd, data, e->len, e->offset) != e->len)
+	{
+		free(data);
+		data = NULL;
+	}
+	return data;
+}
+
+
+/**
+ * Copy the live records of the oldest segment to the end of the log, so that it can be deleted
+ * @param s the log
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise
+ */
+static int MQTTPersistenceLog_compact(LogStore* s)
+{
+	unsigned int id = s->segments[0].id;
+	char* name = MQTTPersistenceLog_segmentName(s, id);
+	Node* node = NULL;
+	int fd, rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (name == NULL || (fd = open(name, O_RDONLY)) < 0)
+		goto exit;
+	rc = 0;
+	while (rc == 0 && (node = TreeNextElement(s->index, node)) != NULL)
+	{
+		LogEntry* e = (LogEntry*)(node->content);
+		char* data;
+		long offset;
+
+		if (e->segment != id)
+			continue;
+		if ((data = MQTTPersistenceLog_read(s, fd, e)) == NULL ||
+				(offset = MQTTPersistenceLog_append(s, LOG_PUT, e->key, 1, &data, &e->len)) < 0)
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		else
+			rc = MQTTPersistenceLog_index(s, e->key, &s->segments[s->nsegments - 1], offset, e->len);
+		free(data);
+	}
+	close(fd);
+	if (rc == 0)
+		rc = MQTTPersistenceLog_commit(s);
+exit:
+	free(name);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Delete the oldest segments while none of their records are live, compacting the oldest
+ * first while less than half of the data before the last segment is live
+ * @param s the log
+ */
+static void MQTTPersistenceLog_clean(LogStore* s)
+{
+	FUNC_ENTRY;
+	s->cleaning = 1;
+	while (s->nsegments > 1)
+	{
+		char* name;
+
+		if (s->segments[0].live > 0)
+		{
+			long size = 0, live = 0;
+			int i;
+
+			for (i = 0; i < s->nsegments - 1; ++i)
+			{
+				size += s->segments[i].size;
+				live += s->segments[i].live;
+			}
+			if (size <= s->segmentSize || live * 2 >= size)
+				break;
+			if (MQTTPersistenceLog_compact(s) != 0 || s->segments[0].live > 0)
+				break;
+		}
+		if ((name = MQTTPersistenceLog_segmentName(s, s->segments[0].id)) == NULL)
+			break;
+		unlink(name);
+		free(name);
+		memmove(&s->segments[0], &s->segments[1], (s->nsegments - 1) * sizeof(LogSegment));
+		--(s->nsegments);
+	}
+	s->cleaning = 0;
+	FUNC_EXIT;
+}
+
+
+/**
+ * Write the pending records to the log in one write, starting a new segment if the last one
+ * is full
+ * @param s the log
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise, in which case the records
+ * are still pending
+ */
+static int MQTTPersistenceLog_commit(LogStore* s)
+{
+	LogSegment* last = &s->segments[s->nsegments - 1];
+	int written = 0;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	Timer_cancel(&s->commit_timer);
+	while (written < s->pendinglen)
+	{
+		ssize_t count = write(s->fd, s->pending + written, s->pendinglen - written);
+
+		if (count < 0 && errno != EINTR)
+			break;
+		if (count > 0)
+			written += (int)count;
+	}
+	if (written < s->pendinglen || (s->sync && written > 0 && fdatasync(s->fd) != 0))
+	{	/* cut off anything written, so the records can be written again */
+		if (ftruncate(s->fd, last->size) != 0)
+			Log(LOG_ERROR, 0, "Error %d truncating persistence log", errno);
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	last->size += s->pendinglen;
+	s->pendinglen = 0;
+	if (last->size >= s->segmentSize)
+		rc = MQTTPersistenceLog_startSegment(s);
+	if (rc == 0 && !s->cleaning)
+		MQTTPersistenceLog_clean(s);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Read the records of a segment into the index
+ * @param s the log
+ * @param seg the segment
+ * @param fd the segment file, open for reading and writing
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise
+ */
+static int MQTTPersistenceLog_load(LogStore* s, LogSegment* seg, int fd)
+{
+	struct stat st;
+	char* data = NULL;
+	char* key = NULL;
+	long pos = 0;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (fstat(fd, &st) != 0 || (data = malloc(st.st_size + 1)) == NULL)
+		goto exit;
+	if (pread(fd, data, st.st_size, 0) != st.st_size)
+		goto exit;
+	rc = 0;
+	while (rc == 0 && pos + LOG_HEADER_SIZE <= st.st_size)
+	{
+		char* p = data + pos;
+		unsigned int keylen = MQTTPersistenceLog_read16(p + 4);
+		unsigned int len = MQTTPersistenceLog_read32(p + 8);
+		long size = LOG_HEADER_SIZE + (long)keylen + len;
+
+		if (keylen == 0 || len > (unsigned long)st.st_size || pos + size > st.st_size ||
+				(p[6] != LOG_PUT && p[6] != LOG_REMOVE) ||
+				MQTTPersistence_checksum(0, p + 4, size - 4) != MQTTPersistenceLog_read32(p))
+			break;	/* torn by a crash */
+		if ((key = malloc(keylen + 1)) == NULL)
+		{
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			break;
+		}
+		memcpy(key, p + LOG_HEADER_SIZE, keylen);
+		key[keylen] = '\0';
+		if (p[6] == LOG_PUT)
+			rc = MQTTPersistenceLog_index(s, key, seg, pos + LOG_HEADER_SIZE + keylen, len);
+		else
+		{
+			Node* node = TreeFind(s->index, key);
+
+			if (node)
+				MQTTPersistenceLog_unindex(s, node);
+		}
+		free(key);
+		pos += size;
+	}
+	seg->size = st.st_size;
+	if (rc == 0 && pos < st.st_size && seg == &s->segments[s->nsegments - 1])
+	{
+		Log(LOG_ERROR, 0, "Persistence log %08x cut off at %ld of %ld bytes", seg->id, pos, (long)st.st_size);
+		if (ftruncate(fd, pos) == 0)
+			seg->size = pos;
+	}
+exit:
+	free(data);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static int MQTTPersistenceLog_segmentCompare(const void* a, const void* b)
+{
+	unsigned int ida = ((const LogSegment*)a)->id, idb = ((const LogSegment*)b)->id;
+
+	return (ida < idb) ? -1 : (ida > idb);
+}
+
+
+/**
+ * Find the segments of the log and read them in order into the index
+ * @param s the log
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise
+ */
+static int MQTTPersistenceLog_loadAll(LogStore* s)
+{
+	DIR* dp;
+	struct dirent* entry;
+	int i, rc = 0;
+
+	FUNC_ENTRY;
+	if ((dp = opendir(s->dir)) == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	while (rc == 0 && (entry = readdir(dp)) != NULL)
+	{
+		unsigned int id;
+		int n = 0;
+
+		if (sscanf(entry->d_name, "%8x%n", &id, &n) == 1 && n == 8 &&
+				strcmp(entry->d_name + 8, LOG_SEGMENT_EXTENSION) == 0 && id > 0)
+		{
+			if (MQTTPersistenceLog_addSegment(s, id) == NULL)
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		}
+	}
+	closedir(dp);
+	qsort(s->segments, s->nsegments, sizeof(LogSegment), MQTTPersistenceLog_segmentCompare);
+	for (i = 0; rc == 0 && i < s->nsegments; ++i)
+	{
+		char* name = MQTTPersistenceLog_segmentName(s, s->segments[i].id);
+		int fd = (name) ? open(name, O_RDWR) : -1;
+
+		if (fd < 0)
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		else
+		{
+			rc = MQTTPersistenceLog_load(s, &s->segments[i], fd);
+			if (i == s->nsegments - 1 && rc == 0)
+			{
+				s->fd = fd;	/* append to the last segment */
+				fd = -1;
+			}
+		}
+		if (fd >= 0)
+			close(fd);
+		free(name);
+	}
+	if (rc == 0 && s->nsegments == 0)
+		rc = MQTTPersistenceLog_startSegment(s);
+	if (rc == 0)
+	{
+		if (lseek(s->fd, 0, SEEK_END) < 0 || fcntl(s->fd, F_SETFL, O_APPEND) != 0)
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		else
+			MQTTPersistenceLog_clean(s);
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Free the index and segments of a log, deleting the segments and the directory if nothing
+ * in them is live
+ * @param s the log
+ * @param remove 1 to delete the segments whatever is in them, 0 to delete them only if nothing
+ * in them is live, -1 to keep them, as when the log could not be loaded
+ */
+static void MQTTPersistenceLog_free(LogStore* s, int remove)
+{
+	Node* node;
+	int i;
+
+	FUNC_ENTRY;
+	Timer_cancel(&s->commit_timer);
+	if (s->fd >= 0)
+		close(s->fd);
+	s->fd = -1;
+	if (remove == 0 && s->index->count == 0)
+		remove = 1;
+	while ((node = TreeNextElement(s->index, NULL)) != NULL)
+		MQTTPersistenceLog_unindex(s, node);
+	for (i = 0; remove > 0 && i < s->nsegments; ++i)
+	{
+		char* name = MQTTPersistenceLog_segmentName(s, s->segments[i].id);
+
+		if (name)
+			unlink(name);
+		free(name);
+	}
+	s->nsegments = 0;
+	s->pendinglen = 0;
+	FUNC_EXIT;
+}
+
+
+/** Open the log of the client, creating its directory if needed, and index its records.
+ *  See ::Persistence_open
+ */
+int MQTTPersistenceLog_open(void** handle, const char* clientID, const char* serverURI, void* context)
+{
+	MQTTClient_logPersistenceOptions* options = context;
+	LogStore* s = NULL;
+	char* clientDir = NULL;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (options == NULL || pstopen((void**)&clientDir, clientID, serverURI, (void*)options->directory) != 0)
+		goto exit;
+	if ((s = malloc(sizeof(LogStore))) == NULL)
+		goto exit;
+	memset(s, '\0', sizeof(LogStore));
+	s->clientDir = clientDir;
+	s->fd = -1;
+	s->segmentSize = (options->segmentSize > 0) ? options->segmentSize : LOG_DEFAULT_SEGMENT_SIZE;
+	s->commitInterval = (options->commitInterval > 0) ? options->commitInterval : 0;
+	s->sync = options->sync;
+	Timer_init(&s->commit_timer);
+	if ((s->dir = malloc(strlen(clientDir) + strlen(LOG_DIRECTORY) + 2)) == NULL ||
+			(s->index = TreeInitialize(MQTTPersistenceLog_compare)) == NULL)
+		goto exit;
+	sprintf(s->dir, "%s/%s", clientDir, LOG_DIRECTORY);
+	if (pstmkdir(s->dir) == 0 && MQTTPersistenceLog_loadAll(s) == 0)
+		rc = 0;
+exit:
+	if (rc == 0)
+		*handle = s;
+	else if (s)
+	{
+		if (s->index)
+		{
+			MQTTPersistenceLog_free(s, -1);
+			TreeFree(s->index);
+		}
+		free(s->segments);
+		free(s->dir);
+		free(s);
+	}
+	if (rc != 0 && clientDir)
+		pstclose(clientDir);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Write any pending records and close the log, deleting it if nothing in it is live.
+ *  See ::Persistence_close
+ */
+int MQTTPersistenceLog_close(void* handle)
+{
+	LogStore* s = handle;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	if (s->pendinglen > 0)
+		rc = MQTTPersistenceLog_commit(s);
+	MQTTPersistenceLog_free(s, 0);
+	rmdir(s->dir);	/* only if it is empty */
+	if (pstclose(s->clientDir) != 0 && rc == 0)
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+	TreeFree(s->index);
+	free(s->segments);
+	free(s->pending);
+	free(s->dir);
+	free(s);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Append a put record to the log, written at once unless a commit interval is set.
+ *  See ::Persistence_put
+ */
+int MQTTPersistenceLog_put(void* handle, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	LogStore* s = handle;
+	long offset;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+	int len = 0, i;
+
+	FUNC_ENTRY;
+	if (s == NULL || (offset = MQTTPersistenceLog_append(s, LOG_PUT, key, bufcount, buffers, buflens)) < 0)
+		goto exit;
+	for (i = 0; i < bufcount; ++i)
+		len += buflens[i];
+	if ((rc = MQTTPersistenceLog_index(s, key, &s->segments[s->nsegments - 1], offset, len)) != 0)
+		goto exit;
+	if (s->commitInterval == 0 || s->pendinglen >= LOG_COMMIT_BYTES)
+		rc = MQTTPersistenceLog_commit(s);
+	else
+		MQTTPersistenceLog_commitWithin(s, s->commitInterval);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Read the data of a key from the log.
+ *  See ::Persistence_get
+ */
+int MQTTPersistenceLog_get(void* handle, char* key, char** buffer, int* buflen)
+{
+	LogStore* s = handle;
+	Node* node;
+	char* name = NULL;
+	int fd, rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL || (node = TreeFind(s->index, key)) == NULL)
+		goto exit;
+	if (s->pendinglen > 0 && MQTTPersistenceLog_commit(s) != 0)
+		goto exit;
+	if ((name = MQTTPersistenceLog_segmentName(s, ((LogEntry*)(node->content))->segment)) == NULL ||
+			(fd = open(name, O_RDONLY)) < 0)
+		goto exit;
+	if ((*buffer = MQTTPersistenceLog_read(s, fd, (LogEntry*)(node->content))) != NULL)
+	{
+		*buflen = ((LogEntry*)(node->content))->len;
+		rc = 0;
+	}
+	close(fd);
+exit:
+	free(name);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Append a remove record to the log, written with the next put.
+ *  See ::Persistence_remove
+ */
+int MQTTPersistenceLog_remove(void* handle, char* key)
+{
+	LogStore* s = handle;
+	Node* node;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	if ((node = TreeFind(s->index, key)) == NULL)
+		goto exit;	/* as removing a file which does not exist */
+	if (MQTTPersistenceLog_append(s, LOG_REMOVE, key, 0, NULL, NULL) < 0)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	MQTTPersistenceLog_unindex(s, node);
+	if (s->pendinglen >= LOG_COMMIT_BYTES)
+		rc = MQTTPersistenceLog_commit(s);
+	else
+		MQTTPersistenceLog_commitWithin(s, (s->commitInterval > 0) ? s->commitInterval : LOG_REMOVE_DELAY);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Return the live keys of the log, in key order.
+ *  See ::Persistence_keys
+ */
+int MQTTPersistenceLog_keys(void* handle, char*** keys, int* nkeys)
+{
+	LogStore* s = handle;
+	Node* node = NULL;
+	int i = 0, rc = 0;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	*keys = NULL;
+	*nkeys = 0;
+	if (s->index->count == 0)
+		goto exit;
+	if ((*keys = malloc(s->index->count * sizeof(char*))) == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	while ((node = TreeNextElement(s->index, node)) != NULL)
+	{
+		char* key = ((LogEntry*)(node->content))->key;
+
+		if (((*keys)[i] = malloc(strlen(key) + 1)) == NULL)
+		{
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			break;
+		}
+		strcpy((*keys)[i++], key);
+	}
+	*nkeys = i;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Delete the whole log and start it afresh.
+ *  See ::Persistence_clear
+ */
+int MQTTPersistenceLog_clear(void* handle)
+{
+	LogStore* s = handle;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	MQTTPersistenceLog_free(s, 1);
+	rc = MQTTPersistenceLog_startSegment(s);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Returns whether a key is live in the log.
+ *  See ::Persistence_containskey
+ */
+int MQTTPersistenceLog_containskey(void* handle, char* key)
+{
+	LogStore* s = handle;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s && TreeFind(s->index, key) != NULL)
+		rc = 0;
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * @file
+ * \brief A log-structured file system based persistence implementation
+ *
+ * Each put and remove is appended to a log of records instead of creating or deleting a file,
+ * so that persisting a message costs one write to a file which is already open.  Records
+ * which arrive together are written together, with one fdatasync() if wanted.
+ */
+
+#if !defined(MQTTPERSISTENCELOG_H)
+#define MQTTPERSISTENCELOG_H
+
+#include "MQTTClientPersistence.h"
+
+/**
+ * Name of the directory of the log, beneath the directory for the client
+ */
+#define LOG_DIRECTORY "log"
+
+/**
+ * Extension of the segment files, which are named by their number in hexadecimal
+ */
+#define LOG_SEGMENT_EXTENSION ".log"
+
+/**
+ * Default size after which the next segment is started
+ */
+#define LOG_DEFAULT_SEGMENT_SIZE (1024 * 1024)
+
+/**
+ * Pending records are written once there are this many bytes of them, whatever the commit interval
+ */
+#define LOG_COMMIT_BYTES (64 * 1024)
+
+/**
+ * Milliseconds removes wait for a put to be written with, when puts are written at once
+ */
+#define LOG_REMOVE_DELAY 100
+
+MQTTClient_logPersistenceOptions* MQTTPersistenceLog_copyOptions(MQTTClient_logPersistenceOptions* options);
+
+int MQTTPersistenceLog_open(void** handle, const char* clientID, const char* serverURI, void* context);
+int MQTTPersistenceLog_close(void* handle);
+int MQTTPersistenceLog_put(void* handle, char* key, int bufcount, char* buffers[], int buflens[]);
+int MQTTPersistenceLog_get(void* handle, char* key, char** buffer, int* buflen);
+int MQTTPersistenceLog_remove(void* handle, char* key);
+int MQTTPersistenceLog_keys(void* handle, char*** keys, int* nkeys);
+int MQTTPersistenceLog_clear(void* handle);
+int MQTTPersistenceLog_containskey(void* handle, char* key);
+
+#endif
@@ -0,0 +1,616 @@
+/**
+ * @file
+ * \brief A memory-mapped file based persistence implementation.
+ *
+ * The file #MMAP_FILE, in the directory #MMAP_DIRECTORY beneath the one the default
+ * persistence would use for the client, is a header giving the number and size of the slots
+ * followed by an array of slots for each kind of record kept in them: sent PUBLISH packets,
+ * sent PUBREL packets and received QoS 2 PUBLISH packets.  A record is kept in the slot of
+ * its message id modulo the number of slots, or the next free one after it.
+ *
+ * Each slot starts with a header of the message id, 0 when the slot is free, a generation,
+ * the length of the data and a CRC-32 of them and the data, which is stored last when a
+ * record is put.  A record whose checksum does not match, having been torn by a crash, is
+ * dropped when the file is opened.  A record put again goes in another slot, and its old slot
+ * is only freed once the new one is complete, so a crash leaves one or other whole; if it
+ * leaves both, the one of the later generation is kept.
+ *
+ * Records which do not fit in a slot, or are of another kind, are written to files in the
+ * directory for the client by the default persistence functions.
+ */
+
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "MQTTPersistenceMmap.h"
+#include "MQTTPersistenceDefault.h"
+#include "MQTTPersistence.h"
+#include "MQTTProtocolClient.h"
+#include "Log.h"
+#include "StackTrace.h"
+
+#include "Heap.h"
+
+#define MMAP_VERSION 1
+
+enum MmapKinds { MMAP_SENT, MMAP_PUBREL, MMAP_RECEIVED, MMAP_KINDS };
+
+static const char* MQTTPersistenceMmap_prefixes[MMAP_KINDS] =
+	{ PERSISTENCE_PUBLISH_SENT, PERSISTENCE_PUBREL, PERSISTENCE_PUBLISH_RECEIVED };
+
+/**
+ * The start of the file
+ */
+typedef struct
+{
+	char magic[4];			/**< "MQMP" */
+	unsigned int version;
+	unsigned int slots;		/**< number of slots of each kind */
+	unsigned int slotSize;	/**< size of the data of a slot */
+} MmapFileHeader;
+
+/**
+ * The start of a slot, followed by the data
+ */
+typedef struct
+{
+	unsigned int checksum;	/**< CRC-32 of the rest of the header and the data */
+	unsigned short msgid;	/**< 0 when the slot is free */
+	unsigned short generation;	/**< one more each time the record is put again */
+	unsigned int len;		/**< length of the data */
+} MmapSlot;
+
+/**
+ * The handle of an open file
+ */
+typedef struct
+{
+	char* clientDir;			/**< the directory for the client, from pstopen(), for other records */
+	char* dir;					/**< the directory of the mapped file */
+	char* map;					/**< the mapped file */
+	size_t mapsize;
+	int slots;
+	int slotSize;
+	int stride;					/**< distance between slots */
+	int live[MMAP_KINDS];		/**< records of each kind in slots */
+	int probes[MMAP_KINDS];		/**< slots after its own the furthest record of each kind may be in, + 1 */
+	int overflow;				/**< records in files */
+} MmapStore;
+
+
+/**
+ * Copy the options of a mapped file, for the context of the persistence structure
+ * @param options the options, or NULL for the defaults
+ * @return the copy, which is freed with free(), or NULL if the options are not valid
+ */
+MQTTClient_mmapPersistenceOptions* MQTTPersistenceMmap_copyOptions(MQTTClient_mmapPersistenceOptions* options)
+{
+	MQTTClient_mmapPersistenceOptions defaults = MQTTClient_mmapPersistenceOptions_initializer;
+	MQTTClient_mmapPersistenceOptions* copy = NULL;
+	const char* dir;
+
+	FUNC_ENTRY;
+	if (options == NULL)
+		options = &defaults;
+	else if (strncmp(options->struct_id, "MQMP", 4) != 0 || options->struct_version != 0)
+		goto exit;
+	dir = (options->directory) ? options->directory : ".";	/* working directory */
+	if ((copy = malloc(sizeof(MQTTClient_mmapPersistenceOptions) + strlen(dir) + 1)) == NULL)
+		goto exit;
+	*copy = *options;
+	copy->directory = strcpy((char*)(copy + 1), dir);
+exit:
+	FUNC_EXIT;
+	return copy;
+}
+
+
+/**
+ * Find the kind and message id of a key, if it is of a record kept in a slot
+ * @param key the key
+ * @param kind set to the kind of record
+ * @param msgid set to the message id
+ * @return boolean: whether the record is kept in a slot
+ */
+static int MQTTPersistenceMmap_parseKey(const char* key, int* kind, int* msgid)
+{
+	int k;
+
+	for (k = 0; k < MMAP_KINDS; ++k)
+	{
+		size_t len = strlen(MQTTPersistenceMmap_prefixes[k]);
+		const char* p = key + len;
+		long id = 0;
+
+		if (strncmp(key, MQTTPersistenceMmap_prefixes[k], len) != 0)
+			continue;
+		for (; *p >= '0' && *p <= '9' && id <= MAX_MSG_ID; ++p)
+			id = id * 10 + (*p - '0');
+		if (*p != '\0' || p == key + len || id == 0 || id > MAX_MSG_ID)
+			return 0;
+		*kind = k;
+		*msgid = (int)id;
+		return 1;
+	}
+	return 0;
+}
+
+
+static MmapSlot* MQTTPersistenceMmap_slot(MmapStore* s, int kind, int i)
+{
+	return (MmapSlot*)(s->map + sizeof(MmapFileHeader) + ((size_t)kind * s->slots + i) * s->stride);
+}
+
+
+static unsigned int MQTTPersistenceMmap_checksum(MmapSlot* slot)
+{
+	unsigned int crc = MQTTPersistence_checksum(0, (char*)&slot->msgid, sizeof(MmapSlot) - sizeof(slot->checksum));
+
+	return MQTTPersistence_checksum(crc, (char*)(slot + 1), slot->len);
+}
+
+
+/**
+ * Find the slot holding a record
+ * @param s the mapped file
+ * @param kind the kind of record
+ * @param msgid the message id of the record
+ * @return the slot, or NULL if the record is not in one
+ */
+static MmapSlot* MQTTPersistenceMmap_find(MmapStore* s, int kind, int msgid)
+{
+	int i;
+
+	for (i = 0; i < s->probes[kind]; ++i)
+	{
+		MmapSlot* slot = MQTTPersistenceMmap_slot(s, kind, (msgid + i) % s->slots);
+
+		if (slot->msgid == msgid)
+			return slot;
+	}
+	return NULL;
+}
+
+
+/**
+ * Find a free slot for a record
+ * @param s the mapped file
+ * @param kind the kind of record
+ * @param msgid the message id of the record
+ * @return the slot, or NULL if all are in use
+ */
+static MmapSlot* MQTTPersistenceMmap_place(MmapStore* s, int kind, int msgid)
+{
+	int i;
+
+	for (i = 0; i < s->slots; ++i)
+	{
+		MmapSlot* slot = MQTTPersistenceMmap_slot(s, kind, (msgid + i) % s->slots);
+
+		if (slot->msgid == 0)
+		{
+			if (i + 1 > s->probes[kind])
+				s->probes[kind] = i + 1;
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+
+static void MQTTPersistenceMmap_free(MmapStore* s, int kind, MmapSlot* slot)
+{
+	slot->msgid = 0;
+	slot->checksum = 0;
+	if (--(s->live[kind]) == 0)
+		s->probes[kind] = 0;
+}
+
+
+/**
+ * Whether a record is in a file, when there may be some
+ */
+static int MQTTPersistenceMmap_inFile(MmapStore* s, char* key)
+{
+	return s->overflow > 0 && pstcontainskey(s->clientDir, key) == 0;
+}
+
+
+/**
+ * Map the file, creating it if it does not exist or is not valid, and index its records
+ * @param s the store, with the sizes wanted for a new file
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise
+ */
+static int MQTTPersistenceMmap_map(MmapStore* s)
+{
+	MmapFileHeader header;
+	struct stat st;
+	char* name;
+	int fd = -1, k, i;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if ((name = malloc(strlen(s->dir) + strlen(MMAP_FILE) + 2)) == NULL)
+		goto exit;
+	sprintf(name, "%s/%s", s->dir, MMAP_FILE);
+	if ((fd = open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0 || fstat(fd, &st) != 0)
+		goto exit;
+	if (st.st_size >= (off_t)sizeof(header) && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+			memcmp(header.magic, "MQMP", 4) == 0 && header.version == MMAP_VERSION &&
+			header.slots > 0 && header.slotSize > 0)
+	{	/* keep the sizes the records were written with */
+		s->slots = header.slots;
+		s->slotSize = header.slotSize;
+	}
+	else
+		st.st_size = 0;
+	s->stride = (sizeof(MmapSlot) + s->slotSize + 7) & ~7;
+	s->mapsize = sizeof(MmapFileHeader) + (size_t)MMAP_KINDS * s->slots * s->stride;
+	if (st.st_size != (off_t)s->mapsize && (ftruncate(fd, 0) != 0 || ftruncate(fd, s->mapsize) != 0))
+		goto exit;	/* a new file is all free slots */
+	if ((s->map = mmap(NULL, s->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		s->map = NULL;
+		goto exit;
+	}
+	memcpy(header.magic, "MQMP", 4);
+	header.version = MMAP_VERSION;
+	header.slots = s->slots;
+	header.slotSize = s->slotSize;
+	memcpy(s->map, &header, sizeof(header));
+
+	for (k = 0; k < MMAP_KINDS; ++k)
+	{
+		for (i = 0; i < s->slots; ++i)
+		{
+			MmapSlot* slot = MQTTPersistenceMmap_slot(s, k, i);
+
+			if (slot->msgid == 0)
+				continue;
+			if (slot->len > (unsigned int)s->slotSize || slot->checksum != MQTTPersistenceMmap_checksum(slot))
+			{
+				Log(LOG_ERROR, 0, "Dropping torn persistence record %s%d", MQTTPersistenceMmap_prefixes[k], slot->msgid);
+				slot->msgid = 0;
+				slot->checksum = 0;
+				continue;
+			}
+			++(s->live[k]);
+			if ((i - slot->msgid % s->slots + s->slots) % s->slots + 1 > s->probes[k])
+				s->probes[k] = (i - slot->msgid % s->slots + s->slots) % s->slots + 1;
+		}
+		for (i = 0; i < s->slots; ++i)
+		{
+			MmapSlot* slot = MQTTPersistenceMmap_slot(s, k, i);
+			MmapSlot* other;
+
+			if (slot->msgid == 0 || (other = MQTTPersistenceMmap_find(s, k, slot->msgid)) == slot)
+				continue;
+			/* a crash came between putting the record again and freeing its old slot */
+			if ((short)(slot->generation - other->generation) > 0)
+				MQTTPersistenceMmap_free(s, k, other);
+			else
+				MQTTPersistenceMmap_free(s, k, slot);
+		}
+	}
+	rc = 0;
+exit:
+	if (fd >= 0)
+		close(fd);
+	free(name);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Open the mapped file of the client, creating it and its directory if needed.
+ *  See ::Persistence_open
+ */
+int MQTTPersistenceMmap_open(void** handle, const char* clientID, const char* serverURI, void* context)
+{
+	MQTTClient_mmapPersistenceOptions* options = context;
+	MmapStore* s = NULL;
+	char* clientDir = NULL;
+	char** keys = NULL;
+	int nkeys = 0, i;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (options == NULL || pstopen((void**)&clientDir, clientID, serverURI, (void*)options->directory) != 0)
+		goto exit;
+	if ((s = malloc(sizeof(MmapStore))) == NULL)
+		goto exit;
+	memset(s, '\0', sizeof(MmapStore));
+	s->clientDir = clientDir;
+	s->slots = (options->slots > 0) ? options->slots : MMAP_DEFAULT_SLOTS;
+	s->slotSize = (options->slotSize > 0) ? options->slotSize : MMAP_DEFAULT_SLOT_SIZE;
+	if ((s->dir = malloc(strlen(clientDir) + strlen(MMAP_DIRECTORY) + 2)) == NULL)
+		goto exit;
+	sprintf(s->dir, "%s/%s", clientDir, MMAP_DIRECTORY);
+	if (pstmkdir(s->dir) != 0 || MQTTPersistenceMmap_map(s) != 0 || pstkeys(clientDir, &keys, &nkeys) != 0)
+		goto exit;
+	s->overflow = nkeys;
+	for (i = 0; i < nkeys; ++i)
+		free(keys[i]);
+	free(keys);
+	rc = 0;
+exit:
+	if (rc == 0)
+		*handle = s;
+	else
+	{
+		if (s)
+		{
+			if (s->map)
+				munmap(s->map, s->mapsize);
+			free(s->dir);
+			free(s);
+		}
+		if (clientDir)
+			pstclose(clientDir);
+	}
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Unmap the file, deleting it if no records are left.
+ *  See ::Persistence_close
+ */
+int MQTTPersistenceMmap_close(void* handle)
+{
+	MmapStore* s = handle;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	munmap(s->map, s->mapsize);
+	if (s->live[MMAP_SENT] + s->live[MMAP_PUBREL] + s->live[MMAP_RECEIVED] == 0)
+	{
+		char* name = malloc(strlen(s->dir) + strlen(MMAP_FILE) + 2);
+
+		if (name)
+		{
+			sprintf(name, "%s/%s", s->dir, MMAP_FILE);
+			unlink(name);
+			free(name);
+		}
+		rmdir(s->dir);
+	}
+	rc = pstclose(s->clientDir);
+	free(s->dir);
+	free(s);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Copy a record into its slot, or write it to a file if it does not fit in one.
+ *  See ::Persistence_put
+ */
+int MQTTPersistenceMmap_put(void* handle, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	MmapStore* s = handle;
+	MmapSlot* slot = NULL;
+	MmapSlot* old = NULL;
+	int kind, msgid;
+	int len = 0, i;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	for (i = 0; i < bufcount; ++i)
+		len += buflens[i];
+	if (MQTTPersistenceMmap_parseKey(key, &kind, &msgid))
+	{	/* never overwrite the old record, which must stay whole until the new one is */
+		old = MQTTPersistenceMmap_find(s, kind, msgid);
+		if (len <= s->slotSize && (slot = MQTTPersistenceMmap_place(s, kind, msgid)) != NULL)
+			++(s->live[kind]);
+	}
+	if (slot)
+	{
+		char* data = (char*)(slot + 1);
+
+		for (i = 0; i < bufcount; ++i)
+		{
+			memcpy(data, buffers[i], buflens[i]);
+			data += buflens[i];
+		}
+		slot->len = len;
+		slot->generation = (old) ? old->generation + 1 : 0;
+		slot->msgid = (unsigned short)msgid;
+		slot->checksum = MQTTPersistenceMmap_checksum(slot);
+		rc = 0;
+		if (MQTTPersistenceMmap_inFile(s, key) && pstremove(s->clientDir, key) == 0)
+			--(s->overflow);
+	}
+	else
+	{
+		int exists = MQTTPersistenceMmap_inFile(s, key);
+
+		if ((rc = pstput(s->clientDir, key, bufcount, buffers, buflens)) == 0 && !exists)
+			++(s->overflow);
+	}
+	if (rc == 0 && old)
+		MQTTPersistenceMmap_free(s, kind, old);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Copy a record from its slot or file.
+ *  See ::Persistence_get
+ */
+int MQTTPersistenceMmap_get(void* handle, char* key, char** buffer, int* buflen)
+{
+	MmapStore* s = handle;
+	MmapSlot* slot;
+	int kind, msgid;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	if (MQTTPersistenceMmap_parseKey(key, &kind, &msgid) && (slot = MQTTPersistenceMmap_find(s, kind, msgid)) != NULL)
+	{
+		if ((*buffer = malloc(slot->len + 1)) != NULL)	/* not malloc(0) */
+		{
+			memcpy(*buffer, slot + 1, slot->len);
+			*buflen = slot->len;
+			rc = 0;
+		}
+	}
+	else if (s->overflow > 0)
+		rc = pstget(s->clientDir, key, buffer, buflen);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Free the slot of a record, or remove its file.
+ *  See ::Persistence_remove
+ */
+int MQTTPersistenceMmap_remove(void* handle, char* key)
+{
+	MmapStore* s = handle;
+	MmapSlot* slot;
+	int kind, msgid;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+	else if (MQTTPersistenceMmap_parseKey(key, &kind, &msgid) && (slot = MQTTPersistenceMmap_find(s, kind, msgid)) != NULL)
+		MQTTPersistenceMmap_free(s, kind, slot);
+	else if (MQTTPersistenceMmap_inFile(s, key) && (rc = pstremove(s->clientDir, key)) == 0)
+		--(s->overflow);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Return the keys of the records in slots and files.
+ *  See ::Persistence_keys
+ */
+int MQTTPersistenceMmap_keys(void* handle, char*** keys, int* nkeys)
+{
+	MmapStore* s = handle;
+	char** fkeys = NULL;
+	int nfkeys = 0, n, k, i;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	*keys = NULL;
+	*nkeys = 0;
+	if (s->overflow > 0 && pstkeys(s->clientDir, &fkeys, &nfkeys) != 0)
+		goto exit;
+	n = s->live[MMAP_SENT] + s->live[MMAP_PUBREL] + s->live[MMAP_RECEIVED] + nfkeys;
+	rc = 0;
+	if (n == 0)
+		goto exit;
+	if ((*keys = malloc(n * sizeof(char*))) == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	n = 0;
+	for (k = 0; k < MMAP_KINDS; ++k)
+	{
+		for (i = 0; i < s->slots && rc == 0; ++i)
+		{
+			MmapSlot* slot = MQTTPersistenceMmap_slot(s, k, i);
+
+			if (slot->msgid == 0)
+				continue;
+			if (((*keys)[n] = malloc(PERSISTENCE_MAX_KEY_LENGTH + 1)) == NULL)
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			else
+				sprintf((*keys)[n++], "%s%d", MQTTPersistenceMmap_prefixes[k], slot->msgid);
+		}
+	}
+	for (i = 0; i < nfkeys; ++i)
+		(*keys)[n++] = fkeys[i];
+	*nkeys = n;
+exit:
+	free(fkeys);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Free all the slots and remove all the files.
+ *  See ::Persistence_clear
+ */
+int MQTTPersistenceMmap_clear(void* handle)
+{
+	MmapStore* s = handle;
+	char** keys = NULL;
+	int nkeys = 0, k, i;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	for (k = 0; k < MMAP_KINDS; ++k)
+	{
+		for (i = 0; i < s->slots; ++i)
+		{
+			MmapSlot* slot = MQTTPersistenceMmap_slot(s, k, i);
+
+			slot->msgid = 0;
+			slot->checksum = 0;
+		}
+		s->live[k] = s->probes[k] = 0;
+	}
+	rc = 0;
+	if (s->overflow > 0 && (rc = pstkeys(s->clientDir, &keys, &nkeys)) == 0)
+	{	/* each by name, as pstclear() looks for them in the working directory */
+		for (i = 0; i < nkeys; ++i)
+		{
+			if (rc == 0 && (rc = pstremove(s->clientDir, keys[i])) == 0)
+				--(s->overflow);
+			free(keys[i]);
+		}
+		free(keys);
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Returns whether a record is in a slot or file.
+ *  See ::Persistence_containskey
+ */
+int MQTTPersistenceMmap_containskey(void* handle, char* key)
+{
+	MmapStore* s = handle;
+	int kind, msgid;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	if (MQTTPersistenceMmap_parseKey(key, &kind, &msgid) && MQTTPersistenceMmap_find(s, kind, msgid) != NULL)
+		rc = 0;
+	else if (MQTTPersistenceMmap_inFile(s, key))
+		rc = 0;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * @file
+ * \brief A memory-mapped file based persistence implementation
+ *
+ * In-flight messages are kept in the slots of one file of fixed size mapped into memory,
+ * so that persisting a message is a copy into its slot and removing it a store to the
+ * slot header, with no system call.  Meant for a persistence directory on tmpfs or
+ * battery-backed RAM, where the file-per-message design only adds overhead.
+ */
+
+#if !defined(MQTTPERSISTENCEMMAP_H)
+#define MQTTPERSISTENCEMMAP_H
+
+#include "MQTTClientPersistence.h"
+
+/**
+ * Name of the directory of the mapped file, beneath the directory for the client, which
+ * itself holds the records which are not kept in slots
+ */
+#define MMAP_DIRECTORY "mmap"
+
+/**
+ * Name of the mapped file
+ */
+#define MMAP_FILE "slots"
+
+/**
+ * Default number of slots for each kind of record
+ */
+#define MMAP_DEFAULT_SLOTS 64
+
+/**
+ * Default size of the data of a slot
+ */
+#define MMAP_DEFAULT_SLOT_SIZE 1024
+
+MQTTClient_mmapPersistenceOptions* MQTTPersistenceMmap_copyOptions(MQTTClient_mmapPersistenceOptions* options);
+
+int MQTTPersistenceMmap_open(void** handle, const char* clientID, const char* serverURI, void* context);
+int MQTTPersistenceMmap_close(void* handle);
+int MQTTPersistenceMmap_put(void* handle, char* key, int bufcount, char* buffers[], int buflens[]);
+int MQTTPersistenceMmap_get(void* handle, char* key, char** buffer, int* buflen);
+int MQTTPersistenceMmap_remove(void* handle, char* key);
+int MQTTPersistenceMmap_keys(void* handle, char*** keys, int* nkeys);
+int MQTTPersistenceMmap_clear(void* handle);
+int MQTTPersistenceMmap_containskey(void* handle, char* key);
+
+#endif
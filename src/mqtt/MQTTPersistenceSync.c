@@ -0,0 +1,417 @@
+/**
+ * @file
+ * \brief The file system based persistence with a choice of durability.
+ *
+ * Records are written to the same files, in the same directory, as by the default
+ * persistence functions, which are used for everything but writing them.  A file is
+ * written with one open() and write() rather than through stdio, and then:
+ *
+ * - in async mode, closed, leaving it to the operating system to write out;
+ * - in strict mode, synced with fdatasync(), and its directory with fsync() so that the
+ *   file is found after a power cut, before the put returns and so before the packet is sent;
+ * - in interval mode, kept open until the sync timer expires or the configured number of
+ *   files are waiting, when they are all synced and the directory once.
+ *
+ * A remove is never synced on its own: losing one only means a message is sent again, and
+ * the next sync of the directory makes it durable.
+ */
+
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "MQTTPersistenceSync.h"
+#include "MQTTPersistenceDefault.h"
+#include "Log.h"
+#include "Timer.h"
+#include "StackTrace.h"
+
+#include "Heap.h"
+
+/**
+ * A file written in interval mode and not yet synced
+ */
+typedef struct
+{
+	char* key;
+	int fd;
+} SyncPending;
+
+/**
+ * The handle of an open store
+ */
+typedef struct
+{
+	char* clientDir;		/**< the directory for the client, from pstopen() */
+	int dirfd;				/**< the directory, open for fsync() */
+	int durability;
+	int syncInterval;
+	SyncPending* pending;	/**< files waiting to be synced, in interval mode */
+	int npending;
+	int maxpending;
+	int dirty;				/**< set when the directory has changed since it was last synced */
+	Timer sync_timer;		/**< armed while there are files waiting or the directory is dirty */
+} SyncStore;
+
+
+/**
+ * Copy the options of the default persistence, for the context of the persistence structure
+ * @param options the options, or NULL for the defaults
+ * @return the copy, which is freed with free(), or NULL if the options are not valid
+ */
+MQTTClient_defaultPersistenceOptions* MQTTPersistenceSync_copyOptions(MQTTClient_defaultPersistenceOptions* options)
+{
+	MQTTClient_defaultPersistenceOptions defaults = MQTTClient_defaultPersistenceOptions_initializer;
+	MQTTClient_defaultPersistenceOptions* copy = NULL;
+	const char* dir;
+
+	FUNC_ENTRY;
+	if (options == NULL)
+		options = &defaults;
+	if (strncmp(options->struct_id, "MQDP", 4) != 0 || options->struct_version != 0 ||
+			options->durability < MQTTCLIENT_PERSISTENCE_ASYNC || options->durability > MQTTCLIENT_PERSISTENCE_STRICT)
+		goto exit;
+	dir = (options->directory) ? options->directory : ".";	/* working directory */
+	if ((copy = malloc(sizeof(MQTTClient_defaultPersistenceOptions) + strlen(dir) + 1)) == NULL)
+		goto exit;
+	*copy = *options;
+	copy->directory = strcpy((char*)(copy + 1), dir);
+exit:
+	FUNC_EXIT;
+	return copy;
+}
+
+
+/**
+ * Find the file waiting to be synced for a key
+ * @param s the store
+ * @param key the key
+ * @return its index in the pending files, or -1 if it is not waiting
+ */
+static int MQTTPersistenceSync_findPending(SyncStore* s, const char* key)
+{
+	int i;
+
+	for (i = 0; i < s->npending; ++i)
+	{
+		if (strcmp(s->pending[i].key, key) == 0)
+			return i;
+	}
+	return -1;
+}
+
+
+/**
+ * Close a file waiting to be synced without syncing it, as it has been rewritten or removed
+ * @param s the store
+ * @param i its index in the pending files
+ */
+static void MQTTPersistenceSync_dropPending(SyncStore* s, int i)
+{
+	close(s->pending[i].fd);
+	free(s->pending[i].key);
+	s->pending[i] = s->pending[--(s->npending)];
+}
+
+
+/**
+ * Sync the files waiting to be synced and then the directory
+ * @param s the store
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise
+ */
+static int MQTTPersistenceSync_flush(SyncStore* s)
+{
+	int rc = 0;
+	int i;
+
+	FUNC_ENTRY;
+	Timer_cancel(&s->sync_timer);
+	for (i = 0; i < s->npending; ++i)
+	{
+		if (fdatasync(s->pending[i].fd) != 0)
+		{
+			Log(LOG_ERROR, 0, "Error %d syncing persisted message %s", errno, s->pending[i].key);
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		}
+		close(s->pending[i].fd);
+		free(s->pending[i].key);
+	}
+	if (s->npending > 0 || s->dirty)
+	{
+		if (fsync(s->dirfd) != 0)
+		{
+			Log(LOG_ERROR, 0, "Error %d syncing persistence directory %s", errno, s->clientDir);
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		}
+		s->dirty = 0;
+	}
+	s->npending = 0;
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static void MQTTPersistenceSync_syncExpired(Timer* timer, void* context)
+{
+	MQTTPersistenceSync_flush((SyncStore*)context);
+}
+
+
+/**
+ * Make sure the directory is synced within the interval, with anything waiting
+ * @param s the store
+ */
+static void MQTTPersistenceSync_syncLater(SyncStore* s)
+{
+	if (!Timer_isArmed(&s->sync_timer))
+		Timer_arm(&s->sync_timer, s->syncInterval, MQTTPersistenceSync_syncExpired, s);
+}
+
+
+/**
+ * Write the buffers of a record to a file
+ * @param fd the file
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise
+ */
+static int MQTTPersistenceSync_write(int fd, int bufcount, char* buffers[], int buflens[])
+{
+	int i;
+
+	for (i = 0; i < bufcount; ++i)
+	{
+		int written = 0;
+
+		while (written < buflens[i])
+		{
+			ssize_t count = write(fd, buffers[i] + written, buflens[i] - written);
+
+			if (count < 0 && errno != EINTR)
+				return MQTTCLIENT_PERSISTENCE_ERROR;
+			if (count > 0)
+				written += (int)count;
+		}
+	}
+	return 0;
+}
+
+
+/** Open the directory of the client, creating it if needed.
+ *  See ::Persistence_open
+ */
+int MQTTPersistenceSync_open(void** handle, const char* clientID, const char* serverURI, void* context)
+{
+	MQTTClient_defaultPersistenceOptions* options = context;
+	SyncStore* s = NULL;
+	char* clientDir = NULL;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (options == NULL || pstopen((void**)&clientDir, clientID, serverURI, (void*)options->directory) != 0)
+		goto exit;
+	if ((s = malloc(sizeof(SyncStore))) == NULL)
+		goto exit;
+	memset(s, '\0', sizeof(SyncStore));
+	s->clientDir = clientDir;
+	s->durability = options->durability;
+	s->syncInterval = (options->syncInterval > 0) ? options->syncInterval : SYNC_DEFAULT_INTERVAL;
+	s->maxpending = (options->syncRecords > 0) ? options->syncRecords : SYNC_DEFAULT_RECORDS;
+	Timer_init(&s->sync_timer);
+	if (s->durability == MQTTCLIENT_PERSISTENCE_INTERVAL &&
+			(s->pending = malloc(s->maxpending * sizeof(SyncPending))) == NULL)
+		goto exit;
+	if ((s->dirfd = open(clientDir, O_RDONLY)) >= 0)
+		rc = 0;
+exit:
+	if (rc == 0)
+		*handle = s;
+	else
+	{
+		if (s)
+		{
+			free(s->pending);
+			free(s);
+		}
+		if (clientDir)
+			pstclose(clientDir);
+	}
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Sync anything waiting and close the directory, deleting it if it is empty.
+ *  See ::Persistence_close
+ */
+int MQTTPersistenceSync_close(void* handle)
+{
+	SyncStore* s = handle;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	MQTTPersistenceSync_flush(s);
+	close(s->dirfd);
+	rc = pstclose(s->clientDir);
+	free(s->pending);
+	free(s);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Write a record to its file, and sync it as the durability wants.
+ *  See ::Persistence_put
+ */
+int MQTTPersistenceSync_put(void* handle, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	SyncStore* s = handle;
+	char* file = NULL;
+	int fd = -1, i;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	if ((i = MQTTPersistenceSync_findPending(s, key)) >= 0)
+		MQTTPersistenceSync_dropPending(s, i);
+	/* consider '/' + '\0' */
+	if ((file = malloc(strlen(s->clientDir) + strlen(key) + strlen(MESSAGE_FILENAME_EXTENSION) + 2)) == NULL)
+		goto exit;
+	sprintf(file, "%s/%s%s", s->clientDir, key, MESSAGE_FILENAME_EXTENSION);
+	if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) < 0)
+		goto exit;
+	if (MQTTPersistenceSync_write(fd, bufcount, buffers, buflens) != 0)
+		goto exit;
+	if (s->durability == MQTTCLIENT_PERSISTENCE_STRICT)
+	{
+		if (fdatasync(fd) != 0 || fsync(s->dirfd) != 0)
+			goto exit;
+		s->dirty = 0;
+	}
+	else if (s->durability == MQTTCLIENT_PERSISTENCE_INTERVAL)
+	{
+		SyncPending* p = &s->pending[s->npending];
+
+		if ((p->key = malloc(strlen(key) + 1)) == NULL)
+			goto exit;
+		strcpy(p->key, key);
+		p->fd = fd;
+		fd = -1;	/* closed when it is synced */
+		if (++(s->npending) == s->maxpending)
+			MQTTPersistenceSync_flush(s);
+		else
+			MQTTPersistenceSync_syncLater(s);
+	}
+	rc = 0;
+exit:
+	if (fd >= 0)
+		close(fd);
+	if (rc != 0 && file)
+		unlink(file);
+	free(file);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Read a record from its file.
+ *  See ::Persistence_get
+ */
+int MQTTPersistenceSync_get(void* handle, char* key, char** buffer, int* buflen)
+{
+	SyncStore* s = handle;
+
+	return (s) ? pstget(s->clientDir, key, buffer, buflen) : MQTTCLIENT_PERSISTENCE_ERROR;
+}
+
+
+/** Delete the file of a record, leaving the directory to be synced with the next put.
+ *  See ::Persistence_remove
+ */
+int MQTTPersistenceSync_remove(void* handle, char* key)
+{
+	SyncStore* s = handle;
+	int i;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	if ((i = MQTTPersistenceSync_findPending(s, key)) >= 0)
+		MQTTPersistenceSync_dropPending(s, i);
+	if ((rc = pstremove(s->clientDir, key)) == 0 && s->durability != MQTTCLIENT_PERSISTENCE_ASYNC)
+	{
+		s->dirty = 1;
+		if (s->durability == MQTTCLIENT_PERSISTENCE_INTERVAL)
+			MQTTPersistenceSync_syncLater(s);
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Return the keys of the records in files.
+ *  See ::Persistence_keys
+ */
+int MQTTPersistenceSync_keys(void* handle, char*** keys, int* nkeys)
+{
+	SyncStore* s = handle;
+
+	return (s) ? pstkeys(s->clientDir, keys, nkeys) : MQTTCLIENT_PERSISTENCE_ERROR;
+}
+
+
+/** Delete the files of all the records, and sync the directory.
+ *  See ::Persistence_clear
+ */
+int MQTTPersistenceSync_clear(void* handle)
+{
+	SyncStore* s = handle;
+	char** keys = NULL;
+	int nkeys = 0, i;
+	int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	while (s->npending > 0)
+		MQTTPersistenceSync_dropPending(s, s->npending - 1);
+	if ((rc = pstkeys(s->clientDir, &keys, &nkeys)) == 0)
+	{	/* each by name, as pstclear() looks for them in the working directory */
+		for (i = 0; i < nkeys; ++i)
+		{
+			if (rc == 0)
+				rc = pstremove(s->clientDir, keys[i]);
+			free(keys[i]);
+		}
+		free(keys);
+	}
+	s->dirty = (s->durability != MQTTCLIENT_PERSISTENCE_ASYNC);
+	if (MQTTPersistenceSync_flush(s) != 0)
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Returns whether a record has a file.
+ *  See ::Persistence_containskey
+ */
+int MQTTPersistenceSync_containskey(void* handle, char* key)
+{
+	SyncStore* s = handle;
+
+	return (s) ? pstcontainskey(s->clientDir, key) : MQTTCLIENT_PERSISTENCE_ERROR;
+}
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ * @file
+ * \brief The file system based persistence with a choice of durability
+ *
+ * The files of the default persistence, written without stdio and synced to the device
+ * each before the packet it records is sent, or in batches by a timer, or not at all, as
+ * chosen in ::MQTTClient_defaultPersistenceOptions.
+ */
+
+#if !defined(MQTTPERSISTENCESYNC_H)
+#define MQTTPERSISTENCESYNC_H
+
+#include "MQTTClientPersistence.h"
+
+/**
+ * Default milliseconds a file may wait to be synced in interval mode
+ */
+#define SYNC_DEFAULT_INTERVAL 100
+
+/**
+ * Default number of files synced together in interval mode
+ */
+#define SYNC_DEFAULT_RECORDS 32
+
+MQTTClient_defaultPersistenceOptions* MQTTPersistenceSync_copyOptions(MQTTClient_defaultPersistenceOptions* options);
+
+int MQTTPersistenceSync_open(void** handle, const char* clientID, const char* serverURI, void* context);
+int MQTTPersistenceSync_close(void* handle);
+int MQTTPersistenceSync_put(void* handle, char* key, int bufcount, char* buffers[], int buflens[]);
+int MQTTPersistenceSync_get(void* handle, char* key, char** buffer, int* buflen);
+int MQTTPersistenceSync_remove(void* handle, char* key);
+int MQTTPersistenceSync_keys(void* handle, char*** keys, int* nkeys);
+int MQTTPersistenceSync_clear(void* handle);
+int MQTTPersistenceSync_containskey(void* handle, char* key);
+
+#endif
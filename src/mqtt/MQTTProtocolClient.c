@@ -28,6 +28,7 @@
 
 
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "MQTTProtocolClient.h"
 #if !defined(NO_PERSISTENCE)
@@ -41,8 +42,15 @@
 #define min(A,B) ( (A) < (B) ? (A):(B))
 #endif
 
+/**
+ * Milliseconds to wait before trying again to send a packet held up by a partially written one
+ */
+#define PENDING_WRITE_RETRY_DELAY 100
+
 void Protocol_processPublication(Publish* publish, Clients* client);
 void MQTTProtocol_closeSession(Clients* client, int sendwill);
+static void MQTTProtocol_measureRoundTrip(Clients* client, Messages* m);
+static void MQTTProtocol_windowAcked(Clients* client);
 
 extern MQTTProtocol state;
 extern ClientStates* bstate;
@@ -60,28 +68,76 @@ int messageIDCompare(void* a, void* b)	//-
 }
 
 
+/**
+ * Find the lowest bit set in a word
+ * @param word the word, not 0
+ * @return the index of the bit
+ */
+static int MQTTProtocol_lowestBit(unsigned int word)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(word);
+#else
+	int bit = 0;
+
+	while ((word & 1) == 0)
+	{
+		word >>= 1;
+		++bit;
+	}
+	return bit;
+#endif
+}
+
+
+/**
+ * Find the lowest message id not in use, from a starting point
+ * @param client a client structure
+ * @param from the id to start at, at least 1
+ * @return the message id, or 0 if all from the starting point up to the maximum are in use
+ */
+static int MQTTProtocol_findFreeMsgId(Clients* client, int from)
+{
+	int word = from >> 5;
+	unsigned int bits = ~client->outboundIds[word] & (~0U << (from & 31));
+	int summary;
+
+	if (bits)
+		return (word << 5) + MQTTProtocol_lowestBit(bits);
+	/* the words after it which are not full, 32 at a time */
+	for (++word, summary = word >> 5; summary < MSGID_BITMAP_WORDS / 32; ++summary)
+	{
+		unsigned int notfull = ~client->outboundFull[summary];
+
+		if (summary == word >> 5)
+			notfull &= ~0U << (word & 31);
+		if (notfull)
+		{
+			word = (summary << 5) + MQTTProtocol_lowestBit(notfull);
+			return (word << 5) + MQTTProtocol_lowestBit(~client->outboundIds[word]);
+		}
+	}
+	return 0;
+}
+
+
 /**
  * Assign a new message id for a client.  Make sure it isn't already being used and does
- * not exceed the maximum.
+ * not exceed the maximum.  The ids of the messages in flight are kept in a bitmap, with a
+ * second bitmap of its full words, so finding the next free id after the last one assigned
+ * looks at no more than a few words however many messages are in flight.
  * @param client a client structure
  * @return the next message id to use, or 0 if none available
  */
 int MQTTProtocol_assignMsgId(Clients* client)	//-Ϊͻ˷һµϢID,ԭ,ӲԹ涨,ظ
 {
-	int start_msgid = client->msgID;
-	int msgid = start_msgid;
+	int msgid = 0;
 
 	FUNC_ENTRY;
-	msgid = (msgid == MAX_MSG_ID) ? 1 : msgid + 1;	//-мһ
-	while (ListFindItem(client->outboundMsgs, &msgid, messageIDCompare) != NULL)	//-ֵòб
-	{//-ûظĻΪ
-		msgid = (msgid == MAX_MSG_ID) ? 1 : msgid + 1;
-		if (msgid == start_msgid) 
-		{ /* we've tried them all - none free */
-			msgid = 0;
-			break;
-		}
-	}
+	if (client->msgID < MAX_MSG_ID)
+		msgid = MQTTProtocol_findFreeMsgId(client, client->msgID + 1);
+	if (msgid == 0)
+		msgid = MQTTProtocol_findFreeMsgId(client, 1);	/* wrap around */
 	if (msgid != 0)
 		client->msgID = msgid;	//-¼ϢID,Ψһ
 	FUNC_EXIT_RC(msgid);
@@ -89,6 +145,204 @@ int MQTTProtocol_assignMsgId(Clients* client)	//-Ϊ
 }
 
 
+/**
+ * Record that a message id is in use by a message in flight
+ * @param client a client structure
+ * @param msgid the message id
+ */
+void MQTTProtocol_useMsgId(Clients* client, int msgid)
+{
+	int word = msgid >> 5;
+
+	client->outboundIds[word] |= 1U << (msgid & 31);
+	if (client->outboundIds[word] == ~0U)
+		client->outboundFull[word >> 5] |= 1U << (word & 31);
+}
+
+
+/**
+ * Record that a message id is no longer in use
+ * @param client a client structure
+ * @param msgid the message id
+ */
+void MQTTProtocol_releaseMsgId(Clients* client, int msgid)
+{
+	int word = msgid >> 5;
+
+	client->outboundIds[word] &= ~(1U << (msgid & 31));
+	client->outboundFull[word >> 5] &= ~(1U << (word & 31));
+}
+
+
+/**
+ * Record that no message ids are in use, when the messages in flight are discarded
+ * @param client a client structure
+ */
+void MQTTProtocol_releaseMsgIds(Clients* client)
+{
+	memset(client->outboundIds, '\0', sizeof(client->outboundIds));
+	memset(client->outboundFull, '\0', sizeof(client->outboundFull));
+}
+
+
+/**
+ * Is a message id in use by a message in flight?
+ * @param client a client structure
+ * @param msgid the message id
+ * @return boolean
+ */
+int MQTTProtocol_msgIdInUse(Clients* client, int msgid)
+{
+	return msgid > 0 && msgid <= MAX_MSG_ID && (client->outboundIds[msgid >> 5] & (1U << (msgid & 31))) != 0;
+}
+
+
+/**
+ * Find the slot of a message id in an index: the slot holding it, or the empty one ending its probe
+ * @param index the index, with at least one slot
+ * @param msgid the message id
+ * @return the slot number
+ */
+static int MQTTProtocol_messageSlot(MessageIndex* index, int msgid)
+{
+	int mask = index->size - 1;
+	int i = msgid & mask;	/* ids are mostly assigned in sequence, so they spread evenly as they are */
+
+	while (index->slots[i] && ((Messages*)(index->slots[i]->content))->msgid != msgid)
+		i = (i + 1) & mask;
+	return i;
+}
+
+
+/**
+ * Find a message in a list by message id, through the index of the list
+ * @param index the index of the list
+ * @param msgid the message id
+ * @return the element of the list holding the message, or NULL if there is none
+ */
+ListElement* MQTTProtocol_findMessage(MessageIndex* index, int msgid)
+{
+	return (index->size == 0) ? NULL : index->slots[MQTTProtocol_messageSlot(index, msgid)];
+}
+
+
+/**
+ * Add the element of a message list to the index of the list, replacing any with the same id
+ * @param index the index of the list
+ * @param elem the element holding the message
+ * @return 0 on success, -1 if the index was full and could not be grown
+ */
+int MQTTProtocol_indexMessage(MessageIndex* index, ListElement* elem)
+{
+	int rc = 0;
+	int i;
+
+	if ((index->count + 1) * 2 > index->size)
+	{
+		int size = (index->size == 0) ? MESSAGE_INDEX_INITIAL_SIZE : index->size * 2;
+		ListElement** slots = malloc(sizeof(ListElement*) * size);
+
+		if (slots == NULL)
+		{
+			if (index->count + 1 >= index->size)
+			{
+				rc = -1;	/* linear probing needs an empty slot to end on */
+				goto exit;
+			}
+		}
+		else
+		{
+			ListElement** old = index->slots;
+			int oldsize = index->size;
+
+			memset(slots, '\0', sizeof(ListElement*) * size);
+			index->slots = slots;
+			index->size = size;
+			for (i = 0; i < oldsize; ++i)
+			{
+				if (old[i])
+					index->slots[MQTTProtocol_messageSlot(index, ((Messages*)(old[i]->content))->msgid)] = old[i];
+			}
+			if (old)
+				free(old);
+		}
+	}
+	i = MQTTProtocol_messageSlot(index, ((Messages*)(elem->content))->msgid);
+	if (index->slots[i] == NULL)
+		++(index->count);
+	index->slots[i] = elem;
+exit:
+	return rc;
+}
+
+
+/**
+ * Remove a message id from an index.  The messages after it in the same run of slots are moved
+ * back so that no probe for them stops short at the emptied slot.
+ * @param index the index of the list
+ * @param msgid the message id
+ */
+void MQTTProtocol_unindexMessage(MessageIndex* index, int msgid)
+{
+	int mask = index->size - 1;
+	int i, j;
+
+	if (index->size == 0 || index->slots[i = MQTTProtocol_messageSlot(index, msgid)] == NULL)
+		return;
+	index->slots[i] = NULL;
+	--(index->count);
+	for (j = (i + 1) & mask; index->slots[j]; j = (j + 1) & mask)
+	{
+		int home = ((Messages*)(index->slots[j]->content))->msgid & mask;
+
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{	/* the gap is between its home slot and where it is, so it can move back into it */
+			index->slots[i] = index->slots[j];
+			index->slots[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+
+/**
+ * Empty an index and free its slots, when its list is emptied
+ * @param index the index
+ */
+void MQTTProtocol_emptyIndex(MessageIndex* index)
+{
+	if (index->slots)
+		free(index->slots);
+	index->slots = NULL;
+	index->size = index->count = 0;
+}
+
+
+/**
+ * Rebuild the indexes and message id bitmap of a client from its lists of messages in flight,
+ * when those have been restored from persistence
+ * @param client a client structure
+ */
+void MQTTProtocol_indexMessages(Clients* client)
+{
+	ListElement* current = NULL;
+
+	FUNC_ENTRY;
+	MQTTProtocol_emptyIndex(&client->inboundIndex);
+	MQTTProtocol_emptyIndex(&client->outboundIndex);
+	MQTTProtocol_releaseMsgIds(client);
+	while (ListNextElement(client->inboundMsgs, &current))
+		MQTTProtocol_indexMessage(&client->inboundIndex, current);
+	current = NULL;
+	while (ListNextElement(client->outboundMsgs, &current))
+	{
+		MQTTProtocol_indexMessage(&client->outboundIndex, current);
+		MQTTProtocol_useMsgId(client, ((Messages*)(current->content))->msgid);
+	}
+	FUNC_EXIT;
+}
+
+
 void MQTTProtocol_storeQoS0(Clients* pubclient, Publish* publish)	//-ķܱȽϼ򵥽ͳȥ,ҪӵĴ:һ
 {
 	int len;
@@ -109,6 +363,25 @@ void MQTTProtocol_storeQoS0(Clients* pubclient, Publish* publish)	//-
 }
 
 
+/**
+ * Hold a reference to a stored publication until the queued write of a packet which points
+ * into it has finished, as its acknowledgement can arrive and remove it before then
+ * @param client the client whose socket the packet is queued on
+ * @param p the publication
+ */
+static void MQTTProtocol_holdPublication(Clients* client, Publications* p)
+{
+	pending_write* pw = malloc(sizeof(pending_write));
+
+	FUNC_ENTRY;
+	++(p->refcount);
+	pw->p = p;
+	pw->socket = client->net.socket;
+	ListAppend(&(state.pending_writes), pw, sizeof(pending_write));
+	FUNC_EXIT;
+}
+
+
 /**
  * Utility function to start a new publish exchange.
  * @param pubclient the client to send the publication to
@@ -137,7 +410,8 @@ int MQTTProtocol_startPublishCommon(Clients* pubclient, Publish* publish, int qo
  * @param qos the MQTT QoS to use
  * @param retained boolean - whether to set the MQTT retained flag
  * @param mm - pointer to the message to send
- * @return the completion code
+ * @return the completion code, or MESSAGE_INDEX_FAILED if the message could not be indexed,
+ * when it is discarded and *mm set to NULL
  */
 int MQTTProtocol_startPublish(Clients* pubclient, Publish* publish, int qos, int retained, Messages** mm)	//-ʼ
 {
@@ -148,13 +422,30 @@ int MQTTProtocol_startPublish(Clients* pubclient, Publish* publish, int qos, int
 	if (qos > 0)	//-0 һ,1 һ,2 ֻһ
 	{
 		*mm = MQTTProtocol_createMessage(publish, mm, qos, retained);	//-ȴϢ
-		ListAppend(pubclient->outboundMsgs, *mm, (*mm)->len);	//-Ȼб
+		ListAppend(pubclient->outboundMsgs, *mm, (*mm)->len);
+		if (MQTTProtocol_indexMessage(&pubclient->outboundIndex, pubclient->outboundMsgs->last) != 0)
+		{	/* its acknowledgements could not be matched to it */
+			Log(LOG_ERROR, -1, "Could not index message %d for client %s", (*mm)->msgid, pubclient->clientID);
+			MQTTProtocol_removePublication((*mm)->publish);
+			ListRemove(pubclient->outboundMsgs, *mm);
+			*mm = NULL;
+			rc = MESSAGE_INDEX_FAILED;
+			goto exit;
+		}
+		MQTTProtocol_useMsgId(pubclient, (*mm)->msgid);	//-Ȼб
 		/* we change these pointers to the saved message location just in case the packet could not be written
 		entirely; the socket buffer will use these locations to finish writing the packet */
 		p.payload = (*mm)->publish->payload;
 		p.topic = (*mm)->publish->topic;
 	}
 	rc = MQTTProtocol_startPublishCommon(pubclient, &p, qos, retained);
+	if (qos > 0)
+	{
+		if (rc == TCPSOCKET_INTERRUPTED)
+			MQTTProtocol_holdPublication(pubclient, (*mm)->publish);
+		MQTTProtocol_armRetry(pubclient, *mm);
+	}
+exit:
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -189,7 +480,10 @@ Messages* MQTTProtocol_createMessage(Publish* publish, Messages **mm, int qos, i
 	m->msgid = publish->msgId;
 	m->qos = qos;
 	m->retain = retained;
-	time(&(m->lastTouch));
+	m->lastTouch = Timer_now();
+	m->created = Timer_nowMicros();
+	Timer_init(&m->retry_timer);
+	m->retries = 0;
 	if (qos == 2)
 		m->nextMessageType = PUBREC;
 	FUNC_EXIT;
@@ -222,8 +516,16 @@ Publications* MQTTProtocol_storePublication(Publish* publish, int* len)	//-
 
 	p->topiclen = publish->topiclen;
 	p->payloadlen = publish->payloadlen;
-	p->payload = malloc(publish->payloadlen);
-	memcpy(p->payload, publish->payload, p->payloadlen);
+	if ((p->shared = publish->shared) != 0)
+	{	/* hold a reference rather than take a copy */
+		p->payload = publish->payload;
+		MQTTProtocol_retainPayload(p->payload);
+	}
+	else
+	{
+		p->payload = malloc(publish->payloadlen);
+		memcpy(p->payload, publish->payload, p->payloadlen);
+	}
 	*len += publish->payloadlen;
 
 	ListAppend(&(state.publications), p, *len);	//-ڴ洢һ
@@ -231,6 +533,67 @@ Publications* MQTTProtocol_storePublication(Publish* publish, int* len)	//-
 	return p;
 }
 
+/**
+ * Header of a reference counted payload buffer, just before the payload
+ */
+typedef union
+{
+	int refcount;
+	double align;	/* so the payload is aligned as malloc would align it */
+} SharedPayload;
+
+
+/**
+ * Allocate a reference counted payload buffer, which the application fills in and hands
+ * over to be published without the payload being copied
+ * @param len the size of the payload
+ * @return the payload, with one reference held by the caller, or NULL if there was no memory
+ */
+char* MQTTProtocol_allocPayload(int len)
+{
+	SharedPayload* s = malloc(sizeof(SharedPayload) + len);
+
+	if (s == NULL)
+		return NULL;
+	s->refcount = 1;
+	return (char*)(s + 1);
+}
+
+
+/**
+ * Take another reference to a payload buffer
+ * @param payload the payload, from MQTTProtocol_allocPayload()
+ */
+void MQTTProtocol_retainPayload(char* payload)
+{
+	SharedPayload* s = (SharedPayload*)payload - 1;
+
+#if defined(__GNUC__)
+	__atomic_add_fetch(&s->refcount, 1, __ATOMIC_RELAXED);
+#else
+	++(s->refcount);
+#endif
+}
+
+
+/**
+ * Drop a reference to a payload buffer, freeing it with the last.  The application may
+ * drop its own reference while the library still holds one, so the count is atomic.
+ * @param payload the payload, from MQTTProtocol_allocPayload()
+ */
+void MQTTProtocol_releasePayload(char* payload)
+{
+	SharedPayload* s = (SharedPayload*)payload - 1;
+
+#if defined(__GNUC__)
+	if (__atomic_sub_fetch(&s->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+#else
+	if (--(s->refcount) == 0)
+#endif
+		free(s);
+}
+
+
 /**
  * Remove stored message data.  Opposite of storePublication
  * @param p stored publication to remove
@@ -240,7 +603,10 @@ void MQTTProtocol_removePublication(Publications* p)
 	FUNC_ENTRY;
 	if (--(p->refcount) == 0)
 	{
-		free(p->payload);
+		if (p->shared)
+			MQTTProtocol_releasePayload(p->payload);
+		else
+			free(p->payload);
 		free(p->topic);
 		ListRemove(&(state.publications), p);
 	}
@@ -266,15 +632,21 @@ int MQTTProtocol_handlePublishes(void* pack, int sock)	//-
 	int rc = TCPSOCKET_COMPLETE;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &sock, clientSocketCompare)->content);	//-ͨ־λм
+	client = Clients_findSocket(bstate, sock);	//-ͨ־λм
 	clientid = client->clientID;
 	Log(LOG_PROTOCOL, 11, NULL, sock, clientid, publish->msgId, publish->header.bits.qos,
 					publish->header.bits.retain, min(20, publish->payloadlen), publish->payload);
 
+	if (publish->header.bits.dup)
+		Clients_addStat(client->stats.duplicates, 1);
 	if (publish->header.bits.qos == 0)
+	{
+		Clients_addStat(client->stats.received[0], 1);
 		Protocol_processPublication(publish, client);
+	}
 	else if (publish->header.bits.qos == 1)
 	{
+		Clients_addStat(client->stats.received[1], 1);
 		/* send puback before processing the publications because a lot of return publications could fill up the socket buffer */
 		rc = MQTTPacket_send_puback(publish->msgId, &client->net, client->clientID);
 		/* if we get a socket error from sending the puback, should we ignore the publication? */
@@ -292,16 +664,34 @@ int MQTTProtocol_handlePublishes(void* pack, int sock)	//-
 		m->qos = publish->header.bits.qos;
 		m->retain = publish->header.bits.retain;
 		m->nextMessageType = PUBREL;
-		if ( ( listElem = ListFindItem(client->inboundMsgs, &(m->msgid), messageIDCompare) ) != NULL )
+		Timer_init(&m->retry_timer);
+		if ( ( listElem = MQTTProtocol_findMessage(&client->inboundIndex, m->msgid) ) != NULL )
 		{   /* discard queued publication with same msgID that the current incoming message */
 			Messages* msg = (Messages*)(listElem->content);
+			ListElement* old = listElem;
+
 			MQTTProtocol_removePublication(msg->publish);
-			ListInsert(client->inboundMsgs, m, sizeof(Messages) + len, listElem);
-			ListRemove(client->inboundMsgs, msg);
-		} else
+			if (publish->header.bits.dup == 0)
+				Clients_addStat(client->stats.duplicates, 1);	/* not counted above */
+			ListInsert(client->inboundMsgs, m, sizeof(Messages) + len, old);
+			listElem = old->prev;
+			MQTTProtocol_unindexMessage(&client->inboundIndex, msg->msgid);
+			ListRemoveElement(client->inboundMsgs, old);
+		}
+		else
+		{
 			ListAppend(client->inboundMsgs, m, sizeof(Messages) + len);
-		rc = MQTTPacket_send_pubrec(publish->msgId, &client->net, client->clientID);
-		publish->topic = NULL;
+			listElem = client->inboundMsgs->last;
+			Clients_addStat(client->stats.received[2], 1);
+		}
+		if (MQTTProtocol_indexMessage(&client->inboundIndex, listElem) != 0)
+		{	/* a PUBREL could not find it, so drop it unacknowledged for the server to send again */
+			Log(LOG_ERROR, -1, "Could not index message %d for client %s", m->msgid, client->clientID);
+			MQTTProtocol_removePublication(p);
+			ListRemove(client->inboundMsgs, m);
+		}
+		else
+			rc = MQTTPacket_send_pubrec(publish->msgId, &client->net, client->clientID);
 	}
 	MQTTPacket_freePublish(publish);
 	FUNC_EXIT_RC(rc);
@@ -318,31 +708,39 @@ int MQTTProtocol_handlePubacks(void* pack, int sock)
 {
 	Puback* puback = (Puback*)pack;
 	Clients* client = NULL;
+	ListElement* listElem = NULL;
 	int rc = TCPSOCKET_COMPLETE;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &sock, clientSocketCompare)->content);
+	client = Clients_findSocket(bstate, sock);
 	Log(LOG_PROTOCOL, 14, NULL, sock, client->clientID, puback->msgId);
 
 	/* look for the message by message id in the records of outbound messages for this client */
-	if (ListFindItem(client->outboundMsgs, &(puback->msgId), messageIDCompare) == NULL)
+	if ((listElem = MQTTProtocol_findMessage(&client->outboundIndex, puback->msgId)) == NULL)
 		Log(TRACE_MIN, 3, NULL, "PUBACK", client->clientID, puback->msgId);
 	else
 	{
-		Messages* m = (Messages*)(client->outboundMsgs->current->content);
+		Messages* m = (Messages*)(listElem->content);
 		if (m->qos != 1)
 			Log(TRACE_MIN, 4, NULL, "PUBACK", client->clientID, puback->msgId, m->qos);
 		else
 		{
 			Log(TRACE_MIN, 6, NULL, "PUBACK", client->clientID, puback->msgId);
+			MQTTProtocol_measureRoundTrip(client, m);
+			MQTTProtocol_windowAcked(client);
+			MQTTProtocol_recordLatency(&client->stats.qos1Latency, m->created);
+			Clients_addStat(client->stats.acknowledged, 1);
 			#if !defined(NO_PERSISTENCE)
 				rc = MQTTPersistence_remove(client, PERSISTENCE_PUBLISH_SENT, m->qos, puback->msgId);
 			#endif
 			MQTTProtocol_removePublication(m->publish);
-			ListRemove(client->outboundMsgs, m);
+			Timer_cancel(&m->retry_timer);
+			MQTTProtocol_unindexMessage(&client->outboundIndex, m->msgid);
+			MQTTProtocol_releaseMsgId(client, m->msgid);
+			ListRemoveElement(client->outboundMsgs, listElem);
 		}
 	}
-	free(pack);
+	MQTTPacket_free_packet(pack);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -358,22 +756,22 @@ int MQTTProtocol_handlePubrecs(void* pack, int sock)
 {
 	Pubrec* pubrec = (Pubrec*)pack;
 	Clients* client = NULL;
+	ListElement* listElem = NULL;
 	int rc = TCPSOCKET_COMPLETE;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &sock, clientSocketCompare)->content);
+	client = Clients_findSocket(bstate, sock);
 	Log(LOG_PROTOCOL, 15, NULL, sock, client->clientID, pubrec->msgId);
 
 	/* look for the message by message id in the records of outbound messages for this client */
-	client->outboundMsgs->current = NULL;
-	if (ListFindItem(client->outboundMsgs, &(pubrec->msgId), messageIDCompare) == NULL)
+	if ((listElem = MQTTProtocol_findMessage(&client->outboundIndex, pubrec->msgId)) == NULL)
 	{
 		if (pubrec->header.bits.dup == 0)
 			Log(TRACE_MIN, 3, NULL, "PUBREC", client->clientID, pubrec->msgId);
 	}
 	else
 	{
-		Messages* m = (Messages*)(client->outboundMsgs->current->content);
+		Messages* m = (Messages*)(listElem->content);
 		if (m->qos != 2)
 		{
 			if (pubrec->header.bits.dup == 0)
@@ -386,12 +784,14 @@ int MQTTProtocol_handlePubrecs(void* pack, int sock)
 		}
 		else
 		{
+			MQTTProtocol_measureRoundTrip(client, m);
 			rc = MQTTPacket_send_pubrel(pubrec->msgId, 0, &client->net, client->clientID);
 			m->nextMessageType = PUBCOMP;
-			time(&(m->lastTouch));
+			m->retries = 0;
+			MQTTProtocol_armRetry(client, m);
 		}
 	}
-	free(pack);
+	MQTTPacket_free_packet(pack);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -412,14 +812,15 @@ int MQTTProtocol_handlePubrels(void* pack, int sock)
 {
 	Pubrel* pubrel = (Pubrel*)pack;
 	Clients* client = NULL;
+	ListElement* listElem = NULL;
 	int rc = TCPSOCKET_COMPLETE;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &sock, clientSocketCompare)->content);
+	client = Clients_findSocket(bstate, sock);
 	Log(LOG_PROTOCOL, 17, NULL, sock, client->clientID, pubrel->msgId);
 
 	/* look for the message by message id in the records of inbound messages for this client */
-	if (ListFindItem(client->inboundMsgs, &(pubrel->msgId), messageIDCompare) == NULL)
+	if ((listElem = MQTTProtocol_findMessage(&client->inboundIndex, pubrel->msgId)) == NULL)
 	{
 		if (pubrel->header.bits.dup == 0)
 			Log(TRACE_MIN, 3, NULL, "PUBREL", client->clientID, pubrel->msgId);
@@ -429,7 +830,7 @@ int MQTTProtocol_handlePubrels(void* pack, int sock)
 	}
 	else
 	{
-		Messages* m = (Messages*)(client->inboundMsgs->current->content);
+		Messages* m = (Messages*)(listElem->content);
 		if (m->qos != 2)
 			Log(TRACE_MIN, 4, NULL, "PUBREL", client->clientID, pubrel->msgId, m->qos);
 		else if (m->nextMessageType != PUBREL)
@@ -438,8 +839,6 @@ int MQTTProtocol_handlePubrels(void* pack, int sock)
 		{
 			Publish publish;
 
-			/* send pubcomp before processing the publications because a lot of return publications could fill up the socket buffer */
-			rc = MQTTPacket_send_pubcomp(pubrel->msgId, &client->net, client->clientID);
 			publish.header.bits.qos = m->qos;
 			publish.header.bits.retain = m->retain;
 			publish.msgId = m->msgid;
@@ -449,14 +848,19 @@ int MQTTProtocol_handlePubrels(void* pack, int sock)
 			publish.payloadlen = m->publish->payloadlen;
 			Protocol_processPublication(&publish, client);
 			#if !defined(NO_PERSISTENCE)
+				/* the queued copy must be persisted before the received record goes and the pubcomp is sent */
+				if (client->persistence && client->qentry_pending > 0)
+					rc += MQTTPersistence_persistQueue(client);
 				rc += MQTTPersistence_remove(client, PERSISTENCE_PUBLISH_RECEIVED, m->qos, pubrel->msgId);
 			#endif
+			rc += MQTTPacket_send_pubcomp(pubrel->msgId, &client->net, client->clientID);
 			ListRemove(&(state.publications), m->publish);
-			ListRemove(client->inboundMsgs, m);
+			MQTTProtocol_unindexMessage(&client->inboundIndex, m->msgid);
+			ListRemoveElement(client->inboundMsgs, listElem);
 			++(state.msgs_received);
 		}
 	}
-	free(pack);
+	MQTTPacket_free_packet(pack);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -475,21 +879,22 @@ int MQTTProtocol_handlePubcomps(void* pack, int sock)
 {
 	Pubcomp* pubcomp = (Pubcomp*)pack;
 	Clients* client = NULL;
+	ListElement* listElem = NULL;
 	int rc = TCPSOCKET_COMPLETE;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &sock, clientSocketCompare)->content);
+	client = Clients_findSocket(bstate, sock);
 	Log(LOG_PROTOCOL, 19, NULL, sock, client->clientID, pubcomp->msgId);
 
 	/* look for the message by message id in the records of outbound messages for this client */
-	if (ListFindItem(client->outboundMsgs, &(pubcomp->msgId), messageIDCompare) == NULL)
+	if ((listElem = MQTTProtocol_findMessage(&client->outboundIndex, pubcomp->msgId)) == NULL)
 	{
 		if (pubcomp->header.bits.dup == 0)
 			Log(TRACE_MIN, 3, NULL, "PUBCOMP", client->clientID, pubcomp->msgId);
 	}
 	else
 	{
-		Messages* m = (Messages*)(client->outboundMsgs->current->content);
+		Messages* m = (Messages*)(listElem->content);
 		if (m->qos != 2)
 			Log(TRACE_MIN, 4, NULL, "PUBCOMP", client->clientID, pubcomp->msgId, m->qos);
 		else
@@ -499,149 +904,383 @@ int MQTTProtocol_handlePubcomps(void* pack, int sock)
 			else
 			{
 				Log(TRACE_MIN, 6, NULL, "PUBCOMP", client->clientID, pubcomp->msgId);
+				MQTTProtocol_measureRoundTrip(client, m);
+				MQTTProtocol_windowAcked(client);
+				MQTTProtocol_recordLatency(&client->stats.qos2Latency, m->created);
+				Clients_addStat(client->stats.acknowledged, 1);
 				#if !defined(NO_PERSISTENCE)
 					rc = MQTTPersistence_remove(client, PERSISTENCE_PUBLISH_SENT, m->qos, pubcomp->msgId);
 				#endif
 				MQTTProtocol_removePublication(m->publish);
-				ListRemove(client->outboundMsgs, m);
+				Timer_cancel(&m->retry_timer);
+				MQTTProtocol_unindexMessage(&client->outboundIndex, m->msgid);
+				MQTTProtocol_releaseMsgId(client, m->msgid);
+				ListRemoveElement(client->outboundMsgs, listElem);
 				(++state.msgs_sent);
 			}
 		}
 	}
-	free(pack);
+	MQTTPacket_free_packet(pack);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
 /**
- * MQTT protocol keepAlive processing.  Sends PINGREQ packets as required.
- * @param now current time
+ * The longest time to wait for an acknowledgement, which is also the wait until a round trip
+ * time has been measured
+ * @param client the client
+ * @return the retry interval in milliseconds
  */
-void MQTTProtocol_keepalive(time_t now)	//-ͨӺ,ʹֻԾ״̬
+static long MQTTProtocol_maxRetryTimeout(Clients* client)
 {
-	ListElement* current = NULL;
+	return max(client->retryInterval, 10) * 1000L;
+}
+
+
+/**
+ * The time to wait for an acknowledgement before retrying a PUBLISH or PUBREL
+ * @param client the client
+ * @return the retry timeout in milliseconds
+ */
+static long MQTTProtocol_retryTimeout(Clients* client)
+{
+	return (client->flow.rto > 0) ? client->flow.rto : MQTTProtocol_maxRetryTimeout(client);
+}
+
+
+/**
+ * Start flow control afresh for a connection: the window at its initial size and nothing
+ * known of the round trip time
+ * @param client the client
+ */
+void MQTTProtocol_initFlow(Clients* client)
+{
+	FlowControl* flow = &client->flow;
+
+	memset(flow, '\0', sizeof(FlowControl));
+	flow->window = min(client->maxInflightMessages, FLOW_INITIAL_WINDOW);
+	flow->ssthresh = client->maxInflightMessages;
+	flow->rto = (int)MQTTProtocol_maxRetryTimeout(client);
+}
+
+
+/**
+ * Measure the round trip time of a packet which has been acknowledged, and set the retry
+ * timeout from it as TCP does: the smoothed round trip time plus four times its variation
+ * @param client the client
+ * @param m the message acknowledged
+ */
+static void MQTTProtocol_measureRoundTrip(Clients* client, Messages* m)
+{
+	FlowControl* flow = &client->flow;
+	int rtt;
+	long rto;
+
+	if (m->retries > 0)
+		return;	/* the acknowledgement could be for any of the times it was sent */
+	rtt = (int)(Timer_now() - m->lastTouch);
+	if (flow->samples++ == 0)
+	{
+		flow->srtt = rtt << 3;
+		flow->rttvar = rtt << 1;
+	}
+	else
+	{
+		int error = rtt - (flow->srtt >> 3);
+
+		flow->srtt += error;
+		if (error < 0)
+			error = -error;
+		flow->rttvar += error - (flow->rttvar >> 2);
+	}
+	rto = (flow->srtt >> 3) + flow->rttvar;
+	flow->rto = (int)min(max(rto, FLOW_MIN_RTO), MQTTProtocol_maxRetryTimeout(client));
+}
+
+
+/**
+ * Grow the window when a message has been acknowledged: by one for each acknowledgement
+ * until the window has first had to be reduced, then by one for each window's worth
+ * @param client the client
+ */
+static void MQTTProtocol_windowAcked(Clients* client)
+{
+	FlowControl* flow = &client->flow;
+
+	if (flow->window >= client->maxInflightMessages)
+		return;
+	if (flow->window < flow->ssthresh)
+		++(flow->window);
+	else if (++(flow->acked) >= flow->window)
+	{
+		++(flow->window);
+		flow->acked = 0;
+	}
+}
+
+
+/**
+ * Halve the window and back off the retry timeout when a message has not been acknowledged
+ * in time, once for all the messages which were in flight together
+ * @param client the client
+ * @param m the message to be retried
+ */
+static void MQTTProtocol_windowLost(Clients* client, Messages* m)
+{
+	FlowControl* flow = &client->flow;
+
+	if (m->lastTouch < flow->recovery)
+		return;	/* sent before the window was last reduced */
+	flow->rto = (int)min(flow->rto * 2L, MQTTProtocol_maxRetryTimeout(client));
+	flow->ssthresh = max(flow->window / 2, 1);
+	flow->window = flow->ssthresh;
+	flow->acked = 0;
+	flow->recovery = Timer_now();
+	Log(TRACE_MIN, -1, "Window for client %s reduced to %d, retry timeout %d ms", client->clientID,
+			flow->window, flow->rto);
+}
+
+
+/**
+ * Find the histogram bucket of a latency: the latency itself below MQTTCLIENT_HISTOGRAM_SUB_BUCKETS,
+ * otherwise the sub-bucket of its power of 2 given by the bits following the highest one
+ * @param latency the latency in microseconds
+ * @return the index of the bucket
+ */
+static int MQTTProtocol_latencyBucket(unsigned long long latency)
+{
+	int shift = 0;
+	int bucket;
+
+#if defined(__GNUC__)
+	if (latency >= 2 * MQTTCLIENT_HISTOGRAM_SUB_BUCKETS)	/* the sub-buckets take 3 bits below the highest */
+		shift = 63 - __builtin_clzll(latency) - 3;
+#else
+	while ((latency >> shift) >= 2 * MQTTCLIENT_HISTOGRAM_SUB_BUCKETS)
+		++shift;
+#endif
+	bucket = shift * MQTTCLIENT_HISTOGRAM_SUB_BUCKETS + (int)(latency >> shift);
+	return min(bucket, MQTTCLIENT_HISTOGRAM_BUCKETS - 1);
+}
+
+
+/**
+ * The lowest latency counted in a histogram bucket, the inverse of MQTTProtocol_latencyBucket()
+ * @param bucket the index of the bucket
+ * @return the latency in microseconds
+ */
+unsigned long long MQTTProtocol_bucketLatency(int bucket)
+{
+	int shift;
+
+	if (bucket < 2 * MQTTCLIENT_HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+	shift = bucket / MQTTCLIENT_HISTOGRAM_SUB_BUCKETS - 1;
+	return (unsigned long long)(bucket - shift * MQTTCLIENT_HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+
+/**
+ * Record the latency of an exchange which has completed in a histogram
+ * @param histogram the histogram
+ * @param start when the exchange started, from Timer_nowMicros()
+ */
+void MQTTProtocol_recordLatency(MQTTClient_histogram* histogram, ustime_type start)
+{
+	unsigned long long latency = Timer_nowMicros() - start;
+
+	Clients_addStat(histogram->buckets[MQTTProtocol_latencyBucket(latency)], 1);
+	Clients_addStat(histogram->count, 1);
+	Clients_addStat(histogram->sum, latency);
+	if (latency > histogram->max)
+		Clients_setStat(histogram->max, latency);	/* only ever updated with the client mutex held */
+}
+
+
+/**
+ * MQTT protocol keepAlive processing, when a client's keepalive timer expires.  Sends a
+ * PINGREQ if nothing has been sent or received for the keepalive interval, or closes the
+ * session if the last PINGREQ has not been answered.
+ * @param timer the client's keepalive timer
+ * @param context the client
+ */
+static void MQTTProtocol_keepaliveExpired(Timer* timer, void* context)
+{
+	Clients* client = (Clients*)context;
+	mstime_type now = Timer_now();
+	mstime_type interval = client->keepAliveInterval * 1000L;
+	mstime_type last = min(client->net.lastSent, client->net.lastReceived);
 
 	FUNC_ENTRY;
-	ListNextElement(bstate->clients, &current);	//-һѰҵһԪ
-	while (current)
-	{//-һͻ˽м
-		Clients* client =	(Clients*)(current->content);	//-ָһͻʵ
-		ListNextElement(bstate->clients, &current);		//-лһͻ,׼,ֱû
-		if (client->connected && client->keepAliveInterval > 0 &&
-			(difftime(now, client->net.lastSent) >= client->keepAliveInterval ||
-					difftime(now, client->net.lastReceived) >= client->keepAliveInterval))
-		{//-ÿõĿͻ,ʱ˾Ҫ,Ҫ
-			if (client->ping_outstanding == 0)	//-û˵ûнյӦ
-			{
-				if (Socket_noPendingWrites(client->net.socket))	//-ûзͳȥͲҪping
-				{//-һʱûݽ,ôͻ˾Ҫping
-					if (MQTTPacket_send_pingreq(&client->net, client->clientID) != TCPSOCKET_COMPLETE)
-					{
-						Log(TRACE_PROTOCOL, -1, "Error sending PINGREQ for client %s on socket %d, disconnecting", client->clientID, client->net.socket);
-						MQTTProtocol_closeSession(client, 1);
-					}
-					else
-					{
-						client->net.lastSent = now;
-						client->ping_outstanding = 1;	//-Ѿͳȥһping֡
-					}
-				}
-			}
-			else
-			{//-pingӦûбյ,ڻԾ
-				Log(TRACE_PROTOCOL, -1, "PINGRESP not received in keepalive interval for client %s on socket %d, disconnecting", client->clientID, client->net.socket);
-				MQTTProtocol_closeSession(client, 1);	//-ҪϿ
-			}
+	if (!client->connected || client->keepAliveInterval <= 0)
+		goto exit;
+	if (now - last < interval) /* there has been traffic since the timer was armed */
+		Timer_arm(timer, (long)(last + interval - now), MQTTProtocol_keepaliveExpired, client);
+	else if (client->ping_outstanding == 0)
+	{
+		/* a PINGREQ goes ahead of any bulk writes queued on the socket, so send it now */
+		if (MQTTPacket_send_pingreq(&client->net, client->clientID) == SOCKET_ERROR)
+		{
+			Log(TRACE_PROTOCOL, -1, "Error sending PINGREQ for client %s on socket %d, disconnecting", client->clientID, client->net.socket);
+			MQTTProtocol_closeSession(client, 1);
 		}
+		else
+		{
+			client->net.lastSent = now;
+			client->pingSent = Timer_nowMicros();
+			client->ping_outstanding = 1;
+			Timer_arm(timer, (long)interval, MQTTProtocol_keepaliveExpired, client);
+		}
+	}
+	else
+	{
+		Log(TRACE_PROTOCOL, -1, "PINGRESP not received in keepalive interval for client %s on socket %d, disconnecting", client->clientID, client->net.socket);
+		MQTTProtocol_closeSession(client, 1);
 	}
+exit:
 	FUNC_EXIT;
 }
 
 
 /**
- * MQTT retry processing per client
- * @param now current time
- * @param client - the client to which to apply the retry processing
- * @param regardless boolean - retry packets regardless of retry interval (used on reconnect)
+ * Start keepalive processing for a newly connected client
+ * @param client the client
  */
-void MQTTProtocol_retries(time_t now, Clients* client, int regardless)	//-ÿͻԴ
+void MQTTProtocol_startKeepalive(Clients* client)
 {
-	ListElement* outcurrent = NULL;
+	FUNC_ENTRY;
+	if (client->keepAliveInterval > 0)
+		Timer_arm(&client->keepalive_timer, client->keepAliveInterval * 1000L, MQTTProtocol_keepaliveExpired, client);
+	FUNC_EXIT;
+}
+
+
+/**
+ * Resend an unacknowledged PUBLISH or PUBREL, and rearm its retry timer
+ * @param client the client which sent the message
+ * @param m the message
+ * @return 0 if the session was closed because of a socket error, 1 otherwise
+ */
+static int MQTTProtocol_retryMessage(Clients* client, Messages* m)
+{
+	int rc = 1;
 
 	FUNC_ENTRY;
+	if (m->qos == 1 || (m->qos == 2 && m->nextMessageType == PUBREC))
+	{
+		Publish publish;
+		int rc1;
+
+		Log(TRACE_MIN, 7, NULL, "PUBLISH", client->clientID, client->net.socket, m->msgid);
+		publish.msgId = m->msgid;
+		publish.topic = m->publish->topic;
+		publish.payload = m->publish->payload;
+		publish.payloadlen = m->publish->payloadlen;
+		publish.prepared = NULL;
+		publish.shared = 0;
+		if ((rc1 = MQTTPacket_send_publish(&publish, 1, m->qos, m->retain, &client->net, client->clientID)) == SOCKET_ERROR)
+			rc = 0;
+		else if (rc1 == TCPSOCKET_INTERRUPTED)
+			MQTTProtocol_holdPublication(client, m->publish);
+	}
+	else if (m->qos && m->nextMessageType == PUBCOMP)
+	{
+		Log(TRACE_MIN, 7, NULL, "PUBREL", client->clientID, client->net.socket, m->msgid);
+		if (MQTTPacket_send_pubrel(m->msgid, 0, &client->net, client->clientID) == SOCKET_ERROR)
+			rc = 0;
+	}
+	if (rc == 0)
+	{
+		client->good = 0;
+		Log(TRACE_PROTOCOL, 29, NULL, client->clientID, client->net.socket,
+				Socket_getpeer(client->net.socket));
+		MQTTProtocol_closeSession(client, 1);
+	}
+	else
+	{
+		++(m->retries);
+		Clients_addStat(client->stats.retries, 1);
+		MQTTProtocol_armRetry(client, m);
+	}
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
 
-	if (!regardless && client->retryInterval <= 0) /* 0 or -ive retryInterval turns off retry except on reconnect */
-		goto exit;
 
-	while (client && ListNextElement(client->outboundMsgs, &outcurrent) &&
-		   client->connected && client->good &&        /* client is connected and has no errors */
-		   Socket_noPendingWrites(client->net.socket)) /* there aren't any previous packets still stacked up on the socket */
+/**
+ * Retry a message when its retry timer expires
+ * @param timer the message's retry timer
+ * @param context the client
+ */
+static void MQTTProtocol_retryExpired(Timer* timer, void* context)
+{
+	Clients* client = (Clients*)context;
+	Messages* m = (Messages*)((char*)timer - offsetof(Messages, retry_timer));
+
+	FUNC_ENTRY;
+	if (client->connected && client->good)   /* client is connected and has no errors */
 	{
-		Messages* m = (Messages*)(outcurrent->content);
-		if (regardless || difftime(now, m->lastTouch) > max(client->retryInterval, 10))
+		if (Socket_noPendingWrites(client->net.socket))
 		{
-			if (m->qos == 1 || (m->qos == 2 && m->nextMessageType == PUBREC))
-			{
-				Publish publish;
-				int rc;
-
-				Log(TRACE_MIN, 7, NULL, "PUBLISH", client->clientID, client->net.socket, m->msgid);
-				publish.msgId = m->msgid;
-				publish.topic = m->publish->topic;
-				publish.payload = m->publish->payload;
-				publish.payloadlen = m->publish->payloadlen;
-				rc = MQTTPacket_send_publish(&publish, 1, m->qos, m->retain, &client->net, client->clientID);
-				if (rc == SOCKET_ERROR)
-				{
-					client->good = 0;
-					Log(TRACE_PROTOCOL, 29, NULL, client->clientID, client->net.socket,
-												Socket_getpeer(client->net.socket));
-					MQTTProtocol_closeSession(client, 1);
-					client = NULL;
-				}
-				else
-				{
-					if (m->qos == 0 && rc == TCPSOCKET_INTERRUPTED)
-						MQTTProtocol_storeQoS0(client, &publish);
-					time(&(m->lastTouch));
-				}
-			}
-			else if (m->qos && m->nextMessageType == PUBCOMP)
-			{
-				Log(TRACE_MIN, 7, NULL, "PUBREL", client->clientID, client->net.socket, m->msgid);
-				if (MQTTPacket_send_pubrel(m->msgid, 0, &client->net, client->clientID) != TCPSOCKET_COMPLETE)
-				{
-					client->good = 0;
-					Log(TRACE_PROTOCOL, 29, NULL, client->clientID, client->net.socket,
-							Socket_getpeer(client->net.socket));
-					MQTTProtocol_closeSession(client, 1);
-					client = NULL;
-				}
-				else
-					time(&(m->lastTouch));
-			}
-			/* break; why not do all retries at once? */
+			MQTTProtocol_windowLost(client, m);
+			MQTTProtocol_retryMessage(client, m);
 		}
+		else /* there are previous packets still stacked up on the socket */
+			Timer_arm(timer, PENDING_WRITE_RETRY_DELAY, MQTTProtocol_retryExpired, client);
+	}
+	FUNC_EXIT;
+}
+
+
+/**
+ * Record that a PUBLISH or PUBREL has been sent, and arm the retry timer for it
+ * @param client the client which sent the message
+ * @param m the message
+ */
+void MQTTProtocol_armRetry(Clients* client, Messages* m)
+{
+	m->lastTouch = Timer_now();
+	if (client->retryInterval > 0) /* 0 or -ive retryInterval turns off retry except on reconnect */
+		Timer_arm(&m->retry_timer, MQTTProtocol_retryTimeout(client), MQTTProtocol_retryExpired, client);
+}
+
+
+/**
+ * MQTT retry processing per client, on reconnect: resend all unacknowledged messages
+ * @param client - the client to which to apply the retry processing
+ */
+void MQTTProtocol_retries(Clients* client)	//-ÿͻԴ
+{
+	ListElement* outcurrent = NULL;
+
+	FUNC_ENTRY;
+	while (ListNextElement(client->outboundMsgs, &outcurrent) &&
+		   client->connected && client->good)        /* client is connected and has no errors */
+	{
+		Messages* m = (Messages*)(outcurrent->content);
+
+		if (Socket_noPendingWrites(client->net.socket) == 0)
+			/* there are previous packets still stacked up on the socket, so retry shortly */
+			Timer_arm(&m->retry_timer, PENDING_WRITE_RETRY_DELAY, MQTTProtocol_retryExpired, client);
+		else if (MQTTProtocol_retryMessage(client, m) == 0)
+			break;
 	}
-exit:
 	FUNC_EXIT;
 }
 
 
 /**
- * MQTT retry protocol and socket pending writes processing.
- * @param now current time
- * @param doRetry boolean - retries as well as pending writes?
- * @param regardless boolean - retry packets regardless of retry interval (used on reconnect)
+ * MQTT retry protocol processing.  Retries themselves are driven by the message timers; this
+ * closes the sessions of clients which have had errors.
+ * @param regardless boolean - retry all packets regardless of retry interval (used on reconnect)
  */
-void MQTTProtocol_retry(time_t now, int doRetry, int regardless)	//-ٴЭ׽ҵд
+void MQTTProtocol_retry(int regardless)	//-ٴЭ׽ҵд
 {
 	ListElement* current = NULL;
 
 	FUNC_ENTRY;
 	ListNextElement(bstate->clients, &current);
-	/* look through the outbound message list of each client, checking to see if a retry is necessary */
 	while (current)	//-ͨѯʶλ,ǷбҪд
 	{//-һͻһͻѯ
 		Clients* client = (Clients*)(current->content);	//-ָͻ˵ʵ
@@ -653,10 +1292,8 @@ void MQTTProtocol_retry(time_t now, int doRetry, int regardless)	//-
 			MQTTProtocol_closeSession(client, 1);
 			continue;
 		}
-		if (Socket_noPendingWrites(client->net.socket) == 0)	//-ڲѯǷдҶе
-			continue;
-		if (doRetry)
-			MQTTProtocol_retries(now, client, regardless);
+		if (regardless)
+			MQTTProtocol_retries(client);
 	}
 	FUNC_EXIT;
 }
@@ -672,6 +1309,8 @@ void MQTTProtocol_freeClient(Clients* client)	//-
 	/* free up pending message lists here, and any other allocated data */
 	MQTTProtocol_freeMessageList(client->outboundMsgs);
 	MQTTProtocol_freeMessageList(client->inboundMsgs);
+	MQTTProtocol_emptyIndex(&client->outboundIndex);
+	MQTTProtocol_emptyIndex(&client->inboundIndex);
 	ListFree(client->messageQueue);
 	free(client->clientID);
 	if (client->will)
@@ -696,6 +1335,8 @@ void MQTTProtocol_freeClient(Clients* client)	//-
 		free(client->sslopts);
 	}
 #endif
+	if (client->sockopts)
+		free(client->sockopts);
 	/* don't free the client structure itself... this is done elsewhere */
 	FUNC_EXIT;
 }
@@ -714,6 +1355,7 @@ void MQTTProtocol_emptyMessageList(List* msgList)	//-
 	{
 		Messages* m = (Messages*)(current->content);
 		MQTTProtocol_removePublication(m->publish);
+		Timer_cancel(&m->retry_timer);
 	}
 	ListEmpty(msgList);
 	FUNC_EXIT;
@@ -29,12 +29,44 @@
 #define MAX_MSG_ID 65535
 #define MAX_CLIENTID_LEN 65535
 
+/**
+ * number of slots in the index of a message list when its first message is added
+ */
+#define MESSAGE_INDEX_INITIAL_SIZE 16
+
+/**
+ * return code of MQTTProtocol_startPublish when the message could not be indexed, so was not sent
+ */
+#define MESSAGE_INDEX_FAILED -30
+
+/**
+ * number of messages allowed in flight on connecting, if maxInflightMessages allows that many
+ */
+#define FLOW_INITIAL_WINDOW 10
+
+/**
+ * the shortest retry timeout in milliseconds, however short the round trip time measured
+ */
+#define FLOW_MIN_RTO 1000
+
 int MQTTProtocol_startPublish(Clients* pubclient, Publish* publish, int qos, int retained, Messages** m);
 Messages* MQTTProtocol_createMessage(Publish* publish, Messages** mm, int qos, int retained);
 Publications* MQTTProtocol_storePublication(Publish* publish, int* len);
 int messageIDCompare(void* a, void* b);
 int MQTTProtocol_assignMsgId(Clients* client);
+void MQTTProtocol_useMsgId(Clients* client, int msgid);
+void MQTTProtocol_releaseMsgId(Clients* client, int msgid);
+void MQTTProtocol_releaseMsgIds(Clients* client);
+int MQTTProtocol_msgIdInUse(Clients* client, int msgid);
+ListElement* MQTTProtocol_findMessage(MessageIndex* index, int msgid);
+int MQTTProtocol_indexMessage(MessageIndex* index, ListElement* elem);
+void MQTTProtocol_unindexMessage(MessageIndex* index, int msgid);
+void MQTTProtocol_emptyIndex(MessageIndex* index);
+void MQTTProtocol_indexMessages(Clients* client);
 void MQTTProtocol_removePublication(Publications* p);
+char* MQTTProtocol_allocPayload(int len);
+void MQTTProtocol_retainPayload(char* payload);
+void MQTTProtocol_releasePayload(char* payload);
 
 int MQTTProtocol_handlePublishes(void* pack, int sock);
 int MQTTProtocol_handlePubacks(void* pack, int sock);
@@ -42,8 +74,12 @@ int MQTTProtocol_handlePubrecs(void* pack, int sock);
 int MQTTProtocol_handlePubrels(void* pack, int sock);
 int MQTTProtocol_handlePubcomps(void* pack, int sock);
 
-void MQTTProtocol_keepalive(time_t);
-void MQTTProtocol_retry(time_t, int, int);
+void MQTTProtocol_startKeepalive(Clients* client);
+void MQTTProtocol_armRetry(Clients* client, Messages* m);
+void MQTTProtocol_initFlow(Clients* client);
+void MQTTProtocol_recordLatency(MQTTClient_histogram* histogram, ustime_type start);
+unsigned long long MQTTProtocol_bucketLatency(int bucket);
+void MQTTProtocol_retry(int regardless);
 void MQTTProtocol_freeClient(Clients* client);
 void MQTTProtocol_emptyMessageList(List* msgList);
 void MQTTProtocol_freeMessageList(List* msgList);
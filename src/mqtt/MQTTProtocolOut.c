@@ -26,6 +26,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "MQTTProtocolOut.h"
 #include "StackTrace.h"
@@ -75,7 +76,7 @@ char* MQTTProtocol_addressPort(const char* uri, int* port)	//-
 
 /**
  * MQTT outgoing connect processing for a client
- * @param ip_address the TCP address:port to connect to
+ * @param ip_address the TCP address:port to connect to, or unix:///path for a Unix domain socket
  * @param aClient a structure with all MQTT data needed
  * @param int ssl
  * @param int MQTTVersion the MQTT version to connect with (3 or 4)
@@ -88,13 +89,23 @@ int MQTTProtocol_connect(const char* ip_address, Clients* aClient, int MQTTVersi
 #endif
 {
 	int rc, port;
-	char* addr;
+	char* addr = NULL;
 
 	FUNC_ENTRY;
 	aClient->good = 1;
 
-	addr = MQTTProtocol_addressPort(ip_address, &port);	//-ַͨȡԼҪϢ:IPַ+˿ں
-	rc = Socket_new(addr, port, &(aClient->net.socket));	//-ʵ˵ײĴ(Ӳ·)
+	if (strncmp(ip_address, URI_UNIX, strlen(URI_UNIX)) == 0)
+		rc = Socket_newUnix(ip_address + strlen(URI_UNIX), &(aClient->net.socket));
+	else
+	{
+		addr = MQTTProtocol_addressPort(ip_address, &port);	//-ַͨȡԼҪϢ:IPַ+˿ں
+		rc = Socket_new(addr, port, aClient->sockopts, &(aClient->net.socket));	//-ʵ˵ײĴ(Ӳ·)
+	}
+	if (aClient->net.socket > 0 && Clients_addSocket(bstate, aClient) != 0)
+	{	/* not found by its socket, so its packets could not be handled; the caller closes it */
+		Log(LOG_ERROR, -1, "Failed to index socket %d for client %s", aClient->net.socket, aClient->clientID);
+		rc = SOCKET_ERROR;
+	}
 	if (rc == EINPROGRESS || rc == EWOULDBLOCK)	//-ӿܻûн,ڵȴ
 		aClient->connect_state = 1; /* TCP connect called - wait for connect completion */	//-ͨʶλ֪״̬
 	else if (rc == 0)
@@ -116,13 +127,15 @@ int MQTTProtocol_connect(const char* ip_address, Clients* aClient, int MQTTVersi
 		if (rc == 0)	//-TCP/IP,ʼЭ
 		{
 			/* Now send the MQTT connect packet */
-			if ((rc = MQTTPacket_send_connect(aClient, MQTTVersion)) == 0)
+			if ((rc = MQTTPacket_send_connect(aClient, MQTTVersion)) == TCPSOCKET_INTERRUPTED)
+				rc = 0; /* the rest of the packet is queued, and written in turn */
+			if (rc == 0)
 				aClient->connect_state = 3; /* MQTT Connect sent - wait for CONNACK */ //-¼ĿǰMQTTЭ״̬,˵ĸ
 			else
 				aClient->connect_state = 0;	//-MQTTûȫͳȥ
 		}
 	}
-	if (addr != ip_address)	//-Ƿ,ֹܵڴй¶
+	if (addr && addr != ip_address)	//-Ƿ,ֹܵڴй¶
 		free(addr);
 
 	FUNC_EXIT_RC(rc);
@@ -142,8 +155,10 @@ int MQTTProtocol_handlePingresps(void* pack, int sock)	//-
 	int rc = TCPSOCKET_COMPLETE;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &sock, clientSocketCompare)->content);	//-׽ѰҵӦĿͻ
+	client = Clients_findSocket(bstate, sock);	//-׽ѰҵӦĿͻ
 	Log(LOG_PROTOCOL, 21, NULL, sock, client->clientID);
+	if (client->ping_outstanding)
+		MQTTProtocol_recordLatency(&client->stats.pingLatency, client->pingSent);
 	client->ping_outstanding = 0;	//-ܾ±ʶλͿ֪Ϣ
 	FUNC_EXIT_RC(rc);
 	return rc;
@@ -182,7 +197,7 @@ int MQTTProtocol_handleSubacks(void* pack, int sock)	//-
 	int rc = TCPSOCKET_COMPLETE;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &sock, clientSocketCompare)->content);
+	client = Clients_findSocket(bstate, sock);
 	Log(LOG_PROTOCOL, 23, NULL, sock, client->clientID, suback->msgId);
 	MQTTPacket_freeSuback(suback);	//-ͷŴ洢ռ,һҪ˼,ΪʲôҪڴͷ
 	FUNC_EXIT_RC(rc);
@@ -221,9 +236,9 @@ int MQTTProtocol_handleUnsubacks(void* pack, int sock)	//-
 	int rc = TCPSOCKET_COMPLETE;
 
 	FUNC_ENTRY;
-	client = (Clients*)(ListFindItem(bstate->clients, &sock, clientSocketCompare)->content);
+	client = Clients_findSocket(bstate, sock);
 	Log(LOG_PROTOCOL, 24, NULL, sock, client->clientID, unsuback->msgId);
-	free(unsuback);
+	MQTTPacket_free_packet(pack);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
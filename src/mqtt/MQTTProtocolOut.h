@@ -29,6 +29,12 @@
 
 #define DEFAULT_PORT 1883
 
+/**
+ * URI prefix for a broker on this machine reached through a Unix domain socket, followed
+ * by the path name of the socket, e.g. unix:///var/run/mosquitto.sock
+ */
+#define URI_UNIX "unix://"
+
 void MQTTProtocol_reconnect(const char* ip_address, Clients* client);
 #if defined(OPENSSL)
 int MQTTProtocol_connect(const char* ip_address, Clients* acClients, int ssl, int MQTTVersion);
@@ -0,0 +1,750 @@
+/**
+ * @file
+ * \brief A store-and-forward queue of messages on disk.
+ *
+ * The spool is a queue for each QoS of segment files in its directory, named by the QoS
+ * and the number of the segment in hexadecimal.  Messages are appended to the last segment
+ * of their queue, and taken from the first segment of whichever queue holds the message
+ * spooled earliest, so that they are sent in the order they were published.  Taking a
+ * message sets a flag in its header in place; a segment is deleted once all its messages
+ * have been taken, or when it is dropped whole to make room or because all its messages
+ * are too old.  Only the header of the next message of each queue is kept in memory.
+ *
+ * Each message is a header of a CRC-32, the flags, the QoS, the retained flag, the time it
+ * was spooled, its position in the order of all messages spooled and the lengths of the
+ * topic and payload, followed by the topic and the payload.  When the spool is opened the
+ * segments are read through to find the first message not taken, and a message torn by a
+ * crash at the end of a segment is cut off.
+ */
+
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "MQTTSpool.h"
+#include "MQTTPersistence.h"
+#include "MQTTPersistenceDefault.h"
+#include "Clients.h"
+#include "Log.h"
+#include "StackTrace.h"
+
+#include "Heap.h"
+
+#define SPOOL_QUEUES 3
+
+/**
+ * Flag set in the header of a message once it has been taken
+ */
+#define SPOOL_TAKEN 1
+
+/**
+ * The start of a message in a segment, followed by the topic and the payload
+ */
+typedef struct
+{
+	unsigned int checksum;	/**< CRC-32 of the header from qos on, the topic and the payload */
+	unsigned char flags;	/**< #SPOOL_TAKEN, written in place */
+	unsigned char qos;
+	unsigned char retained;
+	unsigned char reserved;
+	unsigned int time;		/**< when the message was spooled, in seconds since the epoch */
+	unsigned int topiclen;
+	unsigned long long seq;	/**< position in the order of all the messages spooled */
+	unsigned int payloadlen;
+} SpoolRecord;
+
+/**
+ * One segment file of a queue
+ */
+typedef struct
+{
+	unsigned int id;			/**< number of the segment */
+	long size;					/**< bytes written to the segment */
+	long head;					/**< offset of the first message not taken */
+	int count;					/**< messages not taken */
+	unsigned long long first;	/**< position of the first message written to it */
+	unsigned int newest;		/**< time the last message written to it was spooled */
+} SpoolSegment;
+
+/**
+ * The segments of messages of one QoS
+ */
+typedef struct
+{
+	SpoolSegment* segments;	/**< oldest first */
+	int nsegments;
+	int maxsegments;
+	int count;				/**< messages not taken */
+	int fd;					/**< the last segment, open for appending, or -1 */
+	int readfd;				/**< the first segment, open for reading and writing flags, or -1 */
+	SpoolRecord next;		/**< header of the first message not taken, if peeked is set */
+	int peeked;
+} SpoolQueue;
+
+/**
+ * An open spool
+ */
+struct SpoolStruct
+{
+	char* dir;
+	long maxBytes;
+	int maxAge;
+	int eviction;
+	int segmentSize;
+	SpoolQueue queues[SPOOL_QUEUES];	/**< by QoS */
+	long bytes;							/**< in all the segments */
+	int count;							/**< messages not taken */
+	unsigned long long seq;				/**< position of the next message spooled */
+	unsigned int nextid;				/**< number of the next segment */
+	MQTTClient_stats* stats;
+};
+
+
+static char* MQTTSpool_segmentName(Spool* s, int q, unsigned int id)
+{
+	char* name = malloc(strlen(s->dir) + strlen(SPOOL_SEGMENT_EXTENSION) + 13);
+
+	if (name)
+		sprintf(name, "%s/%d-%08x%s", s->dir, q, id, SPOOL_SEGMENT_EXTENSION);
+	return name;
+}
+
+
+static unsigned int MQTTSpool_checksum(SpoolRecord* rec, const char* topic, const char* payload)
+{
+	unsigned int crc = MQTTPersistence_checksum(0, (char*)&rec->qos, sizeof(SpoolRecord) - offsetof(SpoolRecord, qos));
+
+	crc = MQTTPersistence_checksum(crc, topic, rec->topiclen);
+	return MQTTPersistence_checksum(crc, payload, rec->payloadlen);
+}
+
+
+static long MQTTSpool_recordLength(SpoolRecord* rec)
+{
+	return (long)sizeof(SpoolRecord) + rec->topiclen + rec->payloadlen;
+}
+
+
+/**
+ * Add a segment to the end of a queue
+ * @return the segment, or NULL if there is no memory for it
+ */
+static SpoolSegment* MQTTSpool_addSegment(SpoolQueue* queue, unsigned int id, unsigned long long first)
+{
+	SpoolSegment* seg;
+
+	if (queue->nsegments == queue->maxsegments)
+	{
+		int size = (queue->maxsegments) ? queue->maxsegments * 2 : 4;
+		SpoolSegment* segments = (queue->segments) ? realloc(queue->segments, size * sizeof(SpoolSegment))
+				: malloc(size * sizeof(SpoolSegment));
+
+		if (segments == NULL)
+			return NULL;
+		queue->segments = segments;
+		queue->maxsegments = size;
+	}
+	seg = &queue->segments[queue->nsegments++];
+	memset(seg, '\0', sizeof(SpoolSegment));
+	seg->id = id;
+	seg->first = first;
+	return seg;
+}
+
+
+/**
+ * Delete the first segment of a queue, dropping any messages in it which have not been taken
+ * @param s the spool
+ * @param q the queue
+ * @return the number of messages dropped
+ */
+static int MQTTSpool_dropSegment(Spool* s, int q)
+{
+	SpoolQueue* queue = &s->queues[q];
+	SpoolSegment* seg = &queue->segments[0];
+	char* name = MQTTSpool_segmentName(s, q, seg->id);
+	int dropped = seg->count;
+
+	FUNC_ENTRY;
+	if (queue->readfd >= 0)
+	{
+		close(queue->readfd);
+		queue->readfd = -1;
+	}
+	if (queue->nsegments == 1 && queue->fd >= 0)
+	{
+		close(queue->fd);
+		queue->fd = -1;
+	}
+	if (name)
+	{
+		unlink(name);
+		free(name);
+	}
+	s->bytes -= seg->size;
+	s->count -= dropped;
+	queue->count -= dropped;
+	queue->peeked = 0;
+	memmove(&queue->segments[0], &queue->segments[1], (--(queue->nsegments)) * sizeof(SpoolSegment));
+	Clients_setStat(s->stats->spoolBytes, s->bytes);
+	FUNC_EXIT_RC(dropped);
+	return dropped;
+}
+
+
+/**
+ * Delete the segments at the front of a queue whose messages have all been taken, except
+ * the last, which is still being written
+ */
+static void MQTTSpool_trim(Spool* s, int q)
+{
+	SpoolQueue* queue = &s->queues[q];
+
+	while (queue->nsegments > 1 && queue->segments[0].count == 0)
+		MQTTSpool_dropSegment(s, q);
+}
+
+
+/**
+ * Delete the segments at the front of the queues whose messages are all older than the age limit
+ */
+static void MQTTSpool_expire(Spool* s, unsigned int now)
+{
+	int q;
+
+	for (q = 0; q < SPOOL_QUEUES; ++q)
+	{
+		SpoolQueue* queue = &s->queues[q];
+
+		while (queue->nsegments > 0 && queue->segments[0].newest + (unsigned int)s->maxAge < now)
+			Clients_addStat(s->stats->spoolExpired, MQTTSpool_dropSegment(s, q));
+	}
+}
+
+
+/**
+ * Choose the queue whose first segment is dropped to make room
+ * @return the queue, or -1 if there are no segments
+ */
+static int MQTTSpool_victim(Spool* s)
+{
+	int victim = -1;
+	int q;
+
+	for (q = 0; q < SPOOL_QUEUES; ++q)
+	{
+		SpoolQueue* queue = &s->queues[q];
+
+		if (queue->nsegments == 0)
+			continue;
+		if (s->eviction == MQTTCLIENT_SPOOL_PRIORITY)
+			return q;	/* the lowest QoS first */
+		if (victim < 0 || queue->segments[0].first < s->queues[victim].segments[0].first)
+			victim = q;
+	}
+	return victim;
+}
+
+
+/**
+ * Start a new segment at the end of a queue
+ * @return 0 if success, -1 otherwise
+ */
+static int MQTTSpool_startSegment(Spool* s, int q)
+{
+	SpoolQueue* queue = &s->queues[q];
+	char* name = MQTTSpool_segmentName(s, q, s->nextid);
+	int fd = -1;
+	int rc = -1;
+
+	FUNC_ENTRY;
+	if (name == NULL)
+		goto exit;
+	if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR)) < 0)
+		goto exit;
+	if (MQTTSpool_addSegment(queue, s->nextid, s->seq) == NULL)
+	{
+		close(fd);
+		unlink(name);
+		goto exit;
+	}
+	++(s->nextid);
+	if (queue->fd >= 0)
+		close(queue->fd);
+	queue->fd = fd;
+	MQTTSpool_trim(s, q);
+	rc = 0;
+exit:
+	free(name);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Append a message to the spool, dropping older messages if it is full
+ * @param s the spool
+ * @return 0 if success, -1 if the message could not be written
+ */
+int MQTTSpool_append(Spool* s, const char* topic, const char* payload, int payloadlen, int qos, int retained)
+{
+	SpoolQueue* queue = &s->queues[qos];
+	SpoolSegment* last;
+	SpoolRecord rec;
+	struct iovec iov[3];
+	long len;
+	int rc = -1;
+
+	FUNC_ENTRY;
+	memset(&rec, '\0', sizeof(SpoolRecord));
+	rec.qos = (unsigned char)qos;
+	rec.retained = (unsigned char)(retained != 0);
+	rec.time = (unsigned int)time(NULL);
+	rec.topiclen = (unsigned int)strlen(topic);
+	rec.seq = s->seq;
+	rec.payloadlen = (unsigned int)payloadlen;
+	rec.checksum = MQTTSpool_checksum(&rec, topic, payload);
+	if ((len = MQTTSpool_recordLength(&rec)) > s->maxBytes)
+		goto exit;
+	if (s->maxAge > 0)
+		MQTTSpool_expire(s, rec.time);
+	while (s->bytes + len > s->maxBytes)
+	{
+		int victim = MQTTSpool_victim(s);
+
+		if (victim < 0)
+			break;
+		Clients_addStat(s->stats->spoolEvicted, MQTTSpool_dropSegment(s, victim));
+	}
+	if ((queue->nsegments == 0 || queue->segments[queue->nsegments - 1].size >= s->segmentSize) &&
+			MQTTSpool_startSegment(s, qos) != 0)
+		goto exit;
+	last = &queue->segments[queue->nsegments - 1];
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(SpoolRecord);
+	iov[1].iov_base = (void*)topic;
+	iov[1].iov_len = rec.topiclen;
+	iov[2].iov_base = (void*)payload;
+	iov[2].iov_len = rec.payloadlen;
+	if (writev(queue->fd, iov, 3) != len)
+	{	/* cut off anything written */
+		if (ftruncate(queue->fd, last->size) != 0)
+			Log(LOG_ERROR, 0, "Error %d truncating spool segment", errno);
+		goto exit;
+	}
+	if (last->count == 0)
+		last->head = last->size;
+	last->size += len;
+	++(last->count);
+	last->newest = rec.time;
+	++(queue->count);
+	++(s->count);
+	++(s->seq);
+	s->bytes += len;
+	Clients_addStat(s->stats->spooled, 1);
+	Clients_setStat(s->stats->spoolBytes, s->bytes);
+	rc = 0;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Close the segment being read of a queue after an error reading it, so that the next attempt
+ * opens it again
+ */
+static void MQTTSpool_readFailed(SpoolQueue* queue)
+{
+	Log(LOG_ERROR, 0, "Error %d reading spool segment", errno);
+	if (queue->readfd >= 0)
+	{
+		close(queue->readfd);
+		queue->readfd = -1;
+	}
+}
+
+
+/**
+ * Read the header of the first message not taken of a queue
+ * @return 0 if success, -1 if it could not be read, 1 if the segment is cut short
+ */
+static int MQTTSpool_peek(Spool* s, int q)
+{
+	SpoolQueue* queue = &s->queues[q];
+	SpoolSegment* seg = &queue->segments[0];
+	ssize_t len;
+
+	if (queue->peeked)
+		return 0;
+	if (queue->readfd < 0)
+	{
+		char* name = MQTTSpool_segmentName(s, q, seg->id);
+
+		if (name)
+		{
+			queue->readfd = open(name, O_RDWR);
+			free(name);
+		}
+		if (queue->readfd < 0)
+		{
+			MQTTSpool_readFailed(queue);
+			return -1;
+		}
+	}
+	if ((len = pread(queue->readfd, &queue->next, sizeof(SpoolRecord), seg->head)) < 0)
+	{
+		MQTTSpool_readFailed(queue);
+		return -1;
+	}
+	if (len != sizeof(SpoolRecord) || seg->head + (long)sizeof(SpoolRecord) +
+			(long)queue->next.topiclen + (long)queue->next.payloadlen > seg->size)
+		return 1;
+	queue->peeked = 1;
+	return 0;
+}
+
+
+/**
+ * Take the message spooled earliest of those not yet taken, dropping any older than the age limit
+ * @param s the spool
+ * @param topic set to the topic, which is one allocation with the payload, to be freed by the caller
+ * @param payload set to the payload
+ * @param payloadlen set to the length of the payload
+ * @param qos set to the QoS
+ * @param retained set to the retained flag
+ * @return 0 if a message was taken, -1 if there are none or it could not be read.  A segment
+ * is only dropped if it is found to be corrupt; after an error reading it, it is left to be
+ * read again by a later call.
+ */
+int MQTTSpool_take(Spool* s, char** topic, char** payload, int* payloadlen, int* qos, int* retained)
+{
+	unsigned int now = (unsigned int)time(NULL);
+	int rc = -1;
+
+	FUNC_ENTRY;
+	while (s->count > 0)
+	{
+		SpoolQueue* queue = NULL;
+		SpoolSegment* seg;
+		SpoolRecord* rec;
+		char taken = SPOOL_TAKEN;
+		char* buf;
+		ssize_t len;
+		int q, chosen = -1, corrupt = -1;
+
+		for (q = 0; q < SPOOL_QUEUES && corrupt < 0; ++q)
+		{
+			if (s->queues[q].count == 0)
+				continue;
+			if ((rc = MQTTSpool_peek(s, q)) < 0)
+				goto exit;
+			if (rc > 0)
+				corrupt = q;
+			else if (chosen < 0 || s->queues[q].next.seq < s->queues[chosen].next.seq)
+				chosen = q;
+		}
+		rc = -1;
+		if (corrupt >= 0)
+		{	/* the messages in it cannot be sent */
+			Log(LOG_ERROR, 0, "Dropping corrupt spool segment");
+			MQTTSpool_dropSegment(s, corrupt);
+			continue;
+		}
+		queue = &s->queues[chosen];
+		seg = &queue->segments[0];
+		rec = &queue->next;
+		if ((buf = malloc(rec->topiclen + 1 + rec->payloadlen)) == NULL)
+			goto exit;
+		if ((len = pread(queue->readfd, buf, rec->topiclen + rec->payloadlen, seg->head + sizeof(SpoolRecord))) < 0)
+		{
+			free(buf);
+			MQTTSpool_readFailed(queue);
+			goto exit;
+		}
+		if (len != (ssize_t)(rec->topiclen + rec->payloadlen) ||
+				MQTTSpool_checksum(rec, buf, buf + rec->topiclen) != rec->checksum)
+		{	/* the messages in it cannot be sent */
+			free(buf);
+			Log(LOG_ERROR, 0, "Dropping corrupt spool segment");
+			MQTTSpool_dropSegment(s, chosen);
+			continue;
+		}
+		if (pwrite(queue->readfd, &taken, 1, seg->head + offsetof(SpoolRecord, flags)) != 1)
+			Log(LOG_ERROR, 0, "Error %d marking spooled message taken", errno);
+		seg->head += MQTTSpool_recordLength(rec);
+		--(seg->count);
+		--(queue->count);
+		--(s->count);
+		queue->peeked = 0;
+		if (s->maxAge > 0 && rec->time + (unsigned int)s->maxAge < now)
+		{
+			Clients_addStat(s->stats->spoolExpired, 1);
+			free(buf);
+		}
+		else
+		{
+			memmove(buf + rec->topiclen + 1, buf + rec->topiclen, rec->payloadlen);
+			buf[rec->topiclen] = '\0';
+			*topic = buf;
+			*payload = buf + rec->topiclen + 1;
+			*payloadlen = (int)rec->payloadlen;
+			*qos = rec->qos;
+			*retained = rec->retained;
+			rc = 0;
+		}
+		if (seg->count == 0 && queue->nsegments > 1)
+			MQTTSpool_trim(s, chosen);
+		if (rc == 0)
+			break;
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Read through a segment to count the messages not taken and find the first of them,
+ * cutting off a message torn by a crash
+ * @param s the spool
+ * @param q the queue of the segment
+ * @param seg the segment
+ * @return 0 if success, -1 if the segment could not be read
+ */
+static int MQTTSpool_load(Spool* s, int q, SpoolSegment* seg)
+{
+	char* name = MQTTSpool_segmentName(s, q, seg->id);
+	char buf[4096];
+	struct stat st;
+	long offset = 0;
+	int fd = -1;
+	int rc = -1;
+
+	FUNC_ENTRY;
+	if (name == NULL || (fd = open(name, O_RDWR)) < 0 || fstat(fd, &st) != 0)
+		goto exit;
+	seg->head = -1;
+	while (offset < st.st_size)
+	{
+		SpoolRecord rec;
+		unsigned int crc;
+		long len, pos;
+
+		if (pread(fd, &rec, sizeof(SpoolRecord), offset) != sizeof(SpoolRecord) ||
+				(len = MQTTSpool_recordLength(&rec)) > st.st_size - offset)
+			break;
+		crc = MQTTPersistence_checksum(0, (char*)&rec.qos, sizeof(SpoolRecord) - offsetof(SpoolRecord, qos));
+		for (pos = sizeof(SpoolRecord); pos < len; )
+		{
+			long chunk = (len - pos < (long)sizeof(buf)) ? len - pos : (long)sizeof(buf);
+
+			if (pread(fd, buf, chunk, offset + pos) != chunk)
+				break;
+			crc = MQTTPersistence_checksum(crc, buf, chunk);
+			pos += chunk;
+		}
+		if (pos < len || crc != rec.checksum)
+			break;
+		if (offset == 0)
+			seg->first = rec.seq;
+		if (!(rec.flags & SPOOL_TAKEN))
+		{
+			if (seg->head < 0)
+				seg->head = offset;
+			++(seg->count);
+		}
+		seg->newest = rec.time;
+		if (rec.seq >= s->seq)
+			s->seq = rec.seq + 1;
+		offset += len;
+	}
+	if (offset < st.st_size)
+	{
+		Log(LOG_ERROR, 0, "Cutting off torn spooled message in %s", name);
+		if (ftruncate(fd, offset) != 0)
+			goto exit;
+	}
+	seg->size = offset;
+	if (seg->head < 0)
+		seg->head = offset;
+	rc = 0;
+exit:
+	if (fd >= 0)
+		close(fd);
+	free(name);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static int MQTTSpool_compareSegments(const void* a, const void* b)
+{
+	unsigned int ida = ((const SpoolSegment*)a)->id, idb = ((const SpoolSegment*)b)->id;
+
+	return (ida < idb) ? -1 : (ida > idb);
+}
+
+
+/**
+ * Find the segments in the directory of the spool and read them in order
+ * @return 0 if success, -1 otherwise
+ */
+static int MQTTSpool_loadAll(Spool* s)
+{
+	DIR* dp;
+	struct dirent* entry;
+	int q, i;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if ((dp = opendir(s->dir)) == NULL)
+	{
+		rc = -1;
+		goto exit;
+	}
+	while ((entry = readdir(dp)) != NULL && rc == 0)
+	{
+		unsigned int id;
+		char ext[16];
+
+		if (sscanf(entry->d_name, "%d-%8x%15s", &q, &id, ext) == 3 && q >= 0 && q < SPOOL_QUEUES &&
+				strcmp(ext, SPOOL_SEGMENT_EXTENSION) == 0)
+		{
+			if (MQTTSpool_addSegment(&s->queues[q], id, 0) == NULL)
+				rc = -1;
+			else if (id >= s->nextid)
+				s->nextid = id + 1;
+		}
+	}
+	closedir(dp);
+	for (q = 0; q < SPOOL_QUEUES && rc == 0; ++q)
+	{
+		SpoolQueue* queue = &s->queues[q];
+
+		qsort(queue->segments, queue->nsegments, sizeof(SpoolSegment), MQTTSpool_compareSegments);
+		for (i = 0; i < queue->nsegments && rc == 0; ++i)
+		{
+			if ((rc = MQTTSpool_load(s, q, &queue->segments[i])) == 0)
+			{
+				queue->count += queue->segments[i].count;
+				s->bytes += queue->segments[i].size;
+			}
+		}
+		s->count += queue->count;
+		if (rc == 0 && queue->nsegments > 0)
+		{
+			char* name = MQTTSpool_segmentName(s, q, queue->segments[queue->nsegments - 1].id);
+
+			if (name == NULL || (queue->fd = open(name, O_WRONLY | O_APPEND)) < 0)
+				rc = -1;
+			free(name);
+			MQTTSpool_trim(s, q);
+		}
+	}
+	Clients_setStat(s->stats->spoolBytes, s->bytes);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Free a spool, leaving its segments on disk
+ */
+static void MQTTSpool_free(Spool* s)
+{
+	int q;
+
+	FUNC_ENTRY;
+	for (q = 0; q < SPOOL_QUEUES; ++q)
+	{
+		SpoolQueue* queue = &s->queues[q];
+
+		if (queue->fd >= 0)
+			close(queue->fd);
+		if (queue->readfd >= 0)
+			close(queue->readfd);
+		free(queue->segments);
+	}
+	free(s->dir);
+	free(s);
+	FUNC_EXIT;
+}
+
+
+/**
+ * Open a spool, creating its directory if needed, and find the messages left in it
+ * @param options the options, already checked
+ * @param stats the statistics of the client, which the spool updates
+ * @return the spool, or NULL if it could not be opened
+ */
+Spool* MQTTSpool_open(MQTTClient_spoolOptions* options, MQTTClient_stats* stats)
+{
+	Spool* s = NULL;
+	int q;
+
+	FUNC_ENTRY;
+	if (options->directory == NULL || (s = malloc(sizeof(Spool))) == NULL)
+		goto exit;
+	memset(s, '\0', sizeof(Spool));
+	for (q = 0; q < SPOOL_QUEUES; ++q)
+		s->queues[q].fd = s->queues[q].readfd = -1;
+	s->maxBytes = (options->maxBytes > 0) ? options->maxBytes : SPOOL_DEFAULT_MAX_BYTES;
+	s->maxAge = (options->maxAge > 0) ? options->maxAge : 0;
+	s->eviction = options->eviction;
+	s->segmentSize = (options->segmentSize > 0) ? options->segmentSize : SPOOL_DEFAULT_SEGMENT_SIZE;
+	s->stats = stats;
+	if ((s->dir = malloc(strlen(options->directory) + 1)) == NULL)
+		goto error;
+	strcpy(s->dir, options->directory);
+	if (pstmkdir(s->dir) == 0 && MQTTSpool_loadAll(s) == 0)
+		goto exit;
+error:
+	MQTTSpool_free(s);	/* whatever could not be loaded is left on disk */
+	s = NULL;
+exit:
+	FUNC_EXIT;
+	return s;
+}
+
+
+/**
+ * Close a spool, deleting its segments if all their messages have been taken
+ */
+void MQTTSpool_close(Spool* s)
+{
+	int q;
+
+	FUNC_ENTRY;
+	for (q = 0; q < SPOOL_QUEUES; ++q)
+	{
+		SpoolQueue* queue = &s->queues[q];
+
+		while (queue->nsegments > 0 && queue->count == 0)
+			MQTTSpool_dropSegment(s, q);
+	}
+	MQTTSpool_free(s);
+	FUNC_EXIT;
+}
+
+
+/**
+ * The number of messages waiting to be taken
+ */
+int MQTTSpool_count(Spool* s)
+{
+	return s->count;
+}
+
+#endif
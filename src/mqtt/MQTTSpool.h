@@ -0,0 +1,38 @@
+/**
+ * @file
+ * \brief A store-and-forward queue of messages on disk
+ *
+ * Messages which cannot be sent yet are appended to segment files and taken from them in
+ * the order they were spooled, so that an outage of any length costs disk space up to the
+ * configured limit rather than memory.
+ */
+
+#if !defined(MQTTSPOOL_H)
+#define MQTTSPOOL_H
+
+#include "MQTTClient.h"
+
+/**
+ * Extension of the segment files, which are named by their queue and number
+ */
+#define SPOOL_SEGMENT_EXTENSION ".spool"
+
+/**
+ * Default limit of the bytes in the segments
+ */
+#define SPOOL_DEFAULT_MAX_BYTES (16 * 1024 * 1024)
+
+/**
+ * Default size after which the next segment of a queue is started
+ */
+#define SPOOL_DEFAULT_SEGMENT_SIZE (256 * 1024)
+
+typedef struct SpoolStruct Spool;
+
+Spool* MQTTSpool_open(MQTTClient_spoolOptions* options, MQTTClient_stats* stats);
+void MQTTSpool_close(Spool* s);
+int MQTTSpool_append(Spool* s, const char* topic, const char* payload, int payloadlen, int qos, int retained);
+int MQTTSpool_take(Spool* s, char** topic, char** payload, int* payloadlen, int* qos, int* retained);
+int MQTTSpool_count(Spool* s);
+
+#endif
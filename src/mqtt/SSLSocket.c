@@ -604,6 +604,10 @@ int SSLSocket_getch(SSL* ssl, int socket, char* c)
 		{
 			rc = TCPSOCKET_INTERRUPTED;
 			SocketBuffer_interrupted(socket, 0);
+#if defined(USE_EPOLL)
+			if (err == SSL_ERROR_WANT_READ)
+				Socket_readDrained(socket);
+#endif
 		}
 	}
 	else if (rc == 0)
@@ -640,7 +644,8 @@ char *SSLSocket_getdata(SSL* ssl, int socket, int bytes, int* actual_len)
 		goto exit;
 	}
 
-	buf = SocketBuffer_getQueuedData(socket, bytes, actual_len);
+	if ((buf = SocketBuffer_getQueuedData(socket, bytes, actual_len)) == NULL)
+		goto exit;
 
 	if ((rc = SSL_read(ssl, buf + (*actual_len), (size_t)(bytes - (*actual_len)))) < 0)
 	{
@@ -650,6 +655,10 @@ char *SSLSocket_getdata(SSL* ssl, int socket, int bytes, int* actual_len)
 			buf = NULL;
 			goto exit;
 		}
+#if defined(USE_EPOLL)
+		if (rc == SSL_ERROR_WANT_READ)
+			Socket_readDrained(socket);
+#endif
 	}
 	else if (rc == 0) /* rc 0 means the other end closed the socket */
 	{
@@ -728,7 +737,14 @@ int SSLSocket_putdatas(SSL* ssl, int socket, char* buf0, size_t buf0len, int cou
 	}
 
 	SSL_lock_mutex(&sslCoreMutex);
-	if ((rc = SSL_write(ssl, iovec.iov_base, iovec.iov_len)) == iovec.iov_len)
+	if (!Socket_noPendingWrites(socket))
+	{	/* keep the packets in order, behind those already waiting to be written */
+		int free = 1;
+
+		SocketBuffer_pendingWrite(socket, ssl, 1, &iovec, &free, iovec.iov_len, 0);
+		rc = TCPSOCKET_INTERRUPTED;
+	}
+	else if ((rc = SSL_write(ssl, iovec.iov_base, iovec.iov_len)) == iovec.iov_len)
 		rc = TCPSOCKET_COMPLETE;
 	else 
 	{ 
@@ -736,15 +752,12 @@ int SSLSocket_putdatas(SSL* ssl, int socket, char* buf0, size_t buf0len, int cou
 		
 		if (sslerror == SSL_ERROR_WANT_WRITE)
 		{
-			int* sockmem = (int*)malloc(sizeof(int));
 			int free = 1;
 
 			Log(TRACE_MIN, -1, "Partial write: incomplete write of %d bytes on SSL socket %d",
 				iovec.iov_len, socket);
 			SocketBuffer_pendingWrite(socket, ssl, 1, &iovec, &free, iovec.iov_len, 0);
-			*sockmem = socket;
-			ListAppend(s.write_pending, sockmem, sizeof(int));
-			FD_SET(socket, &(s.pending_wset));
+			Socket_setWritePending(socket);
 			rc = TCPSOCKET_INTERRUPTED;
 		}
 		else 
@@ -806,8 +819,7 @@ int SSLSocket_continueWrite(pending_writes* pw)
 	FUNC_ENTRY;
 	if ((rc = SSL_write(pw->ssl, pw->iovecs[0].iov_base, pw->iovecs[0].iov_len)) == pw->iovecs[0].iov_len)
 	{
-		/* topic and payload buffers are freed elsewhere, when all references to them have been removed */
-		free(pw->iovecs[0].iov_base);
+		/* the buffer is freed when the write is taken off the queue */
 		Log(TRACE_MIN, -1, "SSL continueWrite: partial write now complete for socket %d", pw->socket);
 		rc = 1;
 	}
@@ -34,26 +34,63 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <signal.h>
 #include <ctype.h>
+#if defined(USE_IO_URING)
+#include <poll.h>
+#include <endian.h>
+#endif
 
 #include "Heap.h"
 
 int Socket_close_only(int socket);
+#if !defined(USE_EPOLL)
 int Socket_continueWrites(fd_set* pwset);
+#endif
+#if defined(USE_IO_URING)
+static void Socket_uringArm(int socket);
+static int Socket_uringRecv(int socket, char* dest, int len);
+static int Socket_uringPutdatas(int socket, char* buf0, size_t buf0len, int count, char** buffers, size_t* buflens, int* frees);
+static int Socket_uringGetReadySocket(int timeout);
+static void Socket_uringClose(int socket);
+#endif
 
 #if defined(WIN32) || defined(WIN64)
 #define iov_len len
 #define iov_base buf
 #endif
 
+/**
+ * the most buffers passed to one writev call when continuing queued writes
+ */
+#if defined(IOV_MAX)
+#define SOCKET_IOV_MAX IOV_MAX
+#else
+#define SOCKET_IOV_MAX 16
+#endif
+
+#if defined(USE_EPOLL)
+#if defined(EPOLL_EDGE_TRIGGERED)
+#define SOCKET_EPOLL_MODE EPOLLET
+#else
+#define SOCKET_EPOLL_MODE 0
+#endif
+/**
+ * maximum number of events taken from epoll in one call
+ */
+#define SOCKET_MAX_EVENTS 64
+#endif
+
 /**
  * Structure to hold all socket data for the module
  */
 /* SocketĸϢ˴ڸ״̬ĴSocket */
 Sockets s;
+#if !defined(USE_EPOLL)
 /* fd_setϣֻSocket_getReadySocketʱs.rset_savedĿ */
 static fd_set wset;
+#endif
 
 /**
  * Set a socket non-blocking, OS independently
@@ -127,6 +164,23 @@ void Socket_outInitialize()	//-
 	//-ʵĹ,
 	//-SIG_IGN(ź),źŵĽ߳ûӰ  
 	SocketBuffer_initialize();	//-˺ö¶
+#if defined(USE_EPOLL)
+	if ((s.epfd = epoll_create1(EPOLL_CLOEXEC)) == SOCKET_ERROR)
+		Socket_error("epoll_create1", 0);
+	s.states = NULL;
+	s.nstates = 0;
+	s.nsockets = 0;
+	s.ready_first = s.ready_last = -1;
+	s.nready = 0;
+	s.ready_round = 0;
+#if defined(USE_IO_URING)
+	s.starved = 0;
+	s.unsent = 0;
+	s.multishot = 1;
+	if ((s.uring = (SocketUring_initialize() == 0)) == 0)
+		Log(TRACE_MIN, -1, "io_uring is not available, so epoll is used instead");
+#endif
+#else
 	s.clientsds = ListInitialize();	//-Ǵ洢ݵһʽ,ʹ
 	s.connect_pending = ListInitialize();
 	s.write_pending = ListInitialize();
@@ -135,6 +189,7 @@ void Socket_outInitialize()	//-
 	FD_ZERO(&(s.pending_wset));	//-ָļգڶļϽǰгʼգϵͳڴռͨմԽǲ֪ġ
 	s.maxfdp1 = 0;	//-ָļķΧļֵ1
 	memcpy((void*)&(s.rset_saved), (void*)&(s.rset), sizeof(s.rset_saved));
+#endif
 	FUNC_EXIT;
 }
 
@@ -145,9 +200,20 @@ void Socket_outInitialize()	//-
 void Socket_outTerminate()
 {
 	FUNC_ENTRY;
+#if defined(USE_EPOLL)
+	if (s.epfd != SOCKET_ERROR)
+		close(s.epfd);
+	if (s.states)
+		free(s.states);
+#if defined(USE_IO_URING)
+	if (s.uring)
+		SocketUring_terminate();
+#endif
+#else
 	ListFree(s.connect_pending);
 	ListFree(s.write_pending);
 	ListFree(s.clientsds);	//-ͷͷָ
+#endif
 	SocketBuffer_terminate();
 #if defined(WIN32) || defined(WIN64)
 	WSACleanup();
@@ -156,6 +222,154 @@ void Socket_outTerminate()
 }
 
 
+#if defined(USE_EPOLL)
+/**
+ * Make sure there is a state structure for a socket descriptor
+ * @param sock the socket
+ * @return completion code
+ */
+static int Socket_growStates(int sock)
+{
+	int rc = 0;
+
+	if (sock >= s.nstates)
+	{
+		int n = (s.nstates == 0) ? 64 : s.nstates;
+		SocketState* states;
+
+		while (n <= sock)
+			n *= 2;
+		if (s.states == NULL)
+			states = (SocketState*)malloc(n * sizeof(SocketState));
+		else
+			states = (SocketState*)realloc(s.states, n * sizeof(SocketState));
+		if (states == NULL)
+			rc = SOCKET_ERROR;
+		else
+		{
+			memset(&states[s.nstates], 0, (n - s.nstates) * sizeof(SocketState));
+			s.states = states;
+			s.nstates = n;
+		}
+	}
+	return rc;
+}
+
+
+/**
+ * Register the events wanted for a socket with epoll, according to its state.  While writes
+ * are queued, writability is wanted as well as readability, so that acknowledgements and
+ * other incoming packets are still read while a bulk transfer drains.
+ * @param socket the socket
+ */
+static void Socket_updateEvents(int socket)
+{
+	SocketState* state = &s.states[socket];
+	struct epoll_event event;
+
+#if defined(USE_IO_URING)
+	if (s.uring)
+	{	/* nothing is registered: requests for the socket are submitted as they are needed */
+		SocketUring_lock();
+		Socket_uringArm(socket);
+		SocketUring_submit();
+		SocketUring_unlock();
+		return;
+	}
+#endif
+	if (state->write_pending || state->connect_pending || state->want_write)
+		event.events = EPOLLIN | EPOLLOUT;
+	else
+		event.events = EPOLLIN;
+	event.events |= SOCKET_EPOLL_MODE;
+	if (event.events != state->events)
+	{
+		event.data.u64 = 0;
+		event.data.fd = socket;
+		if (epoll_ctl(s.epfd, EPOLL_CTL_MOD, socket, &event) == SOCKET_ERROR)
+			Socket_error("epoll_ctl", socket);
+		state->events = event.events;
+	}
+}
+
+
+/**
+ * Add a socket to the end of the ready list, if it isn't already on it
+ * @param socket the socket
+ */
+static void Socket_queueReady(int socket)
+{
+	SocketState* state = &s.states[socket];
+
+	if (state->queued)
+		return;
+	state->queued = 1;
+	state->next_ready = -1;
+	state->prev_ready = s.ready_last;
+	if (s.ready_last == -1)
+		s.ready_first = socket;
+	else
+		s.states[s.ready_last].next_ready = socket;
+	s.ready_last = socket;
+	++s.nready;
+}
+
+
+/**
+ * Take a socket off the ready list, if it is on it
+ * @param socket the socket
+ */
+static void Socket_unqueueReady(int socket)
+{
+	SocketState* state = &s.states[socket];
+
+	if (!state->queued)
+		return;
+	if (state->prev_ready == -1)
+		s.ready_first = state->next_ready;
+	else
+		s.states[state->prev_ready].next_ready = state->next_ready;
+	if (state->next_ready == -1)
+		s.ready_last = state->prev_ready;
+	else
+		s.states[state->next_ready].prev_ready = state->prev_ready;
+	state->queued = 0;
+	if (--s.nready < s.ready_round)
+		s.ready_round = s.nready;
+}
+
+
+/**
+ * Note that a read from a socket would block, so that it is not returned as ready again
+ * until epoll reports more data
+ * @param socket the socket
+ */
+void Socket_readDrained(int socket)
+{
+	if (socket >= 0 && socket < s.nstates && s.states[socket].events)
+	{
+#if defined(USE_IO_URING)
+		if (s.uring)
+		{	/* more data may have been received since the read which found none */
+			UringSocket* us;
+
+			SocketUring_lock();
+			if ((us = s.states[socket].uring) != NULL && us->nsegs == 0 && !us->eof && !us->error)
+			{
+				s.states[socket].readable = 0;
+				Socket_unqueueReady(socket);
+			}
+			SocketUring_unlock();
+			return;
+		}
+#endif
+		s.states[socket].readable = 0;
+		Socket_unqueueReady(socket);
+	}
+}
+#endif
+
+
 /**
  * Add a socket to the list of socket to check with select
  * @param newSd the new socket to add
@@ -165,6 +379,41 @@ int Socket_addSocket(int newSd)	//-
 	int rc = 0;
 
 	FUNC_ENTRY;
+#if defined(USE_EPOLL)
+	if (Socket_growStates(newSd) == SOCKET_ERROR)
+		rc = SOCKET_ERROR;
+	else if (s.states[newSd].events == 0) /* make sure we don't add the same socket twice */
+	{
+		struct epoll_event event;
+
+#if defined(USE_IO_URING)
+		if (s.uring)
+		{
+			if ((s.states[newSd].uring = (UringSocket*)malloc(sizeof(UringSocket))) == NULL)
+				rc = SOCKET_ERROR;
+			else
+			{
+				memset(s.states[newSd].uring, '\0', sizeof(UringSocket));
+				s.states[newSd].events = EPOLLIN; /* in use, though not registered with epoll */
+				++s.nsockets;
+				rc = Socket_setnonblocking(newSd);
+			}
+			goto exit;
+		}
+#endif
+		event.events = EPOLLIN | SOCKET_EPOLL_MODE;
+		event.data.u64 = 0;
+		event.data.fd = newSd;
+		if ((rc = epoll_ctl(s.epfd, EPOLL_CTL_ADD, newSd, &event)) == SOCKET_ERROR)
+			Socket_error("epoll_ctl", newSd);
+		else
+		{
+			s.states[newSd].events = event.events;
+			++s.nsockets;
+			rc = Socket_setnonblocking(newSd);
+		}
+	}
+#else
 	if (ListFindItem(s.clientsds, &newSd, intcompare) == NULL) /* make sure we don't add the same socket twice */
 	{//-ûӹ׽,ͽб
 		int* pnewSd = (int*)malloc(sizeof(newSd));	//-ȿһڴռ
@@ -174,17 +423,22 @@ int Socket_addSocket(int newSd)	//-
 		s.maxfdp1 = max(s.maxfdp1, newSd + 1);	//-شֵ
 		rc = Socket_setnonblocking(newSd);
 	}
+#endif
 	else
 		Log(LOG_ERROR, -1, "addSocket: socket %d already in the list", newSd);
 
+#if defined(USE_IO_URING)
+exit:
+#endif
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
+#if !defined(USE_EPOLL)
 /**
- * Don't accept work from a client unless it is accepting work back, i.e. its socket is writeable
- * this seems like a reasonable form of flow control, and practically, seems to work.
+ * Is a socket ready to be read from?  Queued writes don't stop a socket being read, so
+ * that acknowledgements can be received while a bulk transfer is still being written.
  * @param socket the socket to check
  * @param read_set the socket read set (see select doc)
  * @param write_set the socket write set (see select doc)
@@ -199,8 +453,7 @@ int isReady(int socket, fd_set* read_set, fd_set* write_set)	//-
 	if  (ListFindItem(s.connect_pending, &socket, intcompare) && FD_ISSET(socket, write_set))	//-жfdǷڸfdsetУͨselectʹã⵽fd״̬仯ʱ棬򣬷ؼ٣ҲΪָļǷԶд
 		ListRemoveItem(s.connect_pending, &socket, intcompare);	//-׽Ͽд,˵ڽݴ,ԴҶ
 	else
-		/* ɶҿдҴ׽ûд͵ */
-		rc = FD_ISSET(socket, read_set) && FD_ISSET(socket, write_set) && Socket_noPendingWrites(socket);
+		rc = FD_ISSET(socket, read_set);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -224,6 +477,9 @@ int Socket_getReadySocket(int more_work, struct timeval *tp)	//-
 	if (s.clientsds->count == 0)	//-ж׽е׽
 		goto exit;	//-û˵û׽,ôͲеȴ
 
+	if ((rc = SocketBuffer_getBufferedSocket()) > 0)
+		goto exit; /* parse what has been read ahead before calling select again */
+
 	if (more_work)	//-ѡʱ䲻ͬ
 		timeout = zero;
 	else if (tp)
@@ -302,6 +558,48 @@ exit:
 	FUNC_EXIT_RC(rc);
 	return rc;
 } /* end getReadySocket */
+#endif
+
+
+/**
+ *  Receives data from a socket, taking any data in its read-ahead buffer first.  Small reads
+ *  refill the read-ahead buffer with as much data as is waiting, so that the packets which
+ *  follow can be taken from it without calling recv again.
+ *  @param socket the socket to read from
+ *  @param dest where to put the data
+ *  @param len the number of bytes wanted
+ *  @return the number of bytes read, 0 if the socket was closed, or SOCKET_ERROR, as for recv
+ */
+static int Socket_recv(int socket, char* dest, int len)
+{
+	int count;
+
+#if defined(USE_IO_URING)
+	if (s.uring)
+		return Socket_uringRecv(socket, dest, len);
+#endif
+	count = SocketBuffer_takeReadAhead(socket, dest, len);
+	if (count < len)
+	{
+		char* ra = NULL;
+		int rc;
+
+		if (len - count < SOCKETBUFFER_READAHEAD)
+			ra = SocketBuffer_getReadAhead(socket);
+		if (ra == NULL)
+			rc = recv(socket, dest + count, (size_t)(len - count), 0);
+		else if ((rc = recv(socket, ra, (size_t)SOCKETBUFFER_READAHEAD, 0)) > 0)
+		{
+			SocketBuffer_readAheadFilled(socket, rc);
+			rc = SocketBuffer_takeReadAhead(socket, dest + count, len - count);
+		}
+		if (rc > 0)
+			count += rc;
+		else if (count == 0)
+			count = rc;
+	}
+	return count;
+}
 
 
 /**
@@ -318,13 +616,16 @@ int Socket_getch(int socket, char* c)	//-
 	if ((rc = SocketBuffer_getQueuedChar(socket, c)) != SOCKETBUFFER_INTERRUPTED)
 		goto exit;
 
-	if ((rc = recv(socket, c, (size_t)1, 0)) == SOCKET_ERROR)	//-׽,Ѿײ
+	if ((rc = Socket_recv(socket, c, 1)) == SOCKET_ERROR)	//-׽,Ѿײ
 	{
 		int err = Socket_error("recv - getch", socket);
 		if (err == EWOULDBLOCK || err == EAGAIN)
 		{
 			rc = TCPSOCKET_INTERRUPTED;
 			SocketBuffer_interrupted(socket, 0);
+#if defined(USE_EPOLL)
+			Socket_readDrained(socket);
+#endif
 		}
 	}
 	else if (rc == 0)
@@ -360,7 +661,8 @@ char *Socket_getdata(int socket, int bytes, int* actual_len)	//-
 		goto exit;
 	}
 
-	buf = SocketBuffer_getQueuedData(socket, bytes, actual_len);
+	if ((buf = SocketBuffer_getQueuedData(socket, bytes, actual_len)) == NULL)
+		goto exit;
 	//-ĺǴӽջ,ӦڶѰҿռ
 	//-recvcopyݣĽЭɵ
 	//-recvʵcopyֽ
@@ -368,7 +670,7 @@ char *Socket_getdata(int socket, int bytes, int* actual_len)	//-
 	//-ڶָһûrecvյݣ
 	//-ָbufĳȣ
 	//-ĸһ0
-	if ((rc = recv(socket, buf + (*actual_len), (size_t)(bytes - (*actual_len)), 0)) == SOCKET_ERROR)	//-*õ׽
+	if ((rc = Socket_recv(socket, buf + (*actual_len), bytes - (*actual_len))) == SOCKET_ERROR)	//-*õ׽
 	{//-
 		rc = Socket_error("recv - getdata", socket);
 		if (rc != EAGAIN && rc != EWOULDBLOCK)
@@ -376,6 +678,9 @@ char *Socket_getdata(int socket, int bytes, int* actual_len)	//-
 			buf = NULL;
 			goto exit;
 		}
+#if defined(USE_EPOLL)
+		Socket_readDrained(socket);
+#endif
 	}
 	else if (rc == 0) /* rc 0 means the other end closed the socket, albeit "gracefully" */
 	{//-ֹ
@@ -404,8 +709,12 @@ exit:
  */
 int Socket_noPendingWrites(int socket)	//-дм׽Ƿûзͳȥ
 {
+#if defined(USE_EPOLL)
+	return socket < 0 || socket >= s.nstates || !s.states[socket].write_pending;
+#else
 	int cursock = socket;
 	return ListFindItem(s.write_pending, &cursock, intcompare) == NULL;	//-ҵ,ô1
+#endif
 }
 
 
@@ -458,22 +767,32 @@ int Socket_writev(int socket, iobuf* iovecs, int count, unsigned long* bytes)	//
  *  @param count number of buffers
  *  @param buffers an array of buffers to write
  *  @param buflens an array of corresponding buffer lengths
- *  @return completion code, especially TCPSOCKET_INTERRUPTED
+ *  @param frees an array of flags, whether each buffer is to be freed once it has been written
+ *  @return completion code, especially TCPSOCKET_INTERRUPTED, which means the rest of the
+ *  packet has been queued to be written when the socket is writable
  */
 int Socket_putdatas(int socket, char* buf0, size_t buf0len, int count, char** buffers, size_t* buflens, int* frees)	//-ͳȥ,ǲȫܷ͵,ûед뻺
 {//-дһϵеĻһ׽ǱΪһ֡ͳȥ
 	unsigned long bytes = 0L;
-	iobuf iovecs[5];
-	int frees1[5];
+	iobuf iovecs_local[5];
+	int frees_local[5];
+	iobuf* iovecs = iovecs_local;
+	int* frees1 = frees_local;
 	int rc = TCPSOCKET_INTERRUPTED, i, total = buf0len;
 
 	FUNC_ENTRY;
-	if (!Socket_noPendingWrites(socket))	//-д֮ǰжǷ׼ûз,1˵ûд
-	{//-׽ϻݷͷͳȥ,ôдĻͱ
-		Log(LOG_SEVERE, -1, "Trying to write to socket %d for which there is already pending output", socket);
-		rc = SOCKET_ERROR;
+#if defined(USE_IO_URING)
+	if (s.uring)
+	{
+		rc = Socket_uringPutdatas(socket, buf0, buf0len, count, buffers, buflens, frees);
 		goto exit;
 	}
+#endif
+	if (count + 1 > 5)
+	{
+		iovecs = malloc((count + 1) * sizeof(iobuf));
+		frees1 = malloc((count + 1) * sizeof(int));
+	}
 
 	for (i = 0; i < count; i++)	//-Ѽܳ
 		total += buflens[i];
@@ -488,13 +807,22 @@ int Socket_putdatas(int socket, char* buf0, size_t buf0len, int count, char** bu
 		frees1[i+1] = frees[i];
 	}
 
-	if ((rc = Socket_writev(socket, iovecs, count+1, &bytes)) != SOCKET_ERROR)	//-ʵݵշͳȥ
+	if (!Socket_noPendingWrites(socket))
+	{	/* keep the packets in order, behind those already waiting to be written */
+		Log(TRACE_MIN, -1, "Queueing write of %d bytes on socket %d", total, socket);
+#if defined(OPENSSL)
+		SocketBuffer_pendingWrite(socket, NULL, count+1, iovecs, frees1, total, 0);
+#else
+		SocketBuffer_pendingWrite(socket, count+1, iovecs, frees1, total, 0);
+#endif
+		rc = TCPSOCKET_INTERRUPTED;
+	}
+	else if ((rc = Socket_writev(socket, iovecs, count+1, &bytes)) != SOCKET_ERROR)	//-ʵݵշͳȥ
 	{
 		if (bytes == total)
 			rc = TCPSOCKET_COMPLETE;	//-
 		else
 		{//-ûɷ͵ĺ
-			int* sockmem = (int*)malloc(sizeof(int));
 			Log(TRACE_MIN, -1, "Partial write: %ld bytes of %d actually written on socket %d",
 					bytes, total, socket);
 #if defined(OPENSSL)
@@ -502,18 +830,43 @@ int Socket_putdatas(int socket, char* buf0, size_t buf0len, int count, char** bu
 #else
 			SocketBuffer_pendingWrite(socket, count+1, iovecs, frees1, total, bytes);	//-м¼Ϣ
 #endif
-			*sockmem = socket;
-			ListAppend(s.write_pending, sockmem, sizeof(int));	//-ϸ;ͬ
-			FD_SET(socket, &(s.pending_wset));	//-fdset,һ׽
+			Socket_setWritePending(socket);
 			rc = TCPSOCKET_INTERRUPTED;
 		}
 	}
+	if (iovecs != iovecs_local)
+	{
+		free(iovecs);
+		free(frees1);
+	}
+#if defined(USE_IO_URING)
 exit:
+#endif
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
+/**
+ *  Record that writes are queued for a socket, to be continued when the socket is writable.
+ *  Any further writes to the socket are queued behind them.
+ *  @param socket the socket
+ */
+void Socket_setWritePending(int socket)
+{
+#if defined(USE_EPOLL)
+	s.states[socket].write_pending = 1;
+	Socket_updateEvents(socket);
+#else
+	int* sockmem = (int*)malloc(sizeof(int));
+
+	*sockmem = socket;
+	ListAppend(s.write_pending, sockmem, sizeof(int));
+	FD_SET(socket, &(s.pending_wset));
+#endif
+}
+
+
 /**
  *  Add a socket to the pending write list, so that it is checked for writing in select.  This is used
  *  in connect processing when the TCP connect is incomplete, as we need to check the socket for both
@@ -522,7 +875,12 @@ exit:
  */
 void Socket_addPendingWrite(int socket)
 {
+#if defined(USE_EPOLL)
+	s.states[socket].want_write = 1;
+	Socket_updateEvents(socket);
+#else
 	FD_SET(socket, &(s.pending_wset));	//-һļ뼯֮
+#endif
 }
 
 
@@ -532,8 +890,16 @@ void Socket_addPendingWrite(int socket)
  */
 void Socket_clearPendingWrite(int socket)	//-Щ׽ֵ,ʵʶǱϵͳ߼
 {//-FDΪfile descriptorд
+#if defined(USE_EPOLL)
+	if (socket >= 0 && socket < s.nstates && s.states[socket].events)
+	{
+		s.states[socket].want_write = 0;
+		Socket_updateEvents(socket);
+	}
+#else
 	if (FD_ISSET(socket, &(s.pending_wset)))	//-selectغĳǷ׼ãԱнĴ
 		FD_CLR(socket, &(s.pending_wset));	//-һļӼɾ
+#endif
 }
 
 
@@ -573,6 +939,31 @@ int Socket_close_only(int socket)	//-
 void Socket_close(int socket)	//-׽ֵĹرպܼ,ϵͳлԼһ
 {
 	FUNC_ENTRY;
+#if defined(USE_EPOLL)
+	if (socket >= 0 && socket < s.nstates && s.states[socket].events)
+	{
+		struct epoll_event event;
+
+#if defined(USE_IO_URING)
+		if (s.states[socket].uring)
+			Socket_uringClose(socket);
+		else
+#endif
+		{
+			memset(&event, 0, sizeof(event));
+			if (epoll_ctl(s.epfd, EPOLL_CTL_DEL, socket, &event) == SOCKET_ERROR)
+				Socket_error("epoll_ctl", socket);
+		}
+		Socket_unqueueReady(socket);
+		memset(&s.states[socket], 0, sizeof(SocketState));
+		--s.nsockets;
+		Log(TRACE_MIN, -1, "Removed socket %d", socket);
+	}
+	else
+		Log(LOG_ERROR, -1, "Failed to remove socket %d", socket);
+	Socket_close_only(socket);
+	SocketBuffer_cleanup(socket);
+#else
 	Socket_close_only(socket);
 	FD_CLR(socket, &(s.rset_saved));
 	if (FD_ISSET(socket, &(s.pending_wset)))
@@ -598,18 +989,121 @@ void Socket_close(int socket)	//-
 		++(s.maxfdp1);
 		Log(TRACE_MAX, -1, "Reset max fdp1 to %d", s.maxfdp1);
 	}
+#endif
+	FUNC_EXIT;
+}
+
+
+/**
+ *  Set an integer socket option, unless the value is 0, which leaves the system default
+ *  @param sock the socket
+ *  @param level the protocol level of the option
+ *  @param name the option
+ *  @param value the value to set
+ *  @param desc the name of the option, for the log
+ */
+static void Socket_setOption(int sock, int level, int name, int value, const char* desc)
+{
+	if (value != 0 && setsockopt(sock, level, name, (void*)&value, sizeof(value)) != 0)
+		Log(LOG_ERROR, -1, "Could not set %s to %d for socket %d", desc, value, sock);
+}
+
+
+/**
+ *  Get an integer socket option
+ *  @param sock the socket
+ *  @param level the protocol level of the option
+ *  @param name the option
+ *  @return the value, or 0 if it could not be read
+ */
+static int Socket_getOption(int sock, int level, int name)
+{
+	int value = 0;
+	socklen_t len = sizeof(value);
+
+	if (getsockopt(sock, level, name, (void*)&value, &len) != 0)
+		value = 0;
+	return value;
+}
+
+
+/**
+ *  Apply TCP tuning options to a new socket.  This is done before connecting, so that the
+ *  buffer sizes are taken into account when the TCP window is negotiated.
+ *  @param sock the socket
+ *  @param options the options
+ */
+static void Socket_setOptions(int sock, MQTTClient_socketOptions* options)
+{
+	FUNC_ENTRY;
+	Socket_setOption(sock, IPPROTO_TCP, TCP_NODELAY, options->tcpNoDelay, "TCP_NODELAY");
+	Socket_setOption(sock, SOL_SOCKET, SO_SNDBUF, options->sendBufferSize, "SO_SNDBUF");
+	Socket_setOption(sock, SOL_SOCKET, SO_RCVBUF, options->receiveBufferSize, "SO_RCVBUF");
+	Socket_setOption(sock, SOL_SOCKET, SO_KEEPALIVE, options->keepAlive, "SO_KEEPALIVE");
+#if defined(TCP_USER_TIMEOUT)
+	Socket_setOption(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, options->userTimeout, "TCP_USER_TIMEOUT");
+#endif
+#if defined(TCP_KEEPIDLE)
+	Socket_setOption(sock, IPPROTO_TCP, TCP_KEEPIDLE, options->keepAliveIdle, "TCP_KEEPIDLE");
+#endif
+#if defined(TCP_KEEPINTVL)
+	Socket_setOption(sock, IPPROTO_TCP, TCP_KEEPINTVL, options->keepAliveInterval, "TCP_KEEPINTVL");
+#endif
+#if defined(TCP_KEEPCNT)
+	Socket_setOption(sock, IPPROTO_TCP, TCP_KEEPCNT, options->keepAliveCount, "TCP_KEEPCNT");
+#endif
+#if defined(TCP_NOTSENT_LOWAT)
+	Socket_setOption(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, options->notSentLowat, "TCP_NOTSENT_LOWAT");
+#endif
+	FUNC_EXIT;
+}
+
+
+/**
+ *  Report the TCP tuning options in effect on a socket, in the returned member of the options
+ *  @param sock the socket
+ *  @param options the options structure to fill in
+ */
+void Socket_getOptions(int sock, MQTTClient_socketOptions* options)
+{
+	FUNC_ENTRY;
+	memset(&options->returned, '\0', sizeof(options->returned));
+	options->returned.tcpNoDelay = Socket_getOption(sock, IPPROTO_TCP, TCP_NODELAY) != 0;
+	options->returned.sendBufferSize = Socket_getOption(sock, SOL_SOCKET, SO_SNDBUF);
+	options->returned.receiveBufferSize = Socket_getOption(sock, SOL_SOCKET, SO_RCVBUF);
+	options->returned.keepAlive = Socket_getOption(sock, SOL_SOCKET, SO_KEEPALIVE) != 0;
+#if defined(TCP_USER_TIMEOUT)
+	options->returned.userTimeout = Socket_getOption(sock, IPPROTO_TCP, TCP_USER_TIMEOUT);
+#endif
+#if defined(TCP_KEEPIDLE)
+	options->returned.keepAliveIdle = Socket_getOption(sock, IPPROTO_TCP, TCP_KEEPIDLE);
+#endif
+#if defined(TCP_KEEPINTVL)
+	options->returned.keepAliveInterval = Socket_getOption(sock, IPPROTO_TCP, TCP_KEEPINTVL);
+#endif
+#if defined(TCP_KEEPCNT)
+	options->returned.keepAliveCount = Socket_getOption(sock, IPPROTO_TCP, TCP_KEEPCNT);
+#endif
+#if defined(TCP_NOTSENT_LOWAT)
+	options->returned.notSentLowat = Socket_getOption(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+#endif
+	Log(TRACE_MIN, -1, "Socket %d options: nodelay %d sndbuf %d rcvbuf %d user timeout %d keepalive %d",
+		sock, options->returned.tcpNoDelay, options->returned.sendBufferSize,
+		options->returned.receiveBufferSize, options->returned.userTimeout, options->returned.keepAlive);
 	FUNC_EXIT;
 }
 
+
 //-Ҫ͸е,ҲҪģ鴦,ҲĵʱҪܹģʹ,Ҫ˼Ĳ
 /**
  *  Create a new socket and TCP connect to an address/port
  *  @param addr the address string
  *  @param port the TCP port
+ *  @param options TCP tuning options, or NULL for the system defaults
  *  @param sock returns the new socket
  *  @return completion code
  */
-int Socket_new(char* addr, int port, int* sock)	//-ʵֵӲ(׽),ʹTCPӵһַ
+int Socket_new(char* addr, int port, MQTTClient_socketOptions* options, int* sock)	//-ʵֵӲ(׽),ʹTCPӵһַ
 {
 	int type = SOCK_STREAM;
 	struct sockaddr_in address;
@@ -687,6 +1181,8 @@ int Socket_new(char* addr, int port, int* sock)	//-
 			if (setsockopt(*sock, SOL_SOCKET, SO_NOSIGPIPE, (void*)&opt, sizeof(opt)) != 0)
 				Log(LOG_ERROR, -1, "Could not set SO_NOSIGPIPE for socket %d", *sock);
 #endif
+			if (options)
+				Socket_setOptions(*sock, options);
 
 			Log(TRACE_MIN, -1, "New socket %d for %s, port %d",	*sock, addr, port);
 			if (Socket_addSocket(*sock) == SOCKET_ERROR)	//-һ׽ֵ׽,޸һЩֵ
@@ -705,11 +1201,20 @@ int Socket_new(char* addr, int port, int* sock)	//-
 					rc = Socket_error("connect", *sock);
 				if (rc == EINPROGRESS || rc == EWOULDBLOCK)
 				{//-EINPROGRESSôʹӻڽ;EWOULDBLOCKģΪһӱ뻨һЩʱ䡣
+#if defined(USE_EPOLL)
+					s.states[*sock].connect_pending = 1;
+					Socket_updateEvents(*sock);
+#else
 					int* pnewSd = (int*)malloc(sizeof(int));	//-һȫֱһʼͶһȫֱ,ǵҪʱ,
 					*pnewSd = *sock;
 					ListAppend(s.connect_pending, pnewSd, sizeof(int));	//-ӱ,Ǵ洢,߼
+#endif
 					Log(TRACE_MIN, 15, "Connect pending");
 				}
+#if defined(USE_IO_URING)
+				else if (rc == 0)
+					Socket_updateEvents(*sock); /* start receiving */
+#endif
 			}
 		}
 	}
@@ -718,73 +1223,65 @@ int Socket_new(char* addr, int port, int* sock)	//-
 }
 
 
-static Socket_writeComplete* writecomplete = NULL;
-
-void Socket_setWriteCompleteCallback(Socket_writeComplete* mywritecomplete)
-{
-	writecomplete = mywritecomplete;
-}
-
 /**
- *  Continue an outstanding write for a particular socket
- *  @param socket that socket
- *  @return completion code
+ *  Create a new socket and connect it to a broker listening on a Unix domain socket on this
+ *  machine.  Such a connect completes or fails at once, so it is made before the socket is set
+ *  non-blocking, and the socket is then handled like any other.
+ *  @param path the path name of the broker's socket
+ *  @param sock returns the new socket
+ *  @return completion code, 0 if the socket is connected
  */
-int Socket_continueWrite(int socket)	//-һд,ǲһд,пܼ
+int Socket_newUnix(const char* path, int* sock)
 {
-	int rc = 0;
-	pending_writes* pw;
-	unsigned long curbuflen = 0L, /* cumulative total of buffer lengths */
-		bytes;
-	int curbuf = -1, i;
-	iobuf iovecs1[5];
+	int rc = SOCKET_ERROR;
+#if defined(WIN32) || defined(WIN64)
+	FUNC_ENTRY;
+	*sock = -1;
+	Log(LOG_ERROR, -1, "Unix domain sockets are not supported on this platform");
+#else
+	struct sockaddr_un address;
 
 	FUNC_ENTRY;
-	pw = SocketBuffer_getWrite(socket);	//-õ׽׼д,ʽ̬洢
-	
-#if defined(OPENSSL)
-	if (pw->ssl)
+	*sock = -1;
+	if (strlen(path) >= sizeof(address.sun_path))
 	{
-		rc = SSLSocket_continueWrite(pw);
+		Log(LOG_ERROR, -1, "Unix domain socket path %s is too long", path);
 		goto exit;
-	} 	
-#endif
+	}
+	memset(&address, '\0', sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
 
-	for (i = 0; i < pw->count; ++i)	//-Щϸںٿ
+	if ((*sock = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET)
 	{
-		if (pw->bytes <= curbuflen)
-		{ /* if previously written length is less than the buffer we are currently looking at,
-				add the whole buffer */
-			iovecs1[++curbuf].iov_len = pw->iovecs[i].iov_len;
-			iovecs1[curbuf].iov_base = pw->iovecs[i].iov_base;
-		}
-		else if (pw->bytes < curbuflen + pw->iovecs[i].iov_len)
-		{ /* if previously written length is in the middle of the buffer we are currently looking at,
-				add some of the buffer */
-			int offset = pw->bytes - curbuflen;
-			iovecs1[++curbuf].iov_len = pw->iovecs[i].iov_len - offset;
-			iovecs1[curbuf].iov_base = pw->iovecs[i].iov_base + offset;
-			break;
-		}
-		curbuflen += pw->iovecs[i].iov_len;
+		rc = Socket_error("socket", *sock);
+		*sock = -1;
+		goto exit;
 	}
+#if defined(NOSIGPIPE)
+	{
+		int opt = 1;
 
-	if ((rc = Socket_writev(socket, iovecs1, curbuf+1, &bytes)) != SOCKET_ERROR)
+		if (setsockopt(*sock, SOL_SOCKET, SO_NOSIGPIPE, (void*)&opt, sizeof(opt)) != 0)
+			Log(LOG_ERROR, -1, "Could not set SO_NOSIGPIPE for socket %d", *sock);
+	}
+#endif
+	Log(TRACE_MIN, -1, "New socket %d for unix socket %s", *sock, path);
+	if (connect(*sock, (struct sockaddr*)&address, sizeof(address)) == SOCKET_ERROR)
 	{
-		pw->bytes += bytes;	//-Ѿͳȥֽ
-		if ((rc = (pw->bytes == pw->total)))
-		{  /* topic and payload buffers are freed elsewhere, when all references to them have been removed */
-			for (i = 0; i < pw->count; i++)
-			{
-				if (pw->frees[i])
-					free(pw->iovecs[i].iov_base);
-			}
-			Log(TRACE_MIN, -1, "ContinueWrite: partial write now complete for socket %d", socket);		
-		}
-		else
-			Log(TRACE_MIN, -1, "ContinueWrite wrote +%lu bytes on socket %d", bytes, socket);
+		Log(LOG_ERROR, -1, "Could not connect to unix socket %s: %s", path, strerror(errno));
+		close(*sock);
+		*sock = -1;
+	}
+	else if (Socket_addSocket(*sock) == SOCKET_ERROR)
+		rc = Socket_error("setnonblocking", *sock);
+	else
+	{
+		rc = 0;
+#if defined(USE_IO_URING)
+		Socket_updateEvents(*sock); /* start receiving */
+#endif
 	}
-#if defined(OPENSSL)
 exit:
 #endif
 	FUNC_EXIT_RC(rc);
@@ -792,24 +1289,636 @@ exit:
 }
 
 
+static Socket_writeComplete* writecomplete = NULL;
+
+void Socket_setWriteCompleteCallback(Socket_writeComplete* mywritecomplete)
+{
+	writecomplete = mywritecomplete;
+}
+
 /**
- *  Continue any outstanding writes for a socket set
- *  @param pwset the set of sockets
- *  @return completion code
+ *  Gather the unwritten parts of the packets queued for a socket, in order, into an array of
+ *  buffers.
+ *  @param socket the socket
+ *  @param iovecs the array to fill
+ *  @param max the number of entries in iovecs
+ *  @param sending boolean - mark the packets gathered as handed to the kernel
+ *  @return the number of entries filled
  */
-int Socket_continueWrites(fd_set* pwset)	//-һЩΪд׽,һѭ,ͳȥ
+static int Socket_gatherWrites(int socket, iobuf* iovecs, int max, int sending)
 {
-	int rc1 = 0;
-	ListElement* curpending = s.write_pending->first;
+	pending_writes* pw;
+	ListElement* cur = NULL;
+	int count = 0, i;
+
+	while (count < max && (pw = SocketBuffer_getNextWrite(socket, &cur)) != NULL)
+	{
+		unsigned long offset = pw->bytes;
+
+		pw->sending |= sending;
+		for (i = 0; i < pw->count && count < max; ++i)
+		{
+			if (offset >= pw->iovecs[i].iov_len)
+				offset -= pw->iovecs[i].iov_len;
+			else
+			{
+				iovecs[count].iov_base = (char*)(pw->iovecs[i].iov_base) + offset;
+				iovecs[count++].iov_len = pw->iovecs[i].iov_len - offset;
+				offset = 0;
+			}
+		}
+	}
+	return count;
+}
+
+
+/**
+ *  Take the packets which have now been written off the queue of a socket
+ *  @param socket the socket
+ *  @param bytes the number of bytes written from the start of the queue
+ */
+static void Socket_retireWrites(int socket, unsigned long bytes)
+{
+	pending_writes* pw;
+
+	while (bytes > 0 && (pw = SocketBuffer_getWrite(socket)) != NULL)
+	{
+		unsigned long left = pw->total - pw->bytes;
+
+		if (bytes < left)
+		{
+			pw->bytes += bytes;
+			break;
+		}
+		bytes -= left;
+		SocketBuffer_writeComplete(socket);
+	}
+}
+
+
+/**
+ *  Continue the writes queued for a particular socket.  As many of the queued packets as
+ *  will fit in SOCKET_IOV_MAX buffers are written with one writev call.
+ *  @param socket that socket
+ *  @return completion code: 1 if the queue is now empty, 0 if writes remain, SOCKET_ERROR
+ *  if the socket failed, in which case the queued writes are discarded
+ */
+int Socket_continueWrite(int socket)	//-һд,ǲһд,пܼ
+{
+	static iobuf iovecs1[SOCKET_IOV_MAX];
+	int rc = 0;
+	pending_writes* pw;
+	unsigned long bytes = 0L;
+	int curbuf = 0;
+
+	FUNC_ENTRY;
+	pw = SocketBuffer_getWrite(socket);	//-õ׽׼д,ʽ̬洢
+	if (pw == NULL)
+		goto exit;
+
+#if defined(OPENSSL)
+	if (pw->ssl)
+	{	/* SSL writes must be retried with the same buffer, so take one packet at a time */
+		if ((rc = SSLSocket_continueWrite(pw)) == 1)
+		{
+			SocketBuffer_writeComplete(socket);
+			rc = (SocketBuffer_getWrite(socket) == NULL);
+		}
+		else if (rc != 0)
+		{
+			while (SocketBuffer_writeComplete(socket))
+				;
+			rc = SOCKET_ERROR;
+		}
+		goto exit;
+	}
+#endif
+
+	curbuf = Socket_gatherWrites(socket, iovecs1, SOCKET_IOV_MAX, 0);
+	if ((rc = Socket_writev(socket, iovecs1, curbuf, &bytes)) == SOCKET_ERROR)
+	{
+		while (SocketBuffer_writeComplete(socket))
+			; /* the socket has failed, so the queued packets can't be sent */
+		goto exit;
+	}
+	Log(TRACE_MIN, -1, "ContinueWrite wrote +%lu bytes on socket %d", bytes, socket);
+
+	Socket_retireWrites(socket, bytes);
+	if ((rc = (SocketBuffer_getWrite(socket) == NULL)))
+		Log(TRACE_MIN, -1, "ContinueWrite: queued writes now complete for socket %d", socket);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+#if defined(USE_IO_URING)
+/**
+ *  Submit a receive for a socket, or a poll for the end of its TCP connect, unless one is
+ *  outstanding already.  Receives take buffers from the provided buffer ring, and are
+ *  multishot where the kernel allows, so one submission keeps delivering data until it is
+ *  cancelled or the buffers run out.  Called with the io_uring lock held.
+ *  @param socket the socket
+ */
+static void Socket_uringArm(int socket)
+{
+	SocketState* state = &s.states[socket];
+	UringSocket* us = state->uring;
+	struct io_uring_sqe* sqe;
+
+	if (us == NULL || us->closing || us->eof || us->error)
+		return;
+	if (state->connect_pending)
+	{
+		if (!us->poll_armed && (sqe = SocketUring_getSqe()) != NULL)
+		{
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = socket;
+#if __BYTE_ORDER == __BIG_ENDIAN
+			sqe->poll32_events = POLLOUT << 16; /* the kernel swaps the halves on big-endian machines */
+#else
+			sqe->poll32_events = POLLOUT;
+#endif
+			sqe->user_data = SOCKETURING_DATA(SOCKETURING_POLL, socket);
+			us->poll_armed = 1;
+		}
+	}
+	else if (!us->recv_armed && !us->starved && (sqe = SocketUring_getSqe()) != NULL)
+	{
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = socket;
+		sqe->ioprio = s.multishot ? IORING_RECV_MULTISHOT : 0;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		sqe->user_data = SOCKETURING_DATA(SOCKETURING_RECV, socket);
+		us->recv_armed = 1;
+	}
+}
+
+
+/**
+ *  Resubmit the receives which stopped for want of buffers, now that some have been given
+ *  back.  Called with the io_uring lock held.
+ */
+static void Socket_uringFeed(void)
+{
+	int i;
+
+	for (i = 0; i < s.nstates && s.starved > 0; ++i)
+	{
+		if (s.states[i].uring && s.states[i].uring->starved)
+		{
+			s.states[i].uring->starved = 0;
+			--s.starved;
+			Socket_uringArm(i);
+		}
+	}
+}
+
+
+/**
+ *  The io_uring version of recv: take received data from the provided buffers of a socket,
+ *  giving each buffer back to the kernel once it has all been read.
+ *  @param socket the socket to read from
+ *  @param dest where to put the data
+ *  @param len the number of bytes wanted
+ *  @return the number of bytes read, 0 if the socket was closed, or SOCKET_ERROR with errno set
+ */
+static int Socket_uringRecv(int socket, char* dest, int len)
+{
+	UringSocket* us;
+	int count = 0, err = 0, freed = 0;
+
+	SocketUring_lock();
+	if ((us = s.states[socket].uring) == NULL)
+		err = ENOTCONN;
+	else
+	{
+		while (count < len && us->nsegs > 0)
+		{
+			UringSegment* seg = &us->segs[us->first];
+			int n = seg->end - seg->start;
+
+			if (n > len - count)
+				n = len - count;
+			memcpy(dest + count, SocketUring_getBuffer(seg->bid) + seg->start, n);
+			count += n;
+			if ((seg->start += n) == seg->end)
+			{
+				SocketUring_recycleBuffer(seg->bid);
+				us->first = (us->first + 1) % SOCKETURING_BUFFERS;
+				--us->nsegs;
+				freed = 1;
+			}
+		}
+		if (count == 0 && !us->eof)
+			err = (us->error) ? us->error : EAGAIN;
+	}
+	if (freed && s.starved > 0)
+	{
+		Socket_uringFeed();
+		SocketUring_submit();
+	}
+	SocketUring_unlock();
+	if (err)
+	{
+		errno = err;
+		count = SOCKET_ERROR;
+	}
+	return count;
+}
+
+
+/**
+ *  Submit a sendmsg for as many of the packets queued for a socket as fit in one, unless one
+ *  is outstanding already, when the packets wait for it to complete.  Called with the io_uring
+ *  lock held.
+ *  @param socket the socket
+ */
+static void Socket_uringSend(int socket)
+{
+	UringSocket* us = s.states[socket].uring;
+	struct io_uring_sqe* sqe;
+	int count;
+
+	if (us == NULL || us->send_inflight || us->closing)
+		return;
+	if ((count = Socket_gatherWrites(socket, us->iov, SOCKETURING_SEND_IOV, 1)) == 0)
+		return;
+	if ((sqe = SocketUring_getSqe()) == NULL)
+	{	/* tried again after the next completions */
+		Log(TRACE_MIN, -1, "No io_uring submission entry free to send on socket %d", socket);
+		if (!us->unsent)
+		{
+			us->unsent = 1;
+			++s.unsent;
+		}
+		return;
+	}
+	if (us->unsent)
+	{
+		us->unsent = 0;
+		--s.unsent;
+	}
+	memset(&us->msg, '\0', sizeof(us->msg));
+	us->msg.msg_iov = us->iov;
+	us->msg.msg_iovlen = count;
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = socket;
+	sqe->addr = (unsigned long long)(unsigned long)&us->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = SOCKETURING_DATA(SOCKETURING_SEND, socket);
+	us->send_inflight = 1;
+}
+
+
+/**
+ *  Submit the sends which were held up for want of a submission entry.  Called with the
+ *  io_uring lock held.
+ */
+static void Socket_uringResend(void)
+{
+	int i;
+
+	for (i = 0; i < s.nstates && s.unsent > 0; ++i)
+	{
+		if (s.states[i].uring && s.states[i].uring->unsent)
+			Socket_uringSend(i);
+	}
+}
+
+
+/**
+ *  The io_uring version of putdatas: queue a packet and submit a send for it, unless a send is
+ *  outstanding already, when the packet goes in the next.  The kernel may read the data after
+ *  this has returned, so it is copied into one buffer owned by the queue.  The caller keeps
+ *  its buffers, as for a completed write, so QoS 0 publications need not be stored.
+ *  @return completion code: TCPSOCKET_COMPLETE once the copy is queued, or SOCKET_ERROR if
+ *  the socket has failed
+ */
+static int Socket_uringPutdatas(int socket, char* buf0, size_t buf0len, int count, char** buffers, size_t* buflens, int* frees)
+{
+	UringSocket* us;
+	iobuf iovec;
+	char* ptr;
+	int i, free1 = 1, rc = TCPSOCKET_COMPLETE;
+
+	FUNC_ENTRY;
+	iovec.iov_len = buf0len;
+	for (i = 0; i < count; i++)
+		iovec.iov_len += buflens[i];
+	if ((ptr = iovec.iov_base = malloc(iovec.iov_len)) == NULL)
+	{
+		rc = SOCKET_ERROR;
+		goto exit;
+	}
+	memcpy(ptr, buf0, buf0len);
+	ptr += buf0len;
+	for (i = 0; i < count; i++)
+	{
+		memcpy(ptr, buffers[i], buflens[i]);
+		ptr += buflens[i];
+	}
+
+	SocketUring_lock();
+	if ((us = s.states[socket].uring) == NULL || us->error)
+		rc = SOCKET_ERROR;
+	else
+	{
+		SocketBuffer_pendingWrite(socket, 1, &iovec, &free1, (int)iovec.iov_len, 0);
+		s.states[socket].write_pending = 1;
+		Socket_uringSend(socket);
+		SocketUring_submit();
+	}
+	SocketUring_unlock();
+
+	if (rc == SOCKET_ERROR)
+		free(iovec.iov_base);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ *  Act on one completion.  Received data is added to the buffers of the socket and the socket
+ *  queued as ready; a send which completes takes its packets off the queue and submits the
+ *  next; a poll which completes ends a TCP connect.  Called with the io_uring lock held.
+ *  @param data the user data of the request
+ *  @param res the result of the request
+ *  @param flags the completion flags
+ *  @return the socket, if its queue of writes is now empty so the write complete callback
+ *  is due, otherwise 0
+ */
+static int Socket_uringComplete(unsigned long long data, int res, unsigned int flags)
+{
+	int socket = SOCKETURING_SOCKET(data);
+	UringSocket* us = (socket < s.nstates) ? s.states[socket].uring : NULL;
+	int rc = 0;
+
+	switch (SOCKETURING_OP(data))
+	{
+	case SOCKETURING_RECV:
+		if (flags & IORING_CQE_F_BUFFER)
+		{
+			int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+			if (us && res > 0 && !us->closing)
+			{
+				UringSegment* seg = &us->segs[(us->first + us->nsegs++) % SOCKETURING_BUFFERS];
+
+				seg->bid = bid;
+				seg->start = 0;
+				seg->end = res;
+			}
+			else
+				SocketUring_recycleBuffer(bid);
+		}
+		if (us == NULL)
+			break;
+		if (!(flags & IORING_CQE_F_MORE))
+			us->recv_armed = 0;
+		if (us->closing)
+			break;
+		if (res == 0)
+			us->eof = 1;
+		else if (res == -ENOBUFS)
+		{	/* started again when buffers are given back */
+			if (!us->recv_armed && !us->starved)
+			{
+				us->starved = 1;
+				++s.starved;
+			}
+		}
+		else if (res == -EINVAL && s.multishot)
+		{
+			Log(TRACE_MIN, -1, "Multishot receives are not supported, so each receive is submitted separately");
+			s.multishot = 0;
+		}
+		else if (res < 0 && res != -ECANCELED)
+		{
+			us->error = -res;
+			Log(TRACE_MIN, -1, "Socket error %s in recv for socket %d", strerror(-res), socket);
+		}
+		if (res >= 0 || us->error)
+		{
+			s.states[socket].readable = 1;
+			Socket_queueReady(socket);
+		}
+		if (!us->recv_armed)
+			Socket_uringArm(socket);
+		break;
+
+	case SOCKETURING_SEND:
+		if (us == NULL)
+			break;
+		us->send_inflight = 0;
+		if (us->closing)
+			break;
+		if (res < 0)
+		{
+			Log(TRACE_MIN, -1, "Socket error %s in sendmsg for socket %d", strerror(-res), socket);
+			us->error = -res;
+			while (SocketBuffer_writeComplete(socket))
+				; /* the socket has failed, so the queued packets can't be sent */
+			s.states[socket].readable = 1;
+			Socket_queueReady(socket); /* so that the failure is found */
+		}
+		else
+		{
+			Log(TRACE_MIN, -1, "Sendmsg wrote %d bytes on socket %d", res, socket);
+			Socket_retireWrites(socket, (unsigned long)res);
+		}
+		if (SocketBuffer_getWrite(socket) == NULL)
+		{
+			s.states[socket].write_pending = 0;
+			rc = socket;
+		}
+		else
+			Socket_uringSend(socket);
+		break;
+
+	case SOCKETURING_POLL:
+		if (us == NULL)
+			break;
+		us->poll_armed = 0;
+		if (s.states[socket].connect_pending && !us->closing)
+		{
+			s.states[socket].connect_pending = 0;
+			Socket_queueReady(socket);
+			Socket_uringArm(socket);
+		}
+		break;
+	}
+	return rc;
+}
+
+
+/**
+ *  Act on the completions waiting, up to SOCKET_MAX_EVENTS of them, then submit the requests
+ *  they have led to.  Called with the io_uring lock held.
+ *  @param done returns the sockets whose queues of writes are now empty
+ *  @return the number of sockets in done
+ */
+static int Socket_uringProcess(int* done)
+{
+	unsigned long long data;
+	unsigned int flags;
+	int res, count = 0, ndone = 0;
+
+	while (count++ < SOCKET_MAX_EVENTS && SocketUring_nextCompletion(&data, &res, &flags))
+	{
+		int socket = Socket_uringComplete(data, res, flags);
+
+		if (socket > 0)
+			done[ndone++] = socket;
+	}
+	if (s.unsent > 0)
+		Socket_uringResend();
+	SocketUring_submit();
+	return ndone;
+}
+
+
+/**
+ *  The io_uring version of getReadySocket: act on the completions waiting, waiting for some
+ *  if there are no ready sockets, and return the first ready socket.  A socket with data left
+ *  in its buffers goes to the back of the ready list, to be returned again until it has all
+ *  been read.
+ *  @param timeout the longest time to wait, in milliseconds
+ *  @return the socket next ready, or 0 if none is ready
+ */
+static int Socket_uringGetReadySocket(int timeout)
+{
+	int done[SOCKET_MAX_EVENTS];
+	int ndone, i, rc = 0;
+
+	SocketUring_lock();
+	ndone = Socket_uringProcess(done);
+	if (s.nready == 0 && ndone == 0 && timeout > 0)
+	{	/* the lock isn't held while waiting, so that packets can be sent meanwhile */
+		SocketUring_unlock();
+		SocketUring_wait(timeout);
+		SocketUring_lock();
+		ndone = Socket_uringProcess(done);
+	}
+	if (s.nready > 0)
+	{
+		rc = s.ready_first;
+		Socket_unqueueReady(rc);
+		if (s.states[rc].readable)
+			Socket_queueReady(rc);
+	}
+	SocketUring_unlock();
+
+	for (i = 0; i < ndone; ++i)
+	{
+		if (writecomplete)
+			(*writecomplete)(done[i]);
+	}
+	return rc;
+}
+
+
+/**
+ *  Cancel the requests outstanding for a socket which is being closed, and wait for them to
+ *  complete, as until then the kernel may still be using the buffers of the socket.  If no
+ *  submission entry is free for the cancel, the socket is shut down instead, which ends the
+ *  outstanding requests too.
+ *  @param socket the socket
+ */
+static void Socket_uringClose(int socket)
+{
+	UringSocket* us = s.states[socket].uring;
+	struct io_uring_sqe* sqe;
+	int done[SOCKET_MAX_EVENTS];
+	int ndone, busy, i;
+
+	FUNC_ENTRY;
+	SocketUring_lock();
+	us->closing = 1;
+	if (us->unsent)
+	{
+		us->unsent = 0;
+		--s.unsent;
+	}
+	if (us->recv_armed || us->send_inflight || us->poll_armed)
+	{
+		if ((sqe = SocketUring_getSqe()) != NULL)
+		{
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = socket;
+			sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+			sqe->user_data = SOCKETURING_DATA(SOCKETURING_CANCEL, socket);
+			SocketUring_submit();
+		}
+		else
+		{
+			Log(TRACE_MIN, -1, "No io_uring submission entry free to cancel on socket %d", socket);
+			shutdown(socket, SHUT_RDWR);
+		}
+	}
+	do
+	{
+		ndone = Socket_uringProcess(done);
+		if (!(busy = us->recv_armed || us->send_inflight || us->poll_armed))
+		{
+			while (us->nsegs > 0)
+			{
+				SocketUring_recycleBuffer(us->segs[us->first].bid);
+				us->first = (us->first + 1) % SOCKETURING_BUFFERS;
+				--us->nsegs;
+			}
+			if (us->starved)
+				--s.starved;
+			free(us);
+			s.states[socket].uring = NULL;
+		}
+		SocketUring_unlock();
+		for (i = 0; i < ndone; ++i)
+		{
+			if (writecomplete)
+				(*writecomplete)(done[i]);
+		}
+		if (busy)
+		{
+			SocketUring_wait(100);
+			SocketUring_lock();
+		}
+	} while (busy);
+	FUNC_EXIT;
+}
+#endif
+
+
+#if !defined(USE_EPOLL)
+/**
+ *  Continue any outstanding writes for a socket set
+ *  @param pwset the set of sockets
+ *  @return completion code
+ */
+int Socket_continueWrites(fd_set* pwset)	//-һЩΪд׽,һѭ,ͳȥ
+{
+	int rc1 = 0;
+	ListElement* curpending = s.write_pending->first;
 
 	FUNC_ENTRY;
 	while (curpending)
 	{
 		int socket = *(int*)(curpending->content);	//-ȡеһļ
-		if (FD_ISSET(socket, pwset) && Socket_continueWrite(socket))	//-ȼ鼯ָļǷԶд
+		int rc = (FD_ISSET(socket, pwset)) ? Socket_continueWrite(socket) : 0;
+
+		if (rc == SOCKET_ERROR)
+		{	/* the queued writes were discarded; reading the socket reports the failure */
+			FD_CLR(socket, &(s.pending_wset));
+			FD_SET(socket, &(s.rset));
+			if (!ListRemove(s.write_pending, curpending->content))
+				ListNextElement(s.write_pending, &curpending);
+			curpending = s.write_pending->current;
+		}
+		else if (rc == 1)	//-ȼ鼯ָļǷԶд
 		{//-˵ɹ,,ܻûд,Ҫ߻һ
-			if (!SocketBuffer_writeComplete(socket))
-				Log(LOG_SEVERE, -1, "Failed to remove pending write from socket buffer list");
 			FD_CLR(socket, &(s.pending_wset));	//-Ѿдȥ,ԴҶȥ
 			if (!ListRemove(s.write_pending, curpending->content))
 			{
@@ -827,6 +1936,128 @@ int Socket_continueWrites(fd_set* pwset)	//-
 	FUNC_EXIT_RC(rc1);
 	return rc1;
 }
+#else
+
+/**
+ *  Wait for socket events, and put the sockets which are ready on the ready list.  Connects
+ *  which have completed are ready; otherwise a socket is ready when it is readable and has no
+ *  write pending.  Pending writes are continued as soon as their sockets are writable.
+ *  @param timeout the longest time to wait, in milliseconds
+ *  @return the number of events, or SOCKET_ERROR
+ */
+static int Socket_poll(int timeout)
+{
+	struct epoll_event events[SOCKET_MAX_EVENTS];
+	int rc, i;
+
+	FUNC_ENTRY;
+	if ((rc = epoll_wait(s.epfd, events, SOCKET_MAX_EVENTS, timeout)) == SOCKET_ERROR)
+	{
+		Socket_error("epoll_wait", 0);
+		goto exit;
+	}
+	Log(TRACE_MAX, -1, "Return code %d from epoll_wait", rc);
+
+	for (i = 0; i < rc; ++i)
+	{
+		int socket = events[i].data.fd;
+
+		if (socket >= s.nstates || s.states[socket].events == 0)
+			continue; /* closed while an earlier event was being handled */
+		if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			s.states[socket].readable = 1;
+		if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+		{
+			if (s.states[socket].connect_pending)
+			{
+				s.states[socket].connect_pending = 0;
+				Socket_updateEvents(socket);
+				Socket_queueReady(socket);
+			}
+			if (s.states[socket].write_pending)
+			{
+				int rc1 = Socket_continueWrite(socket);
+
+				if (rc1 != 0)
+				{
+					s.states[socket].write_pending = 0;
+					Socket_updateEvents(socket);
+				}
+				if (rc1 == SOCKET_ERROR)
+					s.states[socket].readable = 1;	/* the queued writes were discarded; reading reports the failure */
+				else if (rc1 == 1 && writecomplete)
+					(*writecomplete)(socket);
+			}
+		}
+		if (s.states[socket].readable)
+			Socket_queueReady(socket);
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ *  Returns the next socket ready for communications, from the ready list.  The list is
+ *  refilled from epoll only when all the sockets found ready last time have been returned.
+ *  @param more_work flag to indicate more work is waiting, and thus a timeout value of 0 should
+ *  be used for epoll
+ *  @param tp the timeout to be used for epoll, unless overridden
+ *  @return the socket next ready, or 0 if none is ready
+ */
+int Socket_getReadySocket(int more_work, struct timeval *tp)
+{
+	int rc = 0;
+	int timeout = 1000; /* 1 second */
+
+	FUNC_ENTRY;
+	if (s.nsockets == 0)
+		goto exit;
+
+	if ((rc = SocketBuffer_getBufferedSocket()) > 0)
+		goto exit; /* parse what has been read ahead before asking epoll for more */
+
+	if (more_work)
+		timeout = 0;
+	else if (tp)
+		timeout = tp->tv_sec * 1000 + (tp->tv_usec + 999) / 1000;
+
+#if defined(USE_IO_URING)
+	if (s.uring)
+	{
+		rc = Socket_uringGetReadySocket(timeout);
+		goto exit;
+	}
+#endif
+	if (s.ready_round == 0)
+	{
+		if (s.nready > 0)
+			timeout = 0; /* sockets requeued for another turn are waiting */
+		if (Socket_poll(timeout) == SOCKET_ERROR)
+			goto exit;
+		s.ready_round = s.nready;
+	}
+
+	if (s.nready > 0)
+	{
+		rc = s.ready_first;
+		--s.ready_round;
+		Socket_unqueueReady(rc);
+#if defined(EPOLL_EDGE_TRIGGERED)
+		/* there is no new edge until the socket has been read until it would block,
+		   so give it another turn after the other ready sockets */
+		if (s.states[rc].readable)
+			Socket_queueReady(rc);
+#else
+		s.states[rc].readable = 0;
+#endif
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+} /* end getReadySocket */
+#endif
 
 
 /**
@@ -846,6 +2077,15 @@ char* Socket_getaddrname(struct sockaddr* sa, int sock)	//-
  */
 #define PORTLEN 10
 	static char addr_string[ADDRLEN + PORTLEN];
+#if defined(AF_UNIX) && !defined(WIN32) && !defined(WIN64)
+	static char path_string[sizeof(((struct sockaddr_un*)0)->sun_path) + 1];
+
+	if (sa->sa_family == AF_UNIX)
+	{
+		strncpy(path_string, ((struct sockaddr_un*)sa)->sun_path, sizeof(path_string) - 1);
+		return path_string;
+	}
+#endif
 
 #if defined(WIN32) || defined(WIN64)
 	int buflen = ADDRLEN*2;
@@ -872,7 +2112,7 @@ char* Socket_getaddrname(struct sockaddr* sa, int sock)	//-
  */
 char* Socket_getpeer(int sock)	//-õӵһ׽ֵϢ
 {
-	struct sockaddr_in6 sa;
+	struct sockaddr_storage sa;
 	socklen_t sal = sizeof(sa);
 	int rc;
 
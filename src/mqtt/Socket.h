@@ -18,6 +18,13 @@
 #if !defined(SOCKET_H)
 #define SOCKET_H
 
+#if defined(__linux__) && !defined(USE_SELECT)
+/** use epoll rather than select to wait for sockets, unless USE_SELECT is defined */
+#define USE_EPOLL
+#endif
+#if defined(USE_IO_URING) && (!defined(USE_EPOLL) || defined(OPENSSL))
+#error "USE_IO_URING needs Linux without USE_SELECT, and is not supported with OPENSSL"
+#endif
 #include <sys/types.h>
 
 #if defined(WIN32) || defined(WIN64)
@@ -51,6 +58,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <sys/un.h>
+#if defined(USE_EPOLL)
+#include <sys/epoll.h>
+#endif
 #endif
 
 /** socket operation completed successfully */
@@ -73,6 +84,8 @@
 #endif
 
 #include "LinkedList.h"
+#include "MQTTClient.h"
+#include "SocketUring.h"
 
 /*BE
 def FD_SET
@@ -94,6 +107,77 @@ def SOCKETS
 BE*/
 
 
+#if defined(USE_IO_URING)
+/**
+ * Data received into a provided buffer and not yet read by the packet decoder
+ */
+typedef struct
+{
+	int bid; /**< buffer id */
+	int start, end; /**< the unread data is from start to end - 1 in the buffer */
+} UringSegment;
+
+
+/**
+ * State of one socket for the io_uring engine
+ */
+typedef struct
+{
+	int recv_armed; /**< boolean - a receive is outstanding */
+	int poll_armed; /**< boolean - a poll for the end of a TCP connect is outstanding */
+	int send_inflight; /**< boolean - a sendmsg is outstanding */
+	int starved; /**< boolean - receiving stopped because there were no free buffers */
+	int unsent; /**< boolean - packets are queued but no submission entry was free to send them */
+	int closing; /**< boolean - the outstanding requests are being cancelled */
+	int eof; /**< boolean - the other end has closed the connection */
+	int error; /**< errno of a failed receive or send, 0 if none */
+	UringSegment segs[SOCKETURING_BUFFERS]; /**< received data in order, a ring of nsegs from first */
+	int first, nsegs;
+	struct msghdr msg; /**< the outstanding sendmsg, which must stay valid until it completes */
+	struct iovec iov[SOCKETURING_SEND_IOV];
+} UringSocket;
+#endif
+
+
+#if defined(USE_EPOLL)
+/**
+ * State of one socket for the epoll version of the module, indexed by socket descriptor
+ */
+typedef struct
+{
+	unsigned int events; /**< events registered with epoll, 0 if the socket is not in use */
+	int connect_pending; /**< boolean - a TCP connect is in progress */
+	int write_pending; /**< boolean - a partial write is waiting to be continued */
+	int want_write; /**< boolean - writability is being checked for, see Socket_addPendingWrite */
+	int readable; /**< boolean - there may be data to read */
+	int queued; /**< boolean - the socket is on the ready list */
+	int prev_ready, next_ready; /**< ready list links, -1 at either end */
+#if defined(USE_IO_URING)
+	UringSocket* uring; /**< io_uring state, NULL when epoll is being used */
+#endif
+} SocketState;
+
+
+/**
+ * Structure to hold all socket data for the module
+ */
+typedef struct
+{
+	int epfd; /**< epoll descriptor */
+	SocketState* states; /**< socket states, indexed by socket descriptor */
+	int nstates; /**< number of entries in states */
+	int nsockets; /**< number of sockets in use */
+	int ready_first, ready_last; /**< ready list of sockets, -1 if empty */
+	int nready; /**< number of sockets on the ready list */
+	int ready_round; /**< number of sockets at the front of the ready list to return before epoll is called again */
+#if defined(USE_IO_URING)
+	int uring; /**< boolean - io_uring is being used rather than epoll */
+	int starved; /**< number of sockets waiting for free receive buffers */
+	int unsent; /**< number of sockets waiting for a submission entry to send */
+	int multishot; /**< boolean - the kernel supports multishot receives */
+#endif
+} Sockets;
+#else
 /**
  * Structure to hold all socket data for the module
  */
@@ -110,6 +194,7 @@ typedef struct
 	/* fd_setϣ洢SocketļеĹWriteԪ */
 	fd_set pending_wset; /**< socket pending write set for select */
 } Sockets;
+#endif
 
 
 void Socket_outInitialize(void);
@@ -119,11 +204,17 @@ int Socket_getch(int socket, char* c);
 char *Socket_getdata(int socket, int bytes, int* actual_len);
 int Socket_putdatas(int socket, char* buf0, size_t buf0len, int count, char** buffers, size_t* buflens, int* frees);
 void Socket_close(int socket);
-int Socket_new(char* addr, int port, int* socket);
+int Socket_newUnix(const char* path, int* socket);
+void Socket_getOptions(int sock, MQTTClient_socketOptions* options);
+int Socket_new(char* addr, int port, MQTTClient_socketOptions* options, int* socket);
 
 int Socket_noPendingWrites(int socket);
 char* Socket_getpeer(int sock);
 
+void Socket_setWritePending(int socket);
+#if defined(USE_EPOLL)
+void Socket_readDrained(int socket);
+#endif
 void Socket_addPendingWrite(int socket);
 void Socket_clearPendingWrite(int socket);
 
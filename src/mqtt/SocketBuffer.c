@@ -25,6 +25,7 @@
 #include "LinkedList.h"
 #include "Log.h"
 #include "Messages.h"
+#include "MQTTPacket.h"
 #include "StackTrace.h"
 
 #include <stdlib.h>
@@ -44,9 +45,19 @@
 static socket_queue* def_queue;	//-Ĭϵл,ļȫʹ
 
 /**
- * List of queued input buffers
+ * Receive buffers of one socket
  */
-static List* queues;
+typedef struct
+{
+	socket_queue* queue;			/**< queue of a packet which has been partly read, or NULL */
+	socket_readahead* readahead;	/**< read-ahead buffer, or NULL */
+} socket_buffers;
+
+/**
+ * Receive buffers, indexed by socket
+ */
+static socket_buffers* sockbufs = NULL;
+static int nsockbufs = 0;
 
 /**
  * List of queued write buffers
@@ -54,26 +65,195 @@ static List* queues;
 static List writes;
 
 /**
- * List callback function for comparing socket_queues by socket
- * @param a first integer value
- * @param b second integer value
- * @return boolean indicating whether a and b are equal
+ * The read-ahead buffers which hold unread data, oldest first
+ */
+static socket_readahead *buffered_first = NULL, *buffered_last = NULL;
+
+/**
+ * Pool of receive buffers in size classes, and of queue structures, so that once the pool
+ * holds what the traffic needs, receiving packets does not allocate or free any memory
+ */
+static struct
+{
+	char* free[SOCKETBUFFER_POOL_CLASSES];	/**< free buffers of each class, linked through their first bytes */
+	socket_queue* spare_queues[SOCKETBUFFER_POOL_QUEUES];
+	int nspare_queues;
+	SocketBuffer_poolStats stats;
+} pool;
+
+
+/**
+ * Find the size class for a buffer
+ * @param size the number of bytes needed
+ * @return the class, or SOCKETBUFFER_POOL_CLASSES if the buffer is too big to be pooled
+ */
+static int SocketBuffer_sizeClass(int size)
+{
+	int c = 0;
+
+	while (c < SOCKETBUFFER_POOL_CLASSES && (SOCKETBUFFER_POOL_MIN << c) < size)
+		++c;
+	return c;
+}
+
+
+/**
+ * Get a receive buffer from the pool
+ * @param size the number of bytes needed
+ * @param buflen returns the size of the buffer, which may be more than was asked for
+ * @return the buffer, or NULL if no memory could be allocated
+ */
+static char* SocketBuffer_poolGet(int size, int* buflen)
+{
+	int c = SocketBuffer_sizeClass(size);
+	SocketBuffer_poolClass* cls;
+	char* buf;
+
+	if (c == SOCKETBUFFER_POOL_CLASSES)
+	{
+		++pool.stats.oversize;
+		*buflen = size;
+		return malloc(size);
+	}
+	cls = &pool.stats.classes[c];
+	if ((buf = pool.free[c]) != NULL)
+	{
+		pool.free[c] = *(char**)buf;
+		--cls->cached;
+	}
+	else if ((buf = malloc(cls->size)) == NULL)
+		return NULL;
+	else
+		++cls->allocs;
+	++cls->gets;
+	++cls->in_use;
+	*buflen = cls->size;
+	return buf;
+}
+
+
+/**
+ * Give a receive buffer back to the pool.  Each class keeps up to SOCKETBUFFER_POOL_CACHE
+ * bytes of free buffers, and at least one; any more are freed.
+ * @param buf the buffer, which may be NULL
+ * @param buflen the size of the buffer, as returned by SocketBuffer_poolGet
  */
-int socketcompare(void* a, void* b)	//?׽ֱȽζʲô
+static void SocketBuffer_poolPut(char* buf, int buflen)
 {
-	return ((socket_queue*)a)->socket == *(int*)b;
+	int c = SocketBuffer_sizeClass(buflen);
+	SocketBuffer_poolClass* cls;
+
+	if (buf == NULL)
+		return;
+	if (c == SOCKETBUFFER_POOL_CLASSES)
+	{
+		free(buf);
+		return;
+	}
+	cls = &pool.stats.classes[c];
+	--cls->in_use;
+	if (cls->cached > 0 && (cls->cached + 1) * cls->size > SOCKETBUFFER_POOL_CACHE)
+	{
+		++cls->frees;
+		free(buf);
+	}
+	else
+	{
+		*(char**)buf = pool.free[c];
+		pool.free[c] = buf;
+		++cls->cached;
+	}
+}
+
+
+/**
+ * Get an empty input queue, with a buffer of the smallest class
+ * @return the queue, or NULL if no memory could be allocated
+ */
+static socket_queue* SocketBuffer_newQueue(void)
+{
+	socket_queue* queue;
+
+	if (pool.nspare_queues > 0)
+		queue = pool.spare_queues[--pool.nspare_queues];
+	else if ((queue = malloc(sizeof(socket_queue))) == NULL)
+		return NULL;
+	if ((queue->buf = SocketBuffer_poolGet(SOCKETBUFFER_POOL_MIN, &queue->buflen)) == NULL)
+		queue->buflen = 0; /* a buffer is got when the first packet is read */
+	queue->socket = queue->index = queue->headerlen = queue->datalen = 0;
+	return queue;
+}
+
+
+/**
+ * Give an input queue and its buffer back to the pool
+ * @param queue the queue
+ */
+static void SocketBuffer_freeQueue(socket_queue* queue)
+{
+	if (queue == NULL)
+		return;
+	SocketBuffer_poolPut(queue->buf, queue->buflen);
+	if (pool.nspare_queues < SOCKETBUFFER_POOL_QUEUES)
+		pool.spare_queues[pool.nspare_queues++] = queue;
+	else
+		free(queue);
+}
+
+
+/**
+ * Get the receive buffers of a socket
+ * @param socket the socket
+ * @param create boolean - make room for the socket if there is none yet
+ * @return the buffers, or NULL
+ */
+static socket_buffers* SocketBuffer_getSocket(int socket, int create)
+{
+	if (socket < 0)
+		return NULL;
+	if (socket >= nsockbufs)
+	{
+		int n = (nsockbufs == 0) ? 64 : nsockbufs;
+		socket_buffers* newmem;
+
+		if (!create)
+			return NULL;
+		while (n <= socket)
+			n *= 2;
+		if (sockbufs == NULL)
+			newmem = malloc(n * sizeof(socket_buffers));
+		else
+			newmem = realloc(sockbufs, n * sizeof(socket_buffers));
+		if (newmem == NULL)
+			return NULL;
+		memset(&newmem[nsockbufs], 0, (n - nsockbufs) * sizeof(socket_buffers));
+		sockbufs = newmem;
+		nsockbufs = n;
+	}
+	return &sockbufs[socket];
+}
+
+
+/**
+ * Get the queue of a packet which has been partly read from a socket
+ * @param socket the socket
+ * @return the queue, or NULL if there is none
+ */
+static socket_queue* SocketBuffer_getQueue(int socket)
+{
+	socket_buffers* sb = SocketBuffer_getSocket(socket, 0);
+
+	return (sb) ? sb->queue : NULL;
 }
 
 
 /**
  * Create a new default queue when one has just been used.
+ * @return boolean - was the queue created?
  */
-void SocketBuffer_newDefQ(void)	//-һµ׽ֻԪ,Ҫǿٿռ͸ʼֵ
+int SocketBuffer_newDefQ(void)	//-һµ׽ֻԪ,Ҫǿٿռ͸ʼֵ
 {
-	def_queue = malloc(sizeof(socket_queue));
-	def_queue->buflen = 1000;
-	def_queue->buf = malloc(def_queue->buflen);
-	def_queue->socket = def_queue->index = def_queue->buflen = def_queue->datalen = 0;
+	return (def_queue = SocketBuffer_newQueue()) != NULL;
 }
 
 
@@ -82,10 +262,16 @@ void SocketBuffer_newDefQ(void)	//-
  */
 void SocketBuffer_initialize(void)	//-ʼһϵеԪ,Ϊʵֹ׼
 {
+	int c;
+
 	FUNC_ENTRY;
-	SocketBuffer_newDefQ();	//-һµĶ,дĬֵ
-	queues = ListInitialize();	//-һlistռ
+	memset(&pool, '\0', sizeof(pool));
+	for (c = 0; c < SOCKETBUFFER_POOL_CLASSES; ++c)
+		pool.stats.classes[c].size = SOCKETBUFFER_POOL_MIN << c;
+	if (!SocketBuffer_newDefQ())
+		Log(LOG_ERROR, -1, "Could not allocate the default socket queue");	//-һµĶ,дĬֵ
 	ListZero(&writes);
+	buffered_first = buffered_last = NULL;
 	FUNC_EXIT;
 }
 
@@ -95,8 +281,8 @@ void SocketBuffer_initialize(void)	//-
  */
 void SocketBuffer_freeDefQ(void)	//-ͷĬϵĴ洢ռ
 {
-	free(def_queue->buf);
-	free(def_queue);
+	SocketBuffer_freeQueue(def_queue);
+	def_queue = NULL;
 }
 
 
@@ -105,38 +291,101 @@ void SocketBuffer_freeDefQ(void)	//-
  */
 void SocketBuffer_terminate(void)	//-ֹ׽ֻģ,ܾһб
 {
-	ListElement* cur = NULL;
-	ListEmpty(&writes);
+	int i;
 
 	FUNC_ENTRY;
-	while (ListNextElement(queues, &cur))
-		free(((socket_queue*)(cur->content))->buf);
-	ListFree(queues);
+	ListEmpty(&writes);
+	for (i = 0; i < nsockbufs; ++i)
+	{
+		if (sockbufs[i].queue)
+			SocketBuffer_freeQueue(sockbufs[i].queue);
+		if (sockbufs[i].readahead)
+		{
+			SocketBuffer_poolPut(sockbufs[i].readahead->buf, SOCKETBUFFER_READAHEAD);
+			free(sockbufs[i].readahead);
+		}
+	}
+	if (sockbufs)
+		free(sockbufs);
+	sockbufs = NULL;
+	nsockbufs = 0;
+	buffered_first = buffered_last = NULL;
 	SocketBuffer_freeDefQ();
+
+	for (i = 0; i < SOCKETBUFFER_POOL_CLASSES; ++i)
+	{
+		SocketBuffer_poolClass* cls = &pool.stats.classes[i];
+
+		if (cls->gets > 0)
+			Log(TRACE_MIN, -1, "Receive buffer pool class %d bytes: %lu gets, %lu allocations, %lu frees",
+				cls->size, cls->gets, cls->allocs, cls->frees);
+		while (pool.free[i])
+		{
+			char* buf = pool.free[i];
+
+			pool.free[i] = *(char**)buf;
+			free(buf);
+		}
+	}
+	while (pool.nspare_queues > 0)
+		free(pool.spare_queues[--pool.nspare_queues]);
 	FUNC_EXIT;
 }
 
 
+/**
+ * Take a read-ahead buffer off the list of those holding unread data
+ * @param ra the read-ahead buffer
+ */
+static void SocketBuffer_unlinkBuffered(socket_readahead* ra)
+{
+	if (!ra->buffered)
+		return;
+	if (ra->prev)
+		ra->prev->next = ra->next;
+	else
+		buffered_first = ra->next;
+	if (ra->next)
+		ra->next->prev = ra->prev;
+	else
+		buffered_last = ra->prev;
+	ra->prev = ra->next = NULL;
+	ra->buffered = 0;
+}
+
+
 /**
  * Cleanup any buffers for a specific socket
  * @param socket the socket to clean up
  */
 void SocketBuffer_cleanup(int socket)	//-һض׽ֵĻ
 {
+	socket_buffers* sb = SocketBuffer_getSocket(socket, 0);
+
 	FUNC_ENTRY;
-	if (ListFindItem(queues, &socket, socketcompare))
+	if (sb && sb->queue)
 	{
-		free(((socket_queue*)(queues->current->content))->buf);
-		ListRemove(queues, queues->current->content);
+		SocketBuffer_freeQueue(sb->queue);
+		sb->queue = NULL;
 	}
-	if (def_queue->socket == socket)
+	if (def_queue && def_queue->socket == socket)
 		def_queue->socket = def_queue->index = def_queue->headerlen = def_queue->datalen = 0;
+	while (SocketBuffer_writeComplete(socket))
+		; /* discard any writes still queued */
+	if (sb && sb->readahead)
+	{
+		SocketBuffer_unlinkBuffered(sb->readahead);
+		SocketBuffer_poolPut(sb->readahead->buf, SOCKETBUFFER_READAHEAD);
+		free(sb->readahead);
+		sb->readahead = NULL;
+	}
 	FUNC_EXIT;
 }
 
 
 /**
- * Get any queued data for a specific socket
+ * Get any queued data for a specific socket.  A bigger buffer is taken from the pool when
+ * the packet doesn't fit in the one the queue has, and the smaller one given back.
  * @param socket the socket to get queued data for
  * @param bytes the number of bytes of data to retrieve
  * @param actual_len the actual length returned
@@ -147,11 +396,16 @@ char* SocketBuffer_getQueuedData(int socket, int bytes, int* actual_len)	//-
 	socket_queue* queue = NULL;
 
 	FUNC_ENTRY;
-	if (ListFindItem(queues, &socket, socketcompare))
+	if ((queue = SocketBuffer_getQueue(socket)) != NULL)
 	{  /* if there is queued data for this socket, add any data read to it */
-		queue = (socket_queue*)(queues->current->content);
 		*actual_len = queue->datalen;
 	}
+	else if (def_queue == NULL && !SocketBuffer_newDefQ())
+	{
+		Log(LOG_ERROR, -1, "Could not allocate a queue for socket %d", socket);
+		FUNC_EXIT;
+		return NULL;
+	}
 	else
 	{
 		*actual_len = 0;
@@ -159,16 +413,20 @@ char* SocketBuffer_getQueuedData(int socket, int bytes, int* actual_len)	//-
 	}
 	if (bytes > queue->buflen)
 	{
-		if (queue->datalen > 0)
+		int buflen;
+		char* newmem = SocketBuffer_poolGet(bytes, &buflen);
+
+		if (newmem == NULL)
 		{
-			void* newmem = malloc(bytes);
-			memcpy(newmem, queue->buf, queue->datalen);
-			free(queue->buf);
-			queue->buf = newmem;
+			Log(LOG_ERROR, -1, "Could not allocate %d bytes for a packet on socket %d", bytes, socket);
+			FUNC_EXIT;
+			return NULL;
 		}
-		else
-			queue->buf = realloc(queue->buf, bytes);
-		queue->buflen = bytes;
+		if (queue->datalen > 0)
+			memcpy(newmem, queue->buf, queue->datalen);
+		SocketBuffer_poolPut(queue->buf, queue->buflen);
+		queue->buf = newmem;
+		queue->buflen = buflen;
 	}
 
 	FUNC_EXIT;
@@ -185,11 +443,11 @@ char* SocketBuffer_getQueuedData(int socket, int bytes, int* actual_len)	//-
 int SocketBuffer_getQueuedChar(int socket, char* c)	//-õһЩеԶһָ׽
 {
 	int rc = SOCKETBUFFER_INTERRUPTED;
+	socket_queue* queue;
 
 	FUNC_ENTRY;
-	if (ListFindItem(queues, &socket, socketcompare))	//-һ׽ֻӦһ
+	if ((queue = SocketBuffer_getQueue(socket)) != NULL)	//-һ׽ֻӦһ
 	{  /* if there is queued data for this socket, read that first */
-		socket_queue* queue = (socket_queue*)(queues->current->content);
 		if (queue->index < queue->headerlen)
 		{
 			*c = queue->fixed_header[(queue->index)++];
@@ -217,19 +475,29 @@ exit:
  */
 void SocketBuffer_interrupted(int socket, int actual_len)	//-˼ûпͨ
 {
+	socket_buffers* sb = SocketBuffer_getSocket(socket, 1);
 	socket_queue* queue = NULL;
 
 	FUNC_ENTRY;
-	if (ListFindItem(queues, &socket, socketcompare))
-		queue = (socket_queue*)(queues->current->content);
-	else /* new saved queue */
+	if (sb == NULL)
 	{
-		queue = def_queue;
-		ListAppend(queues, def_queue, sizeof(socket_queue)+def_queue->buflen);
-		SocketBuffer_newDefQ();
+		Log(LOG_ERROR, -1, "Could not save the partly read packet for socket %d", socket);
+		goto exit;
+	}
+	if ((queue = sb->queue) == NULL) /* new saved queue */
+	{	/* the default queue is only handed over once there is another to replace it */
+		if (def_queue == NULL || (queue = SocketBuffer_newQueue()) == NULL)
+		{
+			Log(LOG_ERROR, -1, "Could not save the partly read packet for socket %d", socket);
+			goto exit;
+		}
+		sb->queue = def_queue;
+		def_queue = queue;
+		queue = sb->queue;
 	}
 	queue->index = 0;
 	queue->datalen = actual_len;
+exit:
 	FUNC_EXIT;
 }
 
@@ -241,17 +509,23 @@ void SocketBuffer_interrupted(int socket, int actual_len)	//-
  */
 char* SocketBuffer_complete(int socket)
 {
+	socket_buffers* sb = SocketBuffer_getSocket(socket, 0);
+	char* buf = NULL;
+
 	FUNC_ENTRY;
-	if (ListFindItem(queues, &socket, socketcompare))
+	if (sb && sb->queue)
 	{
-		socket_queue* queue = (socket_queue*)(queues->current->content);
 		SocketBuffer_freeDefQ();
-		def_queue = queue;
-		ListDetach(queues, queue);
+		def_queue = sb->queue;
+		sb->queue = NULL;
+	}
+	if (def_queue || SocketBuffer_newDefQ())
+	{
+		def_queue->socket = def_queue->index = def_queue->headerlen = def_queue->datalen = 0;
+		buf = def_queue->buf;
 	}
-	def_queue->socket = def_queue->index = def_queue->headerlen = def_queue->datalen = 0;
 	FUNC_EXIT;
-	return def_queue->buf;
+	return buf;
 }
 
 
@@ -263,11 +537,18 @@ char* SocketBuffer_complete(int socket)
 void SocketBuffer_queueChar(int socket, char c)
 {
 	int error = 0;
-	socket_queue* curq = def_queue;
+	socket_queue* curq;
+	socket_queue* queue;
 
 	FUNC_ENTRY;
-	if (ListFindItem(queues, &socket, socketcompare))
-		curq = (socket_queue*)(queues->current->content);
+	if (def_queue == NULL && !SocketBuffer_newDefQ())
+	{
+		Log(LOG_ERROR, -1, "Could not allocate a queue for socket %d", socket);
+		goto exit;
+	}
+	curq = def_queue;
+	if ((queue = SocketBuffer_getQueue(socket)) != NULL)
+		curq = queue;
 	else if (def_queue->socket == 0)
 	{
 		def_queue->socket = socket;
@@ -289,15 +570,20 @@ void SocketBuffer_queueChar(int socket, char c)
 		curq->headerlen = curq->index;
 	}
 	Log(TRACE_MAX, -1, "queueChar: index is now %d, headerlen %d", curq->index, curq->headerlen);
+exit:
 	FUNC_EXIT;
 }
 
 
 /**
- * A socket write was interrupted so store the remaining data
+ * A socket write was interrupted, or could not be started because earlier writes are still
+ * pending, so store the remaining data in the socket's write queue.  Packets are written in
+ * the order they are queued, except that acknowledgements and PINGREQs go ahead of any
+ * other packets which have not been started, so that they are not held up by large publications.
  * @param socket the socket for which the write was interrupted
  * @param count the number of iovec buffers
  * @param iovecs buffer array
+ * @param frees array of flags, whether each buffer is to be freed when the write is complete
  * @param total total data length to be written
  * @param bytes actual data length that was written
  */
@@ -308,11 +594,13 @@ void SocketBuffer_pendingWrite(int socket, int count, iobuf* iovecs, int* frees,
 #endif
 {//-׽джԴ洢ʣ
 	int i = 0;
+	int type = ((unsigned char*)(iovecs[0].iov_base))[0] >> 4;
 	pending_writes* pw = NULL;
+	ListElement* before = NULL;
 
 	FUNC_ENTRY;
 	/* store the buffers until the whole packet is written */
-	pw = malloc(sizeof(pending_writes));	//-ȿһռ
+	pw = malloc(sizeof(pending_writes) + count * (sizeof(iobuf) + sizeof(int)));	//-ȿһռ
 	pw->socket = socket;
 #if defined(OPENSSL)
 	pw->ssl = ssl;
@@ -320,12 +608,36 @@ void SocketBuffer_pendingWrite(int socket, int count, iobuf* iovecs, int* frees,
 	pw->bytes = bytes;
 	pw->total = total;
 	pw->count = count;	//-ռΪһԱʹ,¼Ϣ
+	pw->iovecs = (iobuf*)(pw + 1);
+	pw->frees = (int*)(pw->iovecs + count);
 	for (i = 0; i < count; i++)
 	{
 		pw->iovecs[i] = iovecs[i];
 		pw->frees[i] = frees[i];
 	}
-	ListAppend(&writes, pw, sizeof(pw) + total);	//-ﴫݹȥĽһֵ,ʵбҪٴռ
+	pw->urgent = (type >= PUBACK && type <= PUBCOMP) || type == PINGREQ;
+	pw->sending = 0;
+	if (pw->urgent && bytes == 0)
+	{	/* the first packet queued for the socket may be partly written, and packets being sent
+		   asynchronously are already in the kernel's hands, so they stay in front */
+		ListElement* cur = NULL;
+		int first = 1;
+
+		while (ListNextElement(&writes, &cur))
+		{
+			pending_writes* queued = (pending_writes*)(cur->content);
+
+			if (queued->socket != socket)
+				continue;
+			if (!first && !queued->urgent && !queued->sending)
+			{
+				before = cur;
+				break;
+			}
+			first = 0;
+		}
+	}
+	ListInsert(&writes, pw, sizeof(pw) + total, before);	//-ﴫݹȥĽһֵ,ʵбҪٴռ
 	FUNC_EXIT;
 }
 
@@ -343,7 +655,7 @@ int pending_socketcompare(void* a, void* b)	//-
 
 
 /**
- * Get any queued write data for a specific socket
+ * Get the first queued write for a specific socket, which is the one being written
  * @param socket the socket to get queued data for
  * @return pointer to the queued data or NULL
  */
@@ -355,18 +667,33 @@ pending_writes* SocketBuffer_getWrite(int socket)
 
 
 /**
- * A socket write has now completed so we can get rid of the queue
+ * The first queued write for a socket has now completed, or is being discarded, so free
+ * the buffers which belong to it and take it off the queue
  * @param socket the socket for which the operation is now complete
- * @return completion code, boolean - was the queue removed?
+ * @return completion code, boolean - was the write removed?
  */
 int SocketBuffer_writeComplete(int socket)
 {
-	return ListRemoveItem(&writes, &socket, pending_socketcompare);
+	pending_writes* pw = SocketBuffer_getWrite(socket);
+	int i;
+
+	if (pw == NULL)
+		return 0;
+	/* topic and payload buffers are freed elsewhere, when all references to them have been removed */
+	for (i = 0; i < pw->count; i++)
+	{
+		if (pw->frees[i])
+			free(pw->iovecs[i].iov_base);
+	}
+	return ListRemove(&writes, pw);
 }
 
 
 /**
- * Update the queued write data for a socket in the case of QoS 0 messages.
+ * Update the last queued write for a socket in the case of QoS 0 messages.  A publish is
+ * queued as four buffers, the topic and payload being the last two, or as two buffers when
+ * the topic is prepared and part of the first.  A write queued as one buffer, as io_uring
+ * does, is a copy which the queue owns already, so there is nothing to update.
  * @param socket the socket for which the operation is now complete
  * @param topic the topic of the QoS 0 write
  * @param payload the payload of the QoS 0 write
@@ -378,16 +705,178 @@ pending_writes* SocketBuffer_updateWrite(int socket, char* topic, char* payload)
 	ListElement* le = NULL;
 
 	FUNC_ENTRY;
-	if ((le = ListFindItem(&writes, &socket, pending_socketcompare)) != NULL)
+	while (ListPrevElement(&writes, &le))
 	{
+		if (((pending_writes*)(le->content))->socket != socket)
+			continue;
 		pw = (pending_writes*)(le->content);
-		if (pw->count == 4)
+		if (pw->count == 4 && !pw->frees[2])
 		{
 			pw->iovecs[2].iov_base = topic;
 			pw->iovecs[3].iov_base = payload;
 		}
+		else if (pw->count == 2 && !pw->frees[1])
+			pw->iovecs[1].iov_base = payload;
+		break;
 	}
 
 	FUNC_EXIT;
 	return pw;
 }
+
+
+/**
+ * Iterate through the queued writes for a socket, in the order they are to be written
+ * @param socket the socket
+ * @param pos the current position in the queue, NULL to start from the beginning
+ * @return the next queued write, or NULL at the end of the queue
+ */
+pending_writes* SocketBuffer_getNextWrite(int socket, ListElement** pos)
+{
+	while (ListNextElement(&writes, pos))
+	{
+		if (((pending_writes*)((*pos)->content))->socket == socket)
+			return (pending_writes*)((*pos)->content);
+	}
+	return NULL;
+}
+
+
+/**
+ * Get the number of bytes queued for writing to a socket and not yet written
+ * @param socket the socket
+ * @return the number of bytes
+ */
+int SocketBuffer_pendingBytes(int socket)
+{
+	ListElement* cur = NULL;
+	pending_writes* pw;
+	int bytes = 0;
+
+	while ((pw = SocketBuffer_getNextWrite(socket, &cur)) != NULL)
+		bytes += pw->total - pw->bytes;
+	return bytes;
+}
+
+
+/**
+ * Get the read-ahead buffer of a socket, ready to be filled by a read of up to
+ * SOCKETBUFFER_READAHEAD bytes.  Any data in it must have been taken already.
+ * @param socket the socket
+ * @return the buffer, or NULL if no memory could be allocated
+ */
+char* SocketBuffer_getReadAhead(int socket)
+{
+	socket_buffers* sb = SocketBuffer_getSocket(socket, 1);
+	socket_readahead* ra = NULL;
+
+	FUNC_ENTRY;
+	if (sb == NULL)
+		goto exit;
+	if ((ra = sb->readahead) == NULL)
+	{
+		int buflen;
+
+		if ((ra = malloc(sizeof(socket_readahead))) == NULL)
+			goto exit;
+		if ((ra->buf = SocketBuffer_poolGet(SOCKETBUFFER_READAHEAD, &buflen)) == NULL)
+		{
+			free(ra);
+			ra = NULL;
+			goto exit;
+		}
+		ra->socket = socket;
+		ra->prev = ra->next = NULL;
+		ra->buffered = 0;
+		sb->readahead = ra;
+	}
+	ra->start = ra->end = 0;
+exit:
+	FUNC_EXIT;
+	return (ra) ? ra->buf : NULL;
+}
+
+
+/**
+ * Record the amount of data read into the read-ahead buffer of a socket
+ * @param socket the socket
+ * @param len the number of bytes read
+ */
+void SocketBuffer_readAheadFilled(int socket, int len)
+{
+	socket_readahead* ra = sockbufs[socket].readahead;
+
+	ra->start = 0;
+	ra->end = len;
+	if (len > 0 && !ra->buffered)
+	{
+		ra->next = NULL;
+		ra->prev = buffered_last;
+		if (buffered_last)
+			buffered_last->next = ra;
+		else
+			buffered_first = ra;
+		buffered_last = ra;
+		ra->buffered = 1;
+	}
+}
+
+
+/**
+ * Get the amount of unread data in the read-ahead buffer of a socket
+ * @param socket the socket
+ * @return the number of bytes
+ */
+int SocketBuffer_readAheadLength(int socket)
+{
+	socket_buffers* sb = SocketBuffer_getSocket(socket, 0);
+	socket_readahead* ra = (sb) ? sb->readahead : NULL;
+
+	return (ra) ? ra->end - ra->start : 0;
+}
+
+
+/**
+ * Take unread data from the read-ahead buffer of a socket
+ * @param socket the socket
+ * @param dest where to copy the data to
+ * @param len the most data wanted
+ * @return the number of bytes copied
+ */
+int SocketBuffer_takeReadAhead(int socket, char* dest, int len)
+{
+	socket_buffers* sb = SocketBuffer_getSocket(socket, 0);
+	socket_readahead* ra = (sb) ? sb->readahead : NULL;
+	int count = 0;
+
+	if (ra && ra->end > ra->start)
+	{
+		count = (ra->end - ra->start < len) ? ra->end - ra->start : len;
+		memcpy(dest, &ra->buf[ra->start], count);
+		ra->start += count;
+		if (ra->start == ra->end)
+			SocketBuffer_unlinkBuffered(ra);
+	}
+	return count;
+}
+
+
+/**
+ * Find the socket whose read-ahead buffer has held unread data longest, so that it can be
+ * treated as ready to read even when there is no more data waiting in the kernel
+ * @return the socket, or 0 if no read-ahead buffer holds unread data
+ */
+int SocketBuffer_getBufferedSocket(void)
+{
+	return (buffered_first) ? buffered_first->socket : 0;
+}
+
+
+/**
+ * Get the usage statistics of the receive buffer pool
+ * @param stats the structure to fill in
+ */
+void SocketBuffer_getPoolStats(SocketBuffer_poolStats* stats)
+{
+	*stats = pool.stats;
+}
@@ -28,6 +28,8 @@
 #include <openssl/ssl.h>
 #endif
 
+#include "LinkedList.h"
+
 #if defined(WIN32) || defined(WIN64)
 	typedef WSABUF iobuf;
 #else
@@ -75,17 +77,84 @@ typedef struct
 	char* buf;
 } socket_queue;	//-һṹڴ洢׽ֶϢ
 
+/**
+ * A packet queued for writing to a socket, possibly partly written already.  Each socket
+ * has a queue of these, of which only the first can have been partly written.
+ */
 typedef struct
 {
 	int socket, total, count;
 #if defined(OPENSSL)
 	SSL* ssl;
 #endif
-	unsigned long bytes;
-	iobuf iovecs[5];
-	int frees[5];
+	unsigned long bytes;	/**< number of bytes written so far */
+	iobuf* iovecs;			/**< count buffers, allocated with the structure */
+	int* frees;				/**< whether to free each buffer when the packet has been written */
+	int urgent;				/**< boolean - a small control packet, which can go ahead of publications */
+	int sending;			/**< boolean - handed to the kernel in an asynchronous send, so it keeps its place */
 } pending_writes;
 
+/**
+ * Size of the read-ahead buffer of each socket
+ */
+#define SOCKETBUFFER_READAHEAD 16384
+
+/**
+ * Data received from a socket but not yet read by the packet decoder
+ */
+typedef struct socket_readahead_s
+{
+	int socket;
+	int start, end;	/**< the unread data is buf[start] to buf[end - 1] */
+	char* buf;
+	int buffered;	/**< boolean - on the list of read-ahead buffers holding unread data */
+	struct socket_readahead_s *prev, *next;	/**< links in that list */
+} socket_readahead;
+
+/**
+ * Smallest buffer size in the receive buffer pool.  The size classes double from this.
+ */
+#define SOCKETBUFFER_POOL_MIN 1024
+
+/**
+ * Number of size classes in the receive buffer pool, so the largest is 256 kB.  Bigger
+ * packets have buffers of their own, which are freed when done with.
+ */
+#define SOCKETBUFFER_POOL_CLASSES 9
+
+/**
+ * Bytes of free buffers kept for reuse in each class of the receive buffer pool
+ */
+#define SOCKETBUFFER_POOL_CACHE 65536
+
+/**
+ * Number of spare input queue structures kept for reuse
+ */
+#define SOCKETBUFFER_POOL_QUEUES 16
+
+/**
+ * Usage statistics of one size class of the receive buffer pool
+ */
+typedef struct
+{
+	int size;				/**< size of the buffers in the class */
+	int in_use;				/**< buffers in use */
+	int cached;				/**< free buffers kept for reuse */
+	unsigned long gets;		/**< buffers taken from the class */
+	unsigned long allocs;	/**< buffers which had to be allocated, as none were free */
+	unsigned long frees;	/**< buffers given back to the system, as enough were kept */
+} SocketBuffer_poolClass;
+
+/**
+ * Usage statistics of the receive buffer pool.  Once traffic has settled, allocs and frees
+ * stop increasing.
+ */
+typedef struct
+{
+	SocketBuffer_poolClass classes[SOCKETBUFFER_POOL_CLASSES];
+	unsigned long oversize;	/**< buffers bigger than the largest class */
+} SocketBuffer_poolStats;
+
 #define SOCKETBUFFER_COMPLETE 0
 #if !defined(SOCKET_ERROR)
 	#define SOCKET_ERROR -1
@@ -109,5 +178,14 @@ void SocketBuffer_pendingWrite(int socket, int count, iobuf* iovecs, int* frees,
 pending_writes* SocketBuffer_getWrite(int socket);
 int SocketBuffer_writeComplete(int socket);
 pending_writes* SocketBuffer_updateWrite(int socket, char* topic, char* payload);
+pending_writes* SocketBuffer_getNextWrite(int socket, ListElement** pos);
+int SocketBuffer_pendingBytes(int socket);
+
+char* SocketBuffer_getReadAhead(int socket);
+void SocketBuffer_readAheadFilled(int socket, int len);
+int SocketBuffer_readAheadLength(int socket);
+int SocketBuffer_takeReadAhead(int socket, char* dest, int len);
+int SocketBuffer_getBufferedSocket(void);
+void SocketBuffer_getPoolStats(SocketBuffer_poolStats* stats);
 
 #endif
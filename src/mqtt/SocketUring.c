@@ -0,0 +1,341 @@
+/**
+ * @file
+ * \brief io_uring submission and completion rings for the socket module
+ *
+ * The rings are mapped once when the socket module is initialized.  Submissions are made
+ * visible to the kernel by a store-release of the ring tail after the entry has been filled,
+ * and completions are consumed by advancing the head, as the io_uring interface requires.
+ * Receive buffers are handed to the kernel through a registered buffer ring in group 0, and
+ * given back to it with SocketUring_recycleBuffer once their data has been read.
+ */
+
+#if defined(USE_IO_URING)
+
+#include "SocketUring.h"
+#include "Log.h"
+#include "Thread.h"
+#include "StackTrace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Heap.h"
+
+static struct
+{
+	int fd; /**< io_uring descriptor */
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+	void* sq_ring; /**< mapping of the submission ring */
+	size_t sq_ring_size;
+	void* cq_ring; /**< mapping of the completion ring, the same as sq_ring with a single mmap */
+	size_t cq_ring_size;
+	size_t sqes_size;
+	unsigned int sq_local_tail; /**< tail including entries not yet made visible to the kernel */
+	struct io_uring_buf_ring* br; /**< provided buffer ring */
+	size_t br_size;
+	char* buffers; /**< SOCKETURING_BUFFERS receive buffers of SOCKETURING_BUFFER_SIZE bytes */
+	unsigned short br_tail;
+	mutex_type mutex;
+} u = { -1 };
+
+
+static int SocketUring_setup(unsigned int entries, struct io_uring_params* p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int SocketUring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags, void* arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, u.fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+
+static int SocketUring_register(unsigned int opcode, void* arg, unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, u.fd, opcode, arg, nr_args);
+}
+
+
+/**
+ * Register the provided buffer ring and give all the receive buffers to the kernel
+ * @return completion code, 0 for success
+ */
+static int SocketUring_setupBuffers(void)
+{
+	struct io_uring_buf_reg reg;
+	int i, rc = -1;
+
+	FUNC_ENTRY;
+	u.br_size = SOCKETURING_BUFFERS * sizeof(struct io_uring_buf);
+	u.br = mmap(NULL, u.br_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (u.br == MAP_FAILED)
+	{
+		u.br = NULL;
+		goto exit;
+	}
+	if ((u.buffers = malloc(SOCKETURING_BUFFERS * SOCKETURING_BUFFER_SIZE)) == NULL)
+		goto exit;
+
+	memset(&reg, '\0', sizeof(reg));
+	reg.ring_addr = (unsigned long long)(unsigned long)u.br;
+	reg.ring_entries = SOCKETURING_BUFFERS;
+	reg.bgid = 0;
+	if (SocketUring_register(IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+	{
+		Log(TRACE_MIN, -1, "io_uring provided buffer rings are not supported: %s", strerror(errno));
+		goto exit;
+	}
+	u.br_tail = 0;
+	for (i = 0; i < SOCKETURING_BUFFERS; ++i)
+		SocketUring_recycleBuffer(i);
+	rc = 0;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Set up the rings.  Kernels without the features needed, or with io_uring disabled, make
+ * this fail, and the socket module then uses epoll instead.
+ * @return completion code, 0 for success
+ */
+int SocketUring_initialize(void)
+{
+	struct io_uring_params p;
+	unsigned int i;
+	int rc = -1;
+
+	FUNC_ENTRY;
+	memset(&p, '\0', sizeof(p));
+	if ((u.fd = SocketUring_setup(SOCKETURING_ENTRIES, &p)) < 0)
+	{
+		Log(TRACE_MIN, -1, "io_uring_setup failed: %s", strerror(errno));
+		u.fd = -1;
+		goto exit;
+	}
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) ||
+		!(p.features & IORING_FEAT_EXT_ARG))
+	{
+		Log(TRACE_MIN, -1, "io_uring features 0x%x are not enough", p.features);
+		goto exit;
+	}
+
+	u.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (u.cq_ring_size > u.sq_ring_size)
+		u.sq_ring_size = u.cq_ring_size;
+	u.sq_ring = mmap(NULL, u.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			u.fd, IORING_OFF_SQ_RING);
+	if (u.sq_ring == MAP_FAILED)
+	{
+		u.sq_ring = NULL;
+		goto exit;
+	}
+	u.cq_ring = u.sq_ring;
+	u.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u.sqes = mmap(NULL, u.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			u.fd, IORING_OFF_SQES);
+	if (u.sqes == MAP_FAILED)
+	{
+		u.sqes = NULL;
+		goto exit;
+	}
+
+	u.sq_head = (unsigned int*)((char*)u.sq_ring + p.sq_off.head);
+	u.sq_tail = (unsigned int*)((char*)u.sq_ring + p.sq_off.tail);
+	u.sq_mask = (unsigned int*)((char*)u.sq_ring + p.sq_off.ring_mask);
+	u.sq_array = (unsigned int*)((char*)u.sq_ring + p.sq_off.array);
+	u.cq_head = (unsigned int*)((char*)u.cq_ring + p.cq_off.head);
+	u.cq_tail = (unsigned int*)((char*)u.cq_ring + p.cq_off.tail);
+	u.cq_mask = (unsigned int*)((char*)u.cq_ring + p.cq_off.ring_mask);
+	u.cqes = (struct io_uring_cqe*)((char*)u.cq_ring + p.cq_off.cqes);
+	for (i = 0; i < p.sq_entries; ++i)
+		u.sq_array[i] = i; /* submission entries are used in ring order */
+	u.sq_local_tail = *u.sq_tail;
+
+	if (SocketUring_setupBuffers() != 0)
+		goto exit;
+	u.mutex = Thread_create_mutex();
+	rc = 0;
+	Log(TRACE_MIN, -1, "io_uring set up with %u entries and %d receive buffers", p.sq_entries, SOCKETURING_BUFFERS);
+exit:
+	if (rc != 0)
+		SocketUring_terminate();
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Unmap the rings and free the receive buffers
+ */
+void SocketUring_terminate(void)
+{
+	FUNC_ENTRY;
+	if (u.fd >= 0)
+		close(u.fd); /* any requests still outstanding are cancelled */
+	u.fd = -1;
+	if (u.sqes)
+		munmap(u.sqes, u.sqes_size);
+	if (u.sq_ring)
+		munmap(u.sq_ring, u.sq_ring_size);
+	if (u.br)
+		munmap(u.br, u.br_size);
+	if (u.buffers)
+		free(u.buffers);
+	if (u.mutex)
+		Thread_destroy_mutex(u.mutex);
+	u.sqes = NULL;
+	u.sq_ring = u.cq_ring = NULL;
+	u.br = NULL;
+	u.buffers = NULL;
+	u.mutex = NULL;
+	FUNC_EXIT;
+}
+
+
+void SocketUring_lock(void)
+{
+	Thread_lock_mutex(u.mutex);
+}
+
+
+void SocketUring_unlock(void)
+{
+	Thread_unlock_mutex(u.mutex);
+}
+
+
+/**
+ * Get the next free submission entry, cleared.  If the ring is full, what is in it is
+ * submitted first.
+ * @return the entry, or NULL if none could be freed
+ */
+struct io_uring_sqe* SocketUring_getSqe(void)
+{
+	struct io_uring_sqe* sqe = NULL;
+
+	if (u.sq_local_tail - __atomic_load_n(u.sq_head, __ATOMIC_ACQUIRE) >= *u.sq_mask + 1)
+	{
+		SocketUring_submit();
+		if (u.sq_local_tail - __atomic_load_n(u.sq_head, __ATOMIC_ACQUIRE) >= *u.sq_mask + 1)
+			goto exit;
+	}
+	sqe = &u.sqes[u.sq_local_tail & *u.sq_mask];
+	memset(sqe, '\0', sizeof(*sqe));
+	++u.sq_local_tail;
+exit:
+	return sqe;
+}
+
+
+/**
+ * Make the entries filled since the last call visible to the kernel and submit them, without
+ * waiting for any to complete
+ * @return the number submitted, or -1 on error
+ */
+int SocketUring_submit(void)
+{
+	unsigned int count = u.sq_local_tail - *u.sq_tail;
+	int rc = 0;
+
+	if (count == 0)
+		goto exit;
+	__atomic_store_n(u.sq_tail, u.sq_local_tail, __ATOMIC_RELEASE);
+	while ((rc = SocketUring_enter(count, 0, 0, NULL, 0)) < 0 && errno == EINTR)
+		;
+	if (rc < 0)
+		Log(LOG_ERROR, -1, "io_uring_enter failed to submit: %s", strerror(errno));
+exit:
+	return rc;
+}
+
+
+/**
+ * Wait until there are completions to process, or the timeout expires.  This does not touch
+ * the submission ring, so it is called without the lock held.
+ * @param timeout the longest time to wait, in milliseconds
+ * @return completion code, 0 for success or a timeout
+ */
+int SocketUring_wait(int timeout)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	int rc;
+
+	if (__atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE) != *u.cq_head)
+		return 0;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000L;
+	memset(&arg, '\0', sizeof(arg));
+	arg.ts = (unsigned long long)(unsigned long)&ts;
+	rc = SocketUring_enter(0, (timeout > 0) ? 1 : 0, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (rc < 0 && (errno == ETIME || errno == EINTR))
+		rc = 0;
+	else if (rc < 0)
+		Log(LOG_ERROR, -1, "io_uring_enter failed to wait: %s", strerror(errno));
+	return (rc < 0) ? rc : 0;
+}
+
+
+/**
+ * Take the next completion off the completion ring
+ * @param data returns the user data of the submission
+ * @param res returns the result
+ * @param flags returns the completion flags
+ * @return boolean - was there a completion?
+ */
+int SocketUring_nextCompletion(unsigned long long* data, int* res, unsigned int* flags)
+{
+	unsigned int head = *u.cq_head;
+	struct io_uring_cqe* cqe;
+
+	if (head == __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	cqe = &u.cqes[head & *u.cq_mask];
+	*data = cqe->user_data;
+	*res = cqe->res;
+	*flags = cqe->flags;
+	__atomic_store_n(u.cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
+/**
+ * Get a receive buffer, from the buffer id in a receive completion
+ * @param bid the buffer id
+ * @return the buffer
+ */
+char* SocketUring_getBuffer(int bid)
+{
+	return &u.buffers[bid * SOCKETURING_BUFFER_SIZE];
+}
+
+
+/**
+ * Give a receive buffer back to the kernel, once all its data has been read
+ * @param bid the buffer id
+ */
+void SocketUring_recycleBuffer(int bid)
+{
+	struct io_uring_buf* buf = &u.br->bufs[u.br_tail & (SOCKETURING_BUFFERS - 1)];
+
+	buf->addr = (unsigned long long)(unsigned long)SocketUring_getBuffer(bid);
+	buf->len = SOCKETURING_BUFFER_SIZE;
+	buf->bid = (unsigned short)bid;
+	++u.br_tail;
+	__atomic_store_n(&u.br->tail, u.br_tail, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * @file
+ * \brief io_uring submission and completion rings for the socket module
+ *
+ * A thin layer over the io_uring system calls, so that no library is needed: the rings are
+ * set up and mapped here, and a ring of provided buffers is registered for multishot receives
+ * to fill.  The socket module keeps the state of each socket and decides what to submit.
+ * Submissions, completions and buffers are shared between the thread calling the cycle and
+ * the threads sending packets, so they are only touched with SocketUring_lock held.
+ */
+
+#if !defined(SOCKETURING_H)
+#define SOCKETURING_H
+
+#if defined(USE_IO_URING)
+
+#include <linux/io_uring.h>
+
+/**
+ * number of entries in the submission ring
+ */
+#define SOCKETURING_ENTRIES 256
+
+/**
+ * number of provided receive buffers, a power of 2
+ */
+#define SOCKETURING_BUFFERS 64
+
+/**
+ * size of each provided receive buffer
+ */
+#define SOCKETURING_BUFFER_SIZE 4096
+
+/**
+ * the most buffers gathered into one sendmsg submission
+ */
+#define SOCKETURING_SEND_IOV 64
+
+/**
+ * Operations submitted for a socket, recorded in the user data of each submission along with
+ * the socket descriptor
+ */
+enum SocketUring_ops { SOCKETURING_RECV = 1, SOCKETURING_SEND, SOCKETURING_POLL, SOCKETURING_CANCEL };
+
+#define SOCKETURING_DATA(op, socket) (((unsigned long long)(unsigned)(socket) << 8) | (op))
+#define SOCKETURING_OP(data) ((int)((data) & 0xFF))
+#define SOCKETURING_SOCKET(data) ((int)((data) >> 8))
+
+int SocketUring_initialize(void);
+void SocketUring_terminate(void);
+void SocketUring_lock(void);
+void SocketUring_unlock(void);
+
+struct io_uring_sqe* SocketUring_getSqe(void);
+int SocketUring_submit(void);
+int SocketUring_wait(int timeout);
+int SocketUring_nextCompletion(unsigned long long* data, int* res, unsigned int* flags);
+
+char* SocketUring_getBuffer(int bid);
+void SocketUring_recycleBuffer(int bid);
+
+#endif
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ * @file
+ * \brief Hierarchical timer wheel for keepalive and retry scheduling
+ *
+ * Four levels of 64 slots with a resolution of one millisecond, covering about 4.6 hours.
+ * Level n holds the timers due within 64^(n+1) ms, in slots of 64^n ms; as time passes
+ * the slots of the higher levels are cascaded down into the lower ones.  Timers due later
+ * than the span of the wheel sit in the top level and are cascaded again until due.
+ */
+
+#if defined(WIN32) || defined(WIN64)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "Timer.h"
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+#define TIMER_MAX_DELTA ((1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+static struct
+{
+	Timer* slots[TIMER_LEVELS][TIMER_SLOTS];
+	int counts[TIMER_LEVELS];	/**< number of timers in each level */
+	Timer* expired;				/**< timers whose callbacks are being called */
+	int armed;					/**< number of armed timers */
+	mstime_type tick;			/**< next tick to be processed */
+} wheel;
+
+
+/**
+ * Get the current monotonic time, unaffected by changes to the system clock
+ * @return the time in milliseconds
+ */
+mstime_type Timer_now(void)
+{
+#if defined(WIN32) || defined(WIN64)
+	return GetTickCount64();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (mstime_type)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+
+/**
+ * Get the current monotonic time with the resolution needed to measure round trips on a LAN
+ * @return the time in microseconds
+ */
+ustime_type Timer_nowMicros(void)
+{
+#if defined(WIN32) || defined(WIN64)
+	LARGE_INTEGER count, frequency;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (ustime_type)(count.QuadPart / frequency.QuadPart) * 1000000 +
+			(ustime_type)(count.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ustime_type)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+
+static void Timer_link(Timer* timer, Timer** slot, int level)
+{
+	timer->slot = slot;
+	timer->level = level;
+	timer->prev = NULL;
+	timer->next = *slot;
+	if (*slot)
+		(*slot)->prev = timer;
+	*slot = timer;
+	if (level < TIMER_LEVELS)
+		++wheel.counts[level];
+	++wheel.armed;
+}
+
+
+static void Timer_unlink(Timer* timer)
+{
+	if (timer->prev)
+		timer->prev->next = timer->next;
+	else
+		*(timer->slot) = timer->next;
+	if (timer->next)
+		timer->next->prev = timer->prev;
+	if (timer->level < TIMER_LEVELS)
+		--wheel.counts[timer->level];
+	--wheel.armed;
+	timer->slot = NULL;
+	timer->prev = timer->next = NULL;
+}
+
+
+/**
+ * Put a timer into the slot for its expiry time, relative to the current tick
+ * @param timer the timer
+ */
+static void Timer_place(Timer* timer)
+{
+	mstime_type expires = timer->expires;
+	mstime_type delta;
+	int level = 0;
+
+	if (expires < wheel.tick)
+		expires = wheel.tick;	/* already due: process on the next tick */
+	delta = expires - wheel.tick;
+	if (delta > TIMER_MAX_DELTA)
+	{
+		delta = TIMER_MAX_DELTA;
+		expires = wheel.tick + delta;
+	}
+	while (level < TIMER_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_SLOT_BITS)))
+		++level;
+	Timer_link(timer, &wheel.slots[level][(expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK], level);
+}
+
+
+/**
+ * Move the timers in the current slot of a level down into the lower levels
+ * @param level the level to cascade
+ * @return the index of the slot cascaded, 0 meaning the next level is due too
+ */
+static int Timer_cascade(int level)
+{
+	int index = (wheel.tick >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+
+	while (wheel.slots[level][index])
+	{
+		Timer* timer = wheel.slots[level][index];
+
+		Timer_unlink(timer);
+		Timer_place(timer);
+	}
+	return index;
+}
+
+
+/**
+ * Initialize a timer which has not been used, so that it is not armed
+ * @param timer the timer
+ */
+void Timer_init(Timer* timer)
+{
+	timer->prev = timer->next = NULL;
+	timer->slot = NULL;
+	timer->level = 0;
+	timer->expires = 0;
+	timer->callback = NULL;
+	timer->context = NULL;
+}
+
+
+/**
+ * Arm a timer, or rearm it if it is already armed
+ * @param timer the timer
+ * @param ms the number of milliseconds from now after which the timer expires
+ * @param callback the function to call when the timer expires
+ * @param context passed to the callback
+ */
+void Timer_arm(Timer* timer, long ms, Timer_callback* callback, void* context)
+{
+	mstime_type now = Timer_now();
+
+	if (timer->slot)
+		Timer_unlink(timer);
+	if (wheel.armed == 0)
+		wheel.tick = now;	/* nothing to process, so the wheel can jump to the present */
+	timer->expires = now + ((ms > 0) ? ms : 0);
+	timer->callback = callback;
+	timer->context = context;
+	Timer_place(timer);
+}
+
+
+/**
+ * Cancel a timer.  It does not matter if it isn't armed.
+ * @param timer the timer
+ */
+void Timer_cancel(Timer* timer)
+{
+	if (timer->slot)
+		Timer_unlink(timer);
+}
+
+
+/**
+ * Is a timer armed?
+ * @param timer the timer
+ * @return boolean
+ */
+int Timer_isArmed(Timer* timer)
+{
+	return timer->slot != NULL;
+}
+
+
+/**
+ * Advance the wheel to the present, calling the callbacks of the timers which have expired
+ * @param now the current monotonic time
+ * @return the number of timers which expired
+ */
+int Timer_expire(mstime_type now)
+{
+	int count = 0;
+
+	while (wheel.tick <= now)
+	{
+		int index = wheel.tick & TIMER_SLOT_MASK;
+		int level = 1;
+
+		if (wheel.armed == 0)
+		{
+			wheel.tick = now + 1;
+			break;
+		}
+		if (index == 0)
+		{
+			while (level < TIMER_LEVELS && Timer_cascade(level) == 0)
+				++level;
+		}
+		while (wheel.slots[0][index])
+		{
+			Timer* timer = wheel.slots[0][index];
+
+			Timer_unlink(timer);
+			Timer_link(timer, &wheel.expired, TIMER_LEVELS);
+		}
+		++wheel.tick;
+		if (wheel.counts[0] == 0 && (wheel.tick & TIMER_SLOT_MASK) != 0)
+		{	/* skip the empty rest of level 0, up to the next cascade */
+			mstime_type next = (wheel.tick | TIMER_SLOT_MASK) + 1;
+
+			wheel.tick = (next < now + 1) ? next : now + 1;
+		}
+	}
+
+	/* callbacks may arm or cancel other timers, including expired ones, so take one at a time */
+	while (wheel.expired)
+	{
+		Timer* timer = wheel.expired;
+
+		Timer_unlink(timer);
+		++count;
+		if (timer->callback)
+			(*(timer->callback))(timer, timer->context);
+	}
+	return count;
+}
+
+
+/**
+ * Find how long to wait before the wheel needs to be advanced
+ * @param max the longest wait wanted
+ * @return the number of milliseconds to wait, at most max
+ */
+long Timer_timeout(long max)
+{
+	mstime_type now, due;
+	int level = 0;
+
+	if (wheel.armed == 0)
+		return max;
+	if (wheel.expired)
+		return 0;
+	while (level < TIMER_LEVELS && wheel.counts[level] == 0)
+		++level;
+	if (level == TIMER_LEVELS)
+		return max;
+	if (level == 0)
+	{
+		int i;
+
+		due = wheel.tick + TIMER_SLOTS;
+		for (i = 0; i < TIMER_SLOTS; ++i)
+		{
+			if (wheel.slots[0][(wheel.tick + i) & TIMER_SLOT_MASK])
+			{
+				due = wheel.tick + i;
+				break;
+			}
+		}
+	}
+	else
+	{	/* the next time that level is cascaded */
+		mstime_type mask = (1ULL << (level * TIMER_SLOT_BITS)) - 1;
+
+		due = (wheel.tick + mask) & ~mask;
+	}
+	now = Timer_now();
+	if (due <= now)
+		return 0;
+	return (due - now < (mstime_type)max) ? (long)(due - now) : max;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file
+ * \brief Hierarchical timer wheel for keepalive and retry scheduling
+ *
+ * Timers are embedded in the structures they belong to, and linked into the wheel
+ * while armed, so arming and cancelling are O(1) and expiry processing only touches
+ * the timers which have expired.  All calls are made with the client mutex held.
+ */
+
+#if !defined(TIMER_H)
+#define TIMER_H
+
+/**
+ * Monotonic time in milliseconds
+ */
+typedef unsigned long long mstime_type;
+
+/**
+ * Monotonic time in microseconds, for measuring latencies
+ */
+typedef unsigned long long ustime_type;
+
+struct TimerStruct;
+
+/**
+ * Function called when a timer expires.  The timer is no longer armed at that point,
+ * so the function may rearm it.
+ */
+typedef void Timer_callback(struct TimerStruct* timer, void* context);
+
+/**
+ * A timer.  A zeroed structure is a valid timer which is not armed.
+ */
+typedef struct TimerStruct
+{
+	struct TimerStruct *prev, *next;	/**< links within a wheel slot, or the expired list */
+	struct TimerStruct **slot;			/**< head of the list holding the timer, NULL if not armed */
+	int level;							/**< wheel level of slot */
+	mstime_type expires;				/**< monotonic expiry time */
+	Timer_callback* callback;
+	void* context;
+} Timer;
+
+mstime_type Timer_now(void);
+ustime_type Timer_nowMicros(void);
+void Timer_init(Timer* timer);
+void Timer_arm(Timer* timer, long ms, Timer_callback* callback, void* context);
+void Timer_cancel(Timer* timer);
+int Timer_isArmed(Timer* timer);
+int Timer_expire(mstime_type now);
+long Timer_timeout(long max);
+
+#endif
@@ -9,8 +9,33 @@
 #include <memory.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include "mqtt_client.h"
 #include "MQTTClientPersistence.h"
+#include "Compress.h"
+
+/* header of a compressed payload: 0x00 'L' 'Z', method, dictionary id, length (4 bytes) */
+#define MQTT_COMPRESS_HEADER 9
+#define MQTT_COMPRESS_STORED 0
+#define MQTT_COMPRESS_LZ4    1
+#define MQTT_MAX_PAYLOAD     268435455
+
+static const char mqtt_compress_magic[3] = { 0, 'L', 'Z' };
+
+struct _mqtt_compression_policy {
+	char * filter;
+	int min_size;
+	int dictionary;
+	struct _mqtt_compression_policy * next;
+};
+
+struct _mqtt_compression {
+	struct _mqtt_compression_policy * policies;
+	Compress_dictionary * dictionaries[256];
+	int expand;        //boolean - a policy or dictionary has been added, so received payloads are expanded
+	int max_expanded;  //largest payload to expand
+	mqtt_compression_stats stats;
+};
 
 /**
  * create a MQTT client
@@ -29,12 +54,20 @@ mqtt_client * mqtt_new(char * host, int port, char *client_id)	//-
 	m = malloc(sizeof(mqtt_client));	//-ʹʱռ,кôĲ̶ռڴռ
 	if ( m != NULL) {	//-ȴMQTTͻʵ
 		memset(m , 0, sizeof(mqtt_client));	//-ʼ
+		m->compression = calloc(1, sizeof(struct _mqtt_compression));
+		if ( m->compression == NULL ) {
+			free(m);
+			errno = ENOMEM;
+			return NULL;
+		}
+		m->compression->max_expanded = MQTT_DEFAULT_MAX_EXPANDED;
 		rc = MQTTClient_create(&(m->client), host, client_id, MQTTCLIENT_PERSISTENCE_NONE, NULL);	//-ﴴͻ,û׽ֵĲ,ڲϢ
 		if ( rc == MQTTCLIENT_SUCCESS ) {
 			m->timeout = MQTT_DEFAULT_TIME_OUT;	//-һЧĳʼֵ
 			m->received_msg = NULL;
 			//mqtt_set_callback_message_arrived(m, m->on_message_arrived);
 		} else {
+			free(m->compression);
 			free(m);
 			errno = rc;
 			m = NULL;
@@ -61,6 +94,10 @@ int mqtt_connect(mqtt_client * m, char *username, char *password)	//-ʹ
 
 	conn_opts.keepAliveInterval = 20;	//-Ĭѡв޸,ԱʵҪĲ
 	conn_opts.cleansession = 1;	//-ʾҪɾϿ,ûг־ñ,ںͷӵʱ֪ͨ
+	if ( m->max_inflight > 0 ) {  // reliable would hold the window at one message
+		conn_opts.reliable = 0;
+		conn_opts.maxInflightMessages = m->max_inflight;
+	}
 
 	rc = MQTTClient_connect(m->client, &conn_opts);	//-ǰ洴Ŀͻӵ,ʹָĲ
 	return rc;
@@ -114,10 +151,178 @@ int mqtt_set_timeout(mqtt_client *m, int timeout)
 	return MQTT_SUCCESS;
 }
 
+
+/**
+ * Set the most QoS 1 and 2 messages in flight, for the next connect
+ *
+ * @param m pointer to MQTT client object
+ * @param count most messages in flight, or 0 for the default of one at a time
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_set_max_inflight(mqtt_client *m, int count)
+{
+	if (!m || count < 0) return -1;
+	m->max_inflight = count;
+	return MQTT_SUCCESS;
+}
+
+
+/**
+ * Get the protocol counters and latency histograms of the client
+ *
+ * @param m pointer to MQTT client object
+ * @param stats filled in with the counters and latencies
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_get_stats(mqtt_client *m, MQTTClient_stats *stats)
+{
+	if (!m) return -1;
+	return MQTTClient_getStats(m->client, stats);
+}
+
+//monotonic time in nanoseconds, for timing compression (cheaper to read than the thread CPU clock)
+static unsigned long long mqtt_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//return 1 if the topic matches the filter, which may contain the wildcards + and #
+static int mqtt_topic_matches(const char *filter, const char *topic)
+{
+	while ( *filter ) {
+		if ( *filter == '#' )
+			return 1;
+		if ( *filter == '+' ) {
+			while ( *topic && *topic != '/' )
+				topic++;
+			filter++;
+			continue;
+		}
+		if ( *filter != *topic )  // "a/#" matches "a" too
+			return *topic == 0 && strcmp(filter, "/#") == 0;
+		filter++;
+		topic++;
+	}
+	return *topic == 0;
+}
+
+/**
+ * Compress a payload to be published, if a policy for the topic says so
+ *
+ * @return the payload to publish instead, a buffer from MQTTClient_allocBuffer(), or NULL to publish the payload as it is
+ */
+static char * mqtt_compress_payload(mqtt_client *m, const char *topic, void *data, int *length)
+{
+	struct _mqtt_compression *c = m->compression;
+	struct _mqtt_compression_policy *p;
+	int len = *length, n = 0, marked;
+	unsigned long long start;
+	char *buf;
+
+	for (p = c->policies; p != NULL; p = p->next) {
+		if ( mqtt_topic_matches(p->filter, topic) )
+			break;
+	}
+	if ( p == NULL || p->min_size < 0 || data == NULL )
+		return NULL;
+
+	marked = len >= (int)sizeof(mqtt_compress_magic) && memcmp(data, mqtt_compress_magic, sizeof(mqtt_compress_magic)) == 0;
+	if ( len < p->min_size && !marked ) {
+		c->stats.skipped++;
+		return NULL;
+	}
+	if ( len > MQTT_MAX_PAYLOAD - MQTT_COMPRESS_HEADER || (buf = MQTTClient_allocBuffer(MQTT_COMPRESS_HEADER + len)) == NULL )
+		return NULL;
+
+	if ( len >= p->min_size && len > MQTT_COMPRESS_HEADER + 1 ) {
+		start = mqtt_time_ns();
+		// only worth sending if smaller, header included
+		n = Compress_block(data, len, buf + MQTT_COMPRESS_HEADER, len - MQTT_COMPRESS_HEADER - 1,
+				c->dictionaries[p->dictionary]);
+		c->stats.compress_ns += mqtt_time_ns() - start;
+	}
+	if ( n > 0 ) {
+		buf[3] = MQTT_COMPRESS_LZ4;
+		buf[4] = c->dictionaries[p->dictionary] ? (char)p->dictionary : 0;	// only a dictionary actually used
+		c->stats.compressed++;
+		c->stats.bytes_in += len;
+		c->stats.bytes_out += MQTT_COMPRESS_HEADER + n;
+	} else {
+		if ( len >= p->min_size )
+			c->stats.incompressible++;
+		if ( !marked ) {
+			MQTTClient_freeBuffer(buf);
+			return NULL;
+		}
+		memcpy(buf + MQTT_COMPRESS_HEADER, data, len);
+		buf[3] = MQTT_COMPRESS_STORED;
+		buf[4] = 0;
+		n = len;
+	}
+	memcpy(buf, mqtt_compress_magic, sizeof(mqtt_compress_magic));
+	buf[5] = (char)(len >> 24);
+	buf[6] = (char)(len >> 16);
+	buf[7] = (char)(len >> 8);
+	buf[8] = (char)len;
+	*length = MQTT_COMPRESS_HEADER + n;
+	return buf;
+}
+
+/**
+ * Expand a received payload, if it has a compression header
+ *
+ * @return the expanded payload, NUL terminated, to be freed, or NULL if it is to be used as it is
+ */
+static char * mqtt_expand_payload(mqtt_client *m, char *data, int length, int *expanded_length)
+{
+	struct _mqtt_compression *c = m->compression;
+	unsigned char *h = (unsigned char *)data;
+	unsigned long long start;
+	char *buf;
+	int len, n;
+
+	if ( !c->expand || data == NULL || length < MQTT_COMPRESS_HEADER || memcmp(data, mqtt_compress_magic, sizeof(mqtt_compress_magic)) != 0 )
+		return NULL;
+
+	// the length is untrusted: it can't be more than the rest of the payload can expand to
+	len = (int)(((unsigned)h[5] << 24) | (h[6] << 16) | (h[7] << 8) | h[8]);
+	if ( len < 0 || len > c->max_expanded || len / COMPRESS_MAX_RATIO > length - MQTT_COMPRESS_HEADER
+			|| (buf = malloc(len + 1)) == NULL ) {
+		c->stats.errors++;
+		return NULL;
+	}
+	if ( h[3] == MQTT_COMPRESS_STORED ) {
+		n = length - MQTT_COMPRESS_HEADER;
+		if ( n == len )
+			memcpy(buf, data + MQTT_COMPRESS_HEADER, n);
+	} else if ( h[3] == MQTT_COMPRESS_LZ4 && (h[4] == 0 || c->dictionaries[h[4]] != NULL) ) {
+		start = mqtt_time_ns();
+		n = Compress_expand(data + MQTT_COMPRESS_HEADER, length - MQTT_COMPRESS_HEADER, buf, len, c->dictionaries[h[4]]);
+		c->stats.expand_ns += mqtt_time_ns() - start;
+		c->stats.expanded++;
+	} else
+		n = -1;
+	if ( n != len ) {  // not ours after all, or a dictionary is missing: pass it on as it is
+		c->stats.errors++;
+		free(buf);
+		return NULL;
+	}
+	buf[len] = 0;
+	*expanded_length = len;
+	return buf;
+}
+
 //internal callback function
 static int internal_callback_message_arrived(void *context, char *topicName, int topicLen, MQTTClient_message *message)
 {
 	mqtt_client *m;
+	char *expanded;
+	int length, rc;
 
 	m = (mqtt_client *)context;
 	if (!m) return -1;
@@ -126,7 +331,12 @@ static int internal_callback_message_arrived(void *context, char *topicName, int
 	if ( topicName[topicLen] != 0 )
 		topicName[topicLen] = 0;
 
-	return m->on_message_arrived(m, topicName, message->payload, message->payloadlen);
+	expanded = mqtt_expand_payload(m, message->payload, message->payloadlen, &length);
+	if ( expanded == NULL )
+		return m->on_message_arrived(m, topicName, message->payload, message->payloadlen);
+	rc = m->on_message_arrived(m, topicName, expanded, length);
+	free(expanded);
+	return rc;
 }
 
 //internal callback function
@@ -159,6 +369,45 @@ int mqtt_set_callback_message_arrived(mqtt_client *m, CALLBACK_MESSAGE_ARRIVED *
 	return ret;
 }
 
+//internal callback function
+static void internal_callback_writable(void *context)
+{
+	mqtt_client *m;
+
+	m = (mqtt_client *)context;
+	if (m && m->on_writable)
+		m->on_writable(m);
+}
+
+
+/**
+ * Enable or disable non-blocking publish
+ */
+int mqtt_set_nonblocking(mqtt_client *m, int enable, CALLBACK_WRITABLE * function)
+{
+	if (!m) return -1;
+	m->nonblocking = enable;
+	m->on_writable = function;
+	return MQTTClient_setNonBlockingPublish(m->client, enable, m, internal_callback_writable);
+}
+
+
+/**
+ * Spool messages on disk while they cannot be sent
+ */
+int mqtt_set_spool(mqtt_client *m, char *directory, long max_bytes, int max_age)
+{
+	MQTTClient_spoolOptions opts = MQTTClient_spoolOptions_initializer;
+
+	if (!m) return -1;
+	if (directory == NULL)
+		return MQTTClient_setSpool(m->client, NULL);
+	opts.directory = directory;
+	opts.maxBytes = max_bytes;
+	opts.maxAge = max_age;
+	return MQTTClient_setSpool(m->client, &opts);
+}
+
 /**
  * Subscribe a topic
  *
@@ -192,42 +441,66 @@ int mqtt_unsubscribe(mqtt_client *m, char *topic)	//-
  */
 int mqtt_delete(mqtt_client *m)
 {
+	struct _mqtt_compression_policy *p;
+	int i;
+
 	if (!m) return -1;
 	MQTTClient_destroy(&(m->client));
+	while ( (p = m->compression->policies) != NULL ) {
+		m->compression->policies = p->next;
+		free(p->filter);
+		free(p);
+	}
+	for (i = 0; i < 256; i++)
+		Compress_freeDictionary(m->compression->dictionaries[i]);
+	free(m->compression);
+	m->compression = NULL;
+	free(m->received_expanded);
+	m->received_expanded = NULL;
 	return 0;
 }
 
 
 /**
- * Publish a data
+ * Publish a data to a topic or a prepared topic, compressed if a policy for the topic says so
  *
- * @param m pointer to MQTT client object
- * @param topic topic of message
- * @param data content of message
- * @param length length of data
- * @param Qos quality of service, QOS_AT_MOST_ONCE or QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE
+ * @param t prepared topic of message, or NULL to publish to topic
+ * @param handover whether data is a buffer from mqtt_alloc_payload(), which passes to the client if it is accepted
  *
- * @return positive integer of message token if success. return negative integer of error code if fail
- *    Token is a value representing an MQTT message
+ * @return as mqtt_publish_data()
  */
-int mqtt_publish_data(mqtt_client * m, char *topic, void *data, int length, int Qos)
+static int mqtt_publish_common(mqtt_client * m, char *topic, mqtt_topic *t, void *data, int length, int Qos, int handover)
 {
-	MQTTClient_message pubmsg = MQTTClient_message_initializer;	//-¼һϢĽṹ
 	MQTTClient_deliveryToken token = -1;	//-Ͷ ־,ͨ־һм
+	char *compressed = NULL;
+	void *payload = data;
+	int buffer = handover;
 	int rc;
 
-	if (!m) return -1;	//-бҪǰһʵ
-
-	pubmsg.payload = data;
-	pubmsg.payloadlen = length;
-	pubmsg.qos = Qos;
-	pubmsg.retained = 0;	//-ϢǷ񱣳ֱ־
-	//-˸ʽת
-	rc = MQTTClient_publishMessage(m->client, topic, &pubmsg, &token);
+	if ( t != NULL )
+		topic = (char *)MQTTClient_topicName((MQTTClient_topic)t);
+	if ( topic != NULL )
+		compressed = mqtt_compress_payload(m, topic, data, &length);
+	if ( compressed ) {
+		payload = compressed;  // a buffer as well, so the client does not copy it again
+		buffer = 1;
+	}
+	if ( t != NULL )
+		rc = (buffer) ? MQTTClient_publishTopicBuffer(m->client, (MQTTClient_topic)t, length, payload, Qos, 0, &token)
+			: MQTTClient_publishTopic(m->client, (MQTTClient_topic)t, length, payload, Qos, 0, &token);
+	else
+		rc = (buffer) ? MQTTClient_publishBuffer(m->client, topic, length, payload, Qos, 0, &token)
+			: MQTTClient_publish(m->client, topic, length, payload, Qos, 0, &token);
+	if ( compressed ) {
+		if ( rc != MQTTCLIENT_SUCCESS )
+			MQTTClient_freeBuffer(compressed);
+		else if ( handover )
+			MQTTClient_freeBuffer(data);  // published as its compressed copy
+	}
 	if ( rc != MQTTCLIENT_SUCCESS )
 		return rc;
 
-	if ( m->timeout > 0 ) {
+	if ( m->timeout > 0 && !m->nonblocking && token != 0 ) {  // a spooled message has no token yet
 		rc = MQTTClient_waitForCompletion(m->client, token, m->timeout);
 		if ( rc != MQTTCLIENT_SUCCESS )
 			return rc;
@@ -239,6 +512,26 @@ int mqtt_publish_data(mqtt_client * m, char *topic, void *data, int length, int
 }
 
 
+/**
+ * Publish a data
+ *
+ * @param m pointer to MQTT client object
+ * @param topic topic of message
+ * @param data content of message
+ * @param length length of data
+ * @param Qos quality of service, QOS_AT_MOST_ONCE or QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE
+ *
+ * @return positive integer of message token if success. return negative integer of error code if fail
+ *    Token is a value representing an MQTT message
+ */
+int mqtt_publish_data(mqtt_client * m, char *topic, void *data, int length, int Qos)
+{
+	if (!m) return -1;	//-бҪǰһʵ
+
+	return mqtt_publish_common(m, topic, NULL, data, length, Qos, 0);
+}
+
+
 /**
  * Publish a text message
  *
@@ -256,12 +549,230 @@ int mqtt_publish(mqtt_client * m, char *topic, char *message, int Qos)	//-
 }
 
 
+/**
+ * Prepare a topic for publishing to repeatedly
+ *
+ * @param topic topic of messages
+ *
+ * @return pointer to prepared topic if success. return NULL if fail
+ */
+mqtt_topic * mqtt_topic_prepare(char *topic)
+{
+	MQTTClient_topic t = NULL;
+
+	if (MQTTClient_prepareTopic(topic, &t) != MQTTCLIENT_SUCCESS)
+		return NULL;
+	return (mqtt_topic *)t;
+}
+
+
+/**
+ * Free a prepared topic
+ */
+void mqtt_topic_free(mqtt_topic *t)
+{
+	MQTTClient_topic topic = t;
+
+	if (t) MQTTClient_freeTopic(&topic);
+}
+
+
+/**
+ * Publish a data to a prepared topic
+ *
+ * @param m pointer to MQTT client object
+ * @param t prepared topic of message
+ * @param data content of message
+ * @param length length of data
+ * @param Qos quality of service, QOS_AT_MOST_ONCE or QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE
+ *
+ * @return positive integer of message token if success. return negative integer of error code if fail
+ *    Token is a value representing an MQTT message
+ */
+int mqtt_publish_topic(mqtt_client * m, mqtt_topic *t, void *data, int length, int Qos)
+{
+	if (!m) return -1;
+	if (!t) return MQTTCLIENT_NULL_PARAMETER;
+
+	return mqtt_publish_common(m, NULL, t, data, length, Qos, 0);
+}
+
+
+/**
+ * Allocate a buffer for a payload to publish without copying
+ *
+ * Fill in the buffer, for example by reading the data straight into it, and publish it with
+ * mqtt_publish_payload() or mqtt_publish_topic_payload().  The client keeps the buffer until
+ * the message is acknowledged instead of taking a copy of the payload.
+ *
+ * @param length length of payload
+ *
+ * @return pointer to buffer if success. return NULL if fail
+ */
+void * mqtt_alloc_payload(int length)
+{
+	return MQTTClient_allocBuffer(length);
+}
+
+
+/**
+ * Free a buffer from mqtt_alloc_payload() which has not been published
+ */
+void mqtt_free_payload(void *data)
+{
+	MQTTClient_freeBuffer(data);
+}
+
+
+/**
+ * Publish a buffer from mqtt_alloc_payload()
+ *
+ * If the message is accepted the buffer belongs to the client, and must not be used again.
+ * If not, it still belongs to the caller, to publish again or to free with mqtt_free_payload().
+ *
+ * @param m pointer to MQTT client object
+ * @param topic topic of message
+ * @param data buffer holding content of message
+ * @param length length of data
+ * @param Qos quality of service, QOS_AT_MOST_ONCE or QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE
+ *
+ * @return positive integer of message token if success. return negative integer of error code if fail
+ *    Token is a value representing an MQTT message
+ */
+int mqtt_publish_payload(mqtt_client * m, char *topic, void *data, int length, int Qos)
+{
+	if (!m) return -1;
+
+	return mqtt_publish_common(m, topic, NULL, data, length, Qos, 1);
+}
+
+
+/**
+ * Publish a buffer from mqtt_alloc_payload() to a prepared topic
+ *
+ * The buffer is handed over as by mqtt_publish_payload().
+ *
+ * @param m pointer to MQTT client object
+ * @param t prepared topic of message
+ * @param data buffer holding content of message
+ * @param length length of data
+ * @param Qos quality of service, QOS_AT_MOST_ONCE or QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE
+ *
+ * @return positive integer of message token if success. return negative integer of error code if fail
+ *    Token is a value representing an MQTT message
+ */
+int mqtt_publish_topic_payload(mqtt_client * m, mqtt_topic *t, void *data, int length, int Qos)
+{
+	if (!m) return -1;
+	if (!t) return MQTTCLIENT_NULL_PARAMETER;
+
+	return mqtt_publish_common(m, NULL, t, data, length, Qos, 1);
+}
+
+
+/**
+ * Compress the payloads published to matching topics
+ *
+ * @param m pointer to MQTT client object
+ * @param filter topic filter, which may contain the wildcards + and #
+ * @param min_size smallest payload to compress, or -1 to send payloads to the topics as they are
+ * @param dictionary id of a dictionary added with mqtt_add_dictionary(), or 0 for none
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_set_compression(mqtt_client *m, char *filter, int min_size, int dictionary)
+{
+	struct _mqtt_compression_policy *p, **last;
+
+	if (!m) return -1;
+	if ( filter == NULL ) return MQTT_NULL_PARAMETER;
+	if ( dictionary < 0 || dictionary > 255 ) return MQTT_FAILURE;
+
+	for (last = &(m->compression->policies); *last != NULL; last = &((*last)->next)) {
+		if ( strcmp((*last)->filter, filter) == 0 )
+			break;
+	}
+	if ( (p = *last) == NULL ) {
+		if ( (p = malloc(sizeof(*p))) == NULL )
+			return MQTT_FAILURE;
+		if ( (p->filter = malloc(strlen(filter) + 1)) == NULL ) {
+			free(p);
+			return MQTT_FAILURE;
+		}
+		strcpy(p->filter, filter);
+		p->next = NULL;
+		*last = p;
+	}
+	p->min_size = min_size;
+	p->dictionary = dictionary;
+	m->compression->expand = 1;
+	return MQTT_SUCCESS;
+}
+
+
+/**
+ * Add a dictionary for compression
+ *
+ * @param m pointer to MQTT client object
+ * @param id id of the dictionary, 1 to 255
+ * @param data content of dictionary
+ * @param length length of data
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_add_dictionary(mqtt_client *m, int id, void *data, int length)
+{
+	Compress_dictionary *dict;
+
+	if (!m) return -1;
+	if ( data == NULL ) return MQTT_NULL_PARAMETER;
+	if ( id < 1 || id > 255 || length <= 0 ) return MQTT_FAILURE;
+
+	if ( (dict = Compress_createDictionary(data, length)) == NULL )
+		return MQTT_FAILURE;
+	Compress_freeDictionary(m->compression->dictionaries[id]);
+	m->compression->dictionaries[id] = dict;
+	m->compression->expand = 1;
+	return MQTT_SUCCESS;
+}
+
+
+/**
+ * Limit the size of received payloads after expanding
+ */
+int mqtt_set_max_expanded(mqtt_client *m, int max_size)
+{
+	if (!m) return -1;
+	if ( max_size <= 0 || max_size > MQTT_MAX_PAYLOAD ) return MQTT_FAILURE;
+
+	m->compression->max_expanded = max_size;
+	return MQTT_SUCCESS;
+}
+
+
+/**
+ * Get compression statistics
+ */
+int mqtt_get_compression_stats(mqtt_client *m, mqtt_compression_stats *stats)
+{
+	if (!m) return -1;
+	if ( stats == NULL ) return MQTT_NULL_PARAMETER;
+	*stats = m->compression->stats;
+	return MQTT_SUCCESS;
+}
+
+
 static void mqtt_clear_received(mqtt_client *m)	//-ѿͻ˵ı־λʲô˼
 {
 	if (!m) return;
 
 	//MQTTClient_freeMessage();
 
+	if ( m->received_expanded != NULL ) {
+		free(m->received_expanded);
+		m->received_expanded = NULL;
+	}
+
 	if ( m->received_msg != NULL ) {
 		//free(m->received_msg->payload);
 		//free(m->received_msg);
@@ -311,6 +822,10 @@ int mqtt_receive(mqtt_client *m, unsigned long timeout)	//-
 			m->received_message = m->received_msg->payload;
 			m->received_message_len = m->received_msg->payloadlen;
 			m->received_message_id = m->received_msg->msgid;
+			m->received_expanded = mqtt_expand_payload(m, m->received_message, m->received_message_len,
+					&(m->received_message_len));
+			if ( m->received_expanded != NULL )
+				m->received_message = m->received_expanded;
 		}
 	}
 
@@ -65,6 +65,12 @@ extern "C" {
  */
 #define MQTT_BAD_QOS -9
 
+/**
+ * Return code: The message could not be published without waiting (non-blocking mode only).
+ * The writable callback is called when publishing can be retried.
+ */
+#define MQTT_WOULDBLOCK -10
+
 
 
 /**
@@ -92,21 +98,59 @@ extern "C" {
  */
 #define MQTT_DEFAULT_TIME_OUT  3000
 
+/**
+ * Default limit on the size of a received payload after expanding
+ */
+#define MQTT_DEFAULT_MAX_EXPANDED  1048576
+
 
 /* MQTT client object*/
 typedef struct _mqtt_client mqtt_client;
 
+/* topic prepared for publishing */
+typedef struct _mqtt_topic mqtt_topic;
+
+/* compression policies and dictionaries of a client */
+struct _mqtt_compression;
+
+/**
+ * Compression statistics of a client
+ *
+ * The time per message spent compressing is compress_ns / (compressed + incompressible),
+ * and expanding is expand_ns / expanded.  Times are read from the monotonic clock, so they
+ * include any time the thread was not running.
+ */
+typedef struct {
+	unsigned long compressed;        //messages sent compressed
+	unsigned long incompressible;    //messages which did not get smaller, sent as they were
+	unsigned long skipped;           //messages smaller than the minimum size of their policy
+	unsigned long long bytes_in;     //payload bytes of the messages sent compressed
+	unsigned long long bytes_out;    //bytes they were sent as, including headers
+	unsigned long long compress_ns;  //time spent compressing
+	unsigned long expanded;          //messages received compressed
+	unsigned long errors;            //messages received with a header which could not be expanded
+	unsigned long long expand_ns;    //time spent expanding
+} mqtt_compression_stats;
+
 /**
  * prototype of callback function when message arrived
  */
 typedef int CALLBACK_MESSAGE_ARRIVED(mqtt_client *m, char *topic, char *data, int length);
 
+/**
+ * prototype of callback function when publishing can be retried after MQTT_WOULDBLOCK
+ */
+typedef void CALLBACK_WRITABLE(mqtt_client *m);
+
 /* structure of MQTT client object*/
 struct _mqtt_client {
 	MQTTClient client;
 	//int Qos;     //Quality of service
 	int timeout; //time out (milliseconds)
 	CALLBACK_MESSAGE_ARRIVED *on_message_arrived;
+	int nonblocking; //publish returns MQTT_WOULDBLOCK instead of waiting
+	CALLBACK_WRITABLE *on_writable;
+	int max_inflight; //most messages in flight, 0 for one at a time
 
 	int    received_message_id;
 	char * received_topic;
@@ -115,6 +159,9 @@ struct _mqtt_client {
 	int    received_topic_len;
 
 	MQTTClient_message * received_msg;
+	char * received_expanded; //payload of the received message after expanding, to be freed
+
+	struct _mqtt_compression * compression;
 };//-һǿԴͻ˵,һͻǿԴڼӵ,һиֱĵ
 
 
@@ -182,11 +229,69 @@ void mqtt_yield(void);
  */
 int mqtt_set_timeout(mqtt_client *m, int timeout);
 
+/**
+ * Set the most QoS 1 and 2 messages in flight, for the next connect
+ *
+ * The number actually in flight adapts to the link below this, growing while messages are
+ * acknowledged and halving when one has to be sent again.  By default each message is
+ * completed before the next is sent.
+ *
+ * @param m pointer to MQTT client object
+ * @param count most messages in flight, or 0 for the default of one at a time
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_set_max_inflight(mqtt_client *m, int count);
+
+/**
+ * Get the protocol counters and latency histograms of the client
+ *
+ * Cheap enough to call often: it does not wait for the client lock.
+ *
+ * @param m pointer to MQTT client object
+ * @param stats filled in with the counters and latencies
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_get_stats(mqtt_client *m, MQTTClient_stats *stats);
+
 /**
  * set callback function when message arrived
  */
 int mqtt_set_callback_message_arrived(mqtt_client *m, CALLBACK_MESSAGE_ARRIVED * function);
 
+/**
+ * Enable or disable non-blocking publish
+ *
+ * In non-blocking mode mqtt_publish_data() never waits: it returns MQTT_WOULDBLOCK when the
+ * in-flight window is full or a packet is still being written, and does not wait for
+ * delivery to complete. The function is called when publishing can be retried.
+ *
+ * @param m pointer to MQTT client object
+ * @param enable 1 to enable, 0 to disable
+ * @param function callback when publishing can be retried (may be NULL)
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_set_nonblocking(mqtt_client *m, int enable, CALLBACK_WRITABLE * function);
+
+/**
+ * Spool messages on disk while they cannot be sent
+ *
+ * While the client is disconnected or cannot send at once, published messages are appended
+ * to segment files in the directory and sent in order when the connection allows, so that
+ * a long outage loses only the oldest messages once max_bytes is reached. mqtt_publish_data()
+ * returns 0 for a spooled message.
+ *
+ * @param m pointer to MQTT client object
+ * @param directory directory of the spool, or NULL to stop spooling
+ * @param max_bytes limit of the spool on disk, or 0 for the default
+ * @param max_age seconds after which a spooled message is dropped, or 0 for no limit
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_set_spool(mqtt_client *m, char *directory, long max_bytes, int max_age);
+
 /**
  * Subscribe a topic
  *
@@ -239,6 +344,153 @@ int mqtt_publish_data(mqtt_client * m, char *topic, void *data, int length, int
 int mqtt_publish(mqtt_client * m, char *topic, char *message, int Qos);
 
 
+/**
+ * Prepare a topic for publishing to repeatedly
+ *
+ * The topic is validated and encoded once, instead of for every message published to it.
+ *
+ * @param topic topic of messages
+ *
+ * @return pointer to prepared topic if success. return NULL if fail
+ */
+mqtt_topic * mqtt_topic_prepare(char *topic);
+
+/**
+ * Free a prepared topic
+ */
+void mqtt_topic_free(mqtt_topic *t);
+
+/**
+ * Publish a data to a prepared topic
+ *
+ * @param m pointer to MQTT client object
+ * @param t prepared topic of message
+ * @param data content of message
+ * @param length length of data
+ * @param Qos quality of service, QOS_AT_MOST_ONCE or QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE
+ *
+ * @return positive integer of message token if success. return negative integer of error code if fail
+ *    Token is a value representing an MQTT message
+ */
+int mqtt_publish_topic(mqtt_client * m, mqtt_topic *t, void *data, int length, int Qos);
+
+/**
+ * Allocate a buffer for a payload to publish without copying
+ *
+ * Fill in the buffer, for example by reading the data straight into it, and publish it with
+ * mqtt_publish_payload() or mqtt_publish_topic_payload().  The client keeps the buffer until
+ * the message is acknowledged instead of taking a copy of the payload.
+ *
+ * @param length length of payload
+ *
+ * @return pointer to buffer if success. return NULL if fail
+ */
+void * mqtt_alloc_payload(int length);
+
+/**
+ * Free a buffer from mqtt_alloc_payload() which has not been published
+ */
+void mqtt_free_payload(void *data);
+
+/**
+ * Publish a buffer from mqtt_alloc_payload()
+ *
+ * If the message is accepted the buffer belongs to the client, and must not be used again.
+ * If not, it still belongs to the caller, to publish again or to free with mqtt_free_payload().
+ *
+ * @param m pointer to MQTT client object
+ * @param topic topic of message
+ * @param data buffer holding content of message
+ * @param length length of data
+ * @param Qos quality of service, QOS_AT_MOST_ONCE or QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE
+ *
+ * @return positive integer of message token if success. return negative integer of error code if fail
+ *    Token is a value representing an MQTT message
+ */
+int mqtt_publish_payload(mqtt_client * m, char *topic, void *data, int length, int Qos);
+
+/**
+ * Publish a buffer from mqtt_alloc_payload() to a prepared topic
+ *
+ * The buffer is handed over as by mqtt_publish_payload().
+ *
+ * @param m pointer to MQTT client object
+ * @param t prepared topic of message
+ * @param data buffer holding content of message
+ * @param length length of data
+ * @param Qos quality of service, QOS_AT_MOST_ONCE or QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE
+ *
+ * @return positive integer of message token if success. return negative integer of error code if fail
+ *    Token is a value representing an MQTT message
+ */
+int mqtt_publish_topic_payload(mqtt_client * m, mqtt_topic *t, void *data, int length, int Qos);
+
+
+
+/**
+ * Compress the payloads published to matching topics
+ *
+ * Payloads of at least min_size bytes published with mqtt_publish_data(), mqtt_publish() or
+ * mqtt_publish_topic() to a topic matching the filter are compressed, unless that does not make
+ * them smaller.  The first policy added whose filter matches applies; adding one for the same
+ * filter again replaces it.
+ *
+ * A compressed payload starts with a header of 9 bytes: 0x00 'L' 'Z', the method (1 for an LZ4
+ * block, 0 for a payload stored as it was), the dictionary id, and the length of the payload
+ * as 4 bytes big-endian.  Once a client has a policy or a dictionary, mqtt_receive() and the
+ * message arrived callback remove the header and expand the payload; a subscriber which only
+ * receives compressed payloads can add a policy with min_size -1.  A payload starting with
+ * 0x00 'L' 'Z' itself is sent stored, with the header, so that it is not mistaken for one.
+ *
+ * @param m pointer to MQTT client object
+ * @param filter topic filter, which may contain the wildcards + and #
+ * @param min_size smallest payload to compress, or -1 to send payloads to the topics as they are
+ * @param dictionary id of a dictionary added with mqtt_add_dictionary(), or 0 for none
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_set_compression(mqtt_client *m, char *filter, int min_size, int dictionary);
+
+/**
+ * Add a dictionary for compression
+ *
+ * A dictionary is typical content, such as a sample of the payloads, which makes short payloads
+ * compress much better.  The receivers of the messages must add the same dictionary with the
+ * same id.
+ *
+ * @param m pointer to MQTT client object
+ * @param id id of the dictionary, 1 to 255
+ * @param data content of dictionary (only the last 64KB are used)
+ * @param length length of data
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_add_dictionary(mqtt_client *m, int id, void *data, int length);
+
+/**
+ * Limit the size of received payloads after expanding
+ *
+ * A payload whose header gives a larger length is passed on as it is, and counted as an error,
+ * rather than memory being allocated for it.  The default is MQTT_DEFAULT_MAX_EXPANDED.
+ *
+ * @param m pointer to MQTT client object
+ * @param max_size the largest payload to expand, in bytes
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_set_max_expanded(mqtt_client *m, int max_size);
+
+/**
+ * Get compression statistics
+ *
+ * @param m pointer to MQTT client object
+ * @param stats statistics to fill in
+ *
+ * @return 0 if success, else return error code
+ */
+int mqtt_get_compression_stats(mqtt_client *m, mqtt_compression_stats *stats);
+
+
 
 /**
  * Receive message